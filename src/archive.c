@@ -0,0 +1,444 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "archive.h"
+
+#include "error.h"
+#include "memory.h"
+#include "mmap.h"
+#include "rsendian.h"
+#include "util.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* An archive is a header, followed by the chunk data packed with no
+ * padding, followed by the index: one entry per chunk, sorted by
+ * coordinates. The header says where the index starts. All numbers
+ * are big-endian, like region files.
+ */
+
+#define RS_ARCHIVE_MAGIC "RSPA"
+#define RS_ARCHIVE_VERSION 1
+
+/* how much chunk data to collect before writing it out */
+#define RS_ARCHIVE_BUFFER_SIZE (1024 * 1024)
+
+struct ArchiveHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint64_t index_offset;
+} __PACKED__;
+
+struct ArchiveEntry
+{
+    int32_t x, z;
+    uint32_t timestamp;
+    uint64_t offset;
+    uint32_t length;
+    uint8_t compression;
+} __PACKED__;
+
+struct _RSArchive
+{
+    void* map;
+    size_t size;
+    
+    uint32_t count;
+    struct ArchiveEntry* entries;
+    uint64_t data_end;
+};
+
+/* a chunk added to a writer, in native byte order */
+struct WriterEntry
+{
+    int32_t x, z;
+    uint32_t timestamp;
+    uint64_t offset;
+    uint32_t length;
+    uint8_t compression;
+};
+
+struct _RSArchiveWriter
+{
+    char* path;
+    char* tmp_path;
+    int fd;
+    bool failed;
+    
+    /* where the next chunk goes */
+    uint64_t offset;
+    
+    uint8_t* buffer;
+    size_t buffer_used;
+    
+    struct WriterEntry* entries;
+    uint32_t count;
+    uint32_t allocated;
+};
+
+RSArchive* rs_archive_open(const char* path)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0 || stat_buf.st_size < (off_t)sizeof(struct ArchiveHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    void* map = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    
+    /* make sure the header makes sense before trusting the rest */
+    struct ArchiveHeader* header = map;
+    uint32_t count = rs_endian_uint32(header->count);
+    uint64_t index_offset = rs_endian_uint64(header->index_offset);
+    if (memcmp(header->magic, RS_ARCHIVE_MAGIC, 4) != 0 ||
+        rs_endian_uint32(header->version) != RS_ARCHIVE_VERSION ||
+        index_offset < sizeof(struct ArchiveHeader) ||
+        index_offset + (uint64_t)count * sizeof(struct ArchiveEntry) != (uint64_t)stat_buf.st_size)
+    {
+        munmap(map, stat_buf.st_size);
+        return NULL;
+    }
+    
+    RSArchive* self = rs_new0(RSArchive, 1);
+    self->map = map;
+    self->size = stat_buf.st_size;
+    self->count = count;
+    self->entries = (struct ArchiveEntry*)(map + index_offset);
+    self->data_end = index_offset;
+    return self;
+}
+
+void rs_archive_close(RSArchive* self)
+{
+    rs_return_if_fail(self);
+    
+    munmap(self->map, self->size);
+    rs_free(self);
+}
+
+uint32_t rs_archive_get_chunk_count(RSArchive* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->count;
+}
+
+bool rs_archive_get_chunk_coords(RSArchive* self, uint32_t i, int32_t* x, int32_t* z)
+{
+    rs_return_val_if_fail(self && x && z, false);
+    
+    if (i >= self->count)
+        return false;
+    
+    *x = rs_endian_int32(self->entries[i].x);
+    *z = rs_endian_int32(self->entries[i].z);
+    return true;
+}
+
+/* helper to find the index entry for a chunk, or NULL */
+static struct ArchiveEntry* _rs_archive_lookup(RSArchive* self, int32_t x, int32_t z)
+{
+    uint32_t low = 0;
+    uint32_t high = self->count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int32_t mx = rs_endian_int32(self->entries[mid].x);
+        int32_t mz = rs_endian_int32(self->entries[mid].z);
+        
+        if (mx == x && mz == z)
+            return &(self->entries[mid]);
+        
+        if (mx < x || (mx == x && mz < z))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    return NULL;
+}
+
+bool rs_archive_contains_chunk(RSArchive* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, false);
+    return _rs_archive_lookup(self, x, z) != NULL;
+}
+
+uint32_t rs_archive_get_chunk_timestamp(RSArchive* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    struct ArchiveEntry* entry = _rs_archive_lookup(self, x, z);
+    return entry ? rs_endian_uint32(entry->timestamp) : 0;
+}
+
+uint32_t rs_archive_get_chunk_length(RSArchive* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    struct ArchiveEntry* entry = _rs_archive_lookup(self, x, z);
+    return entry ? rs_endian_uint32(entry->length) : 0;
+}
+
+RSCompressionType rs_archive_get_chunk_compression(RSArchive* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, RS_UNKNOWN_COMPRESSION);
+    
+    struct ArchiveEntry* entry = _rs_archive_lookup(self, x, z);
+    if (entry == NULL)
+        return RS_UNKNOWN_COMPRESSION;
+    
+    switch (entry->compression)
+    {
+    case 1:
+        return RS_GZIP;
+    case 2:
+        return RS_ZLIB;
+    };
+    
+    return RS_UNKNOWN_COMPRESSION;
+}
+
+void* rs_archive_get_chunk_data(RSArchive* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    struct ArchiveEntry* entry = _rs_archive_lookup(self, x, z);
+    if (entry == NULL)
+        return NULL;
+    
+    uint64_t offset = rs_endian_uint64(entry->offset);
+    uint32_t length = rs_endian_uint32(entry->length);
+    if (offset < sizeof(struct ArchiveHeader) || offset > self->data_end || length > self->data_end - offset)
+    {
+        rs_critical("archive chunk (%i, %i) lies outside the data", x, z);
+        return NULL;
+    }
+    
+    return self->map + offset;
+}
+
+/* helper to write out the buffered chunk data */
+static bool _rs_archive_writer_flush(RSArchiveWriter* self)
+{
+    if (self->buffer_used > 0 && !(self->failed))
+        self->failed = !rs_write_all(self->fd, self->buffer, self->buffer_used);
+    self->buffer_used = 0;
+    return !(self->failed);
+}
+
+RSArchiveWriter* rs_archive_writer_new(const char* path)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    /* write next to the real file, then move it into place */
+    char* tmp_path = NULL;
+    int fd = rs_file_replace_begin(path, &tmp_path);
+    if (fd < 0)
+        return NULL;
+    
+    RSArchiveWriter* self = rs_new0(RSArchiveWriter, 1);
+    self->path = rs_strdup(path);
+    self->tmp_path = tmp_path;
+    self->fd = fd;
+    self->buffer = rs_new(uint8_t, RS_ARCHIVE_BUFFER_SIZE);
+    
+    /* leave room for the header, which is written last */
+    memset(self->buffer, 0, sizeof(struct ArchiveHeader));
+    self->buffer_used = sizeof(struct ArchiveHeader);
+    self->offset = sizeof(struct ArchiveHeader);
+    return self;
+}
+
+bool rs_archive_writer_add_chunk(RSArchiveWriter* self, int32_t x, int32_t z, uint32_t timestamp, RSCompressionType encoding, void* data, uint32_t length)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(data && length > 0, false);
+    rs_return_val_if_fail(encoding == RS_GZIP || encoding == RS_ZLIB, false);
+    
+    if (self->failed)
+        return false;
+    
+    if (self->count == self->allocated)
+    {
+        self->allocated = self->allocated ? self->allocated * 2 : 1024;
+        self->entries = rs_renew(struct WriterEntry, self->entries, self->allocated);
+    }
+    
+    struct WriterEntry* entry = &(self->entries[self->count++]);
+    entry->x = x;
+    entry->z = z;
+    entry->timestamp = timestamp;
+    entry->offset = self->offset;
+    entry->length = length;
+    entry->compression = (encoding == RS_GZIP) ? 1 : 2;
+    self->offset += length;
+    
+    /* large chunks skip the buffer entirely */
+    if (self->buffer_used + length > RS_ARCHIVE_BUFFER_SIZE && !_rs_archive_writer_flush(self))
+        return false;
+    if (length >= RS_ARCHIVE_BUFFER_SIZE)
+    {
+        self->failed = !rs_write_all(self->fd, data, length);
+        return !(self->failed);
+    }
+    
+    memcpy(self->buffer + self->buffer_used, data, length);
+    self->buffer_used += length;
+    return true;
+}
+
+bool rs_archive_writer_add_region(RSArchiveWriter* self, RSRegion* region, int32_t rx, int32_t rz)
+{
+    rs_return_val_if_fail(self && region, false);
+    
+    for (uint8_t z = 0; z < 32; z++)
+    {
+        for (uint8_t x = 0; x < 32; x++)
+        {
+            if (!rs_region_contains_chunk(region, x, z))
+                continue;
+            
+            void* data = rs_region_get_chunk_data(region, x, z);
+            uint32_t length = rs_region_get_chunk_length(region, x, z);
+            RSCompressionType encoding = rs_region_get_chunk_compression(region, x, z);
+            if (data == NULL || length == 0 || (encoding != RS_GZIP && encoding != RS_ZLIB))
+            {
+                /* an archive missing it would read as if it had never
+                 * existed, so don't let one be finished at all */
+                rs_critical("chunk (%i, %i) can't be read, so it can't be archived", rx * 32 + x, rz * 32 + z);
+                self->failed = true;
+                return false;
+            }
+            
+            if (!rs_archive_writer_add_chunk(self, rx * 32 + x, rz * 32 + z, rs_region_get_chunk_timestamp(region, x, z), encoding, data, length))
+                return false;
+        }
+    }
+    
+    return true;
+}
+
+bool rs_archive_writer_add_world(RSArchiveWriter* self, RSWorld* world)
+{
+    rs_return_val_if_fail(self && world, false);
+    
+    unsigned int count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(world, &count);
+    
+    bool ok = true;
+    for (unsigned int i = 0; ok && i < count; i++)
+    {
+        RSRegion* region = rs_world_get_region(world, coords[i].x, coords[i].z, false);
+        if (region)
+            ok = rs_archive_writer_add_region(self, region, coords[i].x, coords[i].z);
+    }
+    
+    if (coords)
+        rs_free(coords);
+    return ok;
+}
+
+/* qsort comparison for entries, by coordinates */
+static int _rs_archive_compare_coords(const void* a, const void* b)
+{
+    const struct WriterEntry* ea = a;
+    const struct WriterEntry* eb = b;
+    if (ea->x != eb->x)
+        return ea->x < eb->x ? -1 : 1;
+    if (ea->z != eb->z)
+        return ea->z < eb->z ? -1 : 1;
+    return 0;
+}
+
+bool rs_archive_writer_finish(RSArchiveWriter* self)
+{
+    rs_return_val_if_fail(self, false);
+    
+    if (self->count > 0)
+        qsort(self->entries, self->count, sizeof(struct WriterEntry), _rs_archive_compare_coords);
+    
+    for (uint32_t i = 0; i + 1 < self->count; i++)
+    {
+        if (_rs_archive_compare_coords(&(self->entries[i]), &(self->entries[i + 1])) == 0)
+        {
+            rs_critical("chunk (%i, %i) was added to the archive twice", self->entries[i].x, self->entries[i].z);
+            self->failed = true;
+            break;
+        }
+    }
+    
+    /* the index goes through the same buffer as the data */
+    for (uint32_t i = 0; i < self->count && !(self->failed); i++)
+    {
+        if (self->buffer_used + sizeof(struct ArchiveEntry) > RS_ARCHIVE_BUFFER_SIZE)
+            _rs_archive_writer_flush(self);
+        
+        struct ArchiveEntry* stored = (struct ArchiveEntry*)(self->buffer + self->buffer_used);
+        stored->x = rs_endian_int32(self->entries[i].x);
+        stored->z = rs_endian_int32(self->entries[i].z);
+        stored->timestamp = rs_endian_uint32(self->entries[i].timestamp);
+        stored->offset = rs_endian_uint64(self->entries[i].offset);
+        stored->length = rs_endian_uint32(self->entries[i].length);
+        stored->compression = self->entries[i].compression;
+        self->buffer_used += sizeof(struct ArchiveEntry);
+    }
+    
+    struct ArchiveHeader header;
+    memcpy(header.magic, RS_ARCHIVE_MAGIC, 4);
+    header.version = rs_endian_uint32(RS_ARCHIVE_VERSION);
+    header.count = rs_endian_uint32(self->count);
+    header.index_offset = rs_endian_uint64(self->offset);
+    
+    bool ok = _rs_archive_writer_flush(self) &&
+        pwrite(self->fd, &header, sizeof(header), 0) == sizeof(header);
+    
+    /* the commit closes and removes the temporary file either way */
+    if (ok)
+    {
+        ok = rs_file_replace_commit(self->fd, self->tmp_path, self->path, true);
+        self->fd = -1;
+        self->tmp_path = NULL;
+    }
+    
+    rs_archive_writer_free(self);
+    return ok;
+}
+
+void rs_archive_writer_free(RSArchiveWriter* self)
+{
+    rs_return_if_fail(self);
+    
+    /* after a finish, this is already gone */
+    if (self->tmp_path)
+        rs_file_replace_abort(self->fd, self->tmp_path);
+    
+    if (self->entries)
+        rs_free(self->entries);
+    rs_free(self->buffer);
+    rs_free(self->path);
+    rs_free(self);
+}
@@ -0,0 +1,226 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_ARCHIVE_H_INCLUDED__
+#define __RS_ARCHIVE_H_INCLUDED__
+
+#include "compression.h"
+#include "region.h"
+#include "world.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSArchive;
+/**
+ * The world archive data type.
+ *
+ * This is an opaque structure that acts as a handle to a mapped world
+ * archive: a single read-only file holding every chunk of a world.
+ *
+ * Region files keep each chunk in whole 4KB sectors so it can be
+ * rewritten in place, which wastes about half a sector per chunk and
+ * needs one file per region. An archive is never rewritten, so chunks
+ * are packed back to back, and found through one index sorted by
+ * coordinates. The whole file is mapped at once, so reading a chunk
+ * never copies or allocates anything.
+ *
+ * Archives are written with RSArchiveWriter.
+ */
+typedef struct _RSArchive RSArchive;
+
+struct _RSArchiveWriter;
+/**
+ * The world archive writer data type.
+ *
+ * This is an opaque structure used to write a new world archive.
+ * Chunks can be added in any order, and are sorted when the archive
+ * is finished.
+ */
+typedef struct _RSArchiveWriter RSArchiveWriter;
+
+/**
+ * Open a world archive.
+ *
+ * \param path the archive file
+ * \return the archive, or NULL if it could not be opened or is invalid
+ * \sa rs_archive_close
+ */
+RSArchive* rs_archive_open(const char* path);
+
+/**
+ * Close a world archive.
+ *
+ * Any pointers returned by rs_archive_get_chunk_data() become invalid.
+ *
+ * \param self the archive
+ * \sa rs_archive_open
+ */
+void rs_archive_close(RSArchive* self);
+
+/**
+ * Get the number of chunks in an archive.
+ *
+ * \param self the archive
+ * \return the number of chunks
+ * \sa rs_archive_get_chunk_coords
+ */
+uint32_t rs_archive_get_chunk_count(RSArchive* self);
+
+/**
+ * Get the coordinates of a chunk in an archive, by position.
+ *
+ * Chunks are numbered from 0, ordered by x and then by z.
+ *
+ * \param self the archive
+ * \param i the position of the chunk
+ * \param x where to store the global x coordinate of the chunk
+ * \param z where to store the global z coordinate of the chunk
+ * \return true on success, false if i is out of range
+ * \sa rs_archive_get_chunk_count
+ */
+bool rs_archive_get_chunk_coords(RSArchive* self, uint32_t i, int32_t* x, int32_t* z);
+
+/**
+ * Find out if an archive contains a chunk.
+ *
+ * \param self the archive
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return whether the chunk is in the archive
+ */
+bool rs_archive_contains_chunk(RSArchive* self, int32_t x, int32_t z);
+
+/**
+ * Get the last modified time of a chunk.
+ *
+ * \param self the archive
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return the timestamp of the chunk, or 0 if it does not exist
+ * \sa rs_region_get_chunk_timestamp
+ */
+uint32_t rs_archive_get_chunk_timestamp(RSArchive* self, int32_t x, int32_t z);
+
+/**
+ * Get the length of the data for a chunk.
+ *
+ * \param self the archive
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return the length of the chunk data, or 0 if it does not exist
+ * \sa rs_archive_get_chunk_data
+ */
+uint32_t rs_archive_get_chunk_length(RSArchive* self, int32_t x, int32_t z);
+
+/**
+ * Get the compression type of the data for a chunk.
+ *
+ * \param self the archive
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return the compression type, or RS_UNKNOWN_COMPRESSION if the
+ *         chunk does not exist
+ * \sa rs_archive_get_chunk_data
+ */
+RSCompressionType rs_archive_get_chunk_compression(RSArchive* self, int32_t x, int32_t z);
+
+/**
+ * Get the data for a chunk.
+ *
+ * This returns a pointer into the mapped archive, which is valid
+ * until the archive is closed. Like rs_region_get_chunk_data(), the
+ * data is still compressed; see rs_archive_get_chunk_length() and
+ * rs_archive_get_chunk_compression().
+ *
+ * \param self the archive
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return the chunk data, or NULL if it does not exist
+ * \sa rs_region_get_chunk_data
+ */
+void* rs_archive_get_chunk_data(RSArchive* self, int32_t x, int32_t z);
+
+/**
+ * Start writing a world archive.
+ *
+ * Nothing appears at path until rs_archive_writer_finish() succeeds;
+ * an existing archive there is replaced at that point.
+ *
+ * \param path the archive file to write
+ * \return the writer, or NULL if the file could not be created
+ * \sa rs_archive_writer_finish, rs_archive_writer_free
+ */
+RSArchiveWriter* rs_archive_writer_new(const char* path);
+
+/**
+ * Add a chunk to an archive being written.
+ *
+ * Each chunk may only be added once.
+ *
+ * \param self the writer
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param timestamp the last modified time of the chunk
+ * \param encoding the compression used on data (RS_GZIP or RS_ZLIB)
+ * \param data the compressed chunk data
+ * \param length the length of data
+ * \return true on success, false if the write failed
+ * \sa rs_archive_writer_add_region
+ */
+bool rs_archive_writer_add_chunk(RSArchiveWriter* self, int32_t x, int32_t z, uint32_t timestamp, RSCompressionType encoding, void* data, uint32_t length);
+
+/**
+ * Add every chunk in a region to an archive being written.
+ *
+ * The chunk data is copied as it is, without being decompressed. If
+ * any chunk can't be read, or uses a compression type other than
+ * gzip or zlib, this fails, and so will rs_archive_writer_finish().
+ *
+ * \param self the writer
+ * \param region the region to add
+ * \param rx the x coordinate of the region
+ * \param rz the z coordinate of the region
+ * \return true on success, false if a chunk couldn't be read or a
+ *         write failed
+ * \sa rs_archive_writer_add_world
+ */
+bool rs_archive_writer_add_region(RSArchiveWriter* self, RSRegion* region, int32_t rx, int32_t rz);
+
+/**
+ * Add every chunk in a world to an archive being written.
+ *
+ * This calls rs_archive_writer_add_region() on every region in the
+ * world, as it is on disk.
+ *
+ * \param self the writer
+ * \param world the world to add
+ * \return true on success, false if a chunk couldn't be read or a
+ *         write failed
+ * \sa rs_archive_writer_add_region
+ */
+bool rs_archive_writer_add_world(RSArchiveWriter* self, RSWorld* world);
+
+/**
+ * Finish writing an archive, and free the writer.
+ *
+ * This writes the index, syncs the file, and moves it into place.
+ *
+ * \param self the writer
+ * \return true on success, false if the archive could not be written
+ *         or a chunk was added twice
+ * \sa rs_archive_writer_new
+ */
+bool rs_archive_writer_finish(RSArchiveWriter* self);
+
+/**
+ * Abandon an archive being written, and free the writer.
+ *
+ * \param self the writer
+ * \sa rs_archive_writer_finish
+ */
+void rs_archive_writer_free(RSArchiveWriter* self);
+
+#endif /* __RS_ARCHIVE_H_INCLUDED__ */
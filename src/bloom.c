@@ -0,0 +1,392 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "bloom.h"
+
+#include "error.h"
+#include "memory.h"
+#include "mmap.h"
+#include "rsendian.h"
+#include "compression.h"
+#include "tag.h"
+#include "util.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* A sidecar is a header, then a table saying which version of each
+ * chunk its filter was built from (by timestamp, first sector and
+ * length, where timestamp 0 means no filter), then
+ * one fixed-size filter per chunk, all in the same order as the
+ * region header. All numbers are big-endian, like region files.
+ */
+
+#define RS_REGION_BLOOM_MAGIC "RSBF"
+#define RS_REGION_BLOOM_VERSION 2
+
+/* bytes per filter, and bits set per term; with a few hundred terms
+ * per chunk, this gives well under 1% false positives */
+#define RS_REGION_BLOOM_BYTES 512
+#define RS_REGION_BLOOM_HASHES 4
+
+/* deeper NBT than this is treated as garbage */
+#define RS_REGION_BLOOM_MAX_DEPTH 512
+
+struct BloomHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t bytes;
+    uint32_t hashes;
+} __PACKED__;
+
+struct BloomEntry
+{
+    uint32_t timestamp;
+    uint32_t sector;
+    uint32_t length;
+} __PACKED__;
+
+#define RS_REGION_BLOOM_FILE_SIZE (sizeof(struct BloomHeader) + 32 * 32 * (sizeof(struct BloomEntry) + RS_REGION_BLOOM_BYTES))
+
+struct _RSRegionBloom
+{
+    void* map;
+    struct BloomEntry* entries;
+    uint8_t* filters;
+};
+
+/* helper to build the sidecar path for a region */
+static char* _rs_region_bloom_path(const char* region_path)
+{
+    size_t len = strlen(region_path) + strlen(RS_REGION_BLOOM_SUFFIX) + 1;
+    char* path = rs_new(char, len);
+    snprintf(path, len, "%s%s", region_path, RS_REGION_BLOOM_SUFFIX);
+    return path;
+}
+
+/* helper to check a sidecar header */
+static bool _rs_region_bloom_check_header(const struct BloomHeader* header)
+{
+    return memcmp(header->magic, RS_REGION_BLOOM_MAGIC, 4) == 0 &&
+        rs_endian_uint32(header->version) == RS_REGION_BLOOM_VERSION &&
+        rs_endian_uint32(header->bytes) == RS_REGION_BLOOM_BYTES &&
+        rs_endian_uint32(header->hashes) == RS_REGION_BLOOM_HASHES;
+}
+
+RSRegionBloom* rs_region_bloom_open(const char* region_path)
+{
+    rs_return_val_if_fail(region_path, NULL);
+    
+    char* path = _rs_region_bloom_path(region_path);
+    int fd = open(path, O_RDONLY | O_BINARY);
+    rs_free(path);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0 || (size_t)stat_buf.st_size != RS_REGION_BLOOM_FILE_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    void* map = mmap(NULL, RS_REGION_BLOOM_FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    
+    if (!_rs_region_bloom_check_header(map))
+    {
+        munmap(map, RS_REGION_BLOOM_FILE_SIZE);
+        return NULL;
+    }
+    
+    RSRegionBloom* self = rs_new0(RSRegionBloom, 1);
+    self->map = map;
+    self->entries = (struct BloomEntry*)(map + sizeof(struct BloomHeader));
+    self->filters = (uint8_t*)(self->entries + 32 * 32);
+    return self;
+}
+
+void rs_region_bloom_close(RSRegionBloom* self)
+{
+    rs_return_if_fail(self);
+    
+    munmap(self->map, RS_REGION_BLOOM_FILE_SIZE);
+    rs_free(self);
+}
+
+/* helper to set or test the bits for a term; returns whether they
+ * were all set already */
+static bool _rs_region_bloom_term(uint8_t* filter, const uint8_t* term, size_t len, bool add)
+{
+    /* FNV-1a, split in two for double hashing */
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ term[i]) * 1099511628211ULL;
+    
+    uint32_t h1 = hash;
+    uint32_t h2 = (hash >> 32) | 1;
+    bool present = true;
+    for (uint32_t i = 0; i < RS_REGION_BLOOM_HASHES; i++)
+    {
+        uint32_t bit = (h1 + i * h2) % (RS_REGION_BLOOM_BYTES * 8);
+        if (!(filter[bit / 8] & (1 << (bit % 8))))
+            present = false;
+        if (add)
+            filter[bit / 8] |= 1 << (bit % 8);
+    }
+    
+    return present;
+}
+
+/* helpers to read big-endian numbers out of raw NBT */
+static uint16_t _rs_region_bloom_read16(const uint8_t* data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static int32_t _rs_region_bloom_read32(const uint8_t* data)
+{
+    return (int32_t)(((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3]);
+}
+
+/* helper to add every key and string in an NBT payload to a filter,
+ * without building any tags; returns false on malformed data */
+static bool _rs_region_bloom_scan(const uint8_t** data, const uint8_t* end, uint8_t type, uint8_t* filter, unsigned int depth)
+{
+    const uint8_t* p = *data;
+    size_t left = end - p;
+    int32_t count;
+    
+    if (depth > RS_REGION_BLOOM_MAX_DEPTH)
+        return false;
+    
+    switch (type)
+    {
+    case RS_TAG_BYTE:
+        if (left < 1)
+            return false;
+        p += 1;
+        break;
+    case RS_TAG_SHORT:
+        if (left < 2)
+            return false;
+        p += 2;
+        break;
+    case RS_TAG_INT:
+    case RS_TAG_FLOAT:
+        if (left < 4)
+            return false;
+        p += 4;
+        break;
+    case RS_TAG_LONG:
+    case RS_TAG_DOUBLE:
+        if (left < 8)
+            return false;
+        p += 8;
+        break;
+    case RS_TAG_BYTE_ARRAY:
+    case RS_TAG_INT_ARRAY:
+        if (left < 4)
+            return false;
+        count = _rs_region_bloom_read32(p);
+        p += 4;
+        if (count < 0 || (uint64_t)count * (type == RS_TAG_BYTE_ARRAY ? 1 : 4) > left - 4)
+            return false;
+        p += (size_t)count * (type == RS_TAG_BYTE_ARRAY ? 1 : 4);
+        break;
+    case RS_TAG_STRING:
+        if (left < 2 || _rs_region_bloom_read16(p) > left - 2)
+            return false;
+        _rs_region_bloom_term(filter, p + 2, _rs_region_bloom_read16(p), true);
+        p += 2 + _rs_region_bloom_read16(p);
+        break;
+    case RS_TAG_LIST:
+        if (left < 5)
+            return false;
+        type = p[0];
+        count = _rs_region_bloom_read32(p + 1);
+        p += 5;
+        if (count < 0 || (count > 0 && type == RS_TAG_END))
+            return false;
+        for (int32_t i = 0; i < count; i++)
+        {
+            if (!_rs_region_bloom_scan(&p, end, type, filter, depth + 1))
+                return false;
+        }
+        break;
+    case RS_TAG_COMPOUND:
+        while (true)
+        {
+            if (p >= end)
+                return false;
+            uint8_t child = *(p++);
+            if (child == RS_TAG_END)
+                break;
+            
+            if ((size_t)(end - p) < 2 || _rs_region_bloom_read16(p) > (size_t)(end - p) - 2)
+                return false;
+            _rs_region_bloom_term(filter, p + 2, _rs_region_bloom_read16(p), true);
+            p += 2 + _rs_region_bloom_read16(p);
+            
+            if (!_rs_region_bloom_scan(&p, end, child, filter, depth + 1))
+                return false;
+        }
+        break;
+    default:
+        return false;
+    };
+    
+    *data = p;
+    return true;
+}
+
+/* helper to build the filter for one chunk's uncompressed NBT */
+static void _rs_region_bloom_build(uint8_t* filter, const uint8_t* data, size_t len)
+{
+    memset(filter, 0, RS_REGION_BLOOM_BYTES);
+    
+    /* the root is a named compound; its name is not interesting */
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    bool ok = len >= 3 && p[0] == RS_TAG_COMPOUND && _rs_region_bloom_read16(p + 1) <= len - 3;
+    if (ok)
+    {
+        p += 3 + _rs_region_bloom_read16(p + 1);
+        ok = _rs_region_bloom_scan(&p, end, RS_TAG_COMPOUND, filter, 0);
+    }
+    
+    /* a filter that misses terms would hide the chunk from searches,
+     * so one we couldn't finish matches everything instead */
+    if (!ok)
+        memset(filter, 0xff, RS_REGION_BLOOM_BYTES);
+}
+
+bool rs_region_bloom_update(RSRegion* region, bool create)
+{
+    rs_return_val_if_fail(region, false);
+    
+    const char* region_path = rs_region_get_path(region);
+    if (region_path == NULL)
+        return false;
+    
+    char* path = _rs_region_bloom_path(region_path);
+    uint8_t* contents = rs_malloc0(RS_REGION_BLOOM_FILE_SIZE);
+    struct BloomHeader* header = (struct BloomHeader*)contents;
+    struct BloomEntry* entries = (struct BloomEntry*)(contents + sizeof(struct BloomHeader));
+    uint8_t* filters = (uint8_t*)(entries + 32 * 32);
+    
+    /* start from the existing filters, if they are any good */
+    bool loaded = false;
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd >= 0)
+    {
+        size_t got = 0;
+        while (got < RS_REGION_BLOOM_FILE_SIZE)
+        {
+            ssize_t ret = read(fd, contents + got, RS_REGION_BLOOM_FILE_SIZE - got);
+            if (ret <= 0)
+                break;
+            got += ret;
+        }
+        close(fd);
+        
+        loaded = (got == RS_REGION_BLOOM_FILE_SIZE && _rs_region_bloom_check_header(header));
+        if (!loaded)
+            memset(contents, 0, RS_REGION_BLOOM_FILE_SIZE);
+    }
+    
+    if (fd < 0 && !create)
+    {
+        rs_free(contents);
+        rs_free(path);
+        return true;
+    }
+    
+    memcpy(header->magic, RS_REGION_BLOOM_MAGIC, 4);
+    header->version = rs_endian_uint32(RS_REGION_BLOOM_VERSION);
+    header->bytes = rs_endian_uint32(RS_REGION_BLOOM_BYTES);
+    header->hashes = rs_endian_uint32(RS_REGION_BLOOM_HASHES);
+    
+    uint8_t* buffer = NULL;
+    size_t buffer_size = 0;
+    bool changed = !loaded;
+    for (uint16_t i = 0; i < 32 * 32; i++)
+    {
+        uint8_t x = i % 32;
+        uint8_t z = i / 32;
+        struct BloomEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        if (rs_region_contains_chunk(region, x, z))
+        {
+            entry.timestamp = rs_endian_uint32(rs_region_get_chunk_timestamp(region, x, z));
+            entry.sector = rs_endian_uint32(rs_region_get_chunk_offset(region, x, z) / 4096);
+            entry.length = rs_endian_uint32(rs_region_get_chunk_length(region, x, z));
+        }
+        
+        if (memcmp(&entry, &(entries[i]), sizeof(entry)) == 0)
+            continue;
+        
+        changed = true;
+        entries[i] = entry;
+        memset(filters + i * RS_REGION_BLOOM_BYTES, 0, RS_REGION_BLOOM_BYTES);
+        if (entry.timestamp == 0)
+            continue;
+        
+        void* data = rs_region_get_chunk_data(region, x, z);
+        size_t len = 0;
+        if (data && rs_decompress_into(rs_region_get_chunk_compression(region, x, z), data, rs_region_get_chunk_length(region, x, z), &buffer, &buffer_size, &len))
+            _rs_region_bloom_build(filters + i * RS_REGION_BLOOM_BYTES, buffer, len);
+        else
+            memset(filters + i * RS_REGION_BLOOM_BYTES, 0xff, RS_REGION_BLOOM_BYTES);
+    }
+    
+    if (buffer)
+        rs_free(buffer);
+    
+    /* not synced: a filter that doesn't match its chunk is never trusted */
+    bool ok = true;
+    if (changed)
+        ok = rs_file_replace(path, contents, RS_REGION_BLOOM_FILE_SIZE, false);
+    
+    rs_free(contents);
+    rs_free(path);
+    return ok;
+}
+
+bool rs_region_bloom_is_current(RSRegionBloom* self, RSRegion* region, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self && region, false);
+    rs_return_val_if_fail(x < 32 && z < 32, false);
+    
+    struct BloomEntry* entry = &(self->entries[z * 32 + x]);
+    if (!rs_region_contains_chunk(region, x, z))
+        return entry->timestamp == 0;
+    
+    return rs_endian_uint32(entry->timestamp) == rs_region_get_chunk_timestamp(region, x, z) &&
+        rs_endian_uint32(entry->sector) == rs_region_get_chunk_offset(region, x, z) / 4096 &&
+        rs_endian_uint32(entry->length) == rs_region_get_chunk_length(region, x, z);
+}
+
+bool rs_region_bloom_may_contain(RSRegionBloom* self, uint8_t x, uint8_t z, const char* term)
+{
+    rs_return_val_if_fail(self && term, true);
+    rs_return_val_if_fail(x < 32 && z < 32, true);
+    
+    if (self->entries[z * 32 + x].timestamp == 0)
+        return true;
+    
+    return _rs_region_bloom_term(self->filters + (z * 32 + x) * RS_REGION_BLOOM_BYTES, (const uint8_t*)term, strlen(term), false);
+}
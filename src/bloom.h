@@ -0,0 +1,108 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_BLOOM_H_INCLUDED__
+#define __RS_BLOOM_H_INCLUDED__
+
+#include "region.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSRegionBloom;
+/**
+ * The region bloom filter data type.
+ *
+ * This is an opaque structure that acts as a handle to the bloom
+ * filters of a region: a sidecar file holding, for every chunk in the
+ * region, a small bloom filter over every compound key and string
+ * value in the chunk's NBT.
+ *
+ * A bloom filter can say for certain that a chunk does not contain a
+ * term, but only that it might contain one, so searches for an
+ * entity id or a block entity type can skip nearly every chunk
+ * without decompressing it, and only need to parse the rest.
+ *
+ * Sidecar files are optional. They are created with
+ * rs_region_bloom_update() (or rs_world_build_blooms()), and from then
+ * on, RSWorld keeps them up to date whenever it writes the region.
+ */
+typedef struct _RSRegionBloom RSRegionBloom;
+
+/** The suffix added to a region file's path to find its bloom filters. */
+#define RS_REGION_BLOOM_SUFFIX ".bloom"
+
+/**
+ * Open the bloom filters for a region file.
+ *
+ * \param region_path the path of the region file (not the sidecar)
+ * \return the filters, or NULL if there are none or they are invalid
+ * \sa rs_region_bloom_close
+ */
+RSRegionBloom* rs_region_bloom_open(const char* region_path);
+
+/**
+ * Close a region's bloom filters.
+ *
+ * \param self the filters
+ * \sa rs_region_bloom_open
+ */
+void rs_region_bloom_close(RSRegionBloom* self);
+
+/**
+ * Bring a region's bloom filters up to date.
+ *
+ * Only chunks that changed since their filter was built (by
+ * timestamp, position and length) are decompressed and scanned, so
+ * this is cheap to call after every write. Only what is on disk is
+ * seen, so flush the region first.
+ *
+ * The sidecar is replaced with a rename, but not synced: it only
+ * speeds up searches, and a filter that doesn't match its chunk is
+ * never trusted.
+ *
+ * \param region the region, which must be backed by a file
+ * \param create whether to create the filters if there are none yet
+ * \return true on success (including when there were no filters and
+ *         create is false), false if the sidecar could not be written
+ * \sa rs_world_build_blooms
+ */
+bool rs_region_bloom_update(RSRegion* region, bool create);
+
+/**
+ * Find out whether a region's filter for a chunk describes the chunk
+ * as it is now.
+ *
+ * Filters can fall behind if the region was written by something
+ * other than RSWorld. When this is false, rs_region_bloom_may_contain()
+ * still answers for the old version of the chunk, so don't rely on it.
+ *
+ * \param self the filters
+ * \param region the region they belong to
+ * \param x the x coordinate of the chunk inside the region
+ * \param z the z coordinate of the chunk inside the region
+ * \return whether there is an up-to-date filter for the chunk
+ */
+bool rs_region_bloom_is_current(RSRegionBloom* self, RSRegion* region, uint8_t x, uint8_t z);
+
+/**
+ * Find out whether a chunk might contain a term.
+ *
+ * Terms are compound keys (like "id" or "TileEntities") and string
+ * values (like "Zombie" or "minecraft:chest"), anywhere in the
+ * chunk. If this returns false, the chunk certainly does not contain
+ * the term; if it returns true, it probably does, with a small
+ * chance of a false positive. Chunks with no filter always return
+ * true.
+ *
+ * \param self the filters
+ * \param x the x coordinate of the chunk inside the region
+ * \param z the z coordinate of the chunk inside the region
+ * \param term the key or string value to look for
+ * \return false if the chunk does not contain term, true otherwise
+ */
+bool rs_region_bloom_may_contain(RSRegionBloom* self, uint8_t x, uint8_t z, const char* term);
+
+#endif /* __RS_BLOOM_H_INCLUDED__ */
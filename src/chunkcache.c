@@ -0,0 +1,307 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "chunkcache.h"
+
+#include "error.h"
+#include "memory.h"
+#include "nbt.h"
+
+#include <string.h>
+
+/* the number of buckets a new cache starts with */
+#define RS_CHUNK_CACHE_INITIAL_BUCKETS 256
+
+/* a cached chunk */
+struct CacheEntry
+{
+    char* path;
+    uint8_t x, z;
+    uint32_t hash;
+    
+    /* what the region header said when this was parsed, and the
+     * CRC-32 of the compressed data, which catches rewrites that keep
+     * the same length within the same second
+     */
+    uint32_t timestamp;
+    uint32_t length;
+    uint64_t offset;
+    uint32_t crc;
+    
+    RSNBT* nbt;
+    size_t size;
+    
+    /* next entry in the same bucket */
+    struct CacheEntry* next;
+    
+    /* neighbors in the LRU list */
+    struct CacheEntry* newer;
+    struct CacheEntry* older;
+};
+
+struct _RSChunkCache
+{
+    size_t budget;
+    size_t size;
+    
+    /* hash table of entries, with bucket_count a power of two */
+    struct CacheEntry** buckets;
+    uint32_t bucket_count;
+    uint32_t count;
+    
+    /* LRU list, most recently used first */
+    struct CacheEntry* newest;
+    struct CacheEntry* oldest;
+};
+
+/* FNV-1a, over the path and then the coordinates */
+static uint32_t _rs_chunk_cache_hash(const char* path, uint8_t x, uint8_t z)
+{
+    uint32_t hash = 2166136261u;
+    for (; *path; path++)
+        hash = (hash ^ (uint8_t)*path) * 16777619u;
+    hash = (hash ^ x) * 16777619u;
+    hash = (hash ^ z) * 16777619u;
+    return hash;
+}
+
+RSChunkCache* rs_chunk_cache_new(size_t budget)
+{
+    RSChunkCache* self = rs_new0(RSChunkCache, 1);
+    self->budget = budget ? budget : RS_CHUNK_CACHE_DEFAULT_BUDGET;
+    self->size = 0;
+    self->bucket_count = RS_CHUNK_CACHE_INITIAL_BUCKETS;
+    self->buckets = rs_new0(struct CacheEntry*, self->bucket_count);
+    self->count = 0;
+    self->newest = NULL;
+    self->oldest = NULL;
+    return self;
+}
+
+void rs_chunk_cache_free(RSChunkCache* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_chunk_cache_clear(self);
+    rs_free(self->buckets);
+    rs_free(self);
+}
+
+/* helper to find an entry */
+static struct CacheEntry* _rs_chunk_cache_find(RSChunkCache* self, const char* path, uint8_t x, uint8_t z, uint32_t hash)
+{
+    struct CacheEntry* entry = self->buckets[hash & (self->bucket_count - 1)];
+    for (; entry != NULL; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->x == x && entry->z == z && strcmp(entry->path, path) == 0)
+            return entry;
+    }
+    
+    return NULL;
+}
+
+/* helpers to take an entry out of, or put it at the front of, the LRU list */
+static void _rs_chunk_cache_unlink(RSChunkCache* self, struct CacheEntry* entry)
+{
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        self->newest = entry->older;
+    
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        self->oldest = entry->newer;
+    
+    entry->newer = entry->older = NULL;
+}
+
+static void _rs_chunk_cache_push(RSChunkCache* self, struct CacheEntry* entry)
+{
+    entry->newer = NULL;
+    entry->older = self->newest;
+    if (self->newest)
+        self->newest->newer = entry;
+    else
+        self->oldest = entry;
+    self->newest = entry;
+}
+
+/* helper to remove an entry completely, and free it */
+static void _rs_chunk_cache_remove(RSChunkCache* self, struct CacheEntry* entry)
+{
+    struct CacheEntry** link = &(self->buckets[entry->hash & (self->bucket_count - 1)]);
+    while (*link != entry)
+        link = &((*link)->next);
+    *link = entry->next;
+    
+    _rs_chunk_cache_unlink(self, entry);
+    self->size -= entry->size;
+    self->count--;
+    
+    rs_nbt_free(entry->nbt);
+    rs_free(entry->path);
+    rs_free(entry);
+}
+
+/* helper to drop old entries until we're under budget */
+static void _rs_chunk_cache_shrink(RSChunkCache* self)
+{
+    while (self->size > self->budget && self->oldest)
+        _rs_chunk_cache_remove(self, self->oldest);
+}
+
+/* helper to double the number of buckets */
+static void _rs_chunk_cache_grow(RSChunkCache* self)
+{
+    uint32_t bucket_count = self->bucket_count * 2;
+    struct CacheEntry** buckets = rs_new0(struct CacheEntry*, bucket_count);
+    
+    for (uint32_t i = 0; i < self->bucket_count; i++)
+    {
+        struct CacheEntry* entry = self->buckets[i];
+        while (entry)
+        {
+            struct CacheEntry* next = entry->next;
+            uint32_t b = entry->hash & (bucket_count - 1);
+            entry->next = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    
+    rs_free(self->buckets);
+    self->buckets = buckets;
+    self->bucket_count = bucket_count;
+}
+
+/* helper to hand out a chunk's root, without caching it */
+static RSTag* _rs_chunk_cache_take_root(RSNBT* nbt)
+{
+    RSTag* root = rs_nbt_get_root(nbt);
+    if (root)
+        rs_tag_ref(root);
+    rs_nbt_free(nbt);
+    return root;
+}
+
+RSTag* rs_chunk_cache_get(RSChunkCache* self, RSRegion* region, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self && region, NULL);
+    rs_return_val_if_fail(x < 32 && z < 32, NULL);
+    
+    if (!rs_region_contains_chunk(region, x, z))
+        return NULL;
+    
+    const char* path = rs_region_get_path(region);
+    if (path == NULL)
+    {
+        RSNBT* nbt = rs_nbt_parse_from_region(region, x, z);
+        return nbt ? _rs_chunk_cache_take_root(nbt) : NULL;
+    }
+    
+    uint32_t hash = _rs_chunk_cache_hash(path, x, z);
+    uint32_t timestamp = rs_region_get_chunk_timestamp(region, x, z);
+    uint32_t length = rs_region_get_chunk_length(region, x, z);
+    uint64_t offset = rs_region_get_chunk_offset(region, x, z);
+    uint32_t crc = rs_region_get_chunk_hash(region, x, z);
+    
+    struct CacheEntry* entry = _rs_chunk_cache_find(self, path, x, z, hash);
+    if (entry)
+    {
+        if (entry->timestamp == timestamp && entry->length == length && entry->offset == offset && entry->crc == crc)
+        {
+            _rs_chunk_cache_unlink(self, entry);
+            _rs_chunk_cache_push(self, entry);
+            
+            RSTag* root = rs_nbt_get_root(entry->nbt);
+            rs_tag_ref(root);
+            return root;
+        }
+        
+        /* the chunk changed under us */
+        _rs_chunk_cache_remove(self, entry);
+    }
+    
+    RSNBT* nbt = rs_nbt_parse_from_region(region, x, z);
+    if (nbt == NULL)
+        return NULL;
+    if (rs_nbt_get_root(nbt) == NULL)
+        return _rs_chunk_cache_take_root(nbt);
+    
+    size_t size = sizeof(struct CacheEntry) + strlen(path) + 1;
+    size += rs_tag_get_memory_size(rs_nbt_get_root(nbt));
+    if (size > self->budget)
+        return _rs_chunk_cache_take_root(nbt);
+    
+    entry = rs_new0(struct CacheEntry, 1);
+    entry->path = rs_strdup(path);
+    entry->x = x;
+    entry->z = z;
+    entry->hash = hash;
+    entry->timestamp = timestamp;
+    entry->length = length;
+    entry->offset = offset;
+    entry->crc = crc;
+    entry->nbt = nbt;
+    entry->size = size;
+    
+    if (self->count >= self->bucket_count)
+        _rs_chunk_cache_grow(self);
+    
+    uint32_t b = hash & (self->bucket_count - 1);
+    entry->next = self->buckets[b];
+    self->buckets[b] = entry;
+    _rs_chunk_cache_push(self, entry);
+    self->size += size;
+    self->count++;
+    
+    /* take our reference before shrinking, in case this is the only entry */
+    RSTag* root = rs_nbt_get_root(nbt);
+    rs_tag_ref(root);
+    _rs_chunk_cache_shrink(self);
+    return root;
+}
+
+void rs_chunk_cache_invalidate(RSChunkCache* self, RSRegion* region, uint8_t x, uint8_t z)
+{
+    rs_return_if_fail(self && region);
+    
+    const char* path = rs_region_get_path(region);
+    if (path == NULL)
+        return;
+    
+    struct CacheEntry* entry = _rs_chunk_cache_find(self, path, x, z, _rs_chunk_cache_hash(path, x, z));
+    if (entry)
+        _rs_chunk_cache_remove(self, entry);
+}
+
+void rs_chunk_cache_clear(RSChunkCache* self)
+{
+    rs_return_if_fail(self);
+    
+    while (self->oldest)
+        _rs_chunk_cache_remove(self, self->oldest);
+}
+
+void rs_chunk_cache_set_budget(RSChunkCache* self, size_t budget)
+{
+    rs_return_if_fail(self);
+    
+    self->budget = budget ? budget : RS_CHUNK_CACHE_DEFAULT_BUDGET;
+    _rs_chunk_cache_shrink(self);
+}
+
+size_t rs_chunk_cache_get_budget(RSChunkCache* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->budget;
+}
+
+size_t rs_chunk_cache_get_size(RSChunkCache* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->size;
+}
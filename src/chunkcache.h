@@ -0,0 +1,137 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_CHUNKCACHE_H_INCLUDED__
+#define __RS_CHUNKCACHE_H_INCLUDED__
+
+#include "region.h"
+#include "tag.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct _RSChunkCache;
+/**
+ * The chunk cache data type.
+ *
+ * This is an opaque structure that holds parsed chunks, so that
+ * chunks read over and over again are only decompressed and parsed
+ * once.
+ */
+typedef struct _RSChunkCache RSChunkCache;
+
+/** The default memory budget for a chunk cache, in bytes. */
+#define RS_CHUNK_CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+/**
+ * Create a new chunk cache.
+ *
+ * The cache holds as many parsed chunks as fit in budget bytes, as
+ * measured by rs_tag_get_memory_size(). When a new chunk would put
+ * it over budget, the least recently used chunks are dropped.
+ *
+ * \param budget the memory budget, in bytes, or 0 for the default
+ * \return the new cache
+ * \sa rs_chunk_cache_free, rs_chunk_cache_get
+ */
+RSChunkCache* rs_chunk_cache_new(size_t budget);
+
+/**
+ * Free a chunk cache.
+ *
+ * Chunks still referenced by callers stay alive until they are
+ * unreferenced.
+ *
+ * \param self the cache
+ * \sa rs_chunk_cache_new
+ */
+void rs_chunk_cache_free(RSChunkCache* self);
+
+/**
+ * Get a parsed chunk, from the cache if possible.
+ *
+ * Chunks are keyed by the region's path (as returned by
+ * rs_region_get_path()), the chunk coordinates, the chunk's
+ * timestamp, length and offset as currently listed in the region,
+ * and the CRC-32 of its compressed data (see
+ * rs_region_get_chunk_hash()). So, once rs_region_flush() or
+ * rs_region_refresh() changes a chunk, even without changing its
+ * timestamp or length, the cached copy is no longer used, and is
+ * replaced the next time the chunk is asked for. Checking the CRC
+ * reads the compressed data, which is still far cheaper than
+ * decompressing and parsing it. Different RSRegion handles on the same path
+ * share entries.
+ *
+ * Regions without a path are parsed every time, and never cached.
+ *
+ * The root tag returned has a reference held for the caller, which
+ * must be released with rs_tag_unref(). It is shared with the cache
+ * and other callers, so it should be treated as read-only.
+ *
+ * Like the rest of libredstone, a cache must not be used from more
+ * than one thread at a time.
+ *
+ * \param self the cache
+ * \param region the region to read from
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \return the chunk's root tag, or NULL if there is no such chunk
+ * \sa rs_chunk_cache_new, rs_nbt_parse_from_region
+ */
+RSTag* rs_chunk_cache_get(RSChunkCache* self, RSRegion* region, uint8_t x, uint8_t z);
+
+/**
+ * Drop any cached copy of a chunk.
+ *
+ * Stale entries are detected automatically, so this is only needed
+ * to free memory early.
+ *
+ * \param self the cache
+ * \param region the region the chunk is in
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \sa rs_chunk_cache_clear
+ */
+void rs_chunk_cache_invalidate(RSChunkCache* self, RSRegion* region, uint8_t x, uint8_t z);
+
+/**
+ * Drop every chunk in the cache.
+ *
+ * \param self the cache
+ * \sa rs_chunk_cache_invalidate
+ */
+void rs_chunk_cache_clear(RSChunkCache* self);
+
+/**
+ * Change the memory budget of a cache.
+ *
+ * If the cache is already over the new budget, chunks are dropped
+ * immediately.
+ *
+ * \param self the cache
+ * \param budget the memory budget, in bytes, or 0 for the default
+ * \sa rs_chunk_cache_get_budget
+ */
+void rs_chunk_cache_set_budget(RSChunkCache* self, size_t budget);
+
+/**
+ * Get the memory budget of a cache.
+ *
+ * \param self the cache
+ * \return the memory budget, in bytes
+ * \sa rs_chunk_cache_set_budget
+ */
+size_t rs_chunk_cache_get_budget(RSChunkCache* self);
+
+/**
+ * Get the memory currently used by cached chunks.
+ *
+ * \param self the cache
+ * \return the memory used, in bytes
+ */
+size_t rs_chunk_cache_get_size(RSChunkCache* self);
+
+#endif /* __RS_CHUNKCACHE_H_INCLUDED__ */
@@ -0,0 +1,539 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "chunkserver.h"
+
+#include "error.h"
+#include "memory.h"
+#include "rsendian.h"
+#include "util.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H) && defined(HAVE_POLL_H)
+#define RS_HAVE_CHUNK_SERVER
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#endif
+
+/* A client sends requests of 8 bytes: the x and z coordinates of a
+ * chunk. The server answers each in order with a status byte (1 if
+ * the chunk exists, 0 if not), the timestamp, a compression byte (as
+ * in region files), and the data length, followed by the data. All
+ * numbers are big-endian.
+ *
+ * Client sockets are non-blocking. An answer a client isn't reading
+ * yet is kept until it is, as the rest of the header and a
+ * descriptor and offset for the rest of the data, and no more of its
+ * requests are read until then, so one slow client can't hold up the
+ * rest.
+ */
+
+#define RS_CHUNK_REQUEST_SIZE 8
+#define RS_CHUNK_RESPONSE_SIZE 10
+
+/* how often, in seconds, to look for changes made by other processes */
+#define RS_CHUNK_SERVER_REFRESH_INTERVAL 1
+
+struct ServerClient
+{
+    int fd;
+    uint8_t request[RS_CHUNK_REQUEST_SIZE];
+    size_t used;
+    
+    /* the part of an answer not yet written: the header from sent up
+     * to used, then remaining bytes of data from file at offset */
+    uint8_t pending[RS_CHUNK_RESPONSE_SIZE];
+    size_t pending_sent;
+    size_t pending_used;
+    int file;
+    uint64_t file_offset;
+    uint32_t file_remaining;
+};
+
+struct _RSChunkServer
+{
+    RSWorld* world;
+    char* path;
+    int listen_fd;
+    
+    /* written to by rs_chunk_server_stop() to wake up poll() */
+    int wake[2];
+    volatile bool stopping;
+    
+    struct ServerClient* clients;
+    unsigned int client_count;
+    unsigned int client_allocated;
+};
+
+struct _RSChunkClient
+{
+    int fd;
+    uint8_t* buffer;
+    size_t buffer_size;
+};
+
+/* helper to read exactly len bytes, returning false on failure or EOF */
+static bool _rs_chunk_server_read_all(int fd, void* data, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t ret = read(fd, (uint8_t*)data + got, len - got);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        got += ret;
+    }
+    
+    return true;
+}
+
+#ifdef RS_HAVE_CHUNK_SERVER
+
+/* helper to fill in a socket address, returning false if path is too long */
+static bool _rs_chunk_server_address(const char* path, struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        rs_critical("socket path is too long: %s", path);
+        return false;
+    }
+    
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+RSChunkServer* rs_chunk_server_new(RSWorld* world, const char* path)
+{
+    rs_return_val_if_fail(world && path, NULL);
+    
+    struct sockaddr_un addr;
+    if (!_rs_chunk_server_address(path, &addr))
+        return NULL;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return NULL;
+    
+    /* replace a stale socket, but nothing else */
+    struct stat stat_buf;
+    if (lstat(path, &stat_buf) == 0 && S_ISSOCK(stat_buf.st_mode))
+        unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    RSChunkServer* self = rs_new0(RSChunkServer, 1);
+    self->world = world;
+    self->path = rs_strdup(path);
+    self->listen_fd = fd;
+    if (pipe(self->wake) < 0)
+    {
+        self->wake[0] = self->wake[1] = -1;
+        rs_chunk_server_free(self);
+        return NULL;
+    }
+    
+    return self;
+}
+
+/* helper to drop a client */
+static void _rs_chunk_server_remove(RSChunkServer* self, unsigned int i)
+{
+    close(self->clients[i].fd);
+    if (self->clients[i].file >= 0)
+        close(self->clients[i].file);
+    self->clients[i] = self->clients[self->client_count - 1];
+    self->client_count--;
+}
+
+/* helper to check if a client still has an answer to be written */
+static inline bool _rs_chunk_server_busy(struct ServerClient* client)
+{
+    return client->pending_sent < client->pending_used || client->file >= 0;
+}
+
+/* helper to send some chunk data from a file, returning the number
+ * of bytes written, or -1 on error */
+static ssize_t _rs_chunk_server_send_file(struct ServerClient* client)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+    off_t offset = client->file_offset;
+    return sendfile(client->fd, client->file, &offset, client->file_remaining);
+#else
+    uint8_t buffer[65536];
+    ssize_t got = pread(client->file, buffer, MIN(sizeof(buffer), client->file_remaining), client->file_offset);
+    if (got <= 0)
+        return got;
+    return write(client->fd, buffer, got);
+#endif
+}
+
+/* helper to write as much of a client's answer as it will take
+ * without blocking, returning false if the client is gone */
+static bool _rs_chunk_server_flush(struct ServerClient* client)
+{
+    while (client->pending_sent < client->pending_used)
+    {
+        ssize_t ret = write(client->fd, client->pending + client->pending_sent, client->pending_used - client->pending_sent);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (ret <= 0)
+            return false;
+        client->pending_sent += ret;
+    }
+    
+    while (client->file >= 0 && client->file_remaining > 0)
+    {
+        ssize_t ret = _rs_chunk_server_send_file(client);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        
+        /* a short file leaves the client waiting for data that will
+         * never come, so it has to go
+         */
+        if (ret <= 0)
+            return false;
+        client->file_offset += ret;
+        client->file_remaining -= ret;
+    }
+    
+    if (client->file >= 0)
+        close(client->file);
+    client->file = -1;
+    client->pending_sent = client->pending_used = 0;
+    return true;
+}
+
+/* helper to answer one request, returning false if the client is gone */
+static bool _rs_chunk_server_answer(RSChunkServer* self, struct ServerClient* client, int32_t x, int32_t z)
+{
+    uint8_t* response = client->pending;
+    memset(response, 0, RS_CHUNK_RESPONSE_SIZE);
+    client->pending_sent = 0;
+    client->pending_used = RS_CHUNK_RESPONSE_SIZE;
+    
+    RSRegion* region = rs_world_get_region(self->world, rs_world_chunk_to_region(x), rs_world_chunk_to_region(z), false);
+    uint8_t lx = x & 31;
+    uint8_t lz = z & 31;
+    uint32_t length = region ? rs_region_get_chunk_length(region, lx, lz) : 0;
+    RSCompressionType encoding = region ? rs_region_get_chunk_compression(region, lx, lz) : RS_UNKNOWN_COMPRESSION;
+    if (length == 0 || (encoding != RS_GZIP && encoding != RS_ZLIB))
+        return _rs_chunk_server_flush(client);
+    
+    /* the data is sent from its own descriptor, so it stays the same
+     * even if the region is closed or replaced before the client
+     * reads it all
+     */
+    client->file = rs_region_open_chunk_file(region, lx, lz, &(client->file_offset));
+    if (client->file < 0)
+        return false;
+    client->file_remaining = length;
+    
+    uint32_t timestamp = rs_endian_uint32(rs_region_get_chunk_timestamp(region, lx, lz));
+    uint32_t be_length = rs_endian_uint32(length);
+    response[0] = 1;
+    memcpy(response + 1, &timestamp, 4);
+    response[5] = (encoding == RS_GZIP) ? 1 : 2;
+    memcpy(response + 6, &be_length, 4);
+    
+    return _rs_chunk_server_flush(client);
+}
+
+/* helper to read from a client, returning false if it should be dropped */
+static bool _rs_chunk_server_read(RSChunkServer* self, struct ServerClient* client)
+{
+    ssize_t ret = read(client->fd, client->request + client->used, RS_CHUNK_REQUEST_SIZE - client->used);
+    if (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;
+    if (ret <= 0)
+        return false;
+    
+    client->used += ret;
+    if (client->used < RS_CHUNK_REQUEST_SIZE)
+        return true;
+    
+    int32_t x, z;
+    memcpy(&x, client->request, 4);
+    memcpy(&z, client->request + 4, 4);
+    client->used = 0;
+    return _rs_chunk_server_answer(self, client, rs_endian_int32(x), rs_endian_int32(z));
+}
+
+bool rs_chunk_server_run(RSChunkServer* self)
+{
+    rs_return_val_if_fail(self, false);
+    
+    struct pollfd* fds = NULL;
+    unsigned int fds_allocated = 0;
+    time_t last_refresh = time(NULL);
+    bool ok = true;
+    
+    while (!(self->stopping))
+    {
+        if (fds_allocated < self->client_count + 2)
+        {
+            fds_allocated = self->client_count + 2;
+            fds = rs_renew(struct pollfd, fds, fds_allocated);
+        }
+        
+        fds[0].fd = self->wake[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = self->listen_fd;
+        fds[1].events = POLLIN;
+        for (unsigned int i = 0; i < self->client_count; i++)
+        {
+            /* don't take new requests until the last answer is out */
+            fds[i + 2].fd = self->clients[i].fd;
+            fds[i + 2].events = _rs_chunk_server_busy(&(self->clients[i])) ? POLLOUT : POLLIN;
+        }
+        
+        unsigned int count = self->client_count + 2;
+        int ret = poll(fds, count, RS_CHUNK_SERVER_REFRESH_INTERVAL * 1000);
+        if (ret < 0 && errno != EINTR)
+        {
+            ok = false;
+            break;
+        }
+        
+        time_t now = time(NULL);
+        if (now - last_refresh >= RS_CHUNK_SERVER_REFRESH_INTERVAL)
+        {
+            rs_world_refresh(self->world);
+            last_refresh = now;
+        }
+        
+        if (ret <= 0)
+            continue;
+        
+        /* go backwards, so removing a client doesn't skip any */
+        for (unsigned int i = count; i > 2; i--)
+        {
+            if (fds[i - 1].revents == 0)
+                continue;
+            
+            struct ServerClient* client = &(self->clients[i - 3]);
+            bool alive = _rs_chunk_server_busy(client) ? _rs_chunk_server_flush(client) : _rs_chunk_server_read(self, client);
+            if (!alive)
+                _rs_chunk_server_remove(self, i - 3);
+        }
+        
+        if (fds[1].revents & POLLIN)
+        {
+            int fd = accept(self->listen_fd, NULL, NULL);
+            if (fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+            
+            if (fd >= 0)
+            {
+                if (self->client_count == self->client_allocated)
+                {
+                    self->client_allocated = self->client_allocated ? self->client_allocated * 2 : 8;
+                    self->clients = rs_renew(struct ServerClient, self->clients, self->client_allocated);
+                }
+                
+                memset(&(self->clients[self->client_count]), 0, sizeof(struct ServerClient));
+                self->clients[self->client_count].fd = fd;
+                self->clients[self->client_count].file = -1;
+                self->client_count++;
+            }
+        }
+    }
+    
+    if (fds)
+        rs_free(fds);
+    
+    /* drain the wake-up pipe, so the server can be run again */
+    if (self->stopping)
+    {
+        char drain;
+        while (read(self->wake[0], &drain, 1) < 0 && errno == EINTR)
+            ;
+        self->stopping = false;
+    }
+    
+    return ok;
+}
+
+void rs_chunk_server_stop(RSChunkServer* self)
+{
+    rs_return_if_fail(self);
+    
+    self->stopping = true;
+    char wake = 0;
+    while (write(self->wake[1], &wake, 1) < 0 && errno == EINTR)
+        ;
+}
+
+void rs_chunk_server_free(RSChunkServer* self)
+{
+    rs_return_if_fail(self);
+    
+    for (unsigned int i = 0; i < self->client_count; i++)
+    {
+        close(self->clients[i].fd);
+        if (self->clients[i].file >= 0)
+            close(self->clients[i].file);
+    }
+    if (self->clients)
+        rs_free(self->clients);
+    
+    if (self->wake[0] >= 0)
+        close(self->wake[0]);
+    if (self->wake[1] >= 0)
+        close(self->wake[1]);
+    close(self->listen_fd);
+    unlink(self->path);
+    rs_free(self->path);
+    rs_free(self);
+}
+
+RSChunkClient* rs_chunk_client_connect(const char* path)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    struct sockaddr_un addr;
+    if (!_rs_chunk_server_address(path, &addr))
+        return NULL;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return NULL;
+    
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    RSChunkClient* self = rs_new0(RSChunkClient, 1);
+    self->fd = fd;
+    return self;
+}
+
+#else /* !RS_HAVE_CHUNK_SERVER */
+
+RSChunkServer* rs_chunk_server_new(RSWorld* world, const char* path)
+{
+    rs_critical("chunk servers are not supported on this system");
+    return NULL;
+}
+
+bool rs_chunk_server_run(RSChunkServer* self)
+{
+    return false;
+}
+
+void rs_chunk_server_stop(RSChunkServer* self)
+{
+}
+
+void rs_chunk_server_free(RSChunkServer* self)
+{
+}
+
+RSChunkClient* rs_chunk_client_connect(const char* path)
+{
+    rs_critical("chunk servers are not supported on this system");
+    return NULL;
+}
+
+#endif /* RS_HAVE_CHUNK_SERVER */
+
+void rs_chunk_client_close(RSChunkClient* self)
+{
+    rs_return_if_fail(self);
+    
+    if (self->fd >= 0)
+        close(self->fd);
+    if (self->buffer)
+        rs_free(self->buffer);
+    rs_free(self);
+}
+
+void* rs_chunk_client_get(RSChunkClient* self, int32_t x, int32_t z, uint32_t* timestamp, RSCompressionType* encoding, uint32_t* length)
+{
+    rs_return_val_if_fail(self && encoding && length, NULL);
+    
+    *encoding = RS_UNKNOWN_COMPRESSION;
+    *length = 0;
+    if (self->fd < 0)
+        return NULL;
+    
+    uint8_t request[RS_CHUNK_REQUEST_SIZE];
+    uint8_t response[RS_CHUNK_RESPONSE_SIZE];
+    int32_t be_x = rs_endian_int32(x);
+    int32_t be_z = rs_endian_int32(z);
+    memcpy(request, &be_x, 4);
+    memcpy(request + 4, &be_z, 4);
+    
+    bool ok = rs_write_all(self->fd, request, sizeof(request)) &&
+        _rs_chunk_server_read_all(self->fd, response, sizeof(response));
+    
+    uint32_t be_timestamp = 0, be_length = 0;
+    if (ok)
+    {
+        memcpy(&be_timestamp, response + 1, 4);
+        memcpy(&be_length, response + 6, 4);
+    }
+    
+    uint32_t data_length = rs_endian_uint32(be_length);
+    bool found = ok && response[0] == 1 && data_length > 0;
+    if (found)
+    {
+        if (self->buffer_size < data_length)
+        {
+            self->buffer_size = data_length;
+            self->buffer = rs_renew(uint8_t, self->buffer, self->buffer_size);
+        }
+        
+        ok = _rs_chunk_server_read_all(self->fd, self->buffer, data_length);
+    }
+    
+    if (!ok)
+    {
+        close(self->fd);
+        self->fd = -1;
+        return NULL;
+    }
+    
+    if (!found)
+        return NULL;
+    
+    if (timestamp)
+        *timestamp = rs_endian_uint32(be_timestamp);
+    *encoding = (response[5] == 1) ? RS_GZIP : RS_ZLIB;
+    *length = data_length;
+    return self->buffer;
+}
+
+bool rs_chunk_client_is_connected(RSChunkClient* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->fd >= 0;
+}
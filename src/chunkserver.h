@@ -0,0 +1,135 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_CHUNKSERVER_H_INCLUDED__
+#define __RS_CHUNKSERVER_H_INCLUDED__
+
+#include "compression.h"
+#include "world.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSChunkServer;
+/**
+ * The chunk server data type.
+ *
+ * This is an opaque structure that serves the chunks of one world
+ * over a local (UNIX domain) socket. Several processes reading the
+ * same world can share one server instead of each opening every
+ * region file themselves: the server keeps regions open through its
+ * RSWorld, and sends each compressed chunk straight from the file it
+ * is stored in, with sendfile() where the system has it.
+ *
+ * Clients connect with rs_chunk_client_connect().
+ */
+typedef struct _RSChunkServer RSChunkServer;
+
+struct _RSChunkClient;
+/**
+ * The chunk client data type.
+ *
+ * This is an opaque structure for a connection to an RSChunkServer.
+ */
+typedef struct _RSChunkClient RSChunkClient;
+
+/**
+ * Create a chunk server.
+ *
+ * This creates a socket at path and starts listening on it, replacing
+ * any socket file already there. Any other kind of file at path is
+ * left alone, and the server is not created. Nothing is served until
+ * rs_chunk_server_run() is called.
+ *
+ * \param world the world to serve, which must outlive the server
+ * \param path where to create the socket
+ * \return the server, or NULL if the socket could not be created
+ * \sa rs_chunk_server_run, rs_chunk_server_free
+ */
+RSChunkServer* rs_chunk_server_new(RSWorld* world, const char* path);
+
+/**
+ * Serve clients until rs_chunk_server_stop() is called.
+ *
+ * Requests are answered one at a time, in the calling thread, but
+ * without ever waiting on a client: an answer a client isn't reading
+ * yet is kept, and sent as it makes room, while the others are
+ * served. About once a second, rs_world_refresh() is called, so that
+ * chunks written by other processes are served as they are on disk.
+ *
+ * Writing to a client that has gone away raises SIGPIPE, so programs
+ * running a server will usually want to ignore that signal.
+ *
+ * \param self the server
+ * \return true if the server was stopped, false on error
+ * \sa rs_chunk_server_stop
+ */
+bool rs_chunk_server_run(RSChunkServer* self);
+
+/**
+ * Make rs_chunk_server_run() return.
+ *
+ * This is safe to call from a signal handler, or another thread.
+ *
+ * \param self the server
+ * \sa rs_chunk_server_run
+ */
+void rs_chunk_server_stop(RSChunkServer* self);
+
+/**
+ * Free a chunk server, disconnecting all clients and removing the
+ * socket file.
+ *
+ * \param self the server
+ * \sa rs_chunk_server_new
+ */
+void rs_chunk_server_free(RSChunkServer* self);
+
+/**
+ * Connect to a chunk server.
+ *
+ * \param path the server's socket
+ * \return the client, or NULL if the connection failed
+ * \sa rs_chunk_client_close
+ */
+RSChunkClient* rs_chunk_client_connect(const char* path);
+
+/**
+ * Close a connection to a chunk server.
+ *
+ * \param self the client
+ * \sa rs_chunk_client_connect
+ */
+void rs_chunk_client_close(RSChunkClient* self);
+
+/**
+ * Fetch a chunk from a chunk server.
+ *
+ * The data is compressed exactly as it is in the region file, and
+ * belongs to the client; it is only good until the next call.
+ *
+ * \param self the client
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param timestamp where to store the last modified time, or NULL
+ * \param encoding where to store the compression type of the data
+ * \param length where to store the length of the data
+ * \return the chunk data, or NULL if the chunk does not exist or on
+ *         error (see rs_chunk_client_is_connected())
+ */
+void* rs_chunk_client_get(RSChunkClient* self, int32_t x, int32_t z, uint32_t* timestamp, RSCompressionType* encoding, uint32_t* length);
+
+/**
+ * Get whether a client is still connected.
+ *
+ * Once an error has happened, the connection is closed, and every
+ * request fails.
+ *
+ * \param self the client
+ * \return true if the connection is still usable
+ */
+bool rs_chunk_client_is_connected(RSChunkClient* self);
+
+#endif /* __RS_CHUNKSERVER_H_INCLUDED__ */
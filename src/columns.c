@@ -0,0 +1,733 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "columns.h"
+
+#include "error.h"
+#include "memory.h"
+#include "nbt.h"
+#include "rsendian.h"
+#include "util.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A column file is a header, then the x, z and timestamp columns,
+ * then each column: a column header, its path, its presence bytes, its
+ * offsets (if it has any) and its elements. Every block is padded to a
+ * multiple of 8 bytes. All numbers are big-endian.
+ */
+
+#define RS_CHUNK_COLUMNS_MAGIC "RSCF"
+#define RS_CHUNK_COLUMNS_VERSION 1
+
+/* how much to byte-swap at once when writing */
+#define RS_CHUNK_COLUMNS_BUFFER_SIZE (64 * 1024)
+
+struct ColumnsFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t rows;
+    uint32_t columns;
+} __PACKED__;
+
+struct ColumnFileHeader
+{
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t path_length;
+    uint32_t reserved2;
+    uint64_t count;
+} __PACKED__;
+
+struct Column
+{
+    char* path;
+    RSTagType type;
+    size_t width;
+    
+    /* elements, and how many there are and have room for */
+    uint8_t* data;
+    size_t count;
+    size_t allocated;
+    
+    /* one per row, plus one for array and string columns */
+    uint64_t* offsets;
+    uint8_t* present;
+};
+
+struct _RSChunkColumns
+{
+    struct Column* columns;
+    unsigned int column_count;
+    
+    int32_t* x;
+    int32_t* z;
+    uint32_t* timestamps;
+    uint32_t rows;
+    uint32_t allocated;
+};
+
+/* a thread's rows, while rs_chunk_columns_add_world() runs */
+struct ColumnsLocal
+{
+    RSChunkColumns* part;
+};
+
+RSChunkColumns* rs_chunk_columns_new(void)
+{
+    return rs_new0(RSChunkColumns, 1);
+}
+
+void rs_chunk_columns_free(RSChunkColumns* self)
+{
+    rs_return_if_fail(self);
+    
+    for (unsigned int i = 0; i < self->column_count; i++)
+    {
+        struct Column* column = &(self->columns[i]);
+        rs_free(column->path);
+        if (column->data)
+            rs_free(column->data);
+        if (column->offsets)
+            rs_free(column->offsets);
+        if (column->present)
+            rs_free(column->present);
+    }
+    
+    if (self->columns)
+        rs_free(self->columns);
+    if (self->x)
+        rs_free(self->x);
+    if (self->z)
+        rs_free(self->z);
+    if (self->timestamps)
+        rs_free(self->timestamps);
+    rs_free(self);
+}
+
+/* helper to get the size of one element, or 0 for unsupported types */
+static size_t _rs_chunk_columns_width(RSTagType type)
+{
+    switch (type)
+    {
+    case RS_TAG_BYTE:
+    case RS_TAG_BYTE_ARRAY:
+    case RS_TAG_STRING:
+        return 1;
+    case RS_TAG_SHORT:
+        return 2;
+    case RS_TAG_INT:
+    case RS_TAG_FLOAT:
+    case RS_TAG_INT_ARRAY:
+        return 4;
+    case RS_TAG_LONG:
+    case RS_TAG_DOUBLE:
+        return 8;
+    default:
+        return 0;
+    };
+}
+
+/* helper to tell array and string columns from number columns */
+static inline bool _rs_chunk_columns_is_variable(RSTagType type)
+{
+    return type == RS_TAG_BYTE_ARRAY || type == RS_TAG_INT_ARRAY || type == RS_TAG_STRING;
+}
+
+bool rs_chunk_columns_add_column(RSChunkColumns* self, const char* path, RSTagType type)
+{
+    rs_return_val_if_fail(self && path, false);
+    rs_return_val_if_fail(self->rows == 0, false);
+    rs_return_val_if_fail(_rs_chunk_columns_width(type) > 0, false);
+    
+    self->columns = rs_renew(struct Column, self->columns, self->column_count + 1);
+    struct Column* column = &(self->columns[self->column_count++]);
+    memset(column, 0, sizeof(struct Column));
+    column->path = rs_strdup(path);
+    column->type = type;
+    column->width = _rs_chunk_columns_width(type);
+    
+    /* offsets always has the entry for the end of the last row */
+    if (_rs_chunk_columns_is_variable(type))
+        column->offsets = rs_new0(uint64_t, 1);
+    return true;
+}
+
+/* helper to make a new, empty set with the same columns */
+static RSChunkColumns* _rs_chunk_columns_copy_empty(RSChunkColumns* self)
+{
+    RSChunkColumns* copy = rs_chunk_columns_new();
+    for (unsigned int i = 0; i < self->column_count; i++)
+        rs_chunk_columns_add_column(copy, self->columns[i].path, self->columns[i].type);
+    return copy;
+}
+
+/* helper to make room for at least rows rows */
+static void _rs_chunk_columns_reserve_rows(RSChunkColumns* self, uint32_t rows)
+{
+    if (rows <= self->allocated)
+        return;
+    
+    uint32_t allocated = self->allocated ? self->allocated : 256;
+    while (allocated < rows)
+        allocated *= 2;
+    
+    self->x = rs_renew(int32_t, self->x, allocated);
+    self->z = rs_renew(int32_t, self->z, allocated);
+    self->timestamps = rs_renew(uint32_t, self->timestamps, allocated);
+    for (unsigned int i = 0; i < self->column_count; i++)
+    {
+        struct Column* column = &(self->columns[i]);
+        column->present = rs_renew(uint8_t, column->present, allocated);
+        if (column->offsets)
+            column->offsets = rs_renew(uint64_t, column->offsets, allocated + 1);
+        else
+            column->data = rs_renew(uint8_t, column->data, allocated * column->width);
+    }
+    
+    self->allocated = allocated;
+}
+
+/* helper to make room for at least count elements in an array or
+ * string column
+ */
+static void _rs_chunk_columns_reserve_elements(struct Column* column, size_t count)
+{
+    if (count <= column->allocated)
+        return;
+    
+    size_t allocated = column->allocated ? column->allocated : 4096;
+    while (allocated < count)
+        allocated *= 2;
+    
+    column->data = rs_renew(uint8_t, column->data, allocated * column->width);
+    column->allocated = allocated;
+}
+
+/* helper to read any number tag payload as both an integer and a
+ * double, returning false if it is not a number
+ */
+static bool _rs_chunk_columns_read_number(RSTagType type, const uint8_t* data, int64_t* int_out, double* double_out)
+{
+    int16_t short_val;
+    int32_t int_val;
+    int64_t long_val;
+    float float_val;
+    double double_val;
+    
+    switch (type)
+    {
+    case RS_TAG_BYTE:
+        *int_out = (int8_t)data[0];
+        *double_out = *int_out;
+        return true;
+    case RS_TAG_SHORT:
+        memcpy(&short_val, data, 2);
+        *int_out = rs_endian_int16(short_val);
+        *double_out = *int_out;
+        return true;
+    case RS_TAG_INT:
+        memcpy(&int_val, data, 4);
+        *int_out = rs_endian_int32(int_val);
+        *double_out = *int_out;
+        return true;
+    case RS_TAG_LONG:
+        memcpy(&long_val, data, 8);
+        *int_out = rs_endian_int64(long_val);
+        *double_out = *int_out;
+        return true;
+    case RS_TAG_FLOAT:
+        memcpy(&float_val, data, 4);
+        *double_out = rs_endian_float(float_val);
+        break;
+    case RS_TAG_DOUBLE:
+        memcpy(&double_val, data, 8);
+        *double_out = rs_endian_double(double_val);
+        break;
+    default:
+        return false;
+    };
+    
+    /* out of range (or NaN) doubles have no integer value */
+    if (*double_out >= -9.2e18 && *double_out <= 9.2e18)
+        *int_out = (int64_t)*double_out;
+    else
+        *int_out = 0;
+    return true;
+}
+
+/* helper to fill in one row of a number column */
+static bool _rs_chunk_columns_set_number(struct Column* column, uint32_t row, RSTagType type, const uint8_t* payload)
+{
+    uint8_t* dest = column->data + (size_t)row * column->width;
+    memset(dest, 0, column->width);
+    
+    int64_t int_val = 0;
+    double double_val = 0;
+    if (payload == NULL || !_rs_chunk_columns_read_number(type, payload, &int_val, &double_val))
+        return false;
+    
+    int8_t byte_val = int_val;
+    int16_t short_val = int_val;
+    int32_t int32_val = int_val;
+    float float_val = double_val;
+    
+    switch (column->type)
+    {
+    case RS_TAG_BYTE:
+        memcpy(dest, &byte_val, 1);
+        break;
+    case RS_TAG_SHORT:
+        memcpy(dest, &short_val, 2);
+        break;
+    case RS_TAG_INT:
+        memcpy(dest, &int32_val, 4);
+        break;
+    case RS_TAG_LONG:
+        memcpy(dest, &int_val, 8);
+        break;
+    case RS_TAG_FLOAT:
+        memcpy(dest, &float_val, 4);
+        break;
+    case RS_TAG_DOUBLE:
+        memcpy(dest, &double_val, 8);
+        break;
+    default:
+        return false;
+    };
+    
+    return true;
+}
+
+/* helper to fill in one row of an array or string column */
+static bool _rs_chunk_columns_set_variable(struct Column* column, uint32_t row, RSTagType type, const uint8_t* payload)
+{
+    uint64_t start = column->offsets[row];
+    column->offsets[row + 1] = start;
+    if (payload == NULL || type != column->type)
+        return false;
+    
+    uint32_t count;
+    if (type == RS_TAG_STRING)
+    {
+        uint16_t short_len;
+        memcpy(&short_len, payload, 2);
+        count = rs_endian_uint16(short_len);
+        payload += 2;
+    } else {
+        int32_t int_len;
+        memcpy(&int_len, payload, 4);
+        count = rs_endian_int32(int_len);
+        payload += 4;
+    }
+    
+    _rs_chunk_columns_reserve_elements(column, start + count);
+    uint8_t* dest = column->data + start * column->width;
+    if (type == RS_TAG_INT_ARRAY)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int32_t value;
+            memcpy(&value, payload + i * 4, 4);
+            value = rs_endian_int32(value);
+            memcpy(dest + i * 4, &value, 4);
+        }
+    } else {
+        memcpy(dest, payload, count);
+    }
+    
+    column->offsets[row + 1] = start + count;
+    column->count = start + count;
+    return true;
+}
+
+/* helper to add a row from a chunk's uncompressed NBT, decoding only
+ * the requested tags
+ */
+static void _rs_chunk_columns_add_row(RSChunkColumns* self, const RSWorldChunkInfo* info, void* data, size_t len)
+{
+    _rs_chunk_columns_reserve_rows(self, self->rows + 1);
+    uint32_t row = self->rows++;
+    self->x[row] = info->x;
+    self->z[row] = info->z;
+    self->timestamps[row] = info->timestamp;
+    
+    for (unsigned int i = 0; i < self->column_count; i++)
+    {
+        struct Column* column = &(self->columns[i]);
+        RSTagType type = RS_TAG_END;
+        uint8_t* payload = rs_nbt_find_uncompressed(data, len, column->path, &type, NULL);
+        
+        if (column->offsets)
+        {
+            column->present[row] = _rs_chunk_columns_set_variable(column, row, type, payload);
+        } else {
+            column->present[row] = _rs_chunk_columns_set_number(column, row, type, payload);
+            column->count = self->rows;
+        }
+    }
+}
+
+/* helper to move every row of src onto the end of self, which must
+ * have the same columns
+ */
+static void _rs_chunk_columns_append(RSChunkColumns* self, RSChunkColumns* src)
+{
+    if (src->rows == 0)
+        return;
+    
+    uint32_t base = self->rows;
+    _rs_chunk_columns_reserve_rows(self, base + src->rows);
+    memcpy(self->x + base, src->x, src->rows * sizeof(int32_t));
+    memcpy(self->z + base, src->z, src->rows * sizeof(int32_t));
+    memcpy(self->timestamps + base, src->timestamps, src->rows * sizeof(uint32_t));
+    
+    for (unsigned int i = 0; i < self->column_count; i++)
+    {
+        struct Column* column = &(self->columns[i]);
+        struct Column* other = &(src->columns[i]);
+        memcpy(column->present + base, other->present, src->rows);
+        
+        if (column->offsets)
+        {
+            uint64_t start = column->offsets[base];
+            _rs_chunk_columns_reserve_elements(column, start + other->count);
+            if (other->count > 0)
+                memcpy(column->data + start * column->width, other->data, other->count * column->width);
+            for (uint32_t row = 1; row <= src->rows; row++)
+                column->offsets[base + row] = start + other->offsets[row];
+            column->count = start + other->count;
+        } else {
+            memcpy(column->data + (size_t)base * column->width, other->data, src->rows * column->width);
+            column->count = base + src->rows;
+        }
+    }
+    
+    self->rows += src->rows;
+}
+
+/* a row's coordinates and where it is, for sorting */
+struct ColumnsSortKey
+{
+    int32_t x, z;
+    uint32_t row;
+};
+
+/* qsort comparison for sort keys, by coordinates */
+static int _rs_chunk_columns_compare_keys(const void* a, const void* b)
+{
+    const struct ColumnsSortKey* ka = a;
+    const struct ColumnsSortKey* kb = b;
+    if (ka->x != kb->x)
+        return ka->x < kb->x ? -1 : 1;
+    if (ka->z != kb->z)
+        return ka->z < kb->z ? -1 : 1;
+    return 0;
+}
+
+/* helper to sort every row from start onwards by x, then z */
+static void _rs_chunk_columns_sort(RSChunkColumns* self, uint32_t start)
+{
+    uint32_t count = self->rows - start;
+    if (count < 2)
+        return;
+    
+    struct ColumnsSortKey* keys = rs_new(struct ColumnsSortKey, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        keys[i].x = self->x[start + i];
+        keys[i].z = self->z[start + i];
+        keys[i].row = start + i;
+    }
+    qsort(keys, count, sizeof(struct ColumnsSortKey), _rs_chunk_columns_compare_keys);
+    
+    /* gather each array into sorted order through a scratch buffer */
+    size_t scratch_size = count * sizeof(int64_t);
+    uint8_t* scratch = rs_new(uint8_t, scratch_size);
+    
+    for (uint32_t i = 0; i < count; i++)
+        ((uint32_t*)scratch)[i] = self->timestamps[keys[i].row];
+    memcpy(self->timestamps + start, scratch, count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        self->x[start + i] = keys[i].x;
+        self->z[start + i] = keys[i].z;
+    }
+    
+    for (unsigned int c = 0; c < self->column_count; c++)
+    {
+        struct Column* column = &(self->columns[c]);
+        
+        for (uint32_t i = 0; i < count; i++)
+            scratch[i] = column->present[keys[i].row];
+        memcpy(column->present + start, scratch, count);
+        
+        if (column->offsets == NULL)
+        {
+            for (uint32_t i = 0; i < count; i++)
+                memcpy(scratch + i * column->width, column->data + (size_t)keys[i].row * column->width, column->width);
+            memcpy(column->data + (size_t)start * column->width, scratch, count * column->width);
+            continue;
+        }
+        
+        /* array rows vary in size, so they get their own buffer */
+        uint64_t base = column->offsets[start];
+        size_t bytes = (column->count - base) * column->width;
+        uint8_t* sorted = rs_new(uint8_t, bytes > 0 ? bytes : 1);
+        uint64_t* offsets = rs_new(uint64_t, count + 1);
+        offsets[0] = base;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t row = keys[i].row;
+            uint64_t length = column->offsets[row + 1] - column->offsets[row];
+            memcpy(sorted + (offsets[i] - base) * column->width, column->data + column->offsets[row] * column->width, length * column->width);
+            offsets[i + 1] = offsets[i] + length;
+        }
+        
+        memcpy(column->data + base * column->width, sorted, bytes);
+        memcpy(column->offsets + start, offsets, (count + 1) * sizeof(uint64_t));
+        rs_free(offsets);
+        rs_free(sorted);
+    }
+    
+    rs_free(scratch);
+    rs_free(keys);
+}
+
+unsigned int rs_chunk_columns_add_region(RSChunkColumns* self, RSRegion* region, int32_t rx, int32_t rz)
+{
+    rs_return_val_if_fail(self && region, 0);
+    
+    uint8_t* buffer = NULL;
+    size_t buffer_size = 0;
+    unsigned int added = 0;
+    
+    for (uint8_t z = 0; z < 32; z++)
+    {
+        for (uint8_t x = 0; x < 32; x++)
+        {
+            if (!rs_region_contains_chunk(region, x, z))
+                continue;
+            
+            RSWorldChunkInfo info;
+            info.x = rx * 32 + x;
+            info.z = rz * 32 + z;
+            info.timestamp = rs_region_get_chunk_timestamp(region, x, z);
+            info.length = rs_region_get_chunk_length(region, x, z);
+            info.encoding = rs_region_get_chunk_compression(region, x, z);
+            
+            size_t len = 0;
+            void* data = rs_region_get_chunk_data(region, x, z);
+            if (data == NULL || !rs_decompress_into(info.encoding, data, info.length, &buffer, &buffer_size, &len))
+                continue;
+            
+            _rs_chunk_columns_add_row(self, &info, buffer, len);
+            added++;
+        }
+    }
+    
+    if (buffer)
+        rs_free(buffer);
+    return added;
+}
+
+/* per-thread part of rs_chunk_columns_add_world() */
+static void _rs_chunk_columns_world_chunk(const RSWorldChunkInfo* info, void* data, size_t len, void* local, void* user)
+{
+    struct ColumnsLocal* columns_local = local;
+    if (columns_local->part == NULL)
+        columns_local->part = _rs_chunk_columns_copy_empty(user);
+    _rs_chunk_columns_add_row(columns_local->part, info, data, len);
+}
+
+/* merges a thread's rows in, once all threads are done */
+static void _rs_chunk_columns_world_reduce(void* local, void* user)
+{
+    struct ColumnsLocal* columns_local = local;
+    if (columns_local->part)
+    {
+        _rs_chunk_columns_append(user, columns_local->part);
+        rs_chunk_columns_free(columns_local->part);
+    }
+}
+
+unsigned int rs_chunk_columns_add_world(RSChunkColumns* self, RSWorld* world, unsigned int nthreads)
+{
+    rs_return_val_if_fail(self && world, 0);
+    
+    uint32_t start = self->rows;
+    rs_world_foreach_chunk_raw(world, NULL, _rs_chunk_columns_world_chunk, sizeof(struct ColumnsLocal), _rs_chunk_columns_world_reduce, self, nthreads);
+    _rs_chunk_columns_sort(self, start);
+    return self->rows - start;
+}
+
+uint32_t rs_chunk_columns_get_row_count(RSChunkColumns* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->rows;
+}
+
+unsigned int rs_chunk_columns_get_column_count(RSChunkColumns* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->column_count;
+}
+
+const char* rs_chunk_columns_get_path(RSChunkColumns* self, unsigned int column)
+{
+    rs_return_val_if_fail(self && column < self->column_count, NULL);
+    return self->columns[column].path;
+}
+
+RSTagType rs_chunk_columns_get_type(RSChunkColumns* self, unsigned int column)
+{
+    rs_return_val_if_fail(self && column < self->column_count, RS_TAG_END);
+    return self->columns[column].type;
+}
+
+const int32_t* rs_chunk_columns_get_x(RSChunkColumns* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    return self->x;
+}
+
+const int32_t* rs_chunk_columns_get_z(RSChunkColumns* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    return self->z;
+}
+
+const uint32_t* rs_chunk_columns_get_timestamps(RSChunkColumns* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    return self->timestamps;
+}
+
+const void* rs_chunk_columns_get_data(RSChunkColumns* self, unsigned int column, size_t* count)
+{
+    rs_return_val_if_fail(self && column < self->column_count, NULL);
+    
+    if (count)
+        *count = self->columns[column].count;
+    return self->columns[column].data;
+}
+
+const uint64_t* rs_chunk_columns_get_offsets(RSChunkColumns* self, unsigned int column)
+{
+    rs_return_val_if_fail(self && column < self->column_count, NULL);
+    return self->columns[column].offsets;
+}
+
+const uint8_t* rs_chunk_columns_get_present(RSChunkColumns* self, unsigned int column)
+{
+    rs_return_val_if_fail(self && column < self->column_count, NULL);
+    return self->columns[column].present;
+}
+
+/* helper to write a block of elements big-endian, padded to 8 bytes */
+static bool _rs_chunk_columns_write_block(int fd, uint8_t* buffer, const void* data, size_t count, size_t width)
+{
+    const uint8_t* src = data;
+    size_t per_buffer = RS_CHUNK_COLUMNS_BUFFER_SIZE / width;
+    
+    for (size_t done = 0; done < count; done += per_buffer)
+    {
+        size_t n = MIN(per_buffer, count - done);
+        for (size_t i = 0; i < n; i++)
+        {
+            const uint8_t* in = src + (done + i) * width;
+            uint8_t* out = buffer + i * width;
+            uint16_t v16;
+            uint32_t v32;
+            uint64_t v64;
+            
+            switch (width)
+            {
+            case 2:
+                memcpy(&v16, in, 2);
+                v16 = rs_endian_uint16(v16);
+                memcpy(out, &v16, 2);
+                break;
+            case 4:
+                memcpy(&v32, in, 4);
+                v32 = rs_endian_uint32(v32);
+                memcpy(out, &v32, 4);
+                break;
+            case 8:
+                memcpy(&v64, in, 8);
+                v64 = rs_endian_uint64(v64);
+                memcpy(out, &v64, 8);
+                break;
+            default:
+                *out = *in;
+                break;
+            };
+        }
+        
+        if (!rs_write_all(fd, buffer, n * width))
+            return false;
+    }
+    
+    static const uint8_t padding[8] = {0};
+    size_t pad = (8 - (count * width) % 8) % 8;
+    return rs_write_all(fd, padding, pad);
+}
+
+bool rs_chunk_columns_write(RSChunkColumns* self, const char* path)
+{
+    rs_return_val_if_fail(self && path, false);
+    
+    char* tmp_path = NULL;
+    int fd = rs_file_replace_begin(path, &tmp_path);
+    if (fd < 0)
+        return false;
+    
+    uint8_t* buffer = rs_new(uint8_t, RS_CHUNK_COLUMNS_BUFFER_SIZE);
+    
+    struct ColumnsFileHeader header;
+    memcpy(header.magic, RS_CHUNK_COLUMNS_MAGIC, 4);
+    header.version = rs_endian_uint32(RS_CHUNK_COLUMNS_VERSION);
+    header.rows = rs_endian_uint32(self->rows);
+    header.columns = rs_endian_uint32(self->column_count);
+    
+    bool ok = rs_write_all(fd, &header, sizeof(header)) &&
+        _rs_chunk_columns_write_block(fd, buffer, self->x, self->rows, 4) &&
+        _rs_chunk_columns_write_block(fd, buffer, self->z, self->rows, 4) &&
+        _rs_chunk_columns_write_block(fd, buffer, self->timestamps, self->rows, 4);
+    
+    for (unsigned int i = 0; ok && i < self->column_count; i++)
+    {
+        struct Column* column = &(self->columns[i]);
+        size_t path_length = strlen(column->path);
+        
+        struct ColumnFileHeader column_header;
+        memset(&column_header, 0, sizeof(column_header));
+        column_header.type = column->type;
+        column_header.path_length = rs_endian_uint16(path_length);
+        column_header.count = rs_endian_uint64(column->count);
+        
+        ok = rs_write_all(fd, &column_header, sizeof(column_header)) &&
+            _rs_chunk_columns_write_block(fd, buffer, column->path, path_length, 1) &&
+            _rs_chunk_columns_write_block(fd, buffer, column->present, self->rows, 1);
+        if (ok && column->offsets)
+            ok = _rs_chunk_columns_write_block(fd, buffer, column->offsets, self->rows + 1, 8);
+        if (ok)
+            ok = _rs_chunk_columns_write_block(fd, buffer, column->data, column->count, column->width);
+    }
+    
+    rs_free(buffer);
+    if (!ok)
+    {
+        rs_file_replace_abort(fd, tmp_path);
+        return false;
+    }
+    
+    return rs_file_replace_commit(fd, tmp_path, path, true);
+}
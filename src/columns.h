@@ -0,0 +1,229 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_COLUMNS_H_INCLUDED__
+#define __RS_COLUMNS_H_INCLUDED__
+
+#include "region.h"
+#include "tag.h"
+#include "world.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSChunkColumns;
+/**
+ * The chunk columns data type.
+ *
+ * This is an opaque structure holding a few fields from many chunks,
+ * stored by column: one contiguous, typed array per field, with one
+ * row per chunk. This is the shape analysis code usually wants (say,
+ * the LastUpdate of every chunk in a world), and the arrays can be
+ * handed straight to vectorized code.
+ *
+ * Columns are added first, with rs_chunk_columns_add_column(), and
+ * then rows with rs_chunk_columns_add_region() or
+ * rs_chunk_columns_add_world(). Only the requested tags are decoded;
+ * the rest of each chunk is skipped without being parsed. The result
+ * can be saved with rs_chunk_columns_write().
+ *
+ * Every column also has a presence array, with one byte per row that
+ * is 1 if the chunk had the tag and 0 if not. Missing values are
+ * stored as 0, or as an empty array or string.
+ */
+typedef struct _RSChunkColumns RSChunkColumns;
+
+/**
+ * Create an empty set of columns.
+ *
+ * \return the new columns
+ * \sa rs_chunk_columns_free
+ */
+RSChunkColumns* rs_chunk_columns_new(void);
+
+/**
+ * Free a set of columns.
+ *
+ * \param self the columns
+ * \sa rs_chunk_columns_new
+ */
+void rs_chunk_columns_free(RSChunkColumns* self);
+
+/**
+ * Add a column.
+ *
+ * The path is a list of compound keys separated by '/', like
+ * "Level/LastUpdate" (see rs_nbt_find_uncompressed()). Columns can
+ * only be added while there are no rows, and are numbered in the
+ * order they were added.
+ *
+ * The type decides how values are stored:
+ *
+ *  - RS_TAG_BYTE, RS_TAG_SHORT, RS_TAG_INT, RS_TAG_LONG, RS_TAG_FLOAT
+ *    and RS_TAG_DOUBLE store one int8_t, int16_t, int32_t, int64_t,
+ *    float or double per row. Any number in the chunk is converted to
+ *    the column's type.
+ *  - RS_TAG_BYTE_ARRAY, RS_TAG_INT_ARRAY and RS_TAG_STRING store
+ *    every row's int8_t, int32_t or char elements back to back, with
+ *    an offsets array saying where each row starts. These only match
+ *    tags of exactly the same type. Strings are not terminated.
+ *
+ * \param self the columns
+ * \param path the path to the tag
+ * \param type the type of the column
+ * \return true on success, false if the type is not supported or
+ *         there are already rows
+ */
+bool rs_chunk_columns_add_column(RSChunkColumns* self, const char* path, RSTagType type);
+
+/**
+ * Add a row for every chunk in a region.
+ *
+ * Rows are added in the region's order: z, then x.
+ *
+ * \param self the columns
+ * \param region the region to read
+ * \param rx the x coordinate of the region, for the x column
+ * \param rz the z coordinate of the region, for the z column
+ * \return the number of rows added
+ */
+unsigned int rs_chunk_columns_add_region(RSChunkColumns* self, RSRegion* region, int32_t rx, int32_t rz);
+
+/**
+ * Add a row for every chunk in a world.
+ *
+ * Chunks are read in parallel, with rs_world_foreach_chunk_raw(), and
+ * the new rows are sorted by x and then z.
+ *
+ * \param self the columns
+ * \param world the world to read
+ * \param nthreads the number of threads to use, or 0
+ * \return the number of rows added
+ */
+unsigned int rs_chunk_columns_add_world(RSChunkColumns* self, RSWorld* world, unsigned int nthreads);
+
+/**
+ * Get the number of rows.
+ *
+ * \param self the columns
+ * \return the number of rows
+ */
+uint32_t rs_chunk_columns_get_row_count(RSChunkColumns* self);
+
+/**
+ * Get the number of columns, not counting the x, z and timestamp
+ * columns every set has.
+ *
+ * \param self the columns
+ * \return the number of columns
+ */
+unsigned int rs_chunk_columns_get_column_count(RSChunkColumns* self);
+
+/**
+ * Get the tag path a column was added with.
+ *
+ * \param self the columns
+ * \param column the column number
+ * \return the path, which belongs to the columns
+ */
+const char* rs_chunk_columns_get_path(RSChunkColumns* self, unsigned int column);
+
+/**
+ * Get the type a column was added with.
+ *
+ * \param self the columns
+ * \param column the column number
+ * \return the type, or RS_TAG_END if there is no such column
+ */
+RSTagType rs_chunk_columns_get_type(RSChunkColumns* self, unsigned int column);
+
+/**
+ * Get the global x coordinate of every row's chunk.
+ *
+ * Like every other array, this belongs to the columns, and is only
+ * good until more rows are added.
+ *
+ * \param self the columns
+ * \return an array with one entry per row
+ */
+const int32_t* rs_chunk_columns_get_x(RSChunkColumns* self);
+
+/**
+ * Get the global z coordinate of every row's chunk.
+ *
+ * \param self the columns
+ * \return an array with one entry per row
+ */
+const int32_t* rs_chunk_columns_get_z(RSChunkColumns* self);
+
+/**
+ * Get the last modified time of every row's chunk.
+ *
+ * \param self the columns
+ * \return an array with one entry per row
+ */
+const uint32_t* rs_chunk_columns_get_timestamps(RSChunkColumns* self);
+
+/**
+ * Get a column's values.
+ *
+ * For number columns there is one element per row; for array and
+ * string columns, see rs_chunk_columns_get_offsets().
+ *
+ * \param self the columns
+ * \param column the column number
+ * \param count where to store the number of elements, or NULL
+ * \return the elements, in native byte order, or NULL if there are
+ *         none
+ */
+const void* rs_chunk_columns_get_data(RSChunkColumns* self, unsigned int column, size_t* count);
+
+/**
+ * Get where each row starts in an array or string column.
+ *
+ * Row i has the elements from offsets[i] up to offsets[i + 1], so the
+ * array has one more entry than there are rows.
+ *
+ * \param self the columns
+ * \param column the column number
+ * \return the offsets, in elements, or NULL for number columns
+ */
+const uint64_t* rs_chunk_columns_get_offsets(RSChunkColumns* self, unsigned int column);
+
+/**
+ * Get which rows had a value for a column.
+ *
+ * \param self the columns
+ * \param column the column number
+ * \return an array with one byte per row, 1 if the chunk had the tag
+ */
+const uint8_t* rs_chunk_columns_get_present(RSChunkColumns* self, unsigned int column);
+
+/**
+ * Save the columns to a file.
+ *
+ * The file starts with a 16-byte header: the magic "RSCF", then the
+ * format version (1), the number of rows, and the number of columns,
+ * as 32-bit integers. Then come the x, z and timestamp columns, and
+ * then, for each column, a 16-byte header (the type as one byte, a
+ * zero byte, the length of the path as a 16-bit integer, four zero
+ * bytes, and the number of elements as a 64-bit integer), the path,
+ * the presence bytes, the offsets (for array and string columns) and
+ * the elements.
+ *
+ * Every block starts 8-byte aligned, padded with zeros, so the file
+ * can be mapped and read in place. All numbers are big-endian, like
+ * the rest of Minecraft's formats.
+ *
+ * The file is written next to path and moved into place, so it is
+ * never seen half-written.
+ *
+ * \param self the columns
+ * \param path where to write the file
+ * \return true on success
+ */
+bool rs_chunk_columns_write(RSChunkColumns* self, const char* path);
+
+#endif /* __RS_COLUMNS_H_INCLUDED__ */
@@ -129,6 +129,62 @@ void rs_decompress(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uin
     /* our data is correct and properly placed, so... */
 }
 
+bool rs_decompress_into(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** buffer, size_t* buffer_size, size_t* outdatalen)
+{
+    z_stream strm;
+    int ret;
+    
+    *outdatalen = 0;
+    
+    /* guess compression type */
+    if (enc == RS_AUTO_COMPRESSION)
+        enc = rs_get_compression_type(gzdata, gzdatalen);
+    
+    /* if it's not GZIP or ZLIB, return error */
+    if (enc != RS_GZIP && enc != RS_ZLIB)
+        return false;
+    
+    /* initialize zlib state */
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = gzdatalen;
+    strm.next_in = gzdata;
+    
+    /* magick deflate init to handle gzip headers (or not!) */
+    ret = inflateInit2(&strm, (enc == RS_GZIP) ? (16 + MAX_WBITS) : MAX_WBITS);
+    if (ret != Z_OK)
+        return false;
+    
+    /* inflate straight into the caller's buffer, growing it as needed */
+    size_t used = 0;
+    do
+    {
+        if (used == *buffer_size)
+        {
+            *buffer_size = (*buffer_size > 0) ? *buffer_size * 2 : RS_Z_BUFFER_SIZE;
+            *buffer = rs_realloc(*buffer, *buffer_size);
+        }
+        
+        strm.next_out = *buffer + used;
+        strm.avail_out = *buffer_size - used;
+        ret = inflate(&strm, Z_NO_FLUSH);
+        used = *buffer_size - strm.avail_out;
+        
+        /* Z_BUF_ERROR with room left over means the input ran out */
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR ||
+            ret == Z_STREAM_ERROR || (ret == Z_BUF_ERROR && strm.avail_out > 0))
+        {
+            inflateEnd(&strm);
+            return false;
+        }
+    } while (ret != Z_STREAM_END);
+    
+    inflateEnd(&strm);
+    *outdatalen = used;
+    return true;
+}
+
 void rs_compress(RSCompressionType enc, uint8_t* rawdata, size_t rawdatalen, uint8_t** gzdata, size_t* gzdatalen)
 {
     z_stream strm;
@@ -9,6 +9,7 @@
 #include "memory.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * Supported compression methods.
@@ -61,6 +62,27 @@ typedef enum
  */
 void rs_decompress(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** outdata, size_t* outdatalen);
 
+/**
+ * Decompress the given data into a reusable buffer.
+ *
+ * This works like rs_decompress(), except that the data is written
+ * to *buffer, which is grown with rs_realloc() whenever it is too
+ * small. *buffer_size holds its allocated size. Start with a NULL
+ * buffer and a size of 0, and keep passing the same buffer in to
+ * avoid allocating memory for every call. The buffer MUST be freed
+ * when you are done with it.
+ *
+ * \param enc the type of encoding to decompress with
+ * \param gzdata the data to decompress
+ * \param gzdatalen the length of gzdata
+ * \param buffer the buffer to decompress into
+ * \param buffer_size the allocated size of *buffer
+ * \param outdatalen where to store the length of the decompressed data
+ * \return true on success, false if the data could not be decompressed
+ * \sa rs_decompress, rs_free
+ */
+bool rs_decompress_into(RSCompressionType enc, uint8_t* gzdata, size_t gzdatalen, uint8_t** buffer, size_t* buffer_size, size_t* outdatalen);
+
 /**
  * Compress the given data.
  *
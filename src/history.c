@@ -0,0 +1,766 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "history.h"
+
+#include "error.h"
+#include "memory.h"
+#include "compression.h"
+#include "rsendian.h"
+#include "util.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* The log is a series of records: a type byte (keyframe or delta),
+ * the uncompressed length of the version, the stored length, and
+ * then the stored data, which is the zlib-compressed NBT for
+ * keyframes, or the zlib-compressed delta for deltas.
+ *
+ * A delta is a series of operations that build the new version: 0,
+ * then a varint offset and length, copies from the previous version;
+ * 1, then a varint length and that many bytes, inserts new data.
+ *
+ * The index lists (x, z, timestamp, offset, keyframe) for every
+ * version, grouped by chunk and oldest first. A chunk that was seen
+ * again without changing has one more entry after its versions, with
+ * a keyframe byte of 2 and no record, holding the last time it was
+ * seen. Records in the log but not in the index (from a crash before
+ * a sync) are ignored. All numbers are big-endian.
+ */
+
+#define RS_HISTORY_INDEX_MAGIC "RSHI"
+#define RS_HISTORY_VERSION 1
+
+#define RS_HISTORY_KEYFRAME 0
+#define RS_HISTORY_DELTA 1
+
+/* keyframe byte of an index entry that only says when a chunk was seen */
+#define RS_HISTORY_SEEN 2
+
+#define RS_HISTORY_COPY 0
+#define RS_HISTORY_INSERT 1
+
+/* size of a log record header */
+#define RS_HISTORY_RECORD_SIZE 9
+
+/* size of the blocks matched between versions */
+#define RS_HISTORY_BLOCK_SIZE 16
+
+struct IndexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+} __PACKED__;
+
+struct IndexEntry
+{
+    int32_t x, z;
+    uint32_t timestamp;
+    uint64_t offset;
+    uint8_t keyframe;
+} __PACKED__;
+
+/* one version of a chunk */
+struct HistoryVersion
+{
+    uint32_t timestamp;
+    bool keyframe;
+    uint64_t offset;
+};
+
+/* all the versions of a chunk, oldest first */
+struct ChunkVersions
+{
+    int32_t x, z;
+    uint32_t count;
+    uint32_t allocated;
+    struct HistoryVersion* versions;
+    /* the last time the chunk was seen unchanged, or 0 */
+    uint32_t seen;
+};
+
+/* a growable byte buffer */
+struct ByteBuffer
+{
+    uint8_t* data;
+    size_t size;
+    size_t used;
+};
+
+struct _RSChunkHistory
+{
+    char* index_path;
+    int fd;
+    uint64_t log_size;
+    unsigned int interval;
+    bool dirty;
+    
+    /* open-addressed hash table of chunks */
+    struct ChunkVersions** table;
+    uint32_t table_size;
+    uint32_t chunk_count;
+    
+    /* reusable buffers for rebuilding versions */
+    struct ByteBuffer record;
+    struct ByteBuffer scratch;
+    struct ByteBuffer current;
+    struct ByteBuffer work;
+};
+
+static void _rs_history_buffer_reserve(struct ByteBuffer* buffer, size_t extra)
+{
+    if (buffer->used + extra <= buffer->size)
+        return;
+    
+    buffer->size = MAX(buffer->size * 2, buffer->used + extra);
+    buffer->data = rs_renew(uint8_t, buffer->data, buffer->size);
+}
+
+static void _rs_history_buffer_append(struct ByteBuffer* buffer, const void* data, size_t len)
+{
+    _rs_history_buffer_reserve(buffer, len);
+    memcpy(buffer->data + buffer->used, data, len);
+    buffer->used += len;
+}
+
+static void _rs_history_buffer_varint(struct ByteBuffer* buffer, uint64_t value)
+{
+    _rs_history_buffer_reserve(buffer, 10);
+    while (value >= 0x80)
+    {
+        buffer->data[buffer->used++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buffer->data[buffer->used++] = value;
+}
+
+static void _rs_history_buffer_free(struct ByteBuffer* buffer)
+{
+    if (buffer->data)
+        rs_free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = buffer->used = 0;
+}
+
+/* helper to read a varint, returning false if it runs off the end */
+static bool _rs_history_read_varint(const uint8_t** data, const uint8_t* end, uint64_t* value)
+{
+    *value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        if (*data >= end)
+            return false;
+        
+        uint8_t byte = *((*data)++);
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    
+    return false;
+}
+
+/* hash table helpers */
+static uint32_t _rs_history_hash(int32_t x, int32_t z)
+{
+    return ((uint32_t)x * 73856093u) ^ ((uint32_t)z * 19349663u);
+}
+
+static struct ChunkVersions* _rs_history_find(RSChunkHistory* self, int32_t x, int32_t z)
+{
+    if (self->table_size == 0)
+        return NULL;
+    
+    uint32_t mask = self->table_size - 1;
+    uint32_t i = _rs_history_hash(x, z) & mask;
+    while (self->table[i])
+    {
+        if (self->table[i]->x == x && self->table[i]->z == z)
+            return self->table[i];
+        i = (i + 1) & mask;
+    }
+    
+    return NULL;
+}
+
+static void _rs_history_insert(RSChunkHistory* self, struct ChunkVersions* chunk)
+{
+    /* keep the table at most half full */
+    if ((self->chunk_count + 1) * 2 > self->table_size)
+    {
+        struct ChunkVersions** old = self->table;
+        uint32_t old_size = self->table_size;
+        
+        self->table_size = old_size ? old_size * 2 : 1024;
+        self->table = rs_new0(struct ChunkVersions*, self->table_size);
+        self->chunk_count = 0;
+        for (uint32_t i = 0; i < old_size; i++)
+        {
+            if (old[i])
+                _rs_history_insert(self, old[i]);
+        }
+        
+        if (old)
+            rs_free(old);
+    }
+    
+    uint32_t mask = self->table_size - 1;
+    uint32_t i = _rs_history_hash(chunk->x, chunk->z) & mask;
+    while (self->table[i])
+        i = (i + 1) & mask;
+    
+    self->table[i] = chunk;
+    self->chunk_count++;
+}
+
+/* helper to find a chunk, creating it if it isn't there */
+static struct ChunkVersions* _rs_history_get(RSChunkHistory* self, int32_t x, int32_t z)
+{
+    struct ChunkVersions* chunk = _rs_history_find(self, x, z);
+    if (chunk)
+        return chunk;
+    
+    chunk = rs_new0(struct ChunkVersions, 1);
+    chunk->x = x;
+    chunk->z = z;
+    _rs_history_insert(self, chunk);
+    return chunk;
+}
+
+static void _rs_history_add_version(struct ChunkVersions* chunk, uint32_t timestamp, bool keyframe, uint64_t offset)
+{
+    if (chunk->count == chunk->allocated)
+    {
+        chunk->allocated = chunk->allocated ? chunk->allocated * 2 : 4;
+        chunk->versions = rs_renew(struct HistoryVersion, chunk->versions, chunk->allocated);
+    }
+    
+    chunk->versions[chunk->count].timestamp = timestamp;
+    chunk->versions[chunk->count].keyframe = keyframe;
+    chunk->versions[chunk->count].offset = offset;
+    chunk->count++;
+}
+
+/* the newest time we know what the chunk looked like */
+static uint32_t _rs_history_latest(struct ChunkVersions* chunk)
+{
+    uint32_t latest = chunk->count > 0 ? chunk->versions[chunk->count - 1].timestamp : 0;
+    return MAX(latest, chunk->seen);
+}
+
+static bool _rs_history_load_index(RSChunkHistory* self)
+{
+    int fd = open(self->index_path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return true;
+    
+    struct stat stat_buf;
+    struct IndexHeader header;
+    bool ok = (fstat(fd, &stat_buf) == 0 && read(fd, &header, sizeof(header)) == sizeof(header));
+    
+    uint32_t count = ok ? rs_endian_uint32(header.count) : 0;
+    ok = ok && memcmp(header.magic, RS_HISTORY_INDEX_MAGIC, 4) == 0 &&
+        rs_endian_uint32(header.version) == RS_HISTORY_VERSION &&
+        (size_t)stat_buf.st_size == sizeof(header) + (size_t)count * sizeof(struct IndexEntry);
+    
+    struct IndexEntry entry;
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        if (read(fd, &entry, sizeof(entry)) != sizeof(entry))
+        {
+            ok = false;
+            break;
+        }
+        
+        struct ChunkVersions* chunk = _rs_history_get(self, rs_endian_int32(entry.x), rs_endian_int32(entry.z));
+        if (entry.keyframe == RS_HISTORY_SEEN)
+            chunk->seen = rs_endian_uint32(entry.timestamp);
+        else
+            _rs_history_add_version(chunk, rs_endian_uint32(entry.timestamp), entry.keyframe != 0, rs_endian_uint64(entry.offset));
+    }
+    
+    close(fd);
+    return ok;
+}
+
+static bool _rs_history_save_index(RSChunkHistory* self)
+{
+    struct ByteBuffer out = {NULL, 0, 0};
+    struct IndexHeader header;
+    memcpy(header.magic, RS_HISTORY_INDEX_MAGIC, 4);
+    header.version = rs_endian_uint32(RS_HISTORY_VERSION);
+    header.count = 0;
+    _rs_history_buffer_append(&out, &header, sizeof(header));
+    
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < self->table_size; i++)
+    {
+        struct ChunkVersions* chunk = self->table[i];
+        for (uint32_t j = 0; chunk && j < chunk->count; j++)
+        {
+            struct IndexEntry entry;
+            entry.x = rs_endian_int32(chunk->x);
+            entry.z = rs_endian_int32(chunk->z);
+            entry.timestamp = rs_endian_uint32(chunk->versions[j].timestamp);
+            entry.offset = rs_endian_uint64(chunk->versions[j].offset);
+            entry.keyframe = chunk->versions[j].keyframe ? 1 : 0;
+            _rs_history_buffer_append(&out, &entry, sizeof(entry));
+            count++;
+        }
+        
+        if (chunk && chunk->count > 0 && chunk->seen > chunk->versions[chunk->count - 1].timestamp)
+        {
+            struct IndexEntry entry;
+            entry.x = rs_endian_int32(chunk->x);
+            entry.z = rs_endian_int32(chunk->z);
+            entry.timestamp = rs_endian_uint32(chunk->seen);
+            entry.offset = 0;
+            entry.keyframe = RS_HISTORY_SEEN;
+            _rs_history_buffer_append(&out, &entry, sizeof(entry));
+            count++;
+        }
+    }
+    
+    count = rs_endian_uint32(count);
+    memcpy(out.data + offsetof(struct IndexHeader, count), &count, sizeof(count));
+    
+    bool ok = rs_file_replace(self->index_path, out.data, out.used, true);
+    _rs_history_buffer_free(&out);
+    return ok;
+}
+
+RSChunkHistory* rs_chunk_history_open(const char* path, bool create)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    int fd = open(path, (create ? (O_RDWR | O_CREAT) : O_RDWR) | O_BINARY, 0666);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    RSChunkHistory* self = rs_new0(RSChunkHistory, 1);
+    self->fd = fd;
+    self->log_size = stat_buf.st_size;
+    self->interval = RS_CHUNK_HISTORY_DEFAULT_KEYFRAME_INTERVAL;
+    
+    size_t len = strlen(path) + 5;
+    self->index_path = rs_new(char, len);
+    snprintf(self->index_path, len, "%s.idx", path);
+    
+    if (!_rs_history_load_index(self))
+    {
+        /* don't overwrite an index we couldn't read */
+        self->dirty = false;
+        rs_chunk_history_close(self);
+        return NULL;
+    }
+    
+    return self;
+}
+
+void rs_chunk_history_close(RSChunkHistory* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_chunk_history_sync(self);
+    close(self->fd);
+    
+    for (uint32_t i = 0; i < self->table_size; i++)
+    {
+        if (self->table[i] == NULL)
+            continue;
+        if (self->table[i]->versions)
+            rs_free(self->table[i]->versions);
+        rs_free(self->table[i]);
+    }
+    
+    if (self->table)
+        rs_free(self->table);
+    _rs_history_buffer_free(&(self->record));
+    _rs_history_buffer_free(&(self->scratch));
+    _rs_history_buffer_free(&(self->current));
+    _rs_history_buffer_free(&(self->work));
+    rs_free(self->index_path);
+    rs_free(self);
+}
+
+bool rs_chunk_history_sync(RSChunkHistory* self)
+{
+    rs_return_val_if_fail(self, false);
+    
+    if (!(self->dirty))
+        return true;
+    
+    /* records must be safe before the index points at them */
+    if (fsync(self->fd) != 0 || !_rs_history_save_index(self))
+        return false;
+    
+    self->dirty = false;
+    return true;
+}
+
+void rs_chunk_history_set_keyframe_interval(RSChunkHistory* self, unsigned int interval)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(interval > 0);
+    self->interval = interval;
+}
+
+/* helper to read a log record, decompressed into scratch */
+static bool _rs_history_read_record(RSChunkHistory* self, uint64_t offset, uint8_t* type, uint32_t* raw_length)
+{
+    uint8_t header[RS_HISTORY_RECORD_SIZE];
+    if (pread(self->fd, header, sizeof(header), offset) != sizeof(header))
+        return false;
+    
+    uint32_t stored_length;
+    memcpy(raw_length, header + 1, 4);
+    memcpy(&stored_length, header + 5, 4);
+    *type = header[0];
+    *raw_length = rs_endian_uint32(*raw_length);
+    stored_length = rs_endian_uint32(stored_length);
+    
+    self->record.used = 0;
+    _rs_history_buffer_reserve(&(self->record), stored_length);
+    size_t got = 0;
+    while (got < stored_length)
+    {
+        ssize_t ret = pread(self->fd, self->record.data + got, stored_length - got, offset + sizeof(header) + got);
+        if (ret <= 0)
+            return false;
+        got += ret;
+    }
+    
+    return rs_decompress_into(RS_ZLIB, self->record.data, stored_length, &(self->scratch.data), &(self->scratch.size), &(self->scratch.used));
+}
+
+/* helper to apply the delta in scratch to current, leaving the result in current */
+static bool _rs_history_apply_delta(RSChunkHistory* self, uint32_t raw_length)
+{
+    const uint8_t* op = self->scratch.data;
+    const uint8_t* end = op + self->scratch.used;
+    self->work.used = 0;
+    _rs_history_buffer_reserve(&(self->work), raw_length);
+    
+    while (op < end)
+    {
+        uint8_t type = *(op++);
+        uint64_t offset = 0, len = 0;
+        if (type == RS_HISTORY_COPY)
+        {
+            if (!_rs_history_read_varint(&op, end, &offset) || !_rs_history_read_varint(&op, end, &len))
+                return false;
+            if (offset > self->current.used || len > self->current.used - offset)
+                return false;
+            _rs_history_buffer_append(&(self->work), self->current.data + offset, len);
+        } else if (type == RS_HISTORY_INSERT) {
+            if (!_rs_history_read_varint(&op, end, &len) || len > (uint64_t)(end - op))
+                return false;
+            _rs_history_buffer_append(&(self->work), op, len);
+            op += len;
+        } else {
+            return false;
+        }
+    }
+    
+    if (self->work.used != raw_length)
+        return false;
+    
+    struct ByteBuffer tmp = self->current;
+    self->current = self->work;
+    self->work = tmp;
+    return true;
+}
+
+/* helper to rebuild a version into current */
+static bool _rs_history_rebuild(RSChunkHistory* self, struct ChunkVersions* chunk, uint32_t i)
+{
+    uint32_t start = i;
+    while (start > 0 && !chunk->versions[start].keyframe)
+        start--;
+    
+    for (uint32_t j = start; j <= i; j++)
+    {
+        uint8_t type;
+        uint32_t raw_length;
+        if (!_rs_history_read_record(self, chunk->versions[j].offset, &type, &raw_length))
+            return false;
+        
+        if (type == RS_HISTORY_KEYFRAME)
+        {
+            if (self->scratch.used != raw_length)
+                return false;
+            self->current.used = 0;
+            _rs_history_buffer_append(&(self->current), self->scratch.data, self->scratch.used);
+        } else if (type != RS_HISTORY_DELTA || j == start || !_rs_history_apply_delta(self, raw_length)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/* helper to hash a block for delta matching */
+static uint32_t _rs_history_hash_block(const uint8_t* data)
+{
+    uint32_t hash = 2166136261u;
+    for (unsigned int i = 0; i < RS_HISTORY_BLOCK_SIZE; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+/* helper to write an insert operation, if there is anything to insert */
+static void _rs_history_insert_op(struct ByteBuffer* out, const uint8_t* data, size_t len)
+{
+    if (len == 0)
+        return;
+    
+    uint8_t type = RS_HISTORY_INSERT;
+    _rs_history_buffer_append(out, &type, 1);
+    _rs_history_buffer_varint(out, len);
+    _rs_history_buffer_append(out, data, len);
+}
+
+/* helper to encode new as a delta against old, into out. Blocks of
+ * old are indexed by hash; every position in new is looked up, and
+ * matches are grown in both directions. */
+static void _rs_history_encode_delta(const uint8_t* old, size_t old_len, const uint8_t* new, size_t new_len, struct ByteBuffer* out)
+{
+    out->used = 0;
+    
+    uint32_t table_size = 1;
+    while (table_size < (old_len / RS_HISTORY_BLOCK_SIZE) * 2)
+        table_size *= 2;
+    uint32_t* table = rs_new0(uint32_t, table_size);
+    
+    /* positions are stored plus one, so 0 means empty */
+    for (size_t i = 0; i + RS_HISTORY_BLOCK_SIZE <= old_len; i += RS_HISTORY_BLOCK_SIZE)
+        table[_rs_history_hash_block(old + i) & (table_size - 1)] = i + 1;
+    
+    size_t pos = 0;
+    size_t literal = 0;
+    while (pos + RS_HISTORY_BLOCK_SIZE <= new_len)
+    {
+        uint32_t candidate = table[_rs_history_hash_block(new + pos) & (table_size - 1)];
+        if (candidate == 0 || memcmp(old + candidate - 1, new + pos, RS_HISTORY_BLOCK_SIZE) != 0)
+        {
+            pos++;
+            continue;
+        }
+        
+        size_t from = candidate - 1;
+        while (pos > literal && from > 0 && old[from - 1] == new[pos - 1])
+        {
+            pos--;
+            from--;
+        }
+        
+        size_t len = RS_HISTORY_BLOCK_SIZE;
+        while (pos + len < new_len && from + len < old_len && old[from + len] == new[pos + len])
+            len++;
+        
+        _rs_history_insert_op(out, new + literal, pos - literal);
+        
+        uint8_t type = RS_HISTORY_COPY;
+        _rs_history_buffer_append(out, &type, 1);
+        _rs_history_buffer_varint(out, from);
+        _rs_history_buffer_varint(out, len);
+        
+        pos += len;
+        literal = pos;
+    }
+    
+    _rs_history_insert_op(out, new + literal, new_len - literal);
+    rs_free(table);
+}
+
+bool rs_chunk_history_record(RSChunkHistory* self, int32_t x, int32_t z, uint32_t timestamp, void* data, size_t len)
+{
+    rs_return_val_if_fail(self && data, false);
+    
+    struct ChunkVersions* chunk = _rs_history_get(self, x, z);
+    bool keyframe = true;
+    if (chunk->count > 0)
+    {
+        if (timestamp <= _rs_history_latest(chunk))
+            return true;
+        if (!_rs_history_rebuild(self, chunk, chunk->count - 1))
+            return false;
+        if (self->current.used == len && memcmp(self->current.data, data, len) == 0)
+        {
+            /* nothing new to store, but remember we've seen it */
+            chunk->seen = timestamp;
+            self->dirty = true;
+            return true;
+        }
+        
+        uint32_t since_keyframe = 0;
+        while (since_keyframe < chunk->count && !chunk->versions[chunk->count - 1 - since_keyframe].keyframe)
+            since_keyframe++;
+        keyframe = (since_keyframe + 1 >= self->interval);
+    }
+    
+    uint8_t* payload = data;
+    size_t payload_len = len;
+    if (!keyframe)
+    {
+        _rs_history_encode_delta(self->current.data, self->current.used, data, len, &(self->work));
+        
+        /* a delta that barely saves anything isn't worth the slower reads */
+        if (self->work.used < len / 2)
+        {
+            payload = self->work.data;
+            payload_len = self->work.used;
+        } else {
+            keyframe = true;
+        }
+    }
+    
+    uint8_t* stored = NULL;
+    size_t stored_len = 0;
+    rs_compress(RS_ZLIB, payload, payload_len, &stored, &stored_len);
+    if (stored == NULL)
+        return false;
+    
+    uint8_t header[RS_HISTORY_RECORD_SIZE];
+    uint32_t be_raw = rs_endian_uint32(len);
+    uint32_t be_stored = rs_endian_uint32(stored_len);
+    header[0] = keyframe ? RS_HISTORY_KEYFRAME : RS_HISTORY_DELTA;
+    memcpy(header + 1, &be_raw, 4);
+    memcpy(header + 5, &be_stored, 4);
+    
+    bool ok = (pwrite(self->fd, header, sizeof(header), self->log_size) == sizeof(header));
+    size_t written = 0;
+    while (ok && written < stored_len)
+    {
+        ssize_t ret = pwrite(self->fd, stored + written, stored_len - written, self->log_size + sizeof(header) + written);
+        ok = (ret > 0);
+        if (ok)
+            written += ret;
+    }
+    rs_free(stored);
+    
+    if (!ok)
+        return false;
+    
+    _rs_history_add_version(chunk, timestamp, keyframe, self->log_size);
+    self->log_size += sizeof(header) + stored_len;
+    self->dirty = true;
+    return true;
+}
+
+bool rs_chunk_history_record_region(RSChunkHistory* self, RSRegion* region, int32_t rx, int32_t rz)
+{
+    rs_return_val_if_fail(self && region, false);
+    
+    uint8_t* buffer = NULL;
+    size_t buffer_size = 0;
+    bool ok = true;
+    
+    for (uint8_t z = 0; ok && z < 32; z++)
+    {
+        for (uint8_t x = 0; ok && x < 32; x++)
+        {
+            if (!rs_region_contains_chunk(region, x, z))
+                continue;
+            
+            /* skip anything we've already seen, without reading it */
+            uint32_t timestamp = rs_region_get_chunk_timestamp(region, x, z);
+            struct ChunkVersions* chunk = _rs_history_find(self, rx * 32 + x, rz * 32 + z);
+            if (chunk && chunk->count > 0 && timestamp <= _rs_history_latest(chunk))
+                continue;
+            
+            void* data = rs_region_get_chunk_data(region, x, z);
+            size_t len = 0;
+            if (data == NULL || !rs_decompress_into(rs_region_get_chunk_compression(region, x, z), data, rs_region_get_chunk_length(region, x, z), &buffer, &buffer_size, &len))
+                continue;
+            
+            ok = rs_chunk_history_record(self, rx * 32 + x, rz * 32 + z, timestamp, buffer, len);
+        }
+    }
+    
+    if (buffer)
+        rs_free(buffer);
+    return ok;
+}
+
+bool rs_chunk_history_record_world(RSChunkHistory* self, RSWorld* world)
+{
+    rs_return_val_if_fail(self && world, false);
+    
+    unsigned int count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(world, &count);
+    
+    bool ok = true;
+    for (unsigned int i = 0; ok && i < count; i++)
+    {
+        RSRegion* region = rs_world_get_region(world, coords[i].x, coords[i].z, false);
+        if (region)
+            ok = rs_chunk_history_record_region(self, region, coords[i].x, coords[i].z);
+    }
+    
+    if (coords)
+        rs_free(coords);
+    return ok;
+}
+
+uint32_t rs_chunk_history_get_version_count(RSChunkHistory* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    struct ChunkVersions* chunk = _rs_history_find(self, x, z);
+    return chunk ? chunk->count : 0;
+}
+
+uint32_t rs_chunk_history_get_version_timestamp(RSChunkHistory* self, int32_t x, int32_t z, uint32_t i)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    struct ChunkVersions* chunk = _rs_history_find(self, x, z);
+    if (chunk == NULL || i >= chunk->count)
+        return 0;
+    return chunk->versions[i].timestamp;
+}
+
+RSNBT* rs_chunk_history_get(RSChunkHistory* self, int32_t x, int32_t z, uint32_t time)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    struct ChunkVersions* chunk = _rs_history_find(self, x, z);
+    if (chunk == NULL || chunk->count == 0 || chunk->versions[0].timestamp > time)
+        return NULL;
+    
+    /* find the last version no newer than time */
+    uint32_t low = 0;
+    uint32_t high = chunk->count;
+    while (high - low > 1)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (chunk->versions[mid].timestamp <= time)
+            low = mid;
+        else
+            high = mid;
+    }
+    
+    if (!_rs_history_rebuild(self, chunk, low))
+        return NULL;
+    return rs_nbt_parse_uncompressed(self->current.data, self->current.used);
+}
@@ -0,0 +1,172 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_HISTORY_H_INCLUDED__
+#define __RS_HISTORY_H_INCLUDED__
+
+#include "region.h"
+#include "world.h"
+#include "nbt.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct _RSChunkHistory;
+/**
+ * The chunk history data type.
+ *
+ * This is an opaque structure that acts as a handle to a chunk
+ * history: a log of every version of every chunk it has been shown,
+ * which can be read back as of any point in time.
+ *
+ * Each version is stored as a binary delta against the uncompressed
+ * NBT of the version before it, with a full copy (a keyframe) every
+ * so often to keep reads fast. Since consecutive versions of a chunk
+ * usually differ in only a few places, this keeps many versions for
+ * little more than the cost of one.
+ *
+ * A history is stored in two files: the log itself, and an index of
+ * versions next to it, with ".idx" added to the name.
+ */
+typedef struct _RSChunkHistory RSChunkHistory;
+
+/** The default number of versions between keyframes. */
+#define RS_CHUNK_HISTORY_DEFAULT_KEYFRAME_INTERVAL 16
+
+/**
+ * Open a chunk history.
+ *
+ * \param path the log file
+ * \param create whether to create the history if it does not exist
+ * \return the history, or NULL if it could not be opened
+ * \sa rs_chunk_history_close
+ */
+RSChunkHistory* rs_chunk_history_open(const char* path, bool create);
+
+/**
+ * Close a chunk history, after calling rs_chunk_history_sync().
+ *
+ * \param self the history
+ * \sa rs_chunk_history_open
+ */
+void rs_chunk_history_close(RSChunkHistory* self);
+
+/**
+ * Make sure everything recorded so far is safely on disk.
+ *
+ * Versions recorded since the last sync are lost if the program
+ * stops before this is called (or rs_chunk_history_close()), but the
+ * history is never left unreadable.
+ *
+ * \param self the history
+ * \return true on success, false on failure
+ */
+bool rs_chunk_history_sync(RSChunkHistory* self);
+
+/**
+ * Set how often a full copy of a chunk is stored.
+ *
+ * Reading a version means reading the keyframe before it and
+ * applying every delta after that, so a smaller interval makes reads
+ * faster, and a larger one makes the history smaller. A keyframe is
+ * also stored whenever a delta would not save much.
+ *
+ * \param self the history
+ * \param interval the number of versions between keyframes, at least 1
+ */
+void rs_chunk_history_set_keyframe_interval(RSChunkHistory* self, unsigned int interval);
+
+/**
+ * Record a new version of a chunk.
+ *
+ * Versions are told apart by timestamp, so a version no newer than
+ * the latest one recorded for the chunk is ignored. A version
+ * identical to the latest one is not stored, but its timestamp is
+ * remembered, so it is not read again by
+ * rs_chunk_history_record_region().
+ *
+ * \param self the history
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param timestamp the time this version was made
+ * \param data the uncompressed NBT of the chunk
+ * \param len the length of data
+ * \return true on success, false if the version could not be written
+ * \sa rs_chunk_history_record_region
+ */
+bool rs_chunk_history_record(RSChunkHistory* self, int32_t x, int32_t z, uint32_t timestamp, void* data, size_t len);
+
+/**
+ * Record every chunk in a region that changed since it was last seen.
+ *
+ * This compares rs_region_get_chunk_timestamp() against the newest
+ * version recorded for each chunk, and only reads and decompresses
+ * chunks that are newer. Calling this after every save keeps a full
+ * history at the cost of the chunks that actually changed.
+ *
+ * \param self the history
+ * \param region the region to record
+ * \param rx the x coordinate of the region
+ * \param rz the z coordinate of the region
+ * \return true on success, false if a version could not be written
+ * \sa rs_chunk_history_record_world
+ */
+bool rs_chunk_history_record_region(RSChunkHistory* self, RSRegion* region, int32_t rx, int32_t rz);
+
+/**
+ * Record every chunk in a world that changed since it was last seen.
+ *
+ * This calls rs_chunk_history_record_region() on every region in the
+ * world, as it is on disk.
+ *
+ * \param self the history
+ * \param world the world to record
+ * \return true on success, false if a version could not be written
+ * \sa rs_chunk_history_record_region
+ */
+bool rs_chunk_history_record_world(RSChunkHistory* self, RSWorld* world);
+
+/**
+ * Get the number of versions recorded for a chunk.
+ *
+ * \param self the history
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return the number of versions
+ * \sa rs_chunk_history_get_version_timestamp
+ */
+uint32_t rs_chunk_history_get_version_count(RSChunkHistory* self, int32_t x, int32_t z);
+
+/**
+ * Get the timestamp of one version of a chunk.
+ *
+ * Versions are numbered from 0, oldest first.
+ *
+ * \param self the history
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param i the version to look at
+ * \return the timestamp of the version, or 0 if there is no such version
+ * \sa rs_chunk_history_get_version_count
+ */
+uint32_t rs_chunk_history_get_version_timestamp(RSChunkHistory* self, int32_t x, int32_t z, uint32_t i);
+
+/**
+ * Read a chunk as it was at a given time.
+ *
+ * This finds the newest version recorded at or before time, and
+ * rebuilds only that chunk from its nearest keyframe.
+ *
+ * \param self the history
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param time the time to look at
+ * \return the chunk, to be freed with rs_nbt_free(), or NULL if no
+ *         version is that old
+ */
+RSNBT* rs_chunk_history_get(RSChunkHistory* self, int32_t x, int32_t z, uint32_t time);
+
+#endif /* __RS_HISTORY_H_INCLUDED__ */
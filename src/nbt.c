@@ -78,14 +78,20 @@ RSNBT* rs_nbt_parse_from_region(RSRegion* region, uint8_t x, uint8_t z)
 {
     rs_return_val_if_fail(region, NULL);
     
+    /* this does nothing unless locking is turned on */
+    if (!rs_region_lock_chunk(region, x, z))
+        return NULL;
+    
     void* data = rs_region_get_chunk_data(region, x, z);
     uint32_t  len = rs_region_get_chunk_length(region, x, z);
     RSCompressionType enc = rs_region_get_chunk_compression(region, x, z);
     
-    if (!data || len == 0)
-        return NULL;
+    RSNBT* self = NULL;
+    if (data && len > 0)
+        self = rs_nbt_parse(data, len, enc);
     
-    return rs_nbt_parse(data, len, enc);
+    rs_region_unlock_chunk(region, x, z);
+    return self;
 }
 
 /* internal helper to parse string tags */
@@ -305,19 +311,25 @@ RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc)
     if (!expanded)
         return NULL;
     
+    RSNBT* self = rs_nbt_parse_uncompressed(expanded, expanded_size);
+    rs_free(expanded);
+    return self;
+}
+
+RSNBT* rs_nbt_parse_uncompressed(void* data, size_t len)
+{
+    rs_return_val_if_fail(data || len == 0, NULL);
+    
     /* make sure there's actually *some* data to work with */
-    if (expanded_size < 4)
-    {
-        rs_free(expanded);
+    if (len < 4)
         return NULL;
-    }
     
     RSNBT* self = rs_new0(RSNBT, 1);
-    void* read_head = expanded;
-    uint32_t left = expanded_size;
+    void* read_head = data;
+    uint32_t left = len;
     
     /* first, figure out what the root type is */
-    RSTagType root_type = expanded[0];
+    RSTagType root_type = ((uint8_t*)data)[0];
     read_head++;
     left--;
     
@@ -325,7 +337,6 @@ RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc)
     self->root_name = _rs_nbt_parse_string(&read_head, &left);
     if (self->root_name == NULL)
     {
-        rs_free(expanded);
         rs_nbt_free(self);
         return NULL;
     }
@@ -333,7 +344,6 @@ RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc)
     self->root = _rs_nbt_parse_tag(root_type, &read_head, &left);
     if (self->root == NULL || left != 0)
     {
-        rs_free(expanded);
         rs_nbt_free(self);
         return NULL;
     }
@@ -341,10 +351,166 @@ RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc)
     /* now we must sink the floating reference */
     rs_tag_ref(self->root);
     
-    rs_free(expanded);
     return self;
 }
 
+/* lists nested deeper than this are treated as malformed when skipped */
+#define RS_NBT_MAX_DEPTH 512
+
+/* internal helper to find the length of a raw tag payload, or 0 if it
+ * runs past the end of the data
+ */
+static size_t _rs_nbt_skip_payload(RSTagType type, uint8_t* data, size_t len, unsigned int depth)
+{
+    uint16_t short_len;
+    int32_t int_len;
+    size_t pos, sub;
+    
+    if (depth > RS_NBT_MAX_DEPTH)
+        return 0;
+    
+    switch (type)
+    {
+    case RS_TAG_BYTE:
+        return len >= 1 ? 1 : 0;
+    case RS_TAG_SHORT:
+        return len >= 2 ? 2 : 0;
+    case RS_TAG_INT:
+    case RS_TAG_FLOAT:
+        return len >= 4 ? 4 : 0;
+    case RS_TAG_LONG:
+    case RS_TAG_DOUBLE:
+        return len >= 8 ? 8 : 0;
+    case RS_TAG_BYTE_ARRAY:
+    case RS_TAG_INT_ARRAY:
+        if (len < 4)
+            return 0;
+        memcpy(&int_len, data, 4);
+        int_len = rs_endian_int32(int_len);
+        sub = (type == RS_TAG_BYTE_ARRAY) ? 1 : 4;
+        if (int_len < 0 || (uint64_t)int_len * sub > len - 4)
+            return 0;
+        return 4 + (size_t)int_len * sub;
+    case RS_TAG_STRING:
+        if (len < 2)
+            return 0;
+        memcpy(&short_len, data, 2);
+        short_len = rs_endian_uint16(short_len);
+        return (size_t)short_len + 2 <= len ? (size_t)short_len + 2 : 0;
+    case RS_TAG_LIST:
+        if (len < 5)
+            return 0;
+        type = data[0];
+        memcpy(&int_len, data + 1, 4);
+        int_len = rs_endian_int32(int_len);
+        if (int_len < 0 || (int_len > 0 && type == RS_TAG_END))
+            return 0;
+        
+        pos = 5;
+        for (int32_t i = 0; i < int_len; i++)
+        {
+            sub = _rs_nbt_skip_payload(type, data + pos, len - pos, depth + 1);
+            if (sub == 0)
+                return 0;
+            pos += sub;
+        }
+        return pos;
+    case RS_TAG_COMPOUND:
+        pos = 0;
+        while (pos < len)
+        {
+            RSTagType subtype = data[pos++];
+            if (subtype == RS_TAG_END)
+                return pos;
+            
+            if (len - pos < 2)
+                return 0;
+            memcpy(&short_len, data + pos, 2);
+            short_len = rs_endian_uint16(short_len);
+            if (len - pos - 2 < short_len)
+                return 0;
+            pos += 2 + short_len;
+            
+            sub = _rs_nbt_skip_payload(subtype, data + pos, len - pos, depth + 1);
+            if (sub == 0)
+                return 0;
+            pos += sub;
+        }
+        return 0;
+    default:
+        return 0;
+    };
+}
+
+void* rs_nbt_find_uncompressed(void* data, size_t len, const char* path, RSTagType* type, size_t* payload_len)
+{
+    rs_return_val_if_fail(data || len == 0, NULL);
+    rs_return_val_if_fail(path, NULL);
+    
+    /* skip the root's type and name */
+    uint8_t* head = data;
+    uint16_t short_len;
+    if (len < 3 || head[0] != RS_TAG_COMPOUND)
+        return NULL;
+    memcpy(&short_len, head + 1, 2);
+    short_len = rs_endian_uint16(short_len);
+    if (len - 3 < short_len)
+        return NULL;
+    head += 3 + short_len;
+    len -= 3 + short_len;
+    
+    RSTagType current = RS_TAG_COMPOUND;
+    while (true)
+    {
+        const char* end = strchr(path, '/');
+        size_t key_len = end ? (size_t)(end - path) : strlen(path);
+        
+        /* look through this compound for the next key, skipping the rest */
+        if (current != RS_TAG_COMPOUND)
+            return NULL;
+        
+        while (true)
+        {
+            if (len < 1 || head[0] == RS_TAG_END)
+                return NULL;
+            current = head[0];
+            
+            if (len < 3)
+                return NULL;
+            memcpy(&short_len, head + 1, 2);
+            short_len = rs_endian_uint16(short_len);
+            if (len - 3 < short_len)
+                return NULL;
+            
+            bool found = (short_len == key_len && memcmp(head + 3, path, key_len) == 0);
+            head += 3 + short_len;
+            len -= 3 + short_len;
+            if (found)
+                break;
+            
+            size_t skip = _rs_nbt_skip_payload(current, head, len, 0);
+            if (skip == 0)
+                return NULL;
+            head += skip;
+            len -= skip;
+        }
+        
+        if (end == NULL)
+            break;
+        path = end + 1;
+    }
+    
+    size_t size = _rs_nbt_skip_payload(current, head, len, 0);
+    if (size == 0)
+        return NULL;
+    
+    if (type)
+        *type = current;
+    if (payload_len)
+        *payload_len = size;
+    return head;
+}
+
 void rs_nbt_free(RSNBT* self)
 {
     rs_return_if_fail(self);
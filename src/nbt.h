@@ -19,10 +19,16 @@ typedef struct _RSNBT RSNBT;
 /* creating / reading / freeing */
 RSNBT* rs_nbt_new(void);
 RSNBT* rs_nbt_parse(void* data, size_t len, RSCompressionType enc);
+RSNBT* rs_nbt_parse_uncompressed(void* data, size_t len);
 RSNBT* rs_nbt_parse_from_region(RSRegion* region, uint8_t x, uint8_t z);
 RSNBT* rs_nbt_parse_from_file(const char* path);
 void rs_nbt_free(RSNBT* self);
 
+/* finds one tag in uncompressed NBT without parsing the rest; path is
+ * compound keys separated by '/', like "Level/LastUpdate". returns a
+ * pointer into data at the tag's raw, big-endian payload, or NULL */
+void* rs_nbt_find_uncompressed(void* data, size_t len, const char* path, RSTagType* type, size_t* payload_len);
+
 /* writing (returns true on success) */
 bool rs_nbt_write(RSNBT* self, void** datap, size_t* lenp, RSCompressionType enc);
 /* must flush region after writes */
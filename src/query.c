@@ -0,0 +1,442 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "query.h"
+
+#include "error.h"
+#include "memory.h"
+#include "rsendian.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the kinds of value a field condition compares against */
+typedef enum
+{
+    QUERY_FIELD_INT,
+    QUERY_FIELD_DOUBLE,
+    QUERY_FIELD_STRING
+} QueryFieldKind;
+
+struct QueryHeader
+{
+    RSQueryHeaderField field;
+    RSQueryOperator op;
+    int64_t value;
+};
+
+struct QueryField
+{
+    char* path;
+    QueryFieldKind kind;
+    RSQueryOperator op;
+    
+    int64_t int_value;
+    double double_value;
+    char* string_value;
+    size_t string_len;
+};
+
+struct QueryFunc
+{
+    RSQueryFunction func;
+    void* user;
+};
+
+struct _RSWorldQuery
+{
+    /* one array per tier, in the order they are checked */
+    struct QueryHeader* headers;
+    unsigned int header_count;
+    struct QueryField* fields;
+    unsigned int field_count;
+    struct QueryFunc* funcs;
+    unsigned int func_count;
+};
+
+/* the state of one run of a query, shared by all threads */
+struct QueryRun
+{
+    RSWorldQuery* query;
+    
+    /* what to do with matches; when func is NULL, they are only counted
+     * (and listed, if list is true) */
+    RSQueryMatchFunction func;
+    void* user;
+    bool list;
+    
+    /* filled in from each thread's QueryLocal once they finish */
+    unsigned int count;
+    RSWorldChunkInfo* chunks;
+    unsigned int allocated;
+};
+
+/* the matches found by one thread */
+struct QueryLocal
+{
+    unsigned int count;
+    RSWorldChunkInfo* chunks;
+    unsigned int allocated;
+};
+
+RSWorldQuery* rs_world_query_new(void)
+{
+    return rs_new0(RSWorldQuery, 1);
+}
+
+void rs_world_query_free(RSWorldQuery* self)
+{
+    rs_return_if_fail(self);
+    
+    for (unsigned int i = 0; i < self->field_count; i++)
+    {
+        rs_free(self->fields[i].path);
+        if (self->fields[i].string_value)
+            rs_free(self->fields[i].string_value);
+    }
+    
+    if (self->headers)
+        rs_free(self->headers);
+    if (self->fields)
+        rs_free(self->fields);
+    if (self->funcs)
+        rs_free(self->funcs);
+    rs_free(self);
+}
+
+void rs_world_query_where_header(RSWorldQuery* self, RSQueryHeaderField field, RSQueryOperator op, int64_t value)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(op >= RS_QUERY_EQ && op <= RS_QUERY_GE);
+    rs_return_if_fail(field >= RS_QUERY_TIMESTAMP && field <= RS_QUERY_Z);
+    
+    self->headers = rs_renew(struct QueryHeader, self->headers, self->header_count + 1);
+    struct QueryHeader* header = &(self->headers[self->header_count++]);
+    header->field = field;
+    header->op = op;
+    header->value = value;
+}
+
+/* helper to add a field condition, leaving the value for the caller */
+static struct QueryField* _rs_world_query_add_field(RSWorldQuery* self, const char* path, QueryFieldKind kind, RSQueryOperator op)
+{
+    self->fields = rs_renew(struct QueryField, self->fields, self->field_count + 1);
+    struct QueryField* field = &(self->fields[self->field_count++]);
+    memset(field, 0, sizeof(struct QueryField));
+    field->path = rs_strdup(path);
+    field->kind = kind;
+    field->op = op;
+    return field;
+}
+
+void rs_world_query_where_int(RSWorldQuery* self, const char* path, RSQueryOperator op, int64_t value)
+{
+    rs_return_if_fail(self && path);
+    rs_return_if_fail(op >= RS_QUERY_EQ && op <= RS_QUERY_GE);
+    
+    _rs_world_query_add_field(self, path, QUERY_FIELD_INT, op)->int_value = value;
+}
+
+void rs_world_query_where_double(RSWorldQuery* self, const char* path, RSQueryOperator op, double value)
+{
+    rs_return_if_fail(self && path);
+    rs_return_if_fail(op >= RS_QUERY_EQ && op <= RS_QUERY_GE);
+    
+    _rs_world_query_add_field(self, path, QUERY_FIELD_DOUBLE, op)->double_value = value;
+}
+
+void rs_world_query_where_string(RSWorldQuery* self, const char* path, RSQueryOperator op, const char* value)
+{
+    rs_return_if_fail(self && path && value);
+    rs_return_if_fail(op == RS_QUERY_EQ || op == RS_QUERY_NE);
+    
+    struct QueryField* field = _rs_world_query_add_field(self, path, QUERY_FIELD_STRING, op);
+    field->string_value = rs_strdup(value);
+    field->string_len = strlen(value);
+}
+
+void rs_world_query_where_func(RSWorldQuery* self, RSQueryFunction func, void* user)
+{
+    rs_return_if_fail(self && func);
+    
+    self->funcs = rs_renew(struct QueryFunc, self->funcs, self->func_count + 1);
+    self->funcs[self->func_count].func = func;
+    self->funcs[self->func_count].user = user;
+    self->func_count++;
+}
+
+/* helper to turn the sign of a comparison (-1, 0, 1) into a result */
+static inline bool _rs_world_query_test(int cmp, RSQueryOperator op)
+{
+    switch (op)
+    {
+    case RS_QUERY_EQ:
+        return cmp == 0;
+    case RS_QUERY_NE:
+        return cmp != 0;
+    case RS_QUERY_LT:
+        return cmp < 0;
+    case RS_QUERY_LE:
+        return cmp <= 0;
+    case RS_QUERY_GT:
+        return cmp > 0;
+    case RS_QUERY_GE:
+        return cmp >= 0;
+    };
+    
+    return false;
+}
+
+#define _RS_WORLD_QUERY_CMP(a, b) ((a) < (b) ? -1 : ((a) > (b) ? 1 : 0))
+
+/* helper to read an integer tag payload, returning false if it is not one */
+static bool _rs_world_query_read_int(RSTagType type, const uint8_t* data, int64_t* out)
+{
+    int16_t short_val;
+    int32_t int_val;
+    int64_t long_val;
+    
+    switch (type)
+    {
+    case RS_TAG_BYTE:
+        *out = (int8_t)data[0];
+        return true;
+    case RS_TAG_SHORT:
+        memcpy(&short_val, data, 2);
+        *out = rs_endian_int16(short_val);
+        return true;
+    case RS_TAG_INT:
+        memcpy(&int_val, data, 4);
+        *out = rs_endian_int32(int_val);
+        return true;
+    case RS_TAG_LONG:
+        memcpy(&long_val, data, 8);
+        *out = rs_endian_int64(long_val);
+        return true;
+    default:
+        return false;
+    };
+}
+
+/* helper to read a float or double tag payload, returning false if
+ * it is not one
+ */
+static bool _rs_world_query_read_double(RSTagType type, const uint8_t* data, double* out)
+{
+    float float_val;
+    double double_val;
+    
+    switch (type)
+    {
+    case RS_TAG_FLOAT:
+        memcpy(&float_val, data, 4);
+        *out = rs_endian_float(float_val);
+        return true;
+    case RS_TAG_DOUBLE:
+        memcpy(&double_val, data, 8);
+        *out = rs_endian_double(double_val);
+        return true;
+    default:
+        return false;
+    };
+}
+
+/* the first tier: conditions on the region tables */
+static bool _rs_world_query_filter(const RSWorldChunkInfo* info, void* user)
+{
+    RSWorldQuery* self = ((struct QueryRun*)user)->query;
+    for (unsigned int i = 0; i < self->header_count; i++)
+    {
+        struct QueryHeader* header = &(self->headers[i]);
+        int64_t value = 0;
+        switch (header->field)
+        {
+        case RS_QUERY_TIMESTAMP:
+            value = info->timestamp;
+            break;
+        case RS_QUERY_LENGTH:
+            value = info->length;
+            break;
+        case RS_QUERY_X:
+            value = info->x;
+            break;
+        case RS_QUERY_Z:
+            value = info->z;
+            break;
+        };
+        
+        if (!_rs_world_query_test(_RS_WORLD_QUERY_CMP(value, header->value), header->op))
+            return false;
+    }
+    
+    return true;
+}
+
+/* the second tier: a single field, found without parsing */
+static bool _rs_world_query_check_field(struct QueryField* field, void* data, size_t len)
+{
+    RSTagType type;
+    size_t payload_len;
+    uint8_t* payload = rs_nbt_find_uncompressed(data, len, field->path, &type, &payload_len);
+    if (payload == NULL)
+        return false;
+    
+    int64_t int_val;
+    double double_val;
+    int cmp;
+    
+    switch (field->kind)
+    {
+    case QUERY_FIELD_INT:
+        if (_rs_world_query_read_int(type, payload, &int_val))
+            cmp = _RS_WORLD_QUERY_CMP(int_val, field->int_value);
+        else if (_rs_world_query_read_double(type, payload, &double_val))
+            cmp = _RS_WORLD_QUERY_CMP(double_val, (double)field->int_value);
+        else
+            return false;
+        break;
+    case QUERY_FIELD_DOUBLE:
+        if (_rs_world_query_read_int(type, payload, &int_val))
+            double_val = (double)int_val;
+        else if (!_rs_world_query_read_double(type, payload, &double_val))
+            return false;
+        
+        /* NaN matches nothing, not even NE */
+        if (double_val != double_val)
+            return false;
+        cmp = _RS_WORLD_QUERY_CMP(double_val, field->double_value);
+        break;
+    case QUERY_FIELD_STRING:
+        if (type != RS_TAG_STRING)
+            return false;
+        cmp = (payload_len - 2 == field->string_len && memcmp(payload + 2, field->string_value, field->string_len) == 0) ? 0 : 1;
+        break;
+    default:
+        return false;
+    };
+    
+    return _rs_world_query_test(cmp, field->op);
+}
+
+/* the second and third tiers, then whatever the run does with matches */
+static void _rs_world_query_chunk(const RSWorldChunkInfo* info, void* data, size_t len, void* local, void* user)
+{
+    struct QueryRun* run = user;
+    struct QueryLocal* matches = local;
+    RSWorldQuery* self = run->query;
+    
+    for (unsigned int i = 0; i < self->field_count; i++)
+    {
+        if (!_rs_world_query_check_field(&(self->fields[i]), data, len))
+            return;
+    }
+    
+    if (self->func_count > 0 || run->func)
+    {
+        RSNBT* chunk = rs_nbt_parse_uncompressed(data, len);
+        if (chunk == NULL)
+            return;
+        
+        bool ok = true;
+        for (unsigned int i = 0; ok && i < self->func_count; i++)
+            ok = self->funcs[i].func(info->x, info->z, chunk, self->funcs[i].user);
+        
+        if (ok && run->func)
+            run->func(info->x, info->z, chunk, run->user);
+        rs_nbt_free(chunk);
+        
+        if (!ok)
+            return;
+    }
+    
+    matches->count++;
+    if (run->list)
+    {
+        if (matches->count > matches->allocated)
+        {
+            matches->allocated = matches->allocated ? matches->allocated * 2 : 64;
+            matches->chunks = rs_renew(RSWorldChunkInfo, matches->chunks, matches->allocated);
+        }
+        matches->chunks[matches->count - 1] = *info;
+    }
+}
+
+/* merges one thread's matches into the run, once all threads are done */
+static void _rs_world_query_reduce(void* local, void* user)
+{
+    struct QueryRun* run = user;
+    struct QueryLocal* matches = local;
+    
+    if (matches->chunks)
+    {
+        if (run->count + matches->count > run->allocated)
+        {
+            run->allocated = run->count + matches->count;
+            run->chunks = rs_renew(RSWorldChunkInfo, run->chunks, run->allocated);
+        }
+        memcpy(run->chunks + run->count, matches->chunks, matches->count * sizeof(RSWorldChunkInfo));
+        rs_free(matches->chunks);
+    }
+    
+    run->count += matches->count;
+}
+
+/* helper to run a query, filling in run->count (and run->chunks) */
+static void _rs_world_query_execute(struct QueryRun* run, RSWorld* world, unsigned int nthreads)
+{
+    rs_world_foreach_chunk_raw(world, run->query->header_count > 0 ? _rs_world_query_filter : NULL, _rs_world_query_chunk, sizeof(struct QueryLocal), _rs_world_query_reduce, run, nthreads);
+}
+
+unsigned int rs_world_query_count(RSWorldQuery* self, RSWorld* world, unsigned int nthreads)
+{
+    rs_return_val_if_fail(self && world, 0);
+    
+    struct QueryRun run;
+    memset(&run, 0, sizeof(run));
+    run.query = self;
+    _rs_world_query_execute(&run, world, nthreads);
+    return run.count;
+}
+
+/* qsort helper to order chunks by x, then z */
+static int _rs_world_query_compare_chunks(const void* a, const void* b)
+{
+    const RSWorldChunkInfo* ca = a;
+    const RSWorldChunkInfo* cb = b;
+    if (ca->x != cb->x)
+        return _RS_WORLD_QUERY_CMP(ca->x, cb->x);
+    return _RS_WORLD_QUERY_CMP(ca->z, cb->z);
+}
+
+RSWorldChunkInfo* rs_world_query_list(RSWorldQuery* self, RSWorld* world, unsigned int* count, unsigned int nthreads)
+{
+    rs_return_val_if_fail(count, NULL);
+    *count = 0;
+    rs_return_val_if_fail(self && world, NULL);
+    
+    struct QueryRun run;
+    memset(&run, 0, sizeof(run));
+    run.query = self;
+    run.list = true;
+    _rs_world_query_execute(&run, world, nthreads);
+    
+    if (run.chunks)
+        qsort(run.chunks, run.count, sizeof(RSWorldChunkInfo), _rs_world_query_compare_chunks);
+    *count = run.count;
+    return run.chunks;
+}
+
+unsigned int rs_world_query_run(RSWorldQuery* self, RSWorld* world, RSQueryMatchFunction func, void* user, unsigned int nthreads)
+{
+    rs_return_val_if_fail(self && world && func, 0);
+    
+    struct QueryRun run;
+    memset(&run, 0, sizeof(run));
+    run.query = self;
+    run.func = func;
+    run.user = user;
+    _rs_world_query_execute(&run, world, nthreads);
+    return run.count;
+}
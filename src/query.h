@@ -0,0 +1,218 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_QUERY_H_INCLUDED__
+#define __RS_QUERY_H_INCLUDED__
+
+#include "nbt.h"
+#include "world.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSWorldQuery;
+/**
+ * The world query data type.
+ *
+ * This is an opaque structure holding a list of conditions on chunks,
+ * like "LastUpdate > N and InhabitedTime < M", that can be run over a
+ * whole world at once. A chunk matches the query if it passes every
+ * condition.
+ *
+ * Conditions are checked from cheapest to most expensive, no matter
+ * what order they were added in:
+ *
+ *  1. header conditions, which only need the region file's tables
+ *     (rs_world_query_where_header()),
+ *  2. field conditions, which pick single tags out of the
+ *     uncompressed chunk without parsing it
+ *     (rs_world_query_where_int() and friends),
+ *  3. function conditions, which need the fully parsed chunk
+ *     (rs_world_query_where_func()).
+ *
+ * Chunks that fail a header condition are never read, and chunks that
+ * fail a field condition are never parsed. Queries are run with
+ * rs_world_foreach_chunk_raw(), so they use several threads.
+ */
+typedef struct _RSWorldQuery RSWorldQuery;
+
+/**
+ * The comparisons a query condition can make.
+ */
+typedef enum
+{
+    /** equal to the value */
+    RS_QUERY_EQ,
+    /** not equal to the value */
+    RS_QUERY_NE,
+    /** less than the value */
+    RS_QUERY_LT,
+    /** less than or equal to the value */
+    RS_QUERY_LE,
+    /** greater than the value */
+    RS_QUERY_GT,
+    /** greater than or equal to the value */
+    RS_QUERY_GE
+} RSQueryOperator;
+
+/**
+ * The region header fields rs_world_query_where_header() can test.
+ */
+typedef enum
+{
+    /** the chunk's last modified time */
+    RS_QUERY_TIMESTAMP,
+    /** the length of the compressed chunk data */
+    RS_QUERY_LENGTH,
+    /** the chunk's global x coordinate */
+    RS_QUERY_X,
+    /** the chunk's global z coordinate */
+    RS_QUERY_Z
+} RSQueryHeaderField;
+
+/**
+ * A function testing a fully parsed chunk, for
+ * rs_world_query_where_func(). This may be called from several
+ * threads at once.
+ *
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param chunk the chunk's NBT, which belongs to the query
+ * \param user the user data passed to rs_world_query_where_func()
+ * \return true if the chunk passes
+ */
+typedef bool (*RSQueryFunction)(int32_t x, int32_t z, RSNBT* chunk, void* user);
+
+/**
+ * A function called on every chunk matching a query, by
+ * rs_world_query_run(). This may be called from several threads at
+ * once.
+ *
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param chunk the chunk's NBT, which belongs to the query
+ * \param user the user data passed to rs_world_query_run()
+ */
+typedef void (*RSQueryMatchFunction)(int32_t x, int32_t z, RSNBT* chunk, void* user);
+
+/**
+ * Create an empty query, which matches every chunk.
+ *
+ * \return the new query
+ * \sa rs_world_query_free
+ */
+RSWorldQuery* rs_world_query_new(void);
+
+/**
+ * Free a query.
+ *
+ * \param self the query
+ * \sa rs_world_query_new
+ */
+void rs_world_query_free(RSWorldQuery* self);
+
+/**
+ * Add a condition on a region header field.
+ *
+ * \param self the query
+ * \param field the field to test
+ * \param op how to compare the field to value
+ * \param value the value to compare against
+ */
+void rs_world_query_where_header(RSWorldQuery* self, RSQueryHeaderField field, RSQueryOperator op, int64_t value);
+
+/**
+ * Add a condition on a number in the chunk.
+ *
+ * The path is a list of compound keys separated by '/', starting
+ * under the root compound, like "Level/LastUpdate". Any integer tag
+ * is compared exactly; float and double tags are compared as
+ * doubles. Chunks where the path does not lead to a number fail.
+ *
+ * \param self the query
+ * \param path the path to the tag
+ * \param op how to compare the tag to value
+ * \param value the value to compare against
+ * \sa rs_nbt_find_uncompressed
+ */
+void rs_world_query_where_int(RSWorldQuery* self, const char* path, RSQueryOperator op, int64_t value);
+
+/**
+ * Add a condition on a number in the chunk, compared as a double.
+ *
+ * This is like rs_world_query_where_int(), except that every kind of
+ * number is converted to a double first.
+ *
+ * \param self the query
+ * \param path the path to the tag
+ * \param op how to compare the tag to value
+ * \param value the value to compare against
+ */
+void rs_world_query_where_double(RSWorldQuery* self, const char* path, RSQueryOperator op, double value);
+
+/**
+ * Add a condition on a string in the chunk.
+ *
+ * Only RS_QUERY_EQ and RS_QUERY_NE are allowed. Chunks where the path
+ * does not lead to a string fail.
+ *
+ * \param self the query
+ * \param path the path to the tag, as for rs_world_query_where_int()
+ * \param op how to compare the tag to value
+ * \param value the string to compare against
+ */
+void rs_world_query_where_string(RSWorldQuery* self, const char* path, RSQueryOperator op, const char* value);
+
+/**
+ * Add a condition that needs the whole chunk.
+ *
+ * These are only checked on chunks that pass every other condition,
+ * in the order they were added.
+ *
+ * \param self the query
+ * \param func the function testing each chunk
+ * \param user data to pass to func
+ */
+void rs_world_query_where_func(RSWorldQuery* self, RSQueryFunction func, void* user);
+
+/**
+ * Count the chunks in a world matching a query.
+ *
+ * Unless the query has function conditions, no chunk is parsed.
+ *
+ * \param self the query
+ * \param world the world to search
+ * \param nthreads the number of threads to use, or 0
+ * \return the number of matching chunks
+ */
+unsigned int rs_world_query_count(RSWorldQuery* self, RSWorld* world, unsigned int nthreads);
+
+/**
+ * List the chunks in a world matching a query.
+ *
+ * Unless the query has function conditions, no chunk is parsed.
+ *
+ * \param self the query
+ * \param world the world to search
+ * \param count where to store the number of matching chunks
+ * \param nthreads the number of threads to use, or 0
+ * \return the matching chunks, sorted by x and then z, which must be
+ *         freed with rs_free(), or NULL if there are none
+ */
+RSWorldChunkInfo* rs_world_query_list(RSWorldQuery* self, RSWorld* world, unsigned int* count, unsigned int nthreads);
+
+/**
+ * Run a function on every chunk in a world matching a query.
+ *
+ * \param self the query
+ * \param world the world to search
+ * \param func the function to call on each matching chunk
+ * \param user data to pass to func
+ * \param nthreads the number of threads to use, or 0
+ * \return the number of matching chunks
+ */
+unsigned int rs_world_query_run(RSWorldQuery* self, RSWorld* world, RSQueryMatchFunction func, void* user, unsigned int nthreads);
+
+#endif /* __RS_QUERY_H_INCLUDED__ */
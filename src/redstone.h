@@ -24,6 +24,7 @@
 #include "rsendian.h"
 #include "error.h"
 #include "compression.h"
+#include "thread.h"
 
 /* data types */
 #include "list.h"
@@ -31,5 +32,16 @@
 /* save file interfaces */
 #include "region.h"
 #include "nbt.h"
+#include "chunkcache.h"
+#include "stream.h"
+#include "world.h"
+#include "worldindex.h"
+#include "bloom.h"
+#include "snapshot.h"
+#include "history.h"
+#include "archive.h"
+#include "chunkserver.h"
+#include "query.h"
+#include "columns.h"
 
 #endif /* __REDSTONE_H_INCLUDED__ */
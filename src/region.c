@@ -3,6 +3,7 @@
  * See redstone.h for details.
  */
 
+#include "config.h"
 #include "region.h"
 
 #include "error.h"
@@ -10,12 +11,21 @@
 #include "mmap.h"
 #include "rsendian.h"
 #include "list.h"
+#include "thread.h"
+#include "util.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
 #include <time.h>
+#include <zlib.h>
+
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -25,15 +35,15 @@
  * <http://www.minecraftwiki.net/wiki/Beta_Level_Format>.
  */
 
-/* macro that expands to a packed attribute, on GCC
-   gcc_struct (as opposed to ms_struct) will pack together bitfields */
-#ifdef __GNUC__
-#define __PACKED__ __attribute__((gcc_struct, __packed__))
-#else
-#define __PACKED__ /**/
-#endif
- 
-/* for chunk location table */
+/* set in the compression byte of chunks stored in c.X.Z.mcc files */
+#define RS_REGION_EXTERNAL_FLAG 0x80
+
+/* chunks (plus size/compression info) larger than this many sectors
+ * do not fit in a location entry, and are stored externally
+ */
+#define RS_REGION_MAX_SECTORS 255
+
+/* for chunk location table (__PACKED__ comes from util.h) */
 #pragma pack(1)
 struct __PACKED__ ChunkLocation
 {
@@ -50,6 +60,31 @@ struct ChunkWrite
     uint32_t length;
     RSCompressionType encoding;
     uint32_t timestamp;
+    
+    /* external chunks have no data in the region itself. Their
+     * payload lives in external_tmp until the flush, or is already in
+     * place if external_tmp is NULL.
+     */
+    bool external;
+    char* external_tmp;
+    
+    /* chunks copied as they are (by rs_region_compact()) keep their
+     * compression byte, even if it isn't one we know
+     */
+    bool raw;
+    uint8_t raw_encoding;
+    
+    /* for rs_region_set_chunk_data_if(), checked at flush time */
+    RSRegionCondition condition;
+    uint32_t expected_timestamp;
+    uint32_t expected_hash;
+};
+
+/* for mapped external chunk files */
+struct ExternalChunk
+{
+    void* map;
+    size_t length;
 };
 
 /* for ordering chunk writes in in-place region writing */
@@ -59,6 +94,22 @@ struct OrderedChunkWrite
     uint32_t order;
 };
 
+/* for sorting chunks by the sectors they occupy */
+struct SectorRange
+{
+    uint32_t start;
+    uint32_t count;
+    uint16_t index;
+};
+
+/* for chunks locked with rs_region_lock_chunk() */
+struct ChunkLock
+{
+    uint32_t start;
+    uint32_t count;
+    unsigned int depth;
+};
+
 /* overall region info */
 struct _RSRegion
 {
@@ -68,55 +119,131 @@ struct _RSRegion
     off_t fsize;
     void* map;
     
+    /* memory regions have no file (fd is -1), and map is a plain
+     * buffer that we free ourselves if owns_map is set
+     */
+    bool memory;
+    bool owns_map;
+    
     struct ChunkLocation* locations;
     uint32_t* timestamps;
     
-    /* list of ChunkWrite structs */
+    /* list of ChunkWrite structs, and the cell for each chunk (or NULL) */
     RSList* cached_writes;
+    RSList* write_index[32 * 32];
+    
+    /* chunk order used when writing the file from scratch */
+    RSRegionLayout layout;
+    
+    /* region coordinates and directory, for external chunk files */
+    bool has_coords;
+    int32_t rx, rz;
+    char* dir;
+    
+    /* lazily-mapped external chunks, or NULL */
+    struct ExternalChunk* externals;
+    
+    /* whether to use advisory file locks, and the chunks locked
+     * through this handle (lazily allocated, or NULL)
+     */
+    bool locking;
+    struct ChunkLock* locks;
+    
+    /* set while flushing without syncing, by rs_region_flush_nosync(),
+     * and set if external chunk files were moved into place since then
+     * without syncing their directory
+     */
+    bool nosync;
+    bool pending_dir_sync;
+    
+    /* numbers the temporary external chunk files, so a chunk written
+     * twice before a flush doesn't reuse the name of the earlier one
+     */
+    uint32_t external_serial;
+    
+    /* conditional writes dropped by the last flush */
+    RSRegionBitmap conflicts;
+    unsigned int conflict_count;
+    
+    /* copy of the headers as of the last open or refresh, plus this
+     * handle's own flushes, used to find out what changed in
+     * rs_region_refresh()
+     */
+    uint8_t header_snapshot[4096 * 2];
 };
 
-RSRegion* rs_region_open(const char* path, bool write)
+/* helper to build the path to an external chunk file (must be freed),
+ * or to a new temporary one for it
+ */
+static char* _rs_region_external_path(RSRegion* self, uint8_t x, uint8_t z, bool tmp)
 {
-    RSRegion* self;
-    struct stat stat_buf;
-    void* map = NULL;
-    int fd = open(path, (write ? (O_RDWR | O_CREAT) : O_RDONLY) | O_BINARY, 0666);
-    if (fd < 0)
-    {
-        return NULL; /* TODO proper error handling */
-    }
-    
-    if (fstat(fd, &stat_buf) < 0)
-    {
-        close(fd);
-        return NULL;
-    }
+    rs_assert(self->has_coords);
     
-    /* zero size is valid, but anything between 0 and 8192 isn't */
-    if (stat_buf.st_size > 0 && stat_buf.st_size < 8192)
-    {
-        close(fd);
-        return NULL;
-    }
+    int32_t cx = self->rx * 32 + x;
+    int32_t cz = self->rz * 32 + z;
+    size_t len = strlen(self->dir) + 64;
+    char* path = rs_new(char, len);
+    if (tmp)
+        snprintf(path, len, "%sc.%i.%i.mcc.%u.tmp", self->dir, cx, cz, self->external_serial++);
+    else
+        snprintf(path, len, "%sc.%i.%i.mcc", self->dir, cx, cz);
+    return path;
+}
+
+/* helper to unmap all external chunk files */
+static void _rs_region_release_externals(RSRegion* self)
+{
+    if (self->externals == NULL)
+        return;
     
-    if (stat_buf.st_size > 0)
+    for (unsigned int i = 0; i < 32 * 32; i++)
     {
-        map = mmap(NULL, stat_buf.st_size, write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
-        if (map == MAP_FAILED)
-        {
-            close(fd);
-            return NULL;
-        }
+        if (self->externals[i].map)
+            munmap(self->externals[i].map, self->externals[i].length);
     }
     
-    self = rs_new0(RSRegion, 1);
-    self->path = rs_strdup(path);
+    rs_free(self->externals);
+    self->externals = NULL;
+}
+
+/* helper to create a new region handle, without any data yet */
+static RSRegion* _rs_region_new(const char* path, bool write)
+{
+    RSRegion* self = rs_new0(RSRegion, 1);
+    self->path = path ? rs_strdup(path) : NULL;
     self->write = write;
-    self->fd = fd;    
-    self->fsize = stat_buf.st_size;
-    self->map = map;
+    self->fd = -1;
+    self->fsize = 0;
+    self->map = NULL;
+    self->memory = false;
+    self->owns_map = false;
     self->cached_writes = NULL;
+    self->layout = RS_REGION_LAYOUT_NONE;
     
+    /* region files are named r.X.Z.mca (or .mcr), and external chunk
+     * files are stored right next to them
+     */
+    self->has_coords = false;
+    self->dir = NULL;
+    if (path)
+    {
+        const char* base = strrchr(path, '/');
+        base = base ? base + 1 : path;
+        self->has_coords = (sscanf(base, "r.%d.%d.", &(self->rx), &(self->rz)) == 2);
+        self->dir = memcpy(rs_new0(char, base - path + 1), path, base - path);
+    }
+    self->externals = NULL;
+    self->locking = false;
+    self->locks = NULL;
+    
+    self->locations = NULL;
+    self->timestamps = NULL;
+    return self;
+}
+
+/* helper to point the header tables at the current map */
+static inline void _rs_region_update_headers(RSRegion* self)
+{
     self->locations = NULL;
     self->timestamps = NULL;
     if (self->map)
@@ -124,177 +251,1070 @@ RSRegion* rs_region_open(const char* path, bool write)
         self->locations = (struct ChunkLocation*)(self->map);
         self->timestamps = (uint32_t*)(self->map + 4096);
     }
-    
-    return self;
 }
 
-void rs_region_close(RSRegion* self)
+/* helper to copy the current headers (4096 * 2 bytes) to dest */
+static inline void _rs_region_copy_headers(RSRegion* self, uint8_t* dest)
 {
-    rs_return_if_fail(self);
-    
-    if (self->write && self->cached_writes)
-        rs_region_flush(self);
-    rs_assert(self->cached_writes == NULL);
-    
-    rs_free(self->path);
     if (self->map)
-        munmap(self->map, self->fsize);
-    close(self->fd);
-    rs_free(self);
+        memcpy(dest, self->map, 4096 * 2);
+    else
+        memset(dest, 0, 4096 * 2);
 }
 
-uint32_t rs_region_get_chunk_timestamp(RSRegion* self, uint8_t x, uint8_t z)
+/* helper to fold the header entries this handle changed into the
+ * snapshot used by rs_region_refresh(), given the headers as they
+ * were before. Entries changed by others are left alone, so they are
+ * still reported by the next refresh.
+ */
+static void _rs_region_snapshot_changes(RSRegion* self, const uint8_t* before)
 {
-    rs_return_val_if_fail(self, 0);
-    rs_return_val_if_fail(x < 32 && z < 32, 0);
-    if (self->timestamps == NULL)
-        return 0;
-    
-    if (!rs_region_contains_chunk(self, x, z))
-        return 0;
+    uint8_t after[4096 * 2];
+    _rs_region_copy_headers(self, after);
     
-    return rs_endian_uint32(self->timestamps[x + 32*z]);
+    /* location and timestamp entries are both 4 bytes */
+    for (unsigned int i = 0; i < sizeof(after); i += 4)
+    {
+        if (memcmp(after + i, before + i, 4) != 0)
+            memcpy(self->header_snapshot + i, after + i, 4);
+    }
 }
 
-/* LOCAL helper function to return the start of chunk data, including
- * size, compression
- */
-static void* _rs_region_get_data(RSRegion* self, uint8_t x, uint8_t z)
+/* helper to map an already-open regular file. On failure, fd is left open */
+static RSRegion* _rs_region_open_file(int fd, const char* path, bool write)
 {
-    rs_return_val_if_fail(self, NULL);
-    rs_return_val_if_fail(x < 32 && z < 32, NULL);
-    if (self->locations == NULL)
+    struct stat stat_buf;
+    void* map = NULL;
+    
+    if (fstat(fd, &stat_buf) < 0)
         return NULL;
     
-    return self->map + (rs_endian_uint24(self->locations[x + z*32].offset) * 4096);
-}
-
-uint32_t rs_region_get_chunk_length(RSRegion* self, uint8_t x, uint8_t z)
-{
-    if (!rs_region_contains_chunk(self, x, z))
-        return 0;
+    /* zero size is valid, but anything between 0 and 8192 isn't */
+    if (stat_buf.st_size > 0 && stat_buf.st_size < 8192)
+        return NULL;
     
-    uint32_t* size_int = (uint32_t*)_rs_region_get_data(self, x, z);
-    if (!size_int)
-        return 0;
+    if (stat_buf.st_size > 0)
+    {
+        map = mmap(NULL, stat_buf.st_size, write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            return NULL;
+    }
     
-    /* size is big-endian, and 1 larger than it should be */
-    return rs_endian_uint32(size_int[0]) - 1;
+    RSRegion* self = _rs_region_new(path, write);
+    self->fd = fd;
+    self->fsize = stat_buf.st_size;
+    self->map = map;
+    _rs_region_update_headers(self);
+    _rs_region_copy_headers(self, self->header_snapshot);
+    
+    return self;
 }
 
-RSCompressionType rs_region_get_chunk_compression(RSRegion* self, uint8_t x, uint8_t z)
+RSRegion* rs_region_open(const char* path, bool write)
 {
-    if (!rs_region_contains_chunk(self, x, z))
-        return RS_UNKNOWN_COMPRESSION;
-    
-    uint8_t* compression_byte = (uint8_t*)_rs_region_get_data(self, x, z);
-    if (!compression_byte)
-        return RS_UNKNOWN_COMPRESSION;
+    rs_return_val_if_fail(path, NULL);
     
-    /* compression byte is the fifth byte */
-    switch (compression_byte[4])
+    int fd = open(path, (write ? (O_RDWR | O_CREAT) : O_RDONLY) | O_BINARY, 0666);
+    if (fd < 0)
     {
-    case 1:
-        return RS_GZIP;
-    case 2:
-        return RS_ZLIB;
-    default:
-        break;
-    };
+        return NULL; /* TODO proper error handling */
+    }
     
-    return RS_UNKNOWN_COMPRESSION;
+    RSRegion* self = _rs_region_open_file(fd, path, write);
+    if (!self)
+        close(fd);
+    return self;
 }
 
-/* valid until region is closed/flushed */
-void* rs_region_get_chunk_data(RSRegion* self, uint8_t x, uint8_t z)
+RSRegion* rs_region_open_fd(int fd, bool write)
 {
-    if (!rs_region_contains_chunk(self, x, z))
+    rs_return_val_if_fail(fd >= 0, NULL);
+    
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0)
         return NULL;
     
-    void* ret = _rs_region_get_data(self, x, z);
-    if (!ret)
+    if (S_ISREG(stat_buf.st_mode))
+    {
+        /* keep our own descriptor, so the caller can close theirs */
+        int our_fd = dup(fd);
+        if (our_fd < 0)
+            return NULL;
+        
+        RSRegion* self = _rs_region_open_file(our_fd, NULL, write);
+        if (!self)
+            close(our_fd);
+        return self;
+    }
+    
+    /* pipes, sockets, and such can't be mapped, so read them in */
+    size_t len = 0;
+    size_t allocated = 1024 * 64;
+    uint8_t* buf = rs_malloc(allocated);
+    while (true)
+    {
+        if (len == allocated)
+        {
+            allocated *= 2;
+            buf = rs_realloc(buf, allocated);
+        }
+        
+        ssize_t res = read(fd, buf + len, allocated - len);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+        {
+            rs_free(buf);
+            return NULL;
+        }
+        if (res == 0)
+            break;
+        
+        len += res;
+    }
+    
+    if (len > 0 && len < 8192)
+    {
+        rs_free(buf);
         return NULL;
+    }
     
-    /* chunk data starts 5 bytes after */
-    return ret + 5;
+    RSRegion* self = _rs_region_new(NULL, write);
+    self->memory = true;
+    self->owns_map = true;
+    self->fsize = len;
+    self->map = NULL;
+    if (len > 0)
+        self->map = rs_realloc(buf, len);
+    else
+        rs_free(buf);
+    _rs_region_update_headers(self);
+    
+    return self;
 }
 
-bool rs_region_contains_chunk(RSRegion* self, uint8_t x, uint8_t z)
+RSRegion* rs_region_open_memory(void* buf, size_t len, bool writable)
 {
-    rs_return_val_if_fail(self, false);
-    rs_return_val_if_fail(x < 32 && z < 32, false);
+    rs_return_val_if_fail(buf || len == 0, NULL);
     
-    uint16_t i = z * 32 + x;
-    if (self->locations[i].offset == 0)
-        return false;
-    if (self->locations[i].sector_count == 0)
-        return false;
-    if (self->timestamps[i] == 0)
-        return false;
+    /* zero size is valid, but anything between 0 and 8192 isn't */
+    if (len > 0 && len < 8192)
+        return NULL;
     
-    return true;
+    RSRegion* self = _rs_region_new(NULL, writable);
+    self->memory = true;
+    self->fsize = len;
+    if (writable)
+    {
+        /* writes may need to resize the buffer, so work on a copy */
+        self->owns_map = true;
+        self->map = len > 0 ? rs_memdup(buf, len) : NULL;
+    } else {
+        self->owns_map = false;
+        self->map = len > 0 ? buf : NULL;
+    }
+    _rs_region_update_headers(self);
+    
+    return self;
 }
 
-void rs_region_set_chunk_data(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc)
+void* rs_region_get_memory(RSRegion* self, size_t* len)
 {
-    uint32_t timestamp = time(NULL);
-    rs_region_set_chunk_data_full(self, x, z, data, len, enc, timestamp);
+    rs_return_val_if_fail(self, NULL);
+    rs_return_val_if_fail(len, NULL);
+    
+    if (!self->memory)
+    {
+        *len = 0;
+        return NULL;
+    }
+    
+    *len = self->fsize;
+    return self->map;
 }
 
-void rs_region_set_chunk_data_full(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc, uint32_t timestamp)
+/* helper to resize the region's backing file or buffer and remap it
+ * (along with the headers). Existing contents are preserved, up to
+ * the new size.
+ */
+static void _rs_region_resize(RSRegion* self, off_t new_size)
 {
-    rs_return_if_fail(self);
-    rs_return_if_fail(x < 32 && z < 32);
-    if (!(self->write))
+    if (self->memory)
     {
-        rs_critical("region is not opened in write mode.");
+        rs_assert(self->owns_map);
+        if (new_size > 0)
+        {
+            self->map = rs_realloc(self->map, new_size);
+        } else {
+            rs_free(self->map);
+            self->map = NULL;
+        }
+        
+        self->fsize = new_size;
+        _rs_region_update_headers(self);
         return;
     }
     
-    /* first, check if there's a cached write already, and clear it if
-     * needed
-     */
-    RSList* cell = self->cached_writes;
-    for (; cell != NULL; cell = cell->next)
+    if (self->map)
     {
-        struct ChunkWrite* write = cell->data;
-        rs_assert(write);
-        
-        if (write->x == x && write->z == z)
-            break;
+        if (!self->nosync && msync(self->map, self->fsize, MS_SYNC) < 0)
+        {
+            rs_error("sync failed"); /* FIXME */
+        }
+        munmap(self->map, self->fsize);
+        self->map = NULL;
     }
     
-    if (cell)
+    if (ftruncate(self->fd, new_size) < 0)
     {
-        struct ChunkWrite* write = cell->data;
-        rs_free(write->data);
-        rs_free(write);
-        self->cached_writes = rs_list_remove(self->cached_writes, cell);
+        rs_error("file resize failed"); /* FIXME */
     }
     
-    if (len > 0 && data != NULL && enc == RS_AUTO_COMPRESSION)
-        enc = rs_get_compression_type(data, len);
-    
-    /* copy the data */
-    void* data_copy = NULL;
-    if (len > 0 && data != NULL)
-        data_copy = memcpy(rs_malloc(len), data, len);
-    
-    /* now, create a new write struct */
-    struct ChunkWrite* job = rs_new0(struct ChunkWrite, 1);
-    job->x = x;
-    job->z = z;
-    job->data = data_copy;
-    job->length = len;
-    job->encoding = enc;
-    job->timestamp = timestamp;
+    self->fsize = new_size;
+    if (new_size > 0)
+    {
+        self->map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+        if (self->map == MAP_FAILED)
+        {
+            rs_error("remap failed"); /* FIXME */
+        }
+    }
     
-    self->cached_writes = rs_list_push(self->cached_writes, job);
+    _rs_region_update_headers(self);
 }
 
-void rs_region_clear_chunk(RSRegion* self, uint8_t x, uint8_t z)
+/* helper to remap the region after the file was resized by someone
+ * else. Unlike _rs_region_resize(), this leaves the file alone.
+ */
+static void _rs_region_remap(RSRegion* self, off_t new_size)
 {
-    rs_region_set_chunk_data_full(self, x, z, NULL, 0, RS_UNKNOWN_COMPRESSION, 0);
+    if (self->map)
+        munmap(self->map, self->fsize);
+    self->map = NULL;
+    self->fsize = new_size;
+    if (new_size > 0)
+    {
+        self->map = mmap(NULL, new_size, self->write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, self->fd, 0);
+        if (self->map == MAP_FAILED)
+        {
+            rs_error("remap failed"); /* FIXME */
+        }
+    }
+    
+    _rs_region_update_headers(self);
+}
+
+/* helper to notice that the region file was replaced under its path
+ * (by rs_region_compact() through another handle), and switch over to
+ * the new file. Any locks held on the old file go with it. Returns
+ * true if the file was switched.
+ */
+static bool _rs_region_follow_replacement(RSRegion* self)
+{
+    if (self->memory || self->path == NULL)
+        return false;
+    
+    struct stat ours, theirs;
+    if (fstat(self->fd, &ours) < 0 || stat(self->path, &theirs) < 0)
+        return false;
+    if (ours.st_dev == theirs.st_dev && ours.st_ino == theirs.st_ino)
+        return false;
+    
+    int fd = open(self->path, (self->write ? O_RDWR : O_RDONLY) | O_BINARY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &theirs) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    
+    if (self->map)
+        munmap(self->map, self->fsize);
+    self->map = NULL;
+    self->fsize = 0;
+    close(self->fd);
+    self->fd = fd;
+    
+    _rs_region_remap(self, theirs.st_size >= 8192 ? theirs.st_size : 0);
+    _rs_region_release_externals(self);
+    return true;
+}
+
+/* helper to bring our mapping up to date with the file, and read its
+ * headers into headers (4096 * 2 bytes, or NULL). Unlike
+ * rs_region_refresh(), this leaves the header snapshot alone, so the
+ * caller's next refresh still sees every change since their last one.
+ */
+static bool _rs_region_reload(RSRegion* self, uint8_t* headers)
+{
+    uint8_t buf[4096 * 2];
+    if (headers == NULL)
+        headers = buf;
+    memset(headers, 0, 4096 * 2);
+    if (self->memory)
+        return true;
+    
+    _rs_region_follow_replacement(self);
+    
+    struct stat stat_buf;
+    if (fstat(self->fd, &stat_buf) < 0)
+    {
+        rs_critical("could not stat region file");
+        return false;
+    }
+    
+    /* a file caught in the middle of being created has no headers yet */
+    off_t new_size = stat_buf.st_size;
+    if (new_size < 8192)
+        new_size = 0;
+    
+    /* read just the headers, without touching the mapping */
+    if (new_size > 0)
+    {
+        size_t amount_read = 0;
+        while (amount_read < 4096 * 2)
+        {
+            ssize_t res = pread(self->fd, headers + amount_read, 4096 * 2 - amount_read, amount_read);
+            if (res < 0 && errno == EINTR)
+                continue;
+            if (res <= 0)
+            {
+                rs_critical("could not read region headers");
+                return false;
+            }
+            
+            amount_read += res;
+        }
+    }
+    
+    bool remap = (new_size != self->fsize);
+#ifdef MMAP_NONE
+    /* our "map" is a private copy, so it has to be reread */
+    remap = remap || (self->map && memcmp(headers, self->map, 4096 * 2) != 0);
+#endif
+    
+    if (remap)
+        _rs_region_remap(self, new_size);
+    return true;
+}
+
+/* open file description locks belong to the handle, not the process,
+ * so two handles in one process can still lock each other out
+ */
+#if defined(F_OFD_SETLKW)
+#define RS_REGION_SETLK F_OFD_SETLK
+#define RS_REGION_SETLKW F_OFD_SETLKW
+#elif defined(F_SETLKW)
+#define RS_REGION_SETLK F_SETLK
+#define RS_REGION_SETLKW F_SETLKW
+#else
+#define F_RDLCK 0
+#define F_WRLCK 1
+#define F_UNLCK 2
+#endif
+
+/* helper to take (or, with F_UNLCK, release) an advisory lock on part
+ * of the region file. A len of 0 covers everything from start on,
+ * including anything the file grows into later. If wait is false,
+ * this fails instead of blocking on a conflicting lock.
+ */
+static bool _rs_region_lock_range(RSRegion* self, off_t start, off_t len, short type, bool wait)
+{
+#ifdef RS_REGION_SETLKW
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = len;
+    
+    while (fcntl(self->fd, wait ? RS_REGION_SETLKW : RS_REGION_SETLK, &lock) < 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+#endif
+    return true;
+}
+
+/* helper to lock the location and timestamp entries of a chunk */
+static bool _rs_region_lock_entry(RSRegion* self, uint16_t i, short type, bool wait)
+{
+    if (!_rs_region_lock_range(self, i * 4, 4, type, wait))
+        return false;
+    if (!_rs_region_lock_range(self, 4096 + i * 4, 4, type, wait))
+    {
+        _rs_region_lock_range(self, i * 4, 4, F_UNLCK, false);
+        return false;
+    }
+    return true;
+}
+
+/* helper to read a chunk location straight from the file, which may
+ * be newer than (or past the end of) our mapping
+ */
+static bool _rs_region_read_location(RSRegion* self, uint16_t i, uint32_t* start, uint32_t* count)
+{
+    struct ChunkLocation loc;
+    ssize_t res;
+    do
+    {
+        res = pread(self->fd, &loc, sizeof(loc), i * 4);
+    } while (res < 0 && errno == EINTR);
+    
+    *start = 0;
+    *count = 0;
+    if (res < 0)
+        return false;
+    if (res == sizeof(loc))
+    {
+        *start = rs_endian_uint24(loc.offset);
+        *count = loc.sector_count;
+    }
+    return true;
+}
+
+/* helper to drop every chunk lock held through this handle */
+static void _rs_region_release_locks(RSRegion* self)
+{
+    if (self->locks == NULL)
+        return;
+    
+    for (uint16_t i = 0; i < 32 * 32; i++)
+    {
+        struct ChunkLock* held = &(self->locks[i]);
+        if (held->depth == 0)
+            continue;
+        
+        if (held->count > 0)
+            _rs_region_lock_range(self, (off_t)held->start * 4096, (off_t)held->count * 4096, F_UNLCK, false);
+        _rs_region_lock_entry(self, i, F_UNLCK, false);
+    }
+    
+    rs_free(self->locks);
+    self->locks = NULL;
+}
+
+/* helper to find the first sector a flush will rewrite. Anything
+ * after it may be moved, so it all has to be locked.
+ */
+static uint32_t _rs_region_first_rewritten(RSRegion* self)
+{
+    if (self->map == NULL)
+        return 0;
+    
+    uint32_t first = self->fsize / 4096;
+    RSList* cell = self->cached_writes;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct ChunkWrite* write = cell->data;
+        if (!rs_region_contains_chunk(self, write->x, write->z))
+            continue;
+        
+        uint32_t sector = rs_endian_uint24(self->locations[write->x + write->z * 32].offset);
+        if (sector < first)
+            first = sector;
+    }
+    
+    return first;
+}
+
+/* helper to lock everything a flush is about to touch, and bring our
+ * view of the file up to date underneath those locks. That is every
+ * sector from the first one rewritten through to the end of the file,
+ * plus the header entries of every chunk written or moved. Since these
+ * ranges all run to the end of the file, two flushes never overlap.
+ */
+static bool _rs_region_lock_for_flush(RSRegion* self)
+{
+    _rs_region_release_locks(self);
+    
+    /* someone else may move our chunks down before we get the lock */
+    uint32_t first = _rs_region_first_rewritten(self);
+    while (true)
+    {
+        if (!_rs_region_lock_range(self, (off_t)first * 4096, 0, F_WRLCK, true))
+            return false;
+        
+        /* the lock went away with the file, if it was replaced */
+        if (_rs_region_follow_replacement(self))
+        {
+            first = _rs_region_first_rewritten(self);
+            continue;
+        }
+        
+        _rs_region_reload(self, NULL);
+        uint32_t now = _rs_region_first_rewritten(self);
+        if (now >= first)
+            break;
+        first = now;
+    }
+    
+    /* if the headers are in the range, they're already covered */
+    if (first < 2)
+        return true;
+    
+    bool touched[32 * 32];
+    memset(touched, 0, sizeof(touched));
+    RSList* cell = self->cached_writes;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct ChunkWrite* write = cell->data;
+        touched[write->x + write->z * 32] = true;
+    }
+    for (uint16_t i = 0; i < 32 * 32; i++)
+    {
+        if (self->locations[i].sector_count > 0 && rs_endian_uint24(self->locations[i].offset) >= first)
+            touched[i] = true;
+    }
+    
+    for (uint16_t i = 0; i < 32 * 32; i++)
+    {
+        if (touched[i] && !_rs_region_lock_entry(self, i, F_WRLCK, true))
+        {
+            _rs_region_lock_range(self, 0, 0, F_UNLCK, false);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+void rs_region_close(RSRegion* self)
+{
+    rs_return_if_fail(self);
+    
+    if (self->write && self->cached_writes)
+        rs_region_flush(self);
+    rs_assert(self->cached_writes == NULL);
+    
+    _rs_region_release_externals(self);
+    _rs_region_release_locks(self);
+    rs_free(self->path);
+    rs_free(self->dir);
+    if (self->memory)
+    {
+        if (self->owns_map)
+            rs_free(self->map);
+    } else {
+        if (self->map)
+            munmap(self->map, self->fsize);
+        close(self->fd);
+    }
+    rs_free(self);
+}
+
+const char* rs_region_get_path(RSRegion* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    return self->path;
+}
+
+uint32_t rs_region_get_chunk_timestamp(RSRegion* self, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self, 0);
+    rs_return_val_if_fail(x < 32 && z < 32, 0);
+    if (self->timestamps == NULL)
+        return 0;
+    
+    if (!rs_region_contains_chunk(self, x, z))
+        return 0;
+    
+    return rs_endian_uint32(self->timestamps[x + 32*z]);
+}
+
+/* LOCAL helper function to return the start of chunk data, including
+ * size, compression
+ */
+static void* _rs_region_get_data(RSRegion* self, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self, NULL);
+    rs_return_val_if_fail(x < 32 && z < 32, NULL);
+    if (self->locations == NULL)
+        return NULL;
+    
+    /* never hand out a pointer to a size/compression header that
+     * isn't entirely inside the file
+     */
+    off_t offset = (off_t)rs_endian_uint24(self->locations[x + z*32].offset) * 4096;
+    if (offset + 4 + 1 > self->fsize)
+        return NULL;
+    
+    return self->map + offset;
+}
+
+/* LOCAL helper to return the length of the data stored inside the
+ * region itself, which is 0 for external chunks
+ */
+static uint32_t _rs_region_get_stored_length(RSRegion* self, uint8_t x, uint8_t z)
+{
+    void* start = _rs_region_get_data(self, x, z);
+    if (!start)
+        return 0;
+    
+    /* size is big-endian, and 1 larger than it should be */
+    uint32_t size;
+    memcpy(&size, start, 4);
+    size = rs_endian_uint32(size);
+    
+    /* a length that runs off the end of the file is garbage */
+    if (size == 0 || (off_t)size - 1 > self->fsize - (start - self->map) - 4 - 1)
+        return 0;
+    
+    return size - 1;
+}
+
+/* LOCAL helper to map an external chunk file, returns NULL on failure */
+static struct ExternalChunk* _rs_region_get_external(RSRegion* self, uint8_t x, uint8_t z)
+{
+    if (!self->has_coords)
+        return NULL;
+    
+    if (self->externals == NULL)
+        self->externals = rs_new0(struct ExternalChunk, 32 * 32);
+    
+    struct ExternalChunk* ext = &(self->externals[x + z * 32]);
+    if (ext->map)
+        return ext;
+    
+    char* path = _rs_region_external_path(self, x, z, false);
+    int fd = open(path, O_RDONLY | O_BINARY);
+    rs_free(path);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0 || stat_buf.st_size <= 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    void* map = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    
+    ext->map = map;
+    ext->length = stat_buf.st_size;
+    return ext;
+}
+
+uint32_t rs_region_get_chunk_length(RSRegion* self, uint8_t x, uint8_t z)
+{
+    if (!rs_region_contains_chunk(self, x, z))
+        return 0;
+    
+    if (rs_region_chunk_is_external(self, x, z))
+    {
+        struct ExternalChunk* ext = _rs_region_get_external(self, x, z);
+        return ext ? ext->length : 0;
+    }
+    
+    return _rs_region_get_stored_length(self, x, z);
+}
+
+uint64_t rs_region_get_chunk_offset(RSRegion* self, uint8_t x, uint8_t z)
+{
+    if (!rs_region_contains_chunk(self, x, z))
+        return 0;
+    
+    return (uint64_t)rs_endian_uint24(self->locations[z * 32 + x].offset) * 4096;
+}
+
+RSCompressionType rs_region_get_chunk_compression(RSRegion* self, uint8_t x, uint8_t z)
+{
+    if (!rs_region_contains_chunk(self, x, z))
+        return RS_UNKNOWN_COMPRESSION;
+    
+    uint8_t* compression_byte = (uint8_t*)_rs_region_get_data(self, x, z);
+    if (!compression_byte)
+        return RS_UNKNOWN_COMPRESSION;
+    
+    /* compression byte is the fifth byte */
+    switch (compression_byte[4] & ~RS_REGION_EXTERNAL_FLAG)
+    {
+    case 1:
+        return RS_GZIP;
+    case 2:
+        return RS_ZLIB;
+    default:
+        break;
+    };
+    
+    return RS_UNKNOWN_COMPRESSION;
+}
+
+/* valid until region is closed/flushed */
+void* rs_region_get_chunk_data(RSRegion* self, uint8_t x, uint8_t z)
+{
+    if (!rs_region_contains_chunk(self, x, z))
+        return NULL;
+    
+    if (rs_region_chunk_is_external(self, x, z))
+    {
+        struct ExternalChunk* ext = _rs_region_get_external(self, x, z);
+        return ext ? ext->map : NULL;
+    }
+    
+    void* ret = _rs_region_get_data(self, x, z);
+    if (!ret || _rs_region_get_stored_length(self, x, z) == 0)
+        return NULL;
+    
+    /* chunk data starts 5 bytes after */
+    return ret + 5;
+}
+
+bool rs_region_send_chunk(RSRegion* self, uint8_t x, uint8_t z, int fd)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(fd >= 0, false);
+    
+    uint32_t length = rs_region_get_chunk_length(self, x, z);
+    uint8_t* data = rs_region_get_chunk_data(self, x, z);
+    if (!data || length == 0)
+        return false;
+    
+    size_t sent = 0;
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+    /* external chunks and memory regions have no region file to send */
+    if (!self->memory && !rs_region_chunk_is_external(self, x, z))
+    {
+        off_t offset = data - (uint8_t*)self->map;
+        while (sent < length)
+        {
+            ssize_t ret = sendfile(fd, self->fd, &offset, length - sent);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                break;
+            sent += ret;
+        }
+    }
+#endif
+    
+    /* fall back to plain writes for anything sendfile didn't do,
+     * which is everything if fd is something it doesn't support
+     */
+    while (sent < length)
+    {
+        ssize_t ret = write(fd, data + sent, length - sent);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        sent += ret;
+    }
+    
+    return true;
+}
+
+int rs_region_open_chunk_file(RSRegion* self, uint8_t x, uint8_t z, uint64_t* offset)
+{
+    rs_return_val_if_fail(self && offset, -1);
+    
+    if (rs_region_get_chunk_length(self, x, z) == 0)
+        return -1;
+    
+    if (rs_region_chunk_is_external(self, x, z))
+    {
+        char* path = _rs_region_external_path(self, x, z, false);
+        int fd = open(path, O_RDONLY | O_BINARY);
+        rs_free(path);
+        *offset = 0;
+        return fd;
+    }
+    
+    if (self->memory || self->fd < 0)
+        return -1;
+    
+    /* chunk data starts 5 bytes after the sector */
+    *offset = rs_region_get_chunk_offset(self, x, z) + 5;
+    return dup(self->fd);
+}
+
+bool rs_region_chunk_is_external(RSRegion* self, uint8_t x, uint8_t z)
+{
+    if (!rs_region_contains_chunk(self, x, z))
+        return false;
+    
+    uint8_t* compression_byte = (uint8_t*)_rs_region_get_data(self, x, z);
+    if (!compression_byte)
+        return false;
+    
+    return (compression_byte[4] & RS_REGION_EXTERNAL_FLAG) != 0;
+}
+
+bool rs_region_contains_chunk(RSRegion* self, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(x < 32 && z < 32, false);
+    if (self->locations == NULL)
+        return false;
+    
+    uint16_t i = z * 32 + x;
+    if (self->locations[i].offset == 0)
+        return false;
+    if (self->locations[i].sector_count == 0)
+        return false;
+    if (self->timestamps[i] == 0)
+        return false;
+    
+    return true;
+}
+
+void rs_region_set_chunk_data(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc)
+{
+    uint32_t timestamp = time(NULL);
+    rs_region_set_chunk_data_full(self, x, z, data, len, enc, timestamp);
+}
+
+/* helper to free a cached write, and any external data it holds */
+static void _rs_region_free_write(struct ChunkWrite* write)
+{
+    if (write->external_tmp)
+    {
+        unlink(write->external_tmp);
+        rs_free(write->external_tmp);
+    }
+    
+    rs_free(write->data);
+    rs_free(write);
+}
+
+/* helper to stream an oversized chunk to a temporary external file,
+ * which is moved into place when the region is flushed
+ */
+static bool _rs_region_write_external(RSRegion* self, struct ChunkWrite* job, void* data, uint32_t len)
+{
+    if (!self->has_coords)
+    {
+        rs_critical("chunk is too large, and region path has no coordinates for an external chunk file.");
+        return false;
+    }
+    
+    char* tmp = _rs_region_external_path(self, job->x, job->z, true);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (fd < 0)
+    {
+        rs_critical("could not create external chunk file %s", tmp);
+        rs_free(tmp);
+        return false;
+    }
+    
+    /* the data has to be on disk before the flush renames this over
+     * an older file, or a crash could leave neither
+     */
+    if (!rs_write_all(fd, data, len) || fsync(fd) < 0)
+    {
+        rs_critical("could not write external chunk file %s", tmp);
+        close(fd);
+        unlink(tmp);
+        rs_free(tmp);
+        return false;
+    }
+    
+    if (close(fd) < 0)
+    {
+        rs_critical("could not write external chunk file %s", tmp);
+        unlink(tmp);
+        rs_free(tmp);
+        return false;
+    }
+    
+    job->external = true;
+    job->external_tmp = tmp;
+    return true;
+}
+
+/* helper to cache a chunk write, replacing any earlier one for the
+ * same chunk. Returns the new write, or NULL on failure.
+ */
+static struct ChunkWrite* _rs_region_cache_write(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc, uint32_t timestamp)
+{
+    if (!(self->write))
+    {
+        rs_critical("region is not opened in write mode.");
+        return NULL;
+    }
+    
+    if (data == NULL)
+        len = 0;
+    
+    if (len > 0 && enc == RS_AUTO_COMPRESSION)
+        enc = rs_get_compression_type(data, len);
+    
+    /* now, create a new write struct */
+    struct ChunkWrite* job = rs_new0(struct ChunkWrite, 1);
+    job->x = x;
+    job->z = z;
+    job->encoding = enc;
+    job->timestamp = timestamp;
+    
+    if (len + 4 + 1 > RS_REGION_MAX_SECTORS * 4096)
+    {
+        /* too big for the region, so stream it straight out to its
+         * own file instead of copying it
+         */
+        if (!_rs_region_write_external(self, job, data, len))
+        {
+            rs_free(job);
+            return NULL;
+        }
+    } else if (len > 0) {
+        /* copy the data */
+        job->data = memcpy(rs_malloc(len), data, len);
+        job->length = len;
+    }
+    
+    /* replace any write already cached for this chunk */
+    RSList* cell = self->write_index[x + z * 32];
+    if (cell)
+    {
+        _rs_region_free_write(cell->data);
+        cell->data = job;
+    } else {
+        self->cached_writes = rs_list_push(self->cached_writes, job);
+        self->write_index[x + z * 32] = self->cached_writes;
+    }
+    
+    return job;
+}
+
+void rs_region_set_chunk_data_full(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc, uint32_t timestamp)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(x < 32 && z < 32);
+    
+    _rs_region_cache_write(self, x, z, data, len, enc, timestamp);
+}
+
+bool rs_region_set_chunks(RSRegion* self, const RSChunkWrite* writes, size_t count)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(writes || count == 0, false);
+    if (!(self->write))
+    {
+        rs_critical("region is not opened in write mode.");
+        return false;
+    }
+    
+    /* check everything first, so a bad write doesn't leave only some
+     * of the batch cached
+     */
+    for (size_t i = 0; i < count; i++)
+    {
+        const RSChunkWrite* write = &(writes[i]);
+        if (write->x >= 32 || write->z >= 32 || (write->data == NULL && write->length > 0))
+        {
+            rs_critical("invalid chunk write at index %u", (unsigned int)i);
+            return false;
+        }
+    }
+    
+    uint32_t now = time(NULL);
+    bool ok = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        const RSChunkWrite* write = &(writes[i]);
+        uint32_t timestamp = write->timestamp ? write->timestamp : now;
+        if (!_rs_region_cache_write(self, write->x, write->z, write->data, write->length, write->encoding, timestamp))
+            ok = false;
+    }
+    
+    return ok;
+}
+
+void rs_region_set_chunk_data_if(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc, uint32_t timestamp, RSRegionCondition condition, uint32_t expected_timestamp, uint32_t expected_hash)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(x < 32 && z < 32);
+    rs_return_if_fail((condition & ~(RS_REGION_CONDITION_TIMESTAMP | RS_REGION_CONDITION_HASH)) == 0);
+    
+    struct ChunkWrite* job = _rs_region_cache_write(self, x, z, data, len, enc, timestamp);
+    if (job == NULL)
+        return;
+    
+    job->condition = condition;
+    job->expected_timestamp = expected_timestamp;
+    job->expected_hash = expected_hash;
+}
+
+uint32_t rs_region_get_chunk_hash(RSRegion* self, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self, 0);
+    rs_return_val_if_fail(x < 32 && z < 32, 0);
+    
+    void* data = rs_region_get_chunk_data(self, x, z);
+    uint32_t len = rs_region_get_chunk_length(self, x, z);
+    if (data == NULL || len == 0)
+        return 0;
+    
+    return crc32(crc32(0, Z_NULL, 0), data, len);
+}
+
+unsigned int rs_region_get_conflicts(RSRegion* self, RSRegionBitmap* conflicts)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    if (conflicts)
+        memcpy(conflicts, &(self->conflicts), sizeof(RSRegionBitmap));
+    return self->conflict_count;
+}
+
+/* helper to drop conditional writes whose chunk no longer matches what
+ * the caller expected, recording them as conflicts. The region must
+ * be up to date with the file (and locked, if locking is on).
+ */
+static void _rs_region_check_conditions(RSRegion* self)
+{
+    RSList* cell = self->cached_writes;
+    while (cell != NULL)
+    {
+        struct ChunkWrite* write = cell->data;
+        RSList* next = cell->next;
+        
+        bool ok = true;
+        if ((write->condition & RS_REGION_CONDITION_TIMESTAMP) &&
+            rs_region_get_chunk_timestamp(self, write->x, write->z) != write->expected_timestamp)
+            ok = false;
+        if ((write->condition & RS_REGION_CONDITION_HASH) &&
+            rs_region_get_chunk_hash(self, write->x, write->z) != write->expected_hash)
+            ok = false;
+        
+        /* checked once, so compact's rewrite doesn't check again */
+        write->condition = RS_REGION_CONDITION_NONE;
+        if (!ok)
+        {
+            rs_region_bitmap_set(&(self->conflicts), write->x, write->z);
+            self->conflict_count++;
+            self->write_index[write->x + write->z * 32] = NULL;
+            _rs_region_free_write(write);
+            self->cached_writes = rs_list_remove(self->cached_writes, cell);
+        }
+        
+        cell = next;
+    }
+}
+
+/* helper to find out whether any cached write is conditional */
+static bool _rs_region_has_conditions(RSRegion* self)
+{
+    RSList* cell = self->cached_writes;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct ChunkWrite* write = cell->data;
+        if (write->condition != RS_REGION_CONDITION_NONE)
+            return true;
+    }
+    return false;
+}
+
+void rs_region_clear_chunk(RSRegion* self, uint8_t x, uint8_t z)
+{
+    rs_region_set_chunk_data_full(self, x, z, NULL, 0, RS_UNKNOWN_COMPRESSION, 0);
 }
 
 /* helper to convert to/from file representation of encodings */
@@ -312,27 +1332,200 @@ static inline uint8_t _rs_region_get_encoding(RSCompressionType enc)
     return 0;
 }
 
-/* writes are cached until this is called */
-void rs_region_flush(RSRegion* self)
+/* helper to write a chunk's size/compression header and data to dest */
+static void _rs_region_write_chunk(void* dest, struct ChunkWrite* write)
+{
+    /* convert compression types */
+    uint8_t enc = write->raw ? write->raw_encoding : _rs_region_get_encoding(write->encoding);
+    if (write->external)
+        enc |= RS_REGION_EXTERNAL_FLAG;
+    
+    /* write data carefully */
+    ((uint32_t*)dest)[0] = rs_endian_uint32(write->length + 1);
+    ((uint8_t*)dest)[4] = enc;
+    if (write->length > 0)
+        memcpy(dest + 4 + 1, write->data, write->length);
+}
+
+/* qsort comparison for OrderedChunkWrite */
+static int _rs_region_compare_ordered(const void* a, const void* b)
+{
+    const struct OrderedChunkWrite* oa = a;
+    const struct OrderedChunkWrite* ob = b;
+    if (oa->order != ob->order)
+        return oa->order < ob->order ? -1 : 1;
+    return 0;
+}
+
+/* helper to tell whether a cached write deletes its chunk */
+static inline bool _rs_region_write_is_clear(struct ChunkWrite* write)
+{
+    return write->data == NULL && !write->external;
+}
+
+/* helper to interleave the bits of x and z into a Morton (Z-order) code */
+static inline uint16_t _rs_region_morton(uint8_t x, uint8_t z)
+{
+    uint16_t code = 0;
+    for (unsigned int bit = 0; bit < 5; bit++)
+    {
+        code |= ((x >> bit) & 1) << (2 * bit);
+        code |= ((z >> bit) & 1) << (2 * bit + 1);
+    }
+    
+    return code;
+}
+
+/* helper to order cached writes according to the layout policy, for
+ * writing a region from scratch. plan must have room for 32 * 32
+ * writes, and unused slots are set to NULL.
+ */
+static void _rs_region_plan_layout(RSRegion* self, struct ChunkWrite** plan)
+{
+    memset(plan, 0, sizeof(struct ChunkWrite*) * 32 * 32);
+    
+    unsigned int next = 0;
+    RSList* cell = self->cached_writes;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct ChunkWrite* write = cell->data;
+        rs_assert(write);
+        
+        switch (self->layout)
+        {
+        case RS_REGION_LAYOUT_LINEAR:
+            plan[write->x + write->z * 32] = write;
+            break;
+        case RS_REGION_LAYOUT_ZORDER:
+            plan[_rs_region_morton(write->x, write->z)] = write;
+            break;
+        default:
+            /* cached writes are unique per chunk, so this never overflows */
+            rs_assert(next < 32 * 32);
+            plan[next++] = write;
+            break;
+        };
+    }
+}
+
+/* helper to swap the region file for one holding data, which is
+ * written next to it, synced, and renamed into place, so a crash
+ * leaves either the old file or the new one. Other handles notice the
+ * switch in _rs_region_follow_replacement().
+ */
+static bool _rs_region_replace_file(RSRegion* self, const void* data, size_t len)
+{
+    char* tmp_path;
+    int fd = rs_file_replace_begin(self->path, &tmp_path);
+    if (fd < 0)
+        return false;
+    
+    if (!rs_write_all(fd, data, len))
+    {
+        rs_file_replace_abort(fd, tmp_path);
+        return false;
+    }
+    
+    /* this can fail after the rename, so look for the new file anyway */
+    bool ok = rs_file_replace_commit(fd, tmp_path, self->path, !self->nosync);
+    _rs_region_follow_replacement(self);
+    return ok;
+}
+
+/* writes are cached until this is called. This does the actual work
+ * of rs_region_flush(), without resetting the conflicts found so far.
+ * If replace is set, the region is written from scratch into a new
+ * file, which replaces the old one.
+ */
+static void _rs_region_flush(RSRegion* self, bool replace)
 {
-    rs_return_if_fail(self);
-    
     RSList* cell;
     
+    /* external chunk files are about to change underneath us */
+    _rs_region_release_externals(self);
+    
+    /* chunks that are external now, but won't be after this flush */
+    bool drop_external[32 * 32];
+    memset(drop_external, 0, sizeof(drop_external));
+    
+    /* keep other processes out of the parts of the file we rewrite */
+    bool locked = false;
+    if (self->write && self->cached_writes && self->locking)
+    {
+        if (!_rs_region_lock_for_flush(self))
+        {
+            rs_critical("could not lock region file");
+            return;
+        }
+        locked = true;
+    }
+    
+    /* conditions are checked against the file as it is right now */
+    if (self->write && _rs_region_has_conditions(self))
+    {
+        if (!locked)
+            _rs_region_reload(self, NULL);
+        _rs_region_check_conditions(self);
+    }
+    
+    /* the headers before this flush, to tell our changes from others' */
+    uint8_t before[4096 * 2];
+    _rs_region_copy_headers(self, before);
+    
     if (self->write && self->cached_writes)
     {
+        /* move new external chunk files into place, and remember which
+         * old ones are being replaced by in-region data (or nothing)
+         */
+        bool renamed = false;
+        for (cell = self->cached_writes; cell != NULL; cell = cell->next)
+        {
+            struct ChunkWrite* write = cell->data;
+            if (write->external)
+            {
+                if (write->external_tmp)
+                {
+                    char* path = _rs_region_external_path(self, write->x, write->z, false);
+                    if (rename(write->external_tmp, path) < 0)
+                        rs_error("could not move external chunk into place"); /* FIXME */
+                    rs_free(path);
+                    renamed = true;
+                    rs_free(write->external_tmp);
+                    write->external_tmp = NULL;
+                }
+            } else if (self->map && rs_region_chunk_is_external(self, write->x, write->z)) {
+                drop_external[write->x + write->z * 32] = true;
+            }
+        }
+        
+        /* the renames have to be durable before the region points at
+         * the new files (rs_region_sync() catches up on this later)
+         */
+        if (renamed)
+            self->pending_dir_sync = true;
+        if (self->pending_dir_sync && !self->nosync)
+        {
+            if (!rs_sync_parent_directory(self->path))
+                rs_critical("could not sync directory of %s", self->path);
+            self->pending_dir_sync = false;
+        }
+        
         /* check to see if this is a brand-new file */
-        if (self->map == NULL)
+        if (self->map == NULL || replace)
         {
             /* it is! so we have to write everything */
             
-            /* first, figure out how big the file needs to be */
+            /* first, decide on the order chunks will be written in */
+            struct ChunkWrite* plan[32 * 32];
+            _rs_region_plan_layout(self, plan);
+            
+            /* figure out how big the file needs to be */
             uint32_t final_size = 0;
-            cell = self->cached_writes;
-            for (; cell != NULL; cell = cell->next)
+            for (unsigned int j = 0; j < 32 * 32; j++)
             {
-                struct ChunkWrite* write = cell->data;
-                rs_assert(write);
+                struct ChunkWrite* write = plan[j];
+                if (write == NULL || _rs_region_write_is_clear(write))
+                    continue;
                 
                 /* be sure to account for extra size/compression info */
                 final_size += write->length + 4 + 1;
@@ -348,65 +1541,63 @@ void rs_region_flush(RSRegion* self)
             /* make sure final size is on sector boundary */
             rs_assert(final_size % 4096 == 0);
             
-            /* resize the file, and remap */
-            if (ftruncate(self->fd, final_size) < 0)
+            /* a replacement is put together in memory first */
+            uint8_t* dest;
+            if (replace)
             {
-                rs_error("file resize failed"); /* FIXME */
-            }
-            self->fsize = final_size;
-            self->map = mmap(NULL, final_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
-            if (self->map == MAP_FAILED)
-            {
-                rs_error("remap failed"); /* FIXME */
+                dest = rs_new0(uint8_t, final_size);
+            } else {
+                /* resize the file, and remap */
+                _rs_region_resize(self, final_size);
+                dest = self->map;
+                
+                /* zero out the headers */
+                memset(dest, 0, 4096 * 2);
             }
             
-            self->locations = (struct ChunkLocation*)(self->map);
-            self->timestamps = (uint32_t*)(self->map + 4096);
-            
-            /* zero out the headers */
-            memset(self->map, 0, 4096 * 2);
+            struct ChunkLocation* locations = (struct ChunkLocation*)dest;
+            uint32_t* timestamps = (uint32_t*)(dest + 4096);
             
-            /* now, we can iterate through the writes and copy them in */
+            /* now, we can iterate through the plan and copy them in */
             uint32_t cur_sector = 2;
-            for (cell = self->cached_writes; cell != NULL; cell = cell->next)
+            for (unsigned int j = 0; j < 32 * 32; j++)
             {
-                struct ChunkWrite* write = cell->data;
-                rs_assert(write);
-                
-                unsigned int i = write->x + write->z*32;
+                struct ChunkWrite* write = plan[j];
                 
-                /* handle chunk clears */
-                if (write->length == 0)
-                {
-                    self->locations[i].offset = 0;
-                    self->locations[i].sector_count = 0;
-                    self->timestamps[i] = 0;
+                /* chunk clears (and empty plan slots) leave the headers zeroed */
+                if (write == NULL || _rs_region_write_is_clear(write))
                     continue;
-                }
+                
+                unsigned int i = write->x + write->z*32;
                 
                 uint8_t sector_count = (write->length + 4 + 1) / 4096;
                 if ((write->length + 4 + 1) % 4096 > 0)
                     sector_count++;
                 
-                self->locations[i].offset = rs_endian_uint24(cur_sector);
-                self->locations[i].sector_count = sector_count;
-                self->timestamps[i] = rs_endian_uint32(write->timestamp);
-                
-                /* convert compression types */
-                uint8_t enc = _rs_region_get_encoding(write->encoding);
+                locations[i].offset = rs_endian_uint24(cur_sector);
+                locations[i].sector_count = sector_count;
+                timestamps[i] = rs_endian_uint32(write->timestamp);
                 
-                /* write the pre-data header (carefully) */
-                void* dest = _rs_region_get_data(self, write->x, write->z);
-                ((uint32_t*)dest)[0] = rs_endian_uint32(write->length + 1);
-                ((uint8_t*)dest)[4] = enc;
-                
-                /* write out the data */
-                rs_assert(write->data);
-                memcpy(dest + 4 + 1, write->data, write->length);
+                /* write the pre-data header and the data */
+                _rs_region_write_chunk(dest + cur_sector * 4096, write);
                 
                 /* move along */
                 cur_sector += sector_count;
             }
+            
+            if (replace)
+            {
+                bool replaced = _rs_region_replace_file(self, dest, final_size);
+                rs_free(dest);
+                if (!replaced)
+                {
+                    /* keep the writes around for the next flush */
+                    rs_critical("could not replace region file %s", self->path);
+                    if (locked)
+                        _rs_region_lock_range(self, 0, 0, F_UNLCK, false);
+                    return;
+                }
+            }
         } else {
             /* there's already header info in place, we just need to
              * shuffle things around and update it
@@ -425,28 +1616,31 @@ void rs_region_flush(RSRegion* self)
              * efficiently rewrite the region in only two passes
              */
             
-            RSList* shrinks = NULL;
-            RSList* grows = NULL;
+            unsigned int write_count = rs_list_size(self->cached_writes);
+            struct OrderedChunkWrite* shrinks = rs_new(struct OrderedChunkWrite, write_count);
+            struct OrderedChunkWrite* grows = rs_new(struct OrderedChunkWrite, write_count);
+            unsigned int shrink_count = 0;
+            unsigned int grow_count = 0;
             
             for (cell = self->cached_writes; cell != NULL; cell = cell->next)
             {
                 struct ChunkWrite* write = cell->data;
-                RSList** dest = NULL;
+                struct OrderedChunkWrite* ordered_write = NULL;
                 
                 bool exists = rs_region_contains_chunk(self, write->x, write->z);
-                if (write->data == NULL && !exists)
+                if (_rs_region_write_is_clear(write) && !exists)
                 {
                     /* clearing a non-existant chunk is a no-op */
                     continue;
                 }
                 
-                if (write->data == NULL || (exists && write->length <= rs_region_get_chunk_length(self, write->x, write->z)))
+                if (_rs_region_write_is_clear(write) || (exists && write->length <= _rs_region_get_stored_length(self, write->x, write->z)))
                 {
                     /* this write will shrink the file */
-                    dest = &shrinks;
+                    ordered_write = &(shrinks[shrink_count++]);
                 } else {
                     /* this write will grow the file */
-                    dest = &grows;
+                    ordered_write = &(grows[grow_count++]);
                     sectors_added += (write->length + 4 + 1) / 4096;
                     if ((write->length + 4 + 1) % 4096 > 0)
                         sectors_added++;
@@ -456,10 +1650,6 @@ void rs_region_flush(RSRegion* self)
                     }
                 }
                 
-                /* make sure we have a list to insert into */
-                rs_assert(dest != NULL);
-                
-                struct OrderedChunkWrite* ordered_write = rs_new(struct OrderedChunkWrite, 1);
                 ordered_write->write = write;
                 ordered_write->order = rs_endian_uint24(self->locations[write->z * 32 + write->x].offset);
                 if (!exists)
@@ -467,54 +1657,34 @@ void rs_region_flush(RSRegion* self)
                     /* so this chunk is being *added* not modified. We
                      * want to add chunks at the very beginning of the
                      * grow process (taking place at the *end* of the
-                     * file), so we need these to show up at the very
-                     * end of the list.
+                     * file), so we need these to sort to the very end.
                      */
                     ordered_write->order = UINT32_MAX;
                 }
-                
-                while (true)
-                {
-                    if (*dest == NULL)
-                    {
-                        /* end of the line -- must insert it here */
-                        *dest = rs_list_push(*dest, ordered_write);
-                        break;
-                    } else {
-                        /* check to see if we should insert here */
-                        struct OrderedChunkWrite* other = (*dest)->data;
-                        if (ordered_write->order <= other->order)
-                        {
-                            /* make sure we don't have any duplicate writes */
-                            rs_assert(write->x != other->write->x || write->z != other->write->z);
-                            
-                            /* insert before this element! */
-                            *dest = rs_list_push(*dest, ordered_write);
-                            break;
-                        }
-                        
-                        dest = &((*dest)->next);
-                    }
-                }   
             }
             
+            /* cached writes are unique per chunk, so sorting once is
+             * all it takes to get them in file order
+             */
+            qsort(shrinks, shrink_count, sizeof(struct OrderedChunkWrite), _rs_region_compare_ordered);
+            qsort(grows, grow_count, sizeof(struct OrderedChunkWrite), _rs_region_compare_ordered);
+            
             /* save the old file size, write to new one */
             uint32_t new_fsize = self->fsize;
             
             /* shrink the file */
-            if (shrinks)
+            if (shrink_count > 0)
             {
                 /* skip ahead to the first interesting part */
-                struct OrderedChunkWrite* first = shrinks->data;
+                struct OrderedChunkWrite* first = &(shrinks[0]);
                 read_head = _rs_region_get_data(self, first->write->x, first->write->z);
                 read_head_sector = rs_endian_uint24(self->locations[first->write->z * 32 + first->write->x].offset);
                 write_head = read_head;
                 write_head_sector = read_head_sector;
             }
-            for (cell = shrinks; cell != NULL; cell = cell->next)
+            for (unsigned int j = 0; j < shrink_count; j++)
             {
-                struct OrderedChunkWrite* ordered_write = cell->data;
-                struct ChunkWrite* write = ordered_write->write;
+                struct ChunkWrite* write = shrinks[j].write;
                 
                 /* move the read head up to the start of this data */
                 void* data_start = _rs_region_get_data(self, write->x, write->z);
@@ -548,7 +1718,7 @@ void rs_region_flush(RSRegion* self)
                 uint16_t i = write->z * 32 + write->x;
                 uint8_t old_size = self->locations[i].sector_count;
                 
-                if (write->data == NULL)
+                if (_rs_region_write_is_clear(write))
                 {
                     /* deleting this chunk */
                     self->locations[i].offset = 0;
@@ -566,13 +1736,7 @@ void rs_region_flush(RSRegion* self)
                     self->locations[i].sector_count = new_size;
                     self->timestamps[i] = rs_endian_uint32(write->timestamp);
                     
-                    /* convert compression types */
-                    uint8_t enc = _rs_region_get_encoding(write->encoding);
-                    
-                    /* write data carefully */
-                    ((uint32_t*)write_head)[0] = rs_endian_uint32(write->length + 1);
-                    ((uint8_t*)write_head)[4] = enc;
-                    memcpy(write_head + 4 + 1, write->data, write->length);
+                    _rs_region_write_chunk(write_head, write);
                     
                     write_head += new_size * 4096;
                     new_fsize += new_size * 4096;
@@ -584,146 +1748,802 @@ void rs_region_flush(RSRegion* self)
                 new_fsize -= old_size * 4096;
                 read_head_sector += old_size;
             }
-            rs_list_foreach(shrinks, rs_free);
-            rs_list_free(shrinks);
+            if (shrink_count > 0 && read_head_sector > write_head_sector)
+            {
+                /* everything after the last shrunk chunk moves down, too */
+                void* data_end = self->map + self->fsize;
+                rs_assert(data_end >= read_head);
+                
+                for (uint16_t i = 0; i < 32 * 32; i++)
+                {
+                    uint32_t sector = rs_endian_uint24(self->locations[i].offset);
+                    if (sector >= read_head_sector && self->locations[i].sector_count > 0)
+                        self->locations[i].offset = rs_endian_uint24(sector - (read_head_sector - write_head_sector));
+                }
+                
+                memmove(write_head, read_head, data_end - read_head);
+            }
+            rs_free(shrinks);
+            
+            /* resize the file to account for both shrinking and growing */
+            new_fsize += sectors_added * 4096;
+            rs_assert(new_fsize % 4096 == 0);
+            _rs_region_resize(self, new_fsize);
+            
+            /* grow the file (in reverse, so copying doesn't overwrite
+             * information we still need)
+             */
+            write_head = self->map + self->fsize;
+            write_head_sector = self->fsize / 4096;
+            read_head = write_head - (sectors_added * 4096);
+            read_head_sector = write_head_sector - sectors_added;
+            for (unsigned int j = grow_count; j > 0; j--)
+            {
+                struct ChunkWrite* write = grows[j - 1].write;
+                uint16_t i = write->z * 32 + write->x;
+                if (rs_region_contains_chunk(self, write->x, write->z))
+                {
+                    /* enlarging chunk */
+                    
+                    /* move read head to just past this chunk */
+                    void* data_end = _rs_region_get_data(self, write->x, write->z);
+                    data_end += self->locations[i].sector_count * 4096;
+                    
+                    rs_assert(data_end <= read_head);
+                    rs_assert((size_t)(read_head - data_end) % 4096 == 0);
+                    rs_assert(read_head_sector <= write_head_sector);
+                    uint32_t sectors_to_write = (read_head - data_end) / 4096;
+                    
+                    for (uint8_t z = 0; z < 32; z++)
+                    {
+                        for (uint8_t x = 0; x < 32; x++)
+                        {
+                            uint32_t sector = rs_endian_uint24(self->locations[z * 32 + x].offset);
+                            if (sector >= read_head_sector - sectors_to_write && sector < read_head_sector)
+                            {
+                                /* we need to shift this location */
+                                uint32_t new_sector = sector + (write_head_sector - read_head_sector);
+                                rs_assert(new_sector >= sector);
+                                self->locations[z * 32 + x].offset = rs_endian_uint24(new_sector);
+                            }
+                        }
+                    }
+                    
+                    write_head -= read_head - data_end;
+                    write_head_sector -= sectors_to_write;
+                    memmove(write_head, data_end, read_head - data_end);
+                    read_head -= read_head - data_end;
+                    read_head_sector -= sectors_to_write;
+                    rs_assert(read_head == data_end);
+                    
+                    /* write out the new, enlarged chunk */
+                    
+                    uint8_t old_sectors = self->locations[i].sector_count;
+                    uint8_t sectors = (write->length + 4 + 1) / 4096;
+                    if ((write->length + 4 + 1) % 4096 > 0)
+                        sectors++;
+                    
+                    write_head -= sectors * 4096;
+                    write_head_sector -= sectors;
+                    
+                    self->locations[i].offset = rs_endian_uint24(write_head_sector);
+                    self->locations[i].sector_count = sectors;
+                    self->timestamps[i] = rs_endian_uint32(write->timestamp);
+                    
+                    _rs_region_write_chunk(write_head, write);
+                    
+                    /* move read head past old chunk */
+                    read_head -= old_sectors * 4096;
+                    read_head_sector -= old_sectors;
+                } else {
+                    /* adding chunk */
+                    uint8_t sectors = (write->length + 4 + 1) / 4096;
+                    if ((write->length + 4 + 1) % 4096 > 0)
+                        sectors++;
+                    
+                    write_head -= sectors * 4096;
+                    write_head_sector -= sectors;
+                    
+                    self->locations[i].offset = rs_endian_uint24(write_head_sector);
+                    self->locations[i].sector_count = sectors;
+                    self->timestamps[i] = rs_endian_uint32(write->timestamp);
+                    
+                    _rs_region_write_chunk(write_head, write);
+                }
+            }
+            rs_free(grows);
+            
+            /* all done (*phew*) */
+        }
+    }
+    
+    /* clear the cached writes */
+    rs_list_foreach(self->cached_writes, (RSListFunction)_rs_region_free_write);
+    rs_list_free(self->cached_writes);
+    self->cached_writes = NULL;
+    memset(self->write_index, 0, sizeof(self->write_index));
+    
+    /* remove external chunk files that are no longer referenced */
+    if (self->has_coords)
+    {
+        for (uint16_t i = 0; i < 32 * 32; i++)
+        {
+            if (!drop_external[i])
+                continue;
+            
+            char* path = _rs_region_external_path(self, i % 32, i / 32, false);
+            unlink(path);
+            rs_free(path);
+        }
+    }
+    
+    /* sync the memory */
+    if (!self->memory && !self->nosync && self->map && msync(self->map, self->fsize, MS_SYNC) < 0)
+    {
+        rs_error("sync failed"); /* FIXME */
+    }
+    
+    if (locked)
+        _rs_region_lock_range(self, 0, 0, F_UNLCK, false);
+    
+    _rs_region_snapshot_changes(self, before);
+}
+
+void rs_region_flush(RSRegion* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_region_bitmap_clear(&(self->conflicts));
+    self->conflict_count = 0;
+    _rs_region_flush(self, false);
+}
+
+void rs_region_flush_nosync(RSRegion* self)
+{
+    rs_return_if_fail(self);
+    
+    self->nosync = true;
+    rs_region_flush(self);
+    self->nosync = false;
+}
+
+bool rs_region_sync(RSRegion* self)
+{
+    rs_return_val_if_fail(self, false);
+    
+    if (self->memory)
+        return true;
+    
+    /* some mmap implementations need to be told to write back first */
+    if (self->map && msync(self->map, self->fsize, MS_SYNC) < 0)
+        return false;
+
+#ifdef HAVE_FDATASYNC
+    if (fdatasync(self->fd) < 0)
+        return false;
+#else
+    if (fsync(self->fd) < 0)
+        return false;
+#endif
+    
+    /* external chunk files moved into place by a flush without syncing */
+    if (self->pending_dir_sync)
+    {
+        if (!rs_sync_parent_directory(self->path))
+            return false;
+        self->pending_dir_sync = false;
+    }
+    
+    return true;
+}
+
+bool rs_region_is_dirty(RSRegion* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->write && self->cached_writes != NULL;
+}
+
+/* qsort comparison for SectorRange, by starting sector */
+static int _rs_region_compare_ranges(const void* a, const void* b)
+{
+    const struct SectorRange* ra = a;
+    const struct SectorRange* rb = b;
+    if (ra->start != rb->start)
+        return ra->start < rb->start ? -1 : 1;
+    return 0;
+}
+
+/* helper to check the location table for chunks that overlap each
+ * other or lie outside the data area of the file, in O(n log n). The
+ * bitmaps are filled in with the offending chunks, and the number of
+ * sectors used by in-bounds chunks is returned.
+ */
+static uint32_t _rs_region_check_sectors(RSRegion* self, RSRegionBitmap* overlapping, RSRegionBitmap* out_of_bounds)
+{
+    rs_region_bitmap_clear(overlapping);
+    rs_region_bitmap_clear(out_of_bounds);
+    if (self->locations == NULL)
+        return 0;
+    
+    uint32_t total_sectors = (self->fsize + 4095) / 4096;
+    struct SectorRange ranges[32 * 32];
+    unsigned int n = 0;
+    
+    for (uint16_t i = 0; i < 32 * 32; i++)
+    {
+        if (self->locations[i].offset == 0 || self->locations[i].sector_count == 0 || self->timestamps[i] == 0)
+            continue;
+        
+        uint32_t start = rs_endian_uint24(self->locations[i].offset);
+        uint32_t count = self->locations[i].sector_count;
+        if (start < 2 || start + count > total_sectors || (off_t)start * 4096 + 4 + 1 > self->fsize)
+        {
+            rs_region_bitmap_set(out_of_bounds, i % 32, i / 32);
+            continue;
+        }
+        
+        ranges[n].start = start;
+        ranges[n].count = count;
+        ranges[n].index = i;
+        n++;
+    }
+    
+    qsort(ranges, n, sizeof(struct SectorRange), _rs_region_compare_ranges);
+    
+    /* sweep through in order, remembering the range that reaches furthest */
+    uint32_t live = 0;
+    uint32_t reach = 0;
+    int reach_owner = -1;
+    for (unsigned int j = 0; j < n; j++)
+    {
+        uint32_t end = ranges[j].start + ranges[j].count;
+        if (ranges[j].start < reach)
+        {
+            rs_region_bitmap_set(overlapping, ranges[j].index % 32, ranges[j].index / 32);
+            rs_region_bitmap_set(overlapping, reach_owner % 32, reach_owner / 32);
+            if (end > reach)
+                live += end - reach;
+        } else {
+            live += ranges[j].count;
+        }
+        
+        if (end > reach)
+        {
+            reach = end;
+            reach_owner = ranges[j].index;
+        }
+    }
+    
+    return live;
+}
+
+void rs_region_get_stats(RSRegion* self, RSRegionStats* stats)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(stats);
+    
+    memset(stats, 0, sizeof(RSRegionStats));
+    stats->total_sectors = (self->fsize + 4095) / 4096;
+    if (self->locations == NULL)
+        return;
+    
+    RSRegionBitmap overlapping, out_of_bounds;
+    stats->live_sectors = _rs_region_check_sectors(self, &overlapping, &out_of_bounds);
+    if (stats->total_sectors > 2)
+        stats->dead_sectors = stats->total_sectors - 2 - stats->live_sectors;
+    
+    for (uint8_t z = 0; z < 32; z++)
+    {
+        for (uint8_t x = 0; x < 32; x++)
+        {
+            if (!rs_region_contains_chunk(self, x, z))
+                continue;
+            
+            stats->chunk_count++;
+            if (rs_region_bitmap_get(&overlapping, x, z))
+                stats->overlapping_count++;
+            if (rs_region_bitmap_get(&out_of_bounds, x, z))
+            {
+                /* can't trust anything past the header for these */
+                stats->out_of_bounds_count++;
+                continue;
+            }
+            
+            stats->compression_counts[rs_region_get_chunk_compression(self, x, z)]++;
+            
+            uint8_t sectors = self->locations[x + z * 32].sector_count;
+            if (rs_region_chunk_is_external(self, x, z))
+            {
+                stats->external_count++;
+                stats->size_histogram[RS_REGION_STATS_BUCKETS - 1]++;
+            } else {
+                unsigned int bucket = 0;
+                while ((sectors >> (bucket + 1)) > 0)
+                    bucket++;
+                stats->size_histogram[bucket]++;
+            }
+            
+            /* data plus size/compression info, compared to the sectors it fills */
+            uint64_t stored = (uint64_t)_rs_region_get_stored_length(self, x, z) + 4 + 1;
+            uint64_t capacity = (uint64_t)sectors * 4096;
+            stats->data_bytes += stored - 4 - 1;
+            if (stored < capacity)
+                stats->slack_bytes += capacity - stored;
+        }
+    }
+}
+
+/* shared state for decompression checks in rs_region_verify() */
+struct VerifyJob
+{
+    RSRegion* region;
+    uint16_t* chunks;
+    uint32_t count;
+    uint32_t next;
+    bool* bad;
+};
+
+static void _rs_region_verify_worker(void* user, unsigned int thread)
+{
+    struct VerifyJob* job = user;
+    uint32_t j;
+    while ((j = rs_thread_next(&(job->next))) < job->count)
+    {
+        uint8_t x = job->chunks[j] % 32;
+        uint8_t z = job->chunks[j] / 32;
+        
+        /* these only read the map, so they are safe to share */
+        void* data = rs_region_get_chunk_data(job->region, x, z);
+        uint32_t len = rs_region_get_chunk_length(job->region, x, z);
+        RSCompressionType enc = rs_region_get_chunk_compression(job->region, x, z);
+        
+        uint8_t* out = NULL;
+        size_t outlen = 0;
+        if (data && len > 0)
+            rs_decompress(enc, data, len, &out, &outlen);
+        
+        if (out == NULL)
+            job->bad[j] = true;
+        rs_free(out);
+    }
+}
+
+bool rs_region_verify(RSRegion* self, RSRegionVerifyFlags flags, unsigned int nthreads, RSRegionVerifyResult* result)
+{
+    rs_return_val_if_fail(self, false);
+    
+    RSRegionVerifyResult local;
+    if (result == NULL)
+        result = &local;
+    
+    memset(result, 0, sizeof(RSRegionVerifyResult));
+    if (self->locations == NULL)
+        return true;
+    
+    _rs_region_check_sectors(self, &(result->overlapping), &(result->out_of_bounds));
+    
+    uint16_t chunks[32 * 32];
+    uint32_t count = 0;
+    for (uint8_t z = 0; z < 32; z++)
+    {
+        for (uint8_t x = 0; x < 32; x++)
+        {
+            if (!rs_region_contains_chunk(self, x, z))
+                continue;
             
-            /* resize the file to account for both shrinking and growing */
-            new_fsize += sectors_added * 4096;
-            rs_assert(new_fsize % 4096 == 0);
-            if (msync(self->map, self->fsize, MS_SYNC) < 0)
+            result->chunk_count++;
+            if (rs_region_bitmap_get(&(result->out_of_bounds), x, z))
+                continue;
+            
+            /* the length prefix must fit inside the sectors we were given */
+            uint32_t* size_int = _rs_region_get_data(self, x, z);
+            uint32_t size = size_int ? rs_endian_uint32(size_int[0]) : 0;
+            if (size == 0 || (uint64_t)size + 4 > (uint64_t)self->locations[x + z * 32].sector_count * 4096)
             {
-                rs_error("sync failed"); /* FIXME */
+                rs_region_bitmap_set(&(result->bad_length), x, z);
+                continue;
             }
-            munmap(self->map, self->fsize);
-            if (ftruncate(self->fd, new_fsize) < 0)
+            
+            if (rs_region_get_chunk_compression(self, x, z) == RS_UNKNOWN_COMPRESSION)
             {
-                rs_error("file resize failed"); /* FIXME */
+                rs_region_bitmap_set(&(result->bad_data), x, z);
+                continue;
             }
-            self->map = mmap(NULL, new_fsize, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
-            if (self->map == MAP_FAILED)
+            
+            if (rs_region_chunk_is_external(self, x, z) && rs_region_get_chunk_data(self, x, z) == NULL)
             {
-                rs_error("remap failed"); /* FIXME */
+                /* external chunk file is missing */
+                rs_region_bitmap_set(&(result->bad_data), x, z);
+                continue;
             }
-            self->fsize = new_fsize;
-            self->locations = (struct ChunkLocation*)(self->map);
-            self->timestamps = (uint32_t*)(self->map + 4096);
             
-            /* grow the file (in reverse, so copying doesn't overwrite
-             * information we still need)
-             */
-            write_head = self->map + self->fsize;
-            write_head_sector = self->fsize / 4096;
-            read_head = write_head - (sectors_added * 4096);
-            read_head_sector = write_head_sector - sectors_added;
-            grows = rs_list_reverse(grows);
-            for (cell = grows; cell != NULL; cell = cell->next)
+            chunks[count++] = x + z * 32;
+        }
+    }
+    
+    if ((flags & RS_REGION_VERIFY_DECOMPRESS) && count > 0)
+    {
+        /* external chunks are mapped above, so workers never modify the region */
+        struct VerifyJob job;
+        job.region = self;
+        job.chunks = chunks;
+        job.count = count;
+        job.next = 0;
+        job.bad = rs_new0(bool, count);
+        
+        if (nthreads == 0)
+            nthreads = rs_thread_get_default_count();
+        rs_thread_run(MIN(nthreads, count), _rs_region_verify_worker, &job);
+        
+        for (uint32_t j = 0; j < count; j++)
+        {
+            if (job.bad[j])
+                rs_region_bitmap_set(&(result->bad_data), chunks[j] % 32, chunks[j] / 32);
+        }
+        rs_free(job.bad);
+    }
+    
+    for (unsigned int row = 0; row < 32; row++)
+    {
+        uint32_t bad = result->overlapping.bits[row] | result->out_of_bounds.bits[row] |
+            result->bad_length.bits[row] | result->bad_data.bits[row];
+        for (; bad; bad &= bad - 1)
+            result->error_count++;
+    }
+    
+    return result->error_count == 0;
+}
+
+/* shared state for rs_region_verify_files() */
+struct VerifyFilesJob
+{
+    const char** paths;
+    uint32_t count;
+    uint32_t next;
+    RSRegionVerifyFlags flags;
+    RSRegionVerifyFunction func;
+    void* user;
+    RSMutex* lock;
+    unsigned int failures;
+};
+
+static void _rs_region_verify_files_worker(void* user, unsigned int thread)
+{
+    struct VerifyFilesJob* job = user;
+    uint32_t i;
+    while ((i = rs_thread_next(&(job->next))) < job->count)
+    {
+        RSRegionVerifyResult result;
+        bool ok = false;
+        
+        /* files are already spread across threads, so verify each on one */
+        RSRegion* region = rs_region_open(job->paths[i], false);
+        if (region)
+        {
+            ok = rs_region_verify(region, job->flags, 1, &result);
+            rs_region_close(region);
+        }
+        
+        rs_mutex_lock(job->lock);
+        if (!ok)
+            job->failures++;
+        if (job->func)
+            job->func(job->paths[i], region ? &result : NULL, job->user);
+        rs_mutex_unlock(job->lock);
+    }
+}
+
+unsigned int rs_region_verify_files(const char** paths, unsigned int count, RSRegionVerifyFlags flags, unsigned int nthreads, RSRegionVerifyFunction func, void* user)
+{
+    rs_return_val_if_fail(paths || count == 0, 0);
+    if (count == 0)
+        return 0;
+    
+    struct VerifyFilesJob job;
+    job.paths = paths;
+    job.count = count;
+    job.next = 0;
+    job.flags = flags;
+    job.func = func;
+    job.user = user;
+    job.lock = rs_mutex_new();
+    job.failures = 0;
+    
+    if (nthreads == 0)
+        nthreads = rs_thread_get_default_count();
+    rs_thread_run(MIN(nthreads, count), _rs_region_verify_files_worker, &job);
+    
+    rs_mutex_free(job.lock);
+    return job.failures;
+}
+
+unsigned int rs_region_refresh(RSRegion* self, RSRegionBitmap* changed)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    if (changed)
+        rs_region_bitmap_clear(changed);
+    if (self->memory)
+        return 0;
+    
+    uint8_t headers[4096 * 2];
+    if (!_rs_region_reload(self, headers))
+        return 0;
+    
+    /* compare location and timestamp entries, which are both 4 bytes */
+    unsigned int count = 0;
+    for (uint16_t i = 0; i < 32 * 32; i++)
+    {
+        unsigned int loc = i * 4;
+        unsigned int ts = 4096 + i * 4;
+        if (memcmp(headers + loc, self->header_snapshot + loc, 4) == 0 &&
+            memcmp(headers + ts, self->header_snapshot + ts, 4) == 0)
+            continue;
+        
+        count++;
+        if (changed)
+            rs_region_bitmap_set(changed, i % 32, i / 32);
+    }
+    
+    /* external chunk files may have been replaced, too */
+    if (count > 0)
+        _rs_region_release_externals(self);
+    
+    memcpy(self->header_snapshot, headers, sizeof(headers));
+    return count;
+}
+
+void rs_region_set_layout(RSRegion* self, RSRegionLayout layout)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(layout >= RS_REGION_LAYOUT_NONE && layout <= RS_REGION_LAYOUT_ZORDER);
+    self->layout = layout;
+}
+
+RSRegionLayout rs_region_get_layout(RSRegion* self)
+{
+    rs_return_val_if_fail(self, RS_REGION_LAYOUT_NONE);
+    return self->layout;
+}
+
+void rs_region_set_locking(RSRegion* self, bool locking)
+{
+    rs_return_if_fail(self);
+    
+    if (locking && self->memory)
+    {
+        rs_critical("regions in memory cannot be locked");
+        return;
+    }
+#ifndef RS_REGION_SETLKW
+    if (locking)
+    {
+        rs_critical("file locking is not supported on this system");
+        return;
+    }
+#endif
+    
+    if (!locking)
+        _rs_region_release_locks(self);
+    self->locking = locking;
+}
+
+bool rs_region_get_locking(RSRegion* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->locking;
+}
+
+bool rs_region_lock_chunk(RSRegion* self, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(x < 32 && z < 32, false);
+    
+    if (!self->locking)
+        return true;
+    
+    if (self->locks == NULL)
+        self->locks = rs_new0(struct ChunkLock, 32 * 32);
+    
+    uint16_t i = x + z * 32;
+    struct ChunkLock* held = &(self->locks[i]);
+    if (held->depth > 0)
+    {
+        held->depth++;
+        return true;
+    }
+    
+    uint32_t start, count;
+    while (true)
+    {
+        if (!_rs_region_lock_entry(self, i, F_RDLCK, true))
+            return false;
+        if (_rs_region_follow_replacement(self))
+            continue;
+        if (!_rs_region_read_location(self, i, &start, &count))
+        {
+            _rs_region_lock_entry(self, i, F_UNLCK, false);
+            return false;
+        }
+        
+        if (count == 0 || _rs_region_lock_range(self, (off_t)start * 4096, (off_t)count * 4096, F_RDLCK, false))
+            break;
+        
+        /* a flush is moving this chunk. Wait for it to finish without
+         * holding the entries it needs to update, and look again.
+         */
+        _rs_region_lock_entry(self, i, F_UNLCK, false);
+        if (!_rs_region_lock_range(self, (off_t)start * 4096, (off_t)count * 4096, F_RDLCK, true))
+            return false;
+        _rs_region_lock_range(self, (off_t)start * 4096, (off_t)count * 4096, F_UNLCK, false);
+    }
+    
+    held->start = start;
+    held->count = count;
+    held->depth = 1;
+    
+    /* someone else may have grown the file past our mapping */
+    if ((off_t)(start + count) * 4096 > self->fsize)
+    {
+        struct stat stat_buf;
+        if (fstat(self->fd, &stat_buf) == 0 && stat_buf.st_size >= 8192)
+            _rs_region_remap(self, stat_buf.st_size);
+    }
+    
+    return true;
+}
+
+void rs_region_unlock_chunk(RSRegion* self, uint8_t x, uint8_t z)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(x < 32 && z < 32);
+    
+    if (!self->locking)
+        return;
+    
+    uint16_t i = x + z * 32;
+    if (self->locks == NULL || self->locks[i].depth == 0)
+    {
+        rs_critical("chunk is not locked");
+        return;
+    }
+    
+    struct ChunkLock* held = &(self->locks[i]);
+    held->depth--;
+    if (held->depth > 0)
+        return;
+    
+    if (held->count > 0)
+        _rs_region_lock_range(self, (off_t)held->start * 4096, (off_t)held->count * 4096, F_UNLCK, false);
+    _rs_region_lock_entry(self, i, F_UNLCK, false);
+}
+
+void rs_region_compact(RSRegion* self)
+{
+    rs_return_if_fail(self);
+    if (!(self->write))
+    {
+        rs_critical("region is not opened in write mode.");
+        return;
+    }
+    
+    /* the compacted file is renamed over the old one */
+    if (!self->memory && self->path == NULL)
+    {
+        rs_critical("region has no path, so it cannot be compacted.");
+        return;
+    }
+    
+    /* the whole file is about to be rewritten, and must not change
+     * while we read it in (the flush below releases this lock)
+     */
+    if (self->locking)
+    {
+        _rs_region_release_locks(self);
+        do
+        {
+            if (!_rs_region_lock_range(self, 0, 0, F_WRLCK, true))
             {
-                struct OrderedChunkWrite* ordered_write = cell->data;
-                struct ChunkWrite* write = ordered_write->write;
-                uint16_t i = write->z * 32 + write->x;
-                if (rs_region_contains_chunk(self, write->x, write->z))
-                {
-                    /* enlarging chunk */
-                    
-                    /* move read head to just past this chunk */
-                    void* data_end = _rs_region_get_data(self, write->x, write->z);
-                    data_end += self->locations[i].sector_count * 4096;
-                    
-                    rs_assert(data_end <= read_head);
-                    rs_assert((size_t)(read_head - data_end) % 4096 == 0);
-                    rs_assert(read_head_sector <= write_head_sector);
-                    uint32_t sectors_to_write = (read_head - data_end) / 4096;
-                    
-                    for (uint8_t z = 0; z < 32; z++)
-                    {
-                        for (uint8_t x = 0; x < 32; x++)
-                        {
-                            uint32_t sector = rs_endian_uint24(self->locations[z * 32 + x].offset);
-                            if (sector >= read_head_sector - sectors_to_write && sector < read_head_sector)
-                            {
-                                /* we need to shift this location */
-                                uint32_t new_sector = sector + (write_head_sector - read_head_sector);
-                                rs_assert(new_sector >= sector);
-                                self->locations[z * 32 + x].offset = rs_endian_uint24(new_sector);
-                            }
-                        }
-                    }
-                    
-                    write_head -= read_head - data_end;
-                    write_head_sector -= sectors_to_write;
-                    memmove(write_head, data_end, read_head - data_end);
-                    read_head -= read_head - data_end;
-                    read_head_sector -= sectors_to_write;
-                    rs_assert(read_head == data_end);
-                    
-                    /* write out the new, enlarged chunk */
-                    
-                    uint8_t old_sectors = self->locations[i].sector_count;
-                    uint8_t sectors = (write->length + 4 + 1) / 4096;
-                    if ((write->length + 4 + 1) % 4096 > 0)
-                        sectors++;
-                    
-                    write_head -= sectors * 4096;
-                    write_head_sector -= sectors;
-                    
-                    self->locations[i].offset = rs_endian_uint24(write_head_sector);
-                    self->locations[i].sector_count = sectors;
-                    self->timestamps[i] = rs_endian_uint32(write->timestamp);
-                    
-                    /* convert compression type */
-                    uint8_t enc = _rs_region_get_encoding(write->encoding);
-                    
-                    /* write data carefully */
-                    ((uint32_t*)write_head)[0] = rs_endian_uint32(write->length + 1);
-                    ((uint8_t*)write_head)[4] = enc;
-                    memcpy(write_head + 4 + 1, write->data, write->length);
-                    
-                    /* move read head past old chunk */
-                    read_head -= old_sectors * 4096;
-                    read_head_sector -= old_sectors;
-                } else {
-                    /* adding chunk */
-                    uint8_t sectors = (write->length + 4 + 1) / 4096;
-                    if ((write->length + 4 + 1) % 4096 > 0)
-                        sectors++;
-                    
-                    write_head -= sectors * 4096;
-                    write_head_sector -= sectors;
-                    
-                    self->locations[i].offset = rs_endian_uint24(write_head_sector);
-                    self->locations[i].sector_count = sectors;
-                    self->timestamps[i] = rs_endian_uint32(write->timestamp);
-                    
-                    /* convert compression type */
-                    uint8_t enc = _rs_region_get_encoding(write->encoding);
-                    
-                    /* write data carefully */
-                    ((uint32_t*)write_head)[0] = rs_endian_uint32(write->length + 1);
-                    ((uint8_t*)write_head)[4] = enc;
-                    memcpy(write_head + 4 + 1, write->data, write->length);
-                }
+                rs_critical("could not lock region file");
+                return;
             }
-            rs_list_foreach(grows, rs_free);
-            rs_list_free(grows);
+        } while (_rs_region_follow_replacement(self));
+        _rs_region_reload(self, NULL);
+    } else if (_rs_region_has_conditions(self)) {
+        _rs_region_reload(self, NULL);
+    }
+    
+    /* a chunk we can't read can't be copied, and leaving it out would
+     * delete it
+     */
+    for (uint8_t z = 0; z < 32; z++)
+    {
+        for (uint8_t x = 0; x < 32; x++)
+        {
+            if (self->write_index[x + z * 32] || !rs_region_contains_chunk(self, x, z))
+                continue;
+            if (rs_region_chunk_is_external(self, x, z) || rs_region_get_chunk_data(self, x, z))
+                continue;
             
-            /* all done (*phew*) */
+            rs_critical("chunk (%i, %i) is unreadable, so the region cannot be compacted.", x, z);
+            if (self->locking)
+                _rs_region_lock_range(self, 0, 0, F_UNLCK, false);
+            return;
         }
     }
     
-    /* clear the cached writes */
-    cell = self->cached_writes;
-    for (; cell != NULL; cell = cell->next)
+    /* conditional writes have to be checked before the file is
+     * rewritten below
+     */
+    rs_region_bitmap_clear(&(self->conflicts));
+    self->conflict_count = 0;
+    _rs_region_check_conditions(self);
+    
+    /* nothing on disk yet, so a flush is already a fresh write */
+    if (self->map == NULL)
     {
-        struct ChunkWrite* write = cell->data;
-        rs_free(write->data);
-        rs_free(write);
+        _rs_region_flush(self, false);
+        if (self->locking)
+            _rs_region_lock_range(self, 0, 0, F_UNLCK, false);
+        return;
     }
-    rs_list_free(self->cached_writes);
-    self->cached_writes = NULL;
     
-    /* sync the memory */
-    if (self->map && msync(self->map, self->fsize, MS_SYNC) < 0)
+    /* turn every chunk that isn't already being rewritten into a
+     * cached write, so the whole region can be written from scratch.
+     * These are copied byte for byte, compression byte and all.
+     */
+    for (uint8_t z = 0; z < 32; z++)
     {
-        rs_error("sync failed"); /* FIXME */
+        for (uint8_t x = 0; x < 32; x++)
+        {
+            if (self->write_index[x + z * 32] || !rs_region_contains_chunk(self, x, z))
+                continue;
+            
+            uint8_t* header = _rs_region_get_data(self, x, z);
+            uint8_t raw_encoding = header[4] & ~RS_REGION_EXTERNAL_FLAG;
+            uint32_t timestamp = rs_region_get_chunk_timestamp(self, x, z);
+            
+            struct ChunkWrite* job;
+            if (rs_region_chunk_is_external(self, x, z))
+            {
+                /* the external file itself stays where it is */
+                job = rs_new0(struct ChunkWrite, 1);
+                job->x = x;
+                job->z = z;
+                job->timestamp = timestamp;
+                job->external = true;
+                self->cached_writes = rs_list_push(self->cached_writes, job);
+                self->write_index[x + z * 32] = self->cached_writes;
+            } else {
+                /* copied by _rs_region_cache_write, so it survives the flush */
+                job = _rs_region_cache_write(self, x, z,
+                                             rs_region_get_chunk_data(self, x, z),
+                                             _rs_region_get_stored_length(self, x, z),
+                                             RS_UNKNOWN_COMPRESSION, timestamp);
+            }
+            
+            job->raw = true;
+            job->raw_encoding = raw_encoding;
+        }
     }
+    
+    if (self->memory)
+    {
+        /* there's no file to lose, so the buffer is rewritten in place */
+        _rs_region_resize(self, 0);
+        _rs_region_flush(self, false);
+    } else if (self->cached_writes == NULL) {
+        /* no chunks at all, so all that's left is an empty file */
+        uint8_t before[4096 * 2];
+        _rs_region_copy_headers(self, before);
+        if (!_rs_region_replace_file(self, NULL, 0))
+            rs_critical("could not replace region file %s", self->path);
+        _rs_region_snapshot_changes(self, before);
+    } else {
+        _rs_region_flush(self, true);
+    }
+    
+    /* the flush only unlocks if there was something to write */
+    if (self->locking)
+        _rs_region_lock_range(self, 0, 0, F_UNLCK, false);
 }
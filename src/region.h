@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 struct _RSRegion;
 /**
@@ -20,6 +21,201 @@ struct _RSRegion;
  */
 typedef struct _RSRegion RSRegion;
 
+/**
+ * Chunk layout policies.
+ *
+ * These control the order in which chunks are placed in the file
+ * whenever a region is written out from scratch, either because it
+ * is a brand-new file or because it is being compacted with
+ * rs_region_compact(). In-place flushes of existing files always
+ * preserve the order already on disk.
+ *
+ * \sa rs_region_set_layout, rs_region_compact
+ */
+typedef enum
+{
+    /**
+     * Lay chunks out in the order their writes are cached. This is
+     * the default, and is effectively reverse insertion order.
+     */
+    RS_REGION_LAYOUT_NONE,
+    
+    /**
+     * Lay chunks out in header order, one row of 32 chunks at a
+     * time.
+     */
+    RS_REGION_LAYOUT_LINEAR,
+    
+    /**
+     * Lay chunks out along a Morton (Z-order) curve, so that 2x2 and
+     * larger neighborhoods of chunks end up close together on disk.
+     */
+    RS_REGION_LAYOUT_ZORDER,
+} RSRegionLayout;
+
+/**
+ * A set of chunks within a region.
+ *
+ * This is a bitmap with one bit per chunk, used wherever a function
+ * needs to report on many chunks at once. Row z is stored in bits[z],
+ * with chunk x in bit x. Use rs_region_bitmap_clear(),
+ * rs_region_bitmap_set() and rs_region_bitmap_get() to work with it.
+ */
+typedef struct
+{
+    /** one 32-bit row per z coordinate */
+    uint32_t bits[32];
+} RSRegionBitmap;
+
+/** Remove every chunk from an RSRegionBitmap. */
+#define rs_region_bitmap_clear(bm) memset((bm)->bits, 0, sizeof((bm)->bits))
+/** Add the chunk at (x, z) to an RSRegionBitmap. */
+#define rs_region_bitmap_set(bm, x, z) ((bm)->bits[(z)] |= (UINT32_C(1) << (x)))
+/** Test whether the chunk at (x, z) is in an RSRegionBitmap. */
+#define rs_region_bitmap_get(bm, x, z) (((bm)->bits[(z)] >> (x)) & 1)
+
+/**
+ * A single chunk write, for rs_region_set_chunks().
+ *
+ * \sa rs_region_set_chunks
+ */
+typedef struct
+{
+    /** the x coordinate of the chunk */
+    uint8_t x;
+    /** the z coordinate of the chunk */
+    uint8_t z;
+    /** the data to use, or NULL to delete the chunk */
+    void* data;
+    /** the length of the data */
+    uint32_t length;
+    /** the compression type used on data, or RS_AUTO_COMPRESSION */
+    RSCompressionType encoding;
+    /** the modification time to use, or 0 for the current time */
+    uint32_t timestamp;
+} RSChunkWrite;
+
+/**
+ * Conditions for rs_region_set_chunk_data_if().
+ *
+ * These can be combined with bitwise or, in which case all of them
+ * must hold for the write to happen.
+ *
+ * \sa rs_region_set_chunk_data_if
+ */
+typedef enum
+{
+    /** write unconditionally, like rs_region_set_chunk_data_full() */
+    RS_REGION_CONDITION_NONE = 0,
+    /** write only if the chunk timestamp is still the expected one */
+    RS_REGION_CONDITION_TIMESTAMP = 1 << 0,
+    /** write only if rs_region_get_chunk_hash() is still the expected one */
+    RS_REGION_CONDITION_HASH = 1 << 1,
+} RSRegionCondition;
+
+/** Number of buckets in RSRegionStats::size_histogram. */
+#define RS_REGION_STATS_BUCKETS 9
+
+/**
+ * Region file statistics.
+ *
+ * This structure is filled in by rs_region_get_stats(), and describes
+ * how efficiently a region file uses its space. All sizes are
+ * computed from the headers and the per-chunk length prefixes, so
+ * none of the chunk data is read or decompressed.
+ *
+ * \sa rs_region_get_stats
+ */
+typedef struct
+{
+    /** number of chunks present in the region */
+    uint32_t chunk_count;
+    /** number of those chunks stored in external chunk files */
+    uint32_t external_count;
+    
+    /** size of the file in sectors, including the two header sectors */
+    uint32_t total_sectors;
+    /** sectors used by at least one chunk */
+    uint32_t live_sectors;
+    /** sectors after the headers not used by any chunk */
+    uint32_t dead_sectors;
+    
+    /** total length of chunk data stored inside the region */
+    uint64_t data_bytes;
+    /** unused bytes at the end of the sectors chunks occupy */
+    uint64_t slack_bytes;
+    
+    /**
+     * chunk sizes, in sectors: bucket i counts chunks using between
+     * 2^i and 2^(i+1) - 1 sectors, and the last bucket counts
+     * external chunks
+     */
+    uint32_t size_histogram[RS_REGION_STATS_BUCKETS];
+    
+    /** number of chunks using each compression type, indexed by RSCompressionType */
+    uint32_t compression_counts[RS_UNKNOWN_COMPRESSION + 1];
+    
+    /** chunks whose sectors overlap another chunk's sectors */
+    uint32_t overlapping_count;
+    /** chunks whose sectors are in the headers or past the end of the file */
+    uint32_t out_of_bounds_count;
+} RSRegionStats;
+
+/**
+ * Checks performed by rs_region_verify().
+ *
+ * The location table is always checked; these flags enable the more
+ * expensive checks, and can be combined with bitwise or.
+ *
+ * \sa rs_region_verify
+ */
+typedef enum
+{
+    /** check only the headers and chunk length prefixes */
+    RS_REGION_VERIFY_HEADERS = 0,
+    /** also decompress every chunk, to make sure the data is intact */
+    RS_REGION_VERIFY_DECOMPRESS = 1 << 0,
+} RSRegionVerifyFlags;
+
+/**
+ * Results of rs_region_verify().
+ *
+ * Each problem is reported as a set of chunks, so that a repair tool
+ * can tell exactly which chunks to drop or restore.
+ *
+ * \sa rs_region_verify
+ */
+typedef struct
+{
+    /** number of chunks present in the location table */
+    uint32_t chunk_count;
+    /** number of chunks with at least one problem */
+    uint32_t error_count;
+    
+    /** chunks whose sectors overlap another chunk's sectors */
+    RSRegionBitmap overlapping;
+    /** chunks whose sectors are in the headers or past the end of the file */
+    RSRegionBitmap out_of_bounds;
+    /** chunks whose length prefix does not fit in their sectors */
+    RSRegionBitmap bad_length;
+    /** chunks with an unknown compression type, or that fail to decompress */
+    RSRegionBitmap bad_data;
+} RSRegionVerifyResult;
+
+/**
+ * A callback used by rs_region_verify_files().
+ *
+ * This is called once for every file, in no particular order, but
+ * never from two threads at once. If the file could not be opened as
+ * a region at all, result is NULL.
+ *
+ * \param path the path of the region file
+ * \param result the result of the verification, or NULL
+ * \param user the user data passed to rs_region_verify_files()
+ * \sa rs_region_verify_files
+ */
+typedef void (*RSRegionVerifyFunction)(const char* path, RSRegionVerifyResult* result, void* user);
+
 /**
  * Open the given region file.
  *
@@ -34,6 +230,71 @@ typedef struct _RSRegion RSRegion;
  */
 RSRegion* rs_region_open(const char* path, bool write);
 
+/**
+ * Open a region file from a file descriptor.
+ *
+ * This works like rs_region_open(), but on a file that is already
+ * open. Regular files are mapped just like rs_region_open() does, and
+ * the region keeps its own duplicate of the descriptor, so you may
+ * close yours whenever you like. For write mode, the descriptor must
+ * have been opened for both reading and writing.
+ *
+ * Anything that cannot be mapped, like a pipe or a socket, is read
+ * until end-of-file and handled like rs_region_open_memory(). In
+ * write mode, flushed changes then go to that in-memory copy, which
+ * you can retrieve with rs_region_get_memory().
+ *
+ * Regions opened this way have no path, so they cannot use external
+ * chunk files.
+ *
+ * \param fd the file descriptor to read from
+ * \param write whether to open the region in write mode or not
+ * \return the new region object, or NULL
+ * \sa rs_region_open, rs_region_open_memory, rs_region_close
+ */
+RSRegion* rs_region_open_fd(int fd, bool write);
+
+/**
+ * Open a region file stored in memory.
+ *
+ * This parses the given buffer as a region file. If writable is
+ * false, the buffer is used directly, and must stay valid and
+ * unchanged until the region is closed. If writable is true, the
+ * region works on its own copy of the buffer instead, and flushed
+ * changes can be retrieved with rs_region_get_memory().
+ *
+ * As with rs_region_open(), an empty buffer is a valid (empty)
+ * region.
+ *
+ * Regions opened this way have no path, so they cannot use external
+ * chunk files.
+ *
+ * \param buf the region file data
+ * \param len the length of buf
+ * \param writable whether to open the region in write mode or not
+ * \return the new region object, or NULL
+ * \sa rs_region_open, rs_region_get_memory, rs_region_close
+ */
+RSRegion* rs_region_open_memory(void* buf, size_t len, bool writable);
+
+/**
+ * Get the in-memory contents of a region.
+ *
+ * For regions opened with rs_region_open_memory(), or with
+ * rs_region_open_fd() on something that cannot be mapped, this
+ * returns the current region file data as of the last
+ * rs_region_flush(). For regions backed by a file, this returns NULL.
+ *
+ * The returned buffer is owned by the region, and is valid until the
+ * region is closed or flushed.
+ *
+ * \param self the region file
+ * \param len where to store the length of the data
+ * \return the region file data, or NULL
+ * \sa rs_region_open_memory, rs_region_open_fd
+ */
+void* rs_region_get_memory(RSRegion* self, size_t* len);
+
 /**
  * Close the given region file.
  *
@@ -48,6 +309,16 @@ RSRegion* rs_region_open(const char* path, bool write);
  */
 void rs_region_close(RSRegion* self);
 
+/**
+ * Get the path of the file a region was opened from.
+ *
+ * \param self the region file
+ * \return the path given to rs_region_open(), or NULL for regions
+ *         opened some other way
+ * \sa rs_region_open
+ */
+const char* rs_region_get_path(RSRegion* self);
+
 /**
  * Get the last modified time of a given chunk.
  *
@@ -78,6 +349,22 @@ uint32_t rs_region_get_chunk_timestamp(RSRegion* self, uint8_t x, uint8_t z);
  */
 uint32_t rs_region_get_chunk_length(RSRegion* self, uint8_t x, uint8_t z);
 
+/**
+ * Get where a chunk is stored in the region file.
+ *
+ * This is the byte offset of the first sector holding the chunk,
+ * which starts with the chunk's length prefix and compression byte.
+ * Region files can grow past 4 GiB, so this needs 64 bits. If the
+ * chunk does not exist, this is 0.
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \return the byte offset of the chunk, or 0
+ * \sa rs_region_get_chunk_length
+ */
+uint64_t rs_region_get_chunk_offset(RSRegion* self, uint8_t x, uint8_t z);
+
 /**
  * Get the compression type of the chunk data.
  *
@@ -111,6 +398,45 @@ RSCompressionType rs_region_get_chunk_compression(RSRegion* self, uint8_t x, uin
  */
 void* rs_region_get_chunk_data(RSRegion* self, uint8_t x, uint8_t z);
 
+/**
+ * Write the data for a chunk to a file descriptor.
+ *
+ * This writes exactly what rs_region_get_chunk_data() would return,
+ * but where the system allows it, the data is copied by the kernel
+ * straight from the region file (with sendfile()), without passing
+ * through user space at all. This makes it a cheap way to serve
+ * compressed chunks over a socket or pipe.
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \param fd the file descriptor to write to
+ * \return true if all rs_region_get_chunk_length() bytes were
+ *         written, false if the chunk does not exist or on error
+ * \sa rs_region_get_chunk_data
+ */
+bool rs_region_send_chunk(RSRegion* self, uint8_t x, uint8_t z, int fd);
+
+/**
+ * Open the file holding the data for a chunk.
+ *
+ * rs_region_send_chunk() writes a whole chunk before it returns,
+ * which doesn't suit non-blocking descriptors. This instead gives a
+ * new descriptor for the file the chunk is stored in, and where in it
+ * the data starts, so the rs_region_get_chunk_length() bytes there can
+ * be sent a piece at a time with sendfile(). The descriptor stays
+ * usable after the region is closed or replaced.
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \param offset where to store the offset of the data in the file
+ * \return a descriptor the caller must close, or -1 if the chunk
+ *         does not exist, the region is in memory, or on error
+ * \sa rs_region_send_chunk
+ */
+int rs_region_open_chunk_file(RSRegion* self, uint8_t x, uint8_t z, uint64_t* offset);
+
 /**
  * Get whether a chunk is present.
  *
@@ -124,6 +450,27 @@ void* rs_region_get_chunk_data(RSRegion* self, uint8_t x, uint8_t z);
  */
 bool rs_region_contains_chunk(RSRegion* self, uint8_t x, uint8_t z);
 
+/**
+ * Get whether a chunk is stored in an external file.
+ *
+ * Chunks too large to fit in a region file are stored next to it in
+ * a file named c.X.Z.mcc, where X and Z are the global chunk
+ * coordinates, and only a small placeholder is kept in the region
+ * itself. This is handled transparently by the rest of the region
+ * API, but this function lets you find out whether it happened.
+ *
+ * External chunks are only supported for region files named in the
+ * usual r.X.Z.mca style, since the region coordinates are needed to
+ * find the external file.
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \return true if the chunk data is stored externally, false otherwise
+ * \sa rs_region_get_chunk_data
+ */
+bool rs_region_chunk_is_external(RSRegion* self, uint8_t x, uint8_t z);
+
 /**
  * Set the data for a given chunk.
  *
@@ -154,6 +501,10 @@ void rs_region_set_chunk_data(RSRegion* self, uint8_t x, uint8_t z, void* data,
  *
  * This call will only work if the region was opened in write mode.
  *
+ * Chunks that are too large to fit in a region file (a little under
+ * 1MB) are written straight out to an external chunk file instead of
+ * being copied; see rs_region_chunk_is_external().
+ *
  * If the given compression type is RS_AUTO_COMPRESSION, the
  * compression type will be guessed from the given data.
  *
@@ -174,6 +525,93 @@ void rs_region_set_chunk_data(RSRegion* self, uint8_t x, uint8_t z, void* data,
  */
 void rs_region_set_chunk_data_full(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc, uint32_t timestamp);
 
+/**
+ * Set the data for many chunks at once.
+ *
+ * This caches every write in the given array, just as if
+ * rs_region_set_chunk_data_full() (or rs_region_clear_chunk(), for
+ * writes with NULL data) had been called on each one in turn, so
+ * later writes to the same chunk replace earlier ones. The whole
+ * array is checked before anything is cached, and the writes are
+ * all placed by the next rs_region_flush() in a single pass, which
+ * makes this the fastest way to import many chunks.
+ *
+ * As with rs_region_set_chunk_data_full(), the data is copied, and
+ * this only works if the region was opened in write mode.
+ *
+ * \param self the region file
+ * \param writes the writes to cache
+ * \param count the number of writes
+ * \return true if every write was cached, false otherwise
+ * \sa RSChunkWrite, rs_region_set_chunk_data_full, rs_region_flush
+ */
+bool rs_region_set_chunks(RSRegion* self, const RSChunkWrite* writes, size_t count);
+
+/**
+ * Set the data for a given chunk, if nobody else changed it first.
+ *
+ * This works like rs_region_set_chunk_data_full(), except that the
+ * write only happens if, at the time of the next rs_region_flush(),
+ * the chunk on disk still has the expected timestamp and/or hash. A
+ * chunk that does not exist has a timestamp and hash of 0, so
+ * expecting 0 means "only if the chunk is not there yet". Passing
+ * NULL for data deletes the chunk under the same conditions.
+ *
+ * This allows optimistic concurrency between processes: read a
+ * chunk, note its timestamp or hash, and write back the new version
+ * conditionally. Writes that lose the race are dropped, and can be
+ * found with rs_region_get_conflicts() after the flush. The check is
+ * made against the file as it is at flush time, and with
+ * rs_region_set_locking() turned on, the check and the write happen
+ * under the same lock.
+ *
+ * Timestamps only have a resolution of one second, so use the hash
+ * if a chunk may be rewritten several times a second.
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \param data the data to use, or NULL to delete the chunk
+ * \param len the length of the data
+ * \param enc the compression type used on data, or RS_AUTO_COMPRESSION
+ * \param timestamp the modification time to use
+ * \param condition which of the expected values to check
+ * \param expected_timestamp the timestamp the chunk must have
+ * \param expected_hash the hash the chunk must have
+ * \sa RSRegionCondition, rs_region_get_chunk_hash, rs_region_get_conflicts
+ */
+void rs_region_set_chunk_data_if(RSRegion* self, uint8_t x, uint8_t z, void* data, uint32_t len, RSCompressionType enc, uint32_t timestamp, RSRegionCondition condition, uint32_t expected_timestamp, uint32_t expected_hash);
+
+/**
+ * Get a hash of the data for a chunk.
+ *
+ * This is the CRC-32 of the data returned by
+ * rs_region_get_chunk_data(), as it is stored (and compressed) in the
+ * file. If the chunk does not exist, this is 0. It is meant for use
+ * with rs_region_set_chunk_data_if().
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \return the hash of the chunk data, or 0
+ * \sa rs_region_set_chunk_data_if
+ */
+uint32_t rs_region_get_chunk_hash(RSRegion* self, uint8_t x, uint8_t z);
+
+/**
+ * Get the conditional writes dropped by the last flush.
+ *
+ * After rs_region_flush() (or rs_region_compact()), this reports
+ * which writes made with rs_region_set_chunk_data_if() were dropped
+ * because their conditions no longer held.
+ *
+ * \param self the region file
+ * \param conflicts where to store the set of dropped writes, or NULL
+ * \return the number of dropped writes
+ * \sa rs_region_set_chunk_data_if
+ */
+unsigned int rs_region_get_conflicts(RSRegion* self, RSRegionBitmap* conflicts);
+
 /**
  * Delete the given chunk.
  *
@@ -206,4 +644,245 @@ void rs_region_clear_chunk(RSRegion* self, uint8_t x, uint8_t z);
  */
 void rs_region_flush(RSRegion* self);
 
+/**
+ * Flush the cached writes, without waiting for them to reach the disk.
+ *
+ * This works just like rs_region_flush(), except that it does not
+ * sync the file afterwards, so the changes may sit in the operating
+ * system's cache for a while. This is useful when flushing many
+ * regions at once: flush them all this way, then make them durable
+ * together with rs_region_sync() (or something like syncfs()).
+ * rs_world_commit() does exactly that.
+ *
+ * \param self the region to flush
+ * \sa rs_region_flush, rs_region_sync, rs_world_commit
+ */
+void rs_region_flush_nosync(RSRegion* self);
+
+/**
+ * Wait for flushed changes to reach the disk.
+ *
+ * This makes sure everything flushed so far is stored durably, using
+ * fdatasync() where available. This includes the directory entries
+ * of external chunk files moved into place by
+ * rs_region_flush_nosync(). Regions opened from memory have nothing
+ * to sync, and always succeed.
+ *
+ * \param self the region to sync
+ * \return true on success, false otherwise
+ * \sa rs_region_flush_nosync
+ */
+bool rs_region_sync(RSRegion* self);
+
+/**
+ * Get whether a region has cached writes.
+ *
+ * \param self the region file
+ * \return true if rs_region_flush() has anything to write
+ * \sa rs_region_flush
+ */
+bool rs_region_is_dirty(RSRegion* self);
+
+/**
+ * Pick up changes made to the region file by someone else.
+ *
+ * Use this to follow a region file that another process (like a
+ * running game server) is writing to. It rereads only the location
+ * and timestamp headers, compares them against what this handle saw
+ * last, and remaps the file only if its size has changed. Chunks
+ * whose location or timestamp changed are reported in changed, which
+ * may be NULL if you only want the count. Chunks this handle wrote
+ * (or moved) in its own flushes are not reported, but changes made by
+ * others in the meantime still are.
+ *
+ * As with rs_region_flush(), chunk data pointers for changed chunks
+ * (and all chunk data pointers, if the file was remapped) are
+ * invalidated. Cached writes are left alone. Regions opened from
+ * memory never change, and always report no changes.
+ *
+ * \param self the region file
+ * \param changed where to store the set of changed chunks, or NULL
+ * \return the number of changed chunks
+ * \sa rs_region_flush, RSRegionBitmap
+ */
+unsigned int rs_region_refresh(RSRegion* self, RSRegionBitmap* changed);
+
+/**
+ * Turn advisory file locking on or off.
+ *
+ * With locking on, several processes can safely work on the same
+ * region file at once. Readers lock the chunks they use with
+ * rs_region_lock_chunk(), which takes shared locks on the chunk's
+ * header entries and sectors. rs_region_flush() takes exclusive locks
+ * only on the sectors it rewrites (from the first changed chunk to the
+ * end of the file) and on the header entries it changes, so readers
+ * of chunks earlier in the file are never held up by it. Flushes
+ * through different handles always exclude each other.
+ *
+ * These are fcntl() locks, so they only keep out other programs that
+ * lock the same way; they do not protect against a game server that
+ * ignores them. Where open file description locks are available (as
+ * on Linux), locks belong to the handle, and two handles in the same
+ * process exclude each other too. Elsewhere, locks are shared by the
+ * whole process. External chunk files are not locked.
+ *
+ * Locking is off by default, and is not available for regions opened
+ * from memory. Turning it off releases every lock held by this handle.
+ *
+ * \param self the region file
+ * \param locking whether to use file locks
+ * \sa rs_region_lock_chunk, rs_region_get_locking
+ */
+void rs_region_set_locking(RSRegion* self, bool locking);
+
+/**
+ * Get whether advisory file locking is on.
+ *
+ * \param self the region file
+ * \return true if locking is on, false otherwise
+ * \sa rs_region_set_locking
+ */
+bool rs_region_get_locking(RSRegion* self);
+
+/**
+ * Lock a chunk for reading.
+ *
+ * If locking is on, this waits until no other handle is flushing over
+ * the given chunk, and then holds it in place until
+ * rs_region_unlock_chunk() is called, so its data can be read safely.
+ * Locking a chunk that does not exist keeps anyone else from adding
+ * it. If locking is off, this does nothing and returns true.
+ *
+ * Locks nest: a chunk locked twice must be unlocked twice. If another
+ * process grew the file, this remaps it, which invalidates chunk data
+ * pointers, so lock every chunk you need before reading any of them.
+ * rs_region_flush() and rs_region_compact() release all chunk locks
+ * held by this handle before they lock the file for writing.
+ *
+ * rs_nbt_parse_from_region() locks and unlocks the chunk it reads by
+ * itself.
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \return true if the chunk is now locked, false on error
+ * \sa rs_region_unlock_chunk, rs_region_set_locking
+ */
+bool rs_region_lock_chunk(RSRegion* self, uint8_t x, uint8_t z);
+
+/**
+ * Unlock a chunk locked with rs_region_lock_chunk().
+ *
+ * \param self the region file
+ * \param x the x coordinate of the chunk
+ * \param z the z coordinate of the chunk
+ * \sa rs_region_lock_chunk
+ */
+void rs_region_unlock_chunk(RSRegion* self, uint8_t x, uint8_t z);
+
+/**
+ * Get fragmentation and efficiency statistics for a region.
+ *
+ * This fills in an RSRegionStats structure describing the region as
+ * it is on disk; cached writes are not taken into account. It only
+ * looks at the headers and the length prefix of each chunk, so it is
+ * cheap enough to run over many regions when deciding which ones to
+ * compact or recompress.
+ *
+ * \param self the region file
+ * \param stats where to store the statistics
+ * \sa RSRegionStats, rs_region_compact
+ */
+void rs_region_get_stats(RSRegion* self, RSRegionStats* stats);
+
+/**
+ * Check a region file for corruption.
+ *
+ * This always checks the location table for chunks whose sectors
+ * overlap, lie in the headers or past the end of the file, or are too
+ * small for the chunk's length prefix. This is done in O(n log n), by
+ * sorting the table. With RS_REGION_VERIFY_DECOMPRESS, every chunk
+ * that passes those checks is also decompressed, spread across
+ * nthreads threads (or rs_thread_get_default_count() if 0).
+ *
+ * Chunks that fail the location checks are never read, and the other
+ * region functions refuse to return data for chunks that lie outside
+ * the file, so it is always safe to verify a region before deciding
+ * what to do with it.
+ *
+ * \param self the region file
+ * \param flags which extra checks to perform
+ * \param nthreads the number of threads to decompress with, or 0
+ * \param result where to store the details, or NULL
+ * \return true if no problems were found, false otherwise
+ * \sa RSRegionVerifyResult, rs_region_verify_files, rs_region_get_stats
+ */
+bool rs_region_verify(RSRegion* self, RSRegionVerifyFlags flags, unsigned int nthreads, RSRegionVerifyResult* result);
+
+/**
+ * Check many region files for corruption, in parallel.
+ *
+ * This opens each of the given files read-only and runs
+ * rs_region_verify() on it, spreading the files across nthreads
+ * threads (or rs_thread_get_default_count() if 0). The results for
+ * each file are passed to func as they are ready.
+ *
+ * \param paths the paths of the region files
+ * \param count the number of paths
+ * \param flags which extra checks to perform
+ * \param nthreads the number of threads to use, or 0
+ * \param func the function to report results to, or NULL
+ * \param user data to pass to func
+ * \return the number of files that could not be opened or had problems
+ * \sa rs_region_verify
+ */
+unsigned int rs_region_verify_files(const char** paths, unsigned int count, RSRegionVerifyFlags flags, unsigned int nthreads, RSRegionVerifyFunction func, void* user);
+
+/**
+ * Set the chunk layout policy.
+ *
+ * This controls how chunks are ordered on disk the next time the
+ * region is written from scratch: when a brand-new file is first
+ * flushed, or when rs_region_compact() is called. See
+ * RSRegionLayout for the available policies.
+ *
+ * \param self the region file
+ * \param layout the layout policy to use
+ * \sa RSRegionLayout, rs_region_get_layout, rs_region_compact
+ */
+void rs_region_set_layout(RSRegion* self, RSRegionLayout layout);
+
+/**
+ * Get the chunk layout policy.
+ *
+ * \param self the region file
+ * \return the current layout policy
+ * \sa rs_region_set_layout
+ */
+RSRegionLayout rs_region_get_layout(RSRegion* self);
+
+/**
+ * Compact the region file.
+ *
+ * This rewrites the whole region file from scratch, dropping any
+ * unused sectors and ordering chunks according to the current layout
+ * policy. Any cached writes are applied at the same time. This only
+ * works if the region was opened in write mode.
+ *
+ * The compacted region is put together in memory, written to a
+ * temporary file next to the old one, synced, and then renamed over
+ * it, so a crash leaves either the old file or the new one intact.
+ * Other handles on the same file switch over to the new one the next
+ * time they lock, refresh or flush. Chunks are copied byte for byte,
+ * even if their compression type is unknown. If any chunk can't be
+ * read, or the region was opened without a path, nothing is done.
+ *
+ * As with rs_region_flush(), all existing chunk data pointers are
+ * invalidated.
+ *
+ * \param self the region to compact
+ * \sa rs_region_set_layout, rs_region_flush
+ */
+void rs_region_compact(RSRegion* self);
+
 #endif /* __RS_REGION_H_INCLUDED__ */
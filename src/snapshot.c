@@ -0,0 +1,724 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "snapshot.h"
+
+#include "error.h"
+#include "memory.h"
+#include "rsendian.h"
+#include "util.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#if HAVE_MKDIR
+#  if MKDIR_TAKES_ONE_ARG
+#    define mkdir(a, b) mkdir(a)
+#  endif
+#else
+#  if HAVE__MKDIR
+#    define mkdir(a, b) _mkdir(a)
+#  else
+#    error "Don't know how to create a directory on this system."
+#  endif
+#endif
+
+/* A store directory holds:
+ *
+ *   pack        payload records: compression byte, length, data
+ *   objects     header, then (key, offset, length, compression) for
+ *               every payload in the pack
+ *   snapshots/  one manifest per snapshot: header, then (x, z,
+ *               timestamp, key) for every chunk
+ *
+ * Keys are a 64-bit hash of the payload, bumped by one on the rare
+ * collision, so they are unique within a store. All numbers are
+ * big-endian.
+ */
+
+#define RS_SNAPSHOT_OBJECTS_MAGIC "RSSO"
+#define RS_SNAPSHOT_MANIFEST_MAGIC "RSSM"
+#define RS_SNAPSHOT_VERSION 1
+
+struct FileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+} __PACKED__;
+
+struct StoredObject
+{
+    uint64_t key;
+    uint64_t offset;
+    uint32_t length;
+    uint8_t compression;
+} __PACKED__;
+
+struct StoredChunk
+{
+    int32_t x, z;
+    uint32_t timestamp;
+    uint64_t key;
+} __PACKED__;
+
+/* a payload in the pack, as kept in memory */
+struct StoreObject
+{
+    uint64_t key;
+    uint64_t offset;
+    uint32_t length;
+    RSCompressionType encoding;
+};
+
+/* a manifest entry, as kept in memory */
+struct SnapshotChunk
+{
+    int32_t x, z;
+    uint32_t timestamp;
+    uint64_t key;
+};
+
+struct _RSSnapshotStore
+{
+    char* path;
+    int pack_fd;
+    uint64_t pack_size;
+    
+    /* open-addressed hash table of objects, keyed by key (0 is empty) */
+    struct StoreObject* objects;
+    uint32_t object_count;
+    uint32_t table_size;
+    bool objects_dirty;
+    
+    /* for reading payloads back */
+    uint8_t* scratch;
+    size_t scratch_size;
+};
+
+/* helper to build a path inside the store */
+static char* _rs_snapshot_store_path(RSSnapshotStore* self, const char* dir, const char* name)
+{
+    size_t len = strlen(self->path) + strlen(name) + (dir ? strlen(dir) + 1 : 0) + 2;
+    char* path = rs_new(char, len);
+    if (dir)
+        snprintf(path, len, "%s/%s/%s", self->path, dir, name);
+    else
+        snprintf(path, len, "%s/%s", self->path, name);
+    return path;
+}
+
+/* helper to read a whole file into memory */
+static uint8_t* _rs_snapshot_read_file(const char* path, size_t* len)
+{
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    uint8_t* data = rs_malloc(stat_buf.st_size ? stat_buf.st_size : 1);
+    size_t got = 0;
+    while (got < (size_t)stat_buf.st_size)
+    {
+        ssize_t ret = read(fd, data + got, stat_buf.st_size - got);
+        if (ret <= 0)
+            break;
+        got += ret;
+    }
+    close(fd);
+    
+    if (got != (size_t)stat_buf.st_size)
+    {
+        rs_free(data);
+        return NULL;
+    }
+    
+    *len = got;
+    return data;
+}
+
+/* helper to check a file header, and return the entry count */
+static bool _rs_snapshot_check_header(uint8_t* data, size_t len, const char* magic, size_t entry_size, uint32_t* count)
+{
+    if (len < sizeof(struct FileHeader))
+        return false;
+    
+    struct FileHeader* header = (struct FileHeader*)data;
+    *count = rs_endian_uint32(header->count);
+    return memcmp(header->magic, magic, 4) == 0 &&
+        rs_endian_uint32(header->version) == RS_SNAPSHOT_VERSION &&
+        len == sizeof(struct FileHeader) + (size_t)*count * entry_size;
+}
+
+/* hash table helpers */
+static struct StoreObject* _rs_snapshot_store_find(RSSnapshotStore* self, uint64_t key)
+{
+    if (self->table_size == 0)
+        return NULL;
+    
+    uint32_t mask = self->table_size - 1;
+    uint32_t i = (uint32_t)(key ^ (key >> 32)) & mask;
+    while (self->objects[i].key != 0)
+    {
+        if (self->objects[i].key == key)
+            return &(self->objects[i]);
+        i = (i + 1) & mask;
+    }
+    
+    return NULL;
+}
+
+static void _rs_snapshot_store_insert(RSSnapshotStore* self, struct StoreObject* object)
+{
+    /* keep the table at most half full */
+    if ((self->object_count + 1) * 2 > self->table_size)
+    {
+        struct StoreObject* old = self->objects;
+        uint32_t old_size = self->table_size;
+        
+        self->table_size = old_size ? old_size * 2 : 1024;
+        self->objects = rs_new0(struct StoreObject, self->table_size);
+        self->object_count = 0;
+        for (uint32_t i = 0; i < old_size; i++)
+        {
+            if (old[i].key != 0)
+                _rs_snapshot_store_insert(self, &(old[i]));
+        }
+        
+        if (old)
+            rs_free(old);
+    }
+    
+    uint32_t mask = self->table_size - 1;
+    uint32_t i = (uint32_t)(object->key ^ (object->key >> 32)) & mask;
+    while (self->objects[i].key != 0)
+        i = (i + 1) & mask;
+    
+    self->objects[i] = *object;
+    self->object_count++;
+}
+
+static bool _rs_snapshot_store_load_objects(RSSnapshotStore* self)
+{
+    char* path = _rs_snapshot_store_path(self, NULL, "objects");
+    size_t len = 0;
+    uint8_t* data = _rs_snapshot_read_file(path, &len);
+    rs_free(path);
+    
+    /* a new store has no object index yet; anything already in the
+     * pack was never committed to it, and is simply ignored */
+    if (data == NULL)
+        return true;
+    
+    uint32_t count = 0;
+    if (!_rs_snapshot_check_header(data, len, RS_SNAPSHOT_OBJECTS_MAGIC, sizeof(struct StoredObject), &count))
+    {
+        rs_free(data);
+        return false;
+    }
+    
+    struct StoredObject* stored = (struct StoredObject*)(data + sizeof(struct FileHeader));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct StoreObject object;
+        object.key = rs_endian_uint64(stored[i].key);
+        object.offset = rs_endian_uint64(stored[i].offset);
+        object.length = rs_endian_uint32(stored[i].length);
+        object.encoding = stored[i].compression == 1 ? RS_GZIP : RS_ZLIB;
+        _rs_snapshot_store_insert(self, &object);
+    }
+    
+    rs_free(data);
+    return true;
+}
+
+static bool _rs_snapshot_store_save_objects(RSSnapshotStore* self)
+{
+    if (!(self->objects_dirty))
+        return true;
+    
+    size_t len = sizeof(struct FileHeader) + (size_t)self->object_count * sizeof(struct StoredObject);
+    uint8_t* data = rs_malloc0(len);
+    struct FileHeader* header = (struct FileHeader*)data;
+    memcpy(header->magic, RS_SNAPSHOT_OBJECTS_MAGIC, 4);
+    header->version = rs_endian_uint32(RS_SNAPSHOT_VERSION);
+    header->count = rs_endian_uint32(self->object_count);
+    
+    struct StoredObject* stored = (struct StoredObject*)(data + sizeof(struct FileHeader));
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < self->table_size; i++)
+    {
+        struct StoreObject* object = &(self->objects[i]);
+        if (object->key == 0)
+            continue;
+        
+        stored[n].key = rs_endian_uint64(object->key);
+        stored[n].offset = rs_endian_uint64(object->offset);
+        stored[n].length = rs_endian_uint32(object->length);
+        stored[n].compression = object->encoding == RS_GZIP ? 1 : 2;
+        n++;
+    }
+    
+    char* path = _rs_snapshot_store_path(self, NULL, "objects");
+    bool ok = rs_file_replace(path, data, len, true);
+    rs_free(path);
+    rs_free(data);
+    
+    if (ok)
+        self->objects_dirty = false;
+    return ok;
+}
+
+RSSnapshotStore* rs_snapshot_store_open(const char* path, bool create)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    RSSnapshotStore* self = rs_new0(RSSnapshotStore, 1);
+    self->path = rs_strdup(path);
+    self->pack_fd = -1;
+    
+    char* snapshot_dir = _rs_snapshot_store_path(self, NULL, "snapshots");
+    if (create)
+    {
+        if ((mkdir(path, 0777) != 0 && errno != EEXIST) || (mkdir(snapshot_dir, 0777) != 0 && errno != EEXIST))
+        {
+            rs_free(snapshot_dir);
+            rs_snapshot_store_close(self);
+            return NULL;
+        }
+    }
+    rs_free(snapshot_dir);
+    
+    char* pack_path = _rs_snapshot_store_path(self, NULL, "pack");
+    self->pack_fd = open(pack_path, (create ? (O_RDWR | O_CREAT) : O_RDWR) | O_BINARY, 0666);
+    rs_free(pack_path);
+    
+    struct stat stat_buf;
+    if (self->pack_fd < 0 || fstat(self->pack_fd, &stat_buf) < 0)
+    {
+        rs_snapshot_store_close(self);
+        return NULL;
+    }
+    self->pack_size = stat_buf.st_size;
+    
+    if (!_rs_snapshot_store_load_objects(self))
+    {
+        rs_snapshot_store_close(self);
+        return NULL;
+    }
+    
+    return self;
+}
+
+void rs_snapshot_store_close(RSSnapshotStore* self)
+{
+    rs_return_if_fail(self);
+    
+    if (self->pack_fd >= 0)
+    {
+        _rs_snapshot_store_save_objects(self);
+        close(self->pack_fd);
+    }
+    
+    if (self->objects)
+        rs_free(self->objects);
+    if (self->scratch)
+        rs_free(self->scratch);
+    rs_free(self->path);
+    rs_free(self);
+}
+
+/* helper to read an object's payload into the scratch buffer */
+static bool _rs_snapshot_store_read(RSSnapshotStore* self, struct StoreObject* object)
+{
+    if (object->length > self->scratch_size)
+    {
+        self->scratch_size = object->length;
+        self->scratch = rs_renew(uint8_t, self->scratch, self->scratch_size);
+    }
+    
+    /* skip the compression byte and length */
+    off_t offset = object->offset + 5;
+    size_t got = 0;
+    while (got < object->length)
+    {
+        ssize_t ret = pread(self->pack_fd, self->scratch + got, object->length - got, offset + got);
+        if (ret <= 0)
+            return false;
+        got += ret;
+    }
+    
+    return true;
+}
+
+/* helper to find or add a payload, returning its key (or 0 on error) */
+static uint64_t _rs_snapshot_store_add(RSSnapshotStore* self, void* data, uint32_t length, RSCompressionType encoding, RSSnapshotStats* stats)
+{
+    uint64_t key = ((uint64_t)crc32(crc32(0, Z_NULL, 0), data, length) << 32) | adler32(adler32(0, Z_NULL, 0), data, length);
+    
+    while (true)
+    {
+        if (key == 0)
+            key = 1;
+        
+        struct StoreObject* object = _rs_snapshot_store_find(self, key);
+        if (object == NULL)
+            break;
+        
+        /* never trust the hash alone */
+        if (object->length == length && object->encoding == encoding &&
+            _rs_snapshot_store_read(self, object) && memcmp(self->scratch, data, length) == 0)
+        {
+            stats->duplicates++;
+            return key;
+        }
+        
+        key++;
+    }
+    
+    uint8_t record[5];
+    uint32_t be_length = rs_endian_uint32(length);
+    record[0] = encoding == RS_GZIP ? 1 : 2;
+    memcpy(record + 1, &be_length, 4);
+    
+    if (pwrite(self->pack_fd, record, 5, self->pack_size) != 5)
+        return 0;
+    size_t written = 0;
+    while (written < length)
+    {
+        ssize_t ret = pwrite(self->pack_fd, (uint8_t*)data + written, length - written, self->pack_size + 5 + written);
+        if (ret <= 0)
+            return 0;
+        written += ret;
+    }
+    
+    struct StoreObject object;
+    object.key = key;
+    object.offset = self->pack_size;
+    object.length = length;
+    object.encoding = encoding;
+    _rs_snapshot_store_insert(self, &object);
+    
+    self->pack_size += 5 + length;
+    self->objects_dirty = true;
+    stats->added++;
+    stats->added_bytes += length;
+    return key;
+}
+
+/* qsort comparison for manifest entries, by region and then position */
+static int _rs_snapshot_compare_chunks(const void* a, const void* b)
+{
+    const struct SnapshotChunk* ca = a;
+    const struct SnapshotChunk* cb = b;
+    int32_t rxa = rs_world_chunk_to_region(ca->x), rxb = rs_world_chunk_to_region(cb->x);
+    int32_t rza = rs_world_chunk_to_region(ca->z), rzb = rs_world_chunk_to_region(cb->z);
+    if (rxa != rxb)
+        return rxa < rxb ? -1 : 1;
+    if (rza != rzb)
+        return rza < rzb ? -1 : 1;
+    if (ca->z != cb->z)
+        return ca->z < cb->z ? -1 : 1;
+    if (ca->x != cb->x)
+        return ca->x < cb->x ? -1 : 1;
+    return 0;
+}
+
+/* helper to load a manifest, sorted by region */
+static struct SnapshotChunk* _rs_snapshot_store_load_manifest(RSSnapshotStore* self, const char* name, uint32_t* count)
+{
+    char* path = _rs_snapshot_store_path(self, "snapshots", name);
+    size_t len = 0;
+    uint8_t* data = _rs_snapshot_read_file(path, &len);
+    rs_free(path);
+    
+    if (data == NULL)
+        return NULL;
+    if (!_rs_snapshot_check_header(data, len, RS_SNAPSHOT_MANIFEST_MAGIC, sizeof(struct StoredChunk), count))
+    {
+        rs_free(data);
+        return NULL;
+    }
+    
+    struct StoredChunk* stored = (struct StoredChunk*)(data + sizeof(struct FileHeader));
+    struct SnapshotChunk* chunks = rs_new(struct SnapshotChunk, *count ? *count : 1);
+    for (uint32_t i = 0; i < *count; i++)
+    {
+        chunks[i].x = rs_endian_int32(stored[i].x);
+        chunks[i].z = rs_endian_int32(stored[i].z);
+        chunks[i].timestamp = rs_endian_uint32(stored[i].timestamp);
+        chunks[i].key = rs_endian_uint64(stored[i].key);
+    }
+    rs_free(data);
+    
+    qsort(chunks, *count, sizeof(struct SnapshotChunk), _rs_snapshot_compare_chunks);
+    return chunks;
+}
+
+/* helper to find a chunk in a sorted manifest */
+static struct SnapshotChunk* _rs_snapshot_find_chunk(struct SnapshotChunk* chunks, uint32_t count, int32_t x, int32_t z)
+{
+    struct SnapshotChunk needle;
+    needle.x = x;
+    needle.z = z;
+    return bsearch(&needle, chunks, count, sizeof(struct SnapshotChunk), _rs_snapshot_compare_chunks);
+}
+
+bool rs_snapshot_store_create(RSSnapshotStore* self, RSWorld* world, const char* name, const char* base, RSSnapshotStats* stats)
+{
+    rs_return_val_if_fail(self && world && name, false);
+    rs_return_val_if_fail(name[0] != 0 && strchr(name, '/') == NULL, false);
+    
+    RSSnapshotStats local_stats;
+    if (stats == NULL)
+        stats = &local_stats;
+    memset(stats, 0, sizeof(RSSnapshotStats));
+    
+    uint32_t base_count = 0;
+    struct SnapshotChunk* base_chunks = base ? _rs_snapshot_store_load_manifest(self, base, &base_count) : NULL;
+    if (base && base_chunks == NULL)
+        return false;
+    
+    unsigned int region_count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(world, &region_count);
+    
+    uint32_t allocated = 1024;
+    struct SnapshotChunk* chunks = rs_new(struct SnapshotChunk, allocated);
+    bool ok = true;
+    
+    for (unsigned int i = 0; ok && i < region_count; i++)
+    {
+        RSRegion* region = rs_world_get_region(world, coords[i].x, coords[i].z, false);
+        if (region == NULL)
+            continue;
+        
+        for (uint8_t z = 0; ok && z < 32; z++)
+        {
+            for (uint8_t x = 0; ok && x < 32; x++)
+            {
+                if (!rs_region_contains_chunk(region, x, z))
+                    continue;
+                
+                if (stats->chunks == allocated)
+                {
+                    allocated *= 2;
+                    chunks = rs_renew(struct SnapshotChunk, chunks, allocated);
+                }
+                
+                struct SnapshotChunk* chunk = &(chunks[stats->chunks]);
+                chunk->x = coords[i].x * 32 + x;
+                chunk->z = coords[i].z * 32 + z;
+                chunk->timestamp = rs_region_get_chunk_timestamp(region, x, z);
+                
+                struct SnapshotChunk* prev = base_chunks ? _rs_snapshot_find_chunk(base_chunks, base_count, chunk->x, chunk->z) : NULL;
+                if (prev && prev->timestamp == chunk->timestamp)
+                {
+                    chunk->key = prev->key;
+                    stats->unchanged++;
+                    stats->chunks++;
+                    continue;
+                }
+                
+                void* data = rs_region_get_chunk_data(region, x, z);
+                RSCompressionType encoding = rs_region_get_chunk_compression(region, x, z);
+                if (data == NULL || (encoding != RS_GZIP && encoding != RS_ZLIB))
+                {
+                    /* leaving it out would have restore delete it */
+                    rs_critical("chunk (%i, %i) can't be read, so it can't be stored", chunk->x, chunk->z);
+                    ok = false;
+                    break;
+                }
+                
+                chunk->key = _rs_snapshot_store_add(self, data, rs_region_get_chunk_length(region, x, z), encoding, stats);
+                ok = (chunk->key != 0);
+                stats->chunks++;
+            }
+        }
+    }
+    
+    if (coords)
+        rs_free(coords);
+    if (base_chunks)
+        rs_free(base_chunks);
+    
+    /* payloads and the object index must be safe before the manifest */
+    ok = ok && fsync(self->pack_fd) == 0 && _rs_snapshot_store_save_objects(self);
+    
+    if (ok)
+    {
+        size_t len = sizeof(struct FileHeader) + (size_t)stats->chunks * sizeof(struct StoredChunk);
+        uint8_t* data = rs_malloc0(len);
+        struct FileHeader* header = (struct FileHeader*)data;
+        memcpy(header->magic, RS_SNAPSHOT_MANIFEST_MAGIC, 4);
+        header->version = rs_endian_uint32(RS_SNAPSHOT_VERSION);
+        header->count = rs_endian_uint32(stats->chunks);
+        
+        struct StoredChunk* stored = (struct StoredChunk*)(data + sizeof(struct FileHeader));
+        for (uint32_t i = 0; i < stats->chunks; i++)
+        {
+            stored[i].x = rs_endian_int32(chunks[i].x);
+            stored[i].z = rs_endian_int32(chunks[i].z);
+            stored[i].timestamp = rs_endian_uint32(chunks[i].timestamp);
+            stored[i].key = rs_endian_uint64(chunks[i].key);
+        }
+        
+        char* path = _rs_snapshot_store_path(self, "snapshots", name);
+        ok = rs_file_replace(path, data, len, true);
+        rs_free(path);
+        rs_free(data);
+    }
+    
+    rs_free(chunks);
+    return ok;
+}
+
+/* helper for rs_snapshot_store_restore(), to rewrite one region */
+static bool _rs_snapshot_store_restore_region(RSSnapshotStore* self, RSWorld* world, int32_t rx, int32_t rz, struct SnapshotChunk* chunks, uint32_t count)
+{
+    RSRegion* region = rs_world_get_region(world, rx, rz, count > 0);
+    if (region == NULL)
+        return count == 0;
+    
+    RSChunkWrite* writes = rs_new0(RSChunkWrite, 32 * 32);
+    size_t* offsets = rs_new(size_t, 32 * 32);
+    size_t write_count = 0;
+    
+    uint8_t* data = NULL;
+    size_t data_size = 0;
+    size_t data_used = 0;
+    
+    RSRegionBitmap kept;
+    rs_region_bitmap_clear(&kept);
+    bool ok = true;
+    
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        struct StoreObject* object = _rs_snapshot_store_find(self, chunks[i].key);
+        if (object == NULL || !_rs_snapshot_store_read(self, object))
+        {
+            ok = false;
+            break;
+        }
+        
+        if (data_used + object->length > data_size)
+        {
+            data_size = MAX(data_size * 2, data_used + object->length);
+            data = rs_renew(uint8_t, data, data_size);
+        }
+        memcpy(data + data_used, self->scratch, object->length);
+        
+        uint8_t x = rs_world_chunk_to_local(chunks[i].x);
+        uint8_t z = rs_world_chunk_to_local(chunks[i].z);
+        writes[write_count].x = x;
+        writes[write_count].z = z;
+        writes[write_count].length = object->length;
+        writes[write_count].encoding = object->encoding;
+        writes[write_count].timestamp = chunks[i].timestamp;
+        offsets[write_count] = data_used;
+        data_used += object->length;
+        write_count++;
+        
+        rs_region_bitmap_set(&kept, x, z);
+    }
+    
+    if (ok)
+    {
+        for (size_t i = 0; i < write_count; i++)
+            writes[i].data = data + offsets[i];
+        
+        /* anything else in the region wasn't there when the snapshot was taken */
+        for (uint8_t z = 0; z < 32; z++)
+        {
+            for (uint8_t x = 0; x < 32; x++)
+            {
+                if (rs_region_bitmap_get(&kept, x, z) || !rs_region_contains_chunk(region, x, z))
+                    continue;
+                
+                writes[write_count].x = x;
+                writes[write_count].z = z;
+                writes[write_count].data = NULL;
+                write_count++;
+            }
+        }
+        
+        ok = rs_region_set_chunks(region, writes, write_count);
+    }
+    
+    if (data)
+        rs_free(data);
+    rs_free(offsets);
+    rs_free(writes);
+    return ok;
+}
+
+bool rs_snapshot_store_restore(RSSnapshotStore* self, const char* name, RSWorld* world)
+{
+    rs_return_val_if_fail(self && name && world, false);
+    
+    uint32_t count = 0;
+    struct SnapshotChunk* chunks = _rs_snapshot_store_load_manifest(self, name, &count);
+    if (chunks == NULL)
+        return false;
+    
+    unsigned int region_count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(world, &region_count);
+    
+    /* walk the snapshot's regions and the world's regions together,
+     * both in region order, so every region in either is visited once */
+    bool ok = true;
+    uint32_t i = 0;
+    unsigned int j = 0;
+    while (ok && (i < count || j < region_count))
+    {
+        int32_t rx = 0, rz = 0;
+        bool from_snapshot = i < count;
+        if (from_snapshot)
+        {
+            rx = rs_world_chunk_to_region(chunks[i].x);
+            rz = rs_world_chunk_to_region(chunks[i].z);
+        }
+        
+        if (j < region_count && (!from_snapshot || coords[j].x < rx || (coords[j].x == rx && coords[j].z < rz)))
+        {
+            /* this region is not in the snapshot at all */
+            ok = _rs_snapshot_store_restore_region(self, world, coords[j].x, coords[j].z, NULL, 0);
+            j++;
+            continue;
+        }
+        
+        uint32_t end = i;
+        while (end < count && rs_world_chunk_to_region(chunks[end].x) == rx && rs_world_chunk_to_region(chunks[end].z) == rz)
+            end++;
+        
+        ok = _rs_snapshot_store_restore_region(self, world, rx, rz, chunks + i, end - i);
+        if (j < region_count && coords[j].x == rx && coords[j].z == rz)
+            j++;
+        i = end;
+    }
+    
+    if (coords)
+        rs_free(coords);
+    rs_free(chunks);
+    
+    return rs_world_commit(world, 0) && ok;
+}
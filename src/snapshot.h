@@ -0,0 +1,113 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_SNAPSHOT_H_INCLUDED__
+#define __RS_SNAPSHOT_H_INCLUDED__
+
+#include "world.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSSnapshotStore;
+/**
+ * The snapshot store data type.
+ *
+ * This is an opaque structure that acts as a handle to a snapshot
+ * store: a directory holding any number of world snapshots. Chunk
+ * data is stored only once no matter how many snapshots (or how many
+ * places in one world) it appears in, so each snapshot costs little
+ * more than the chunks that changed since the last one.
+ *
+ * A store is a directory holding a pack file of compressed chunk
+ * payloads, an index of those payloads keyed by a 64-bit hash, and a
+ * manifest for each snapshot listing which payload each chunk uses.
+ */
+typedef struct _RSSnapshotStore RSSnapshotStore;
+
+/**
+ * Statistics about a snapshot, filled in by rs_snapshot_store_create().
+ *
+ * \sa rs_snapshot_store_create
+ */
+typedef struct
+{
+    /** number of chunks in the snapshot */
+    uint32_t chunks;
+    /** chunks taken from the base snapshot without being read */
+    uint32_t unchanged;
+    /** chunks whose data was already in the store */
+    uint32_t duplicates;
+    /** chunks whose data was added to the store */
+    uint32_t added;
+    /** bytes of chunk data added to the store */
+    uint64_t added_bytes;
+} RSSnapshotStats;
+
+/**
+ * Open a snapshot store.
+ *
+ * \param path the store directory
+ * \param create whether to create the store if it does not exist
+ * \return the store, or NULL if it could not be opened
+ * \sa rs_snapshot_store_close
+ */
+RSSnapshotStore* rs_snapshot_store_open(const char* path, bool create);
+
+/**
+ * Close a snapshot store.
+ *
+ * \param self the store
+ * \sa rs_snapshot_store_open
+ */
+void rs_snapshot_store_close(RSSnapshotStore* self);
+
+/**
+ * Take a snapshot of a world.
+ *
+ * Every chunk in the world is recorded under the given name, which
+ * must not contain '/'. A snapshot with the same name is replaced.
+ *
+ * If base names an earlier snapshot, chunks whose timestamp matches
+ * the one recorded there are assumed unchanged, and are not read at
+ * all. Other chunks are hashed, and their data is only added to the
+ * store if no identical payload is there already; matching hashes
+ * are always confirmed by comparing the data itself.
+ *
+ * Only what is on disk is recorded, so call rs_world_commit() first
+ * if there are writes you want included. The snapshot is only
+ * visible once everything it refers to has been written and synced.
+ *
+ * A snapshot must hold every chunk, so this fails if any chunk that
+ * needs storing can't be read, or uses a compression type other than
+ * gzip or zlib.
+ *
+ * \param self the store
+ * \param world the world to snapshot
+ * \param name the name of the new snapshot
+ * \param base the name of a snapshot to compare against, or NULL
+ * \param stats where to store statistics, or NULL
+ * \return true on success, false on failure
+ * \sa rs_snapshot_store_restore
+ */
+bool rs_snapshot_store_create(RSSnapshotStore* self, RSWorld* world, const char* name, const char* base, RSSnapshotStats* stats);
+
+/**
+ * Restore a world to the state recorded in a snapshot.
+ *
+ * Chunks in the snapshot are written back with their recorded
+ * timestamps, and chunks not in the snapshot are deleted. Each region
+ * is written with a single rs_region_set_chunks() call, and the world
+ * is committed with rs_world_commit() at the end.
+ *
+ * \param self the store
+ * \param name the snapshot to restore
+ * \param world the world to write to, open for writing
+ * \return true on success, false on failure
+ * \sa rs_snapshot_store_create
+ */
+bool rs_snapshot_store_restore(RSSnapshotStore* self, const char* name, RSWorld* world);
+
+#endif /* __RS_SNAPSHOT_H_INCLUDED__ */
@@ -0,0 +1,295 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "stream.h"
+
+#include "error.h"
+#include "memory.h"
+#include "rsendian.h"
+#include "util.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/* A chunk stream is a header, followed by records. Each record starts
+ * with a type byte; chunk records carry the coordinates, timestamp,
+ * compression byte (as in region files) and length, followed by the
+ * data, and the end record has nothing else. All numbers are
+ * big-endian.
+ */
+
+#define RS_CHUNK_STREAM_MAGIC "RSCS"
+#define RS_CHUNK_STREAM_VERSION 1
+
+#define RS_CHUNK_STREAM_END 0
+#define RS_CHUNK_STREAM_CHUNK 1
+
+/* size of a chunk record, before the data */
+#define RS_CHUNK_STREAM_RECORD_SIZE 18
+
+/* how much output is buffered before it is written */
+#define RS_CHUNK_STREAM_BUFFER_SIZE (64 * 1024)
+
+/* chunks at least this large are sent straight from their region file */
+#define RS_CHUNK_STREAM_SEND_SIZE (16 * 1024)
+
+struct _RSChunkStream
+{
+    int fd;
+    bool writing;
+    bool failed;
+    bool complete;
+    
+    /* output buffer for writers, data buffer for readers */
+    uint8_t* buffer;
+    size_t buffer_size;
+    size_t buffer_used;
+};
+
+/* helper to read a whole buffer from a file descriptor */
+static bool _rs_chunk_stream_read_all(int fd, uint8_t* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret = read(fd, data, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        
+        data += ret;
+        len -= ret;
+    }
+    
+    return true;
+}
+
+/* helper to write out anything buffered */
+static bool _rs_chunk_stream_flush(RSChunkStream* self)
+{
+    if (self->buffer_used > 0 && !self->failed)
+        self->failed = !rs_write_all(self->fd, self->buffer, self->buffer_used);
+    self->buffer_used = 0;
+    return !self->failed;
+}
+
+/* helper to add to the output buffer, writing large data straight through */
+static bool _rs_chunk_stream_append(RSChunkStream* self, const void* data, size_t len)
+{
+    if (self->buffer_used + len > self->buffer_size)
+    {
+        if (!_rs_chunk_stream_flush(self))
+            return false;
+        
+        if (len > self->buffer_size)
+        {
+            self->failed = !rs_write_all(self->fd, data, len);
+            return !self->failed;
+        }
+    }
+    
+    memcpy(self->buffer + self->buffer_used, data, len);
+    self->buffer_used += len;
+    return true;
+}
+
+RSChunkStream* rs_chunk_stream_new_writer(int fd)
+{
+    rs_return_val_if_fail(fd >= 0, NULL);
+    
+    uint8_t header[8];
+    uint32_t version = rs_endian_uint32(RS_CHUNK_STREAM_VERSION);
+    memcpy(header, RS_CHUNK_STREAM_MAGIC, 4);
+    memcpy(header + 4, &version, 4);
+    
+    RSChunkStream* self = rs_new0(RSChunkStream, 1);
+    self->fd = fd;
+    self->writing = true;
+    self->buffer_size = RS_CHUNK_STREAM_BUFFER_SIZE;
+    self->buffer = rs_malloc(self->buffer_size);
+    
+    if (!_rs_chunk_stream_append(self, header, sizeof(header)))
+    {
+        rs_chunk_stream_free(self);
+        return NULL;
+    }
+    
+    return self;
+}
+
+RSChunkStream* rs_chunk_stream_new_reader(int fd)
+{
+    rs_return_val_if_fail(fd >= 0, NULL);
+    
+    uint8_t header[8];
+    uint32_t version;
+    if (!_rs_chunk_stream_read_all(fd, header, sizeof(header)))
+        return NULL;
+    
+    memcpy(&version, header + 4, 4);
+    if (memcmp(header, RS_CHUNK_STREAM_MAGIC, 4) != 0 || rs_endian_uint32(version) != RS_CHUNK_STREAM_VERSION)
+        return NULL;
+    
+    RSChunkStream* self = rs_new0(RSChunkStream, 1);
+    self->fd = fd;
+    self->writing = false;
+    return self;
+}
+
+/* helper to add the record for a chunk, up to its data */
+static bool _rs_chunk_stream_write_record(RSChunkStream* self, int32_t x, int32_t z, uint32_t timestamp, RSCompressionType encoding, uint32_t length)
+{
+    uint8_t record[RS_CHUNK_STREAM_RECORD_SIZE];
+    int32_t be_x = rs_endian_int32(x);
+    int32_t be_z = rs_endian_int32(z);
+    uint32_t be_timestamp = rs_endian_uint32(timestamp);
+    uint32_t be_length = rs_endian_uint32(length);
+    
+    record[0] = RS_CHUNK_STREAM_CHUNK;
+    memcpy(record + 1, &be_x, 4);
+    memcpy(record + 5, &be_z, 4);
+    memcpy(record + 9, &be_timestamp, 4);
+    record[13] = (encoding == RS_GZIP) ? 1 : 2;
+    memcpy(record + 14, &be_length, 4);
+    
+    return _rs_chunk_stream_append(self, record, sizeof(record));
+}
+
+bool rs_chunk_stream_write(RSChunkStream* self, int32_t x, int32_t z, uint32_t timestamp, RSCompressionType encoding, void* data, uint32_t length)
+{
+    rs_return_val_if_fail(self && self->writing, false);
+    rs_return_val_if_fail(data || length == 0, false);
+    rs_return_val_if_fail(encoding == RS_GZIP || encoding == RS_ZLIB, false);
+    
+    if (self->failed)
+        return false;
+    if (length > RS_CHUNK_STREAM_MAX_LENGTH)
+    {
+        rs_critical("chunk is too large for a stream");
+        return false;
+    }
+    
+    return _rs_chunk_stream_write_record(self, x, z, timestamp, encoding, length) && _rs_chunk_stream_append(self, data, length);
+}
+
+bool rs_chunk_stream_write_from_region(RSChunkStream* self, RSRegion* region, int32_t rx, int32_t rz, uint8_t x, uint8_t z)
+{
+    rs_return_val_if_fail(self && self->writing && region, false);
+    
+    if (self->failed)
+        return false;
+    
+    uint32_t length = rs_region_get_chunk_length(region, x, z);
+    RSCompressionType encoding = rs_region_get_chunk_compression(region, x, z);
+    void* data = rs_region_get_chunk_data(region, x, z);
+    if (data == NULL || length == 0 || (encoding != RS_GZIP && encoding != RS_ZLIB))
+        return false;
+    if (length > RS_CHUNK_STREAM_MAX_LENGTH)
+    {
+        rs_critical("chunk is too large for a stream");
+        return false;
+    }
+    
+    if (!_rs_chunk_stream_write_record(self, rx * 32 + x, rz * 32 + z, rs_region_get_chunk_timestamp(region, x, z), encoding, length))
+        return false;
+    
+    /* small chunks are cheaper to copy than to give their own syscall */
+    if (length < RS_CHUNK_STREAM_SEND_SIZE)
+        return _rs_chunk_stream_append(self, data, length);
+    
+    if (!_rs_chunk_stream_flush(self))
+        return false;
+    self->failed = !rs_region_send_chunk(region, x, z, self->fd);
+    return !self->failed;
+}
+
+bool rs_chunk_stream_read(RSChunkStream* self, RSStreamChunk* chunk)
+{
+    rs_return_val_if_fail(self && !self->writing && chunk, false);
+    
+    if (self->failed || self->complete)
+        return false;
+    
+    uint8_t record[RS_CHUNK_STREAM_RECORD_SIZE];
+    if (!_rs_chunk_stream_read_all(self->fd, record, 1))
+    {
+        self->failed = true;
+        return false;
+    }
+    
+    if (record[0] == RS_CHUNK_STREAM_END)
+    {
+        self->complete = true;
+        return false;
+    }
+    
+    if (record[0] != RS_CHUNK_STREAM_CHUNK || !_rs_chunk_stream_read_all(self->fd, record + 1, sizeof(record) - 1))
+    {
+        self->failed = true;
+        return false;
+    }
+    
+    int32_t x, z;
+    uint32_t timestamp, length;
+    memcpy(&x, record + 1, 4);
+    memcpy(&z, record + 5, 4);
+    memcpy(&timestamp, record + 9, 4);
+    memcpy(&length, record + 14, 4);
+    length = rs_endian_uint32(length);
+    
+    /* don't let a corrupt length make us allocate anything huge */
+    if ((record[13] != 1 && record[13] != 2) || length > RS_CHUNK_STREAM_MAX_LENGTH)
+    {
+        self->failed = true;
+        return false;
+    }
+    
+    if (length > self->buffer_size)
+    {
+        self->buffer_size = length;
+        self->buffer = rs_renew(uint8_t, self->buffer, self->buffer_size);
+    }
+    
+    if (!_rs_chunk_stream_read_all(self->fd, self->buffer, length))
+    {
+        self->failed = true;
+        return false;
+    }
+    
+    chunk->x = rs_endian_int32(x);
+    chunk->z = rs_endian_int32(z);
+    chunk->timestamp = rs_endian_uint32(timestamp);
+    chunk->encoding = (record[13] == 1) ? RS_GZIP : RS_ZLIB;
+    chunk->data = self->buffer;
+    chunk->length = length;
+    return true;
+}
+
+bool rs_chunk_stream_is_complete(RSChunkStream* self)
+{
+    rs_return_val_if_fail(self, false);
+    return self->complete;
+}
+
+bool rs_chunk_stream_finish(RSChunkStream* self)
+{
+    rs_return_val_if_fail(self && self->writing, false);
+    
+    uint8_t end = RS_CHUNK_STREAM_END;
+    bool ok = _rs_chunk_stream_append(self, &end, 1) && _rs_chunk_stream_flush(self);
+    rs_chunk_stream_free(self);
+    return ok;
+}
+
+void rs_chunk_stream_free(RSChunkStream* self)
+{
+    rs_return_if_fail(self);
+    
+    if (self->buffer)
+        rs_free(self->buffer);
+    rs_free(self);
+}
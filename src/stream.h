@@ -0,0 +1,170 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_STREAM_H_INCLUDED__
+#define __RS_STREAM_H_INCLUDED__
+
+#include "compression.h"
+#include "region.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * The largest chunk a stream can carry, in bytes.
+ *
+ * Chunks stored inside a region are always under 1 MiB, and external
+ * chunk files are never anywhere near this large, so a longer record
+ * means the stream is corrupt.
+ */
+#define RS_CHUNK_STREAM_MAX_LENGTH (256 * 1024 * 1024)
+
+struct _RSChunkStream;
+/**
+ * The chunk stream data type.
+ *
+ * This is an opaque structure for reading or writing a chunk stream:
+ * a flat sequence of compressed chunks, each tagged with its global
+ * coordinates and timestamp. Chunk data is carried exactly as it is
+ * stored in region files, so nothing is decompressed or recompressed
+ * on the way through. Streams are read and written sequentially, so
+ * they work over pipes and sockets as well as files.
+ */
+typedef struct _RSChunkStream RSChunkStream;
+
+/**
+ * A single chunk read from a chunk stream.
+ *
+ * \sa rs_chunk_stream_read
+ */
+typedef struct
+{
+    /** the global x coordinate of the chunk */
+    int32_t x;
+    /** the global z coordinate of the chunk */
+    int32_t z;
+    /** the last modified time of the chunk */
+    uint32_t timestamp;
+    /** the compression used on data */
+    RSCompressionType encoding;
+    /** the compressed chunk data, owned by the stream */
+    void* data;
+    /** the length of data */
+    uint32_t length;
+} RSStreamChunk;
+
+/**
+ * Start writing a chunk stream to a file descriptor.
+ *
+ * The stream header is written immediately. Output is buffered, so
+ * nothing is guaranteed to reach fd until rs_chunk_stream_finish().
+ * The file descriptor is not closed by the stream.
+ *
+ * \param fd the file descriptor to write to
+ * \return the new stream, or NULL if the header could not be written
+ * \sa rs_chunk_stream_write, rs_chunk_stream_finish
+ */
+RSChunkStream* rs_chunk_stream_new_writer(int fd);
+
+/**
+ * Start reading a chunk stream from a file descriptor.
+ *
+ * The stream header is read and checked immediately. The file
+ * descriptor is not closed by the stream.
+ *
+ * \param fd the file descriptor to read from
+ * \return the new stream, or NULL if fd does not hold a chunk stream
+ * \sa rs_chunk_stream_read, rs_chunk_stream_free
+ */
+RSChunkStream* rs_chunk_stream_new_reader(int fd);
+
+/**
+ * Add a chunk to a stream being written.
+ *
+ * \param self the stream
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param timestamp the last modified time of the chunk
+ * \param encoding the compression used on data (RS_GZIP or RS_ZLIB)
+ * \param data the compressed chunk data
+ * \param length the length of data, at most RS_CHUNK_STREAM_MAX_LENGTH
+ * \return true on success, false if the chunk is too large or the
+ *         write failed
+ * \sa rs_chunk_stream_new_writer
+ */
+bool rs_chunk_stream_write(RSChunkStream* self, int32_t x, int32_t z, uint32_t timestamp, RSCompressionType encoding, void* data, uint32_t length);
+
+/**
+ * Add a chunk from a region file to a stream being written.
+ *
+ * This writes the same record as rs_chunk_stream_write() would for
+ * the chunk's data, timestamp and compression, but large chunks are
+ * copied straight from the region file to the stream's file
+ * descriptor with rs_region_send_chunk(), without passing through
+ * user space.
+ *
+ * \param self the stream
+ * \param region the region holding the chunk
+ * \param rx the x coordinate of the region
+ * \param rz the z coordinate of the region
+ * \param x the x coordinate of the chunk inside the region
+ * \param z the z coordinate of the chunk inside the region
+ * \return true on success, false if the chunk does not exist, is too
+ *         large, or the write failed
+ * \sa rs_chunk_stream_write
+ */
+bool rs_chunk_stream_write_from_region(RSChunkStream* self, RSRegion* region, int32_t rx, int32_t rz, uint8_t x, uint8_t z);
+
+/**
+ * Read the next chunk from a stream.
+ *
+ * The data in chunk belongs to the stream, and is only good until
+ * the next call. A record longer than RS_CHUNK_STREAM_MAX_LENGTH is
+ * treated as corruption, and fails the stream.
+ *
+ * \param self the stream
+ * \param chunk where to store the chunk
+ * \return true if a chunk was read, false at the end of the stream or
+ *         on error
+ * \sa rs_chunk_stream_is_complete
+ */
+bool rs_chunk_stream_read(RSChunkStream* self, RSStreamChunk* chunk);
+
+/**
+ * Get whether a stream being read ended properly.
+ *
+ * After rs_chunk_stream_read() returns false, use this to tell a
+ * complete stream apart from one that was cut short or corrupted.
+ *
+ * \param self the stream
+ * \return true if the end-of-stream marker was read
+ * \sa rs_chunk_stream_read
+ */
+bool rs_chunk_stream_is_complete(RSChunkStream* self);
+
+/**
+ * Finish writing a stream, and free it.
+ *
+ * This writes the end-of-stream marker and any buffered output.
+ *
+ * \param self the stream
+ * \return true if everything was written, false otherwise
+ * \sa rs_chunk_stream_new_writer
+ */
+bool rs_chunk_stream_finish(RSChunkStream* self);
+
+/**
+ * Free a stream without finishing it.
+ *
+ * Use this for streams being read, or to abandon a stream being
+ * written; readers will see it as incomplete.
+ *
+ * \param self the stream
+ * \sa rs_chunk_stream_finish
+ */
+void rs_chunk_stream_free(RSChunkStream* self);
+
+#endif /* __RS_STREAM_H_INCLUDED__ */
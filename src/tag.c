@@ -9,6 +9,8 @@
 #include "memory.h"
 #include "list.h"
 
+#include <string.h>
+
 /* used in the compound tag RSList */
 typedef struct
 {
@@ -191,6 +193,46 @@ static void _rs_tag_free(RSTag* self)
     rs_free(self);
 }
 
+size_t rs_tag_get_memory_size(RSTag* self)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    size_t size = sizeof(RSTag);
+    RSList* cell;
+    
+    switch (self->type)
+    {
+    case RS_TAG_BYTE_ARRAY:
+        size += self->byte_array.size;
+        break;
+    case RS_TAG_INT_ARRAY:
+        size += self->int_array.size * sizeof(uint32_t);
+        break;
+    case RS_TAG_STRING:
+        size += strlen(self->string) + 1;
+        break;
+    case RS_TAG_LIST:
+        cell = self->list.items;
+        for (; cell != NULL; cell = cell->next)
+            size += sizeof(RSList) + rs_tag_get_memory_size((RSTag*)(cell->data));
+        break;
+    case RS_TAG_COMPOUND:
+        cell = self->compound;
+        for (; cell != NULL; cell = cell->next)
+        {
+            RSTagCompoundNode* node = (RSTagCompoundNode*)(cell->data);
+            size += sizeof(RSList) + sizeof(RSTagCompoundNode);
+            size += strlen(node->key) + 1;
+            size += rs_tag_get_memory_size(node->value);
+        }
+        break;
+    default:
+        break;
+    };
+    
+    return size;
+}
+
 void rs_tag_ref(RSTag* self)
 {
     rs_return_if_fail(self);
@@ -66,6 +66,9 @@ RSTag* rs_tag_new(RSTagType type, ...);
 void rs_tag_ref(RSTag* self);
 void rs_tag_unref(RSTag* self);
 
+/* approximate heap memory used by this tag and everything in it */
+size_t rs_tag_get_memory_size(RSTag* self);
+
 /* finds the first tag with this name, recursively */
 RSTag* rs_tag_find(RSTag* self, const char* name);
 
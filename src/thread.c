@@ -0,0 +1,154 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "thread.h"
+
+#include "error.h"
+#include "memory.h"
+
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct _RSMutex
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;
+#else
+    int unused;
+#endif
+};
+
+unsigned int rs_thread_get_default_count(void)
+{
+#if defined(HAVE_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+        return count;
+#endif
+    return 1;
+}
+
+#ifdef HAVE_PTHREAD
+
+/* what each spawned worker needs to know */
+struct ThreadStart
+{
+    RSThreadFunction func;
+    void* user;
+    unsigned int index;
+};
+
+static void* _rs_thread_start(void* data)
+{
+    struct ThreadStart* start = data;
+    start->func(start->user, start->index);
+    return NULL;
+}
+
+#endif /* HAVE_PTHREAD */
+
+unsigned int rs_thread_run(unsigned int nthreads, RSThreadFunction func, void* user)
+{
+    rs_return_val_if_fail(func, 0);
+    
+    if (nthreads == 0)
+        nthreads = rs_thread_get_default_count();
+    
+#ifdef HAVE_PTHREAD
+    pthread_t* threads = rs_new(pthread_t, nthreads);
+    struct ThreadStart* starts = rs_new(struct ThreadStart, nthreads);
+    unsigned int started = 1;
+    
+    /* worker 0 is the calling thread, so start from 1 */
+    for (unsigned int i = 1; i < nthreads; i++)
+    {
+        starts[i].func = func;
+        starts[i].user = user;
+        starts[i].index = i;
+        if (pthread_create(&(threads[i]), NULL, _rs_thread_start, &(starts[i])) != 0)
+        {
+            /* run with what we have */
+            break;
+        }
+        
+        started = i + 1;
+    }
+    
+    func(user, 0);
+    
+    for (unsigned int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+    
+    rs_free(starts);
+    rs_free(threads);
+    return started;
+#else
+    func(user, 0);
+    return 1;
+#endif
+}
+
+uint32_t rs_thread_next(uint32_t* counter)
+{
+    rs_assert(counter);
+#if defined(HAVE_PTHREAD) && defined(__GNUC__)
+    return __sync_fetch_and_add(counter, 1);
+#elif defined(HAVE_PTHREAD)
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&lock);
+    uint32_t ret = (*counter)++;
+    pthread_mutex_unlock(&lock);
+    return ret;
+#else
+    return (*counter)++;
+#endif
+}
+
+void rs_thread_yield(void)
+{
+#ifdef HAVE_PTHREAD
+    sched_yield();
+#endif
+}
+
+RSMutex* rs_mutex_new(void)
+{
+    RSMutex* self = rs_new0(RSMutex, 1);
+#ifdef HAVE_PTHREAD
+    if (pthread_mutex_init(&(self->mutex), NULL) != 0)
+        rs_error("could not create mutex");
+#endif
+    return self;
+}
+
+void rs_mutex_lock(RSMutex* self)
+{
+    rs_return_if_fail(self);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&(self->mutex));
+#endif
+}
+
+void rs_mutex_unlock(RSMutex* self)
+{
+    rs_return_if_fail(self);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&(self->mutex));
+#endif
+}
+
+void rs_mutex_free(RSMutex* self)
+{
+    rs_return_if_fail(self);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&(self->mutex));
+#endif
+    rs_free(self);
+}
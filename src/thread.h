@@ -0,0 +1,117 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_THREAD_H_INCLUDED__
+#define __RS_THREAD_H_INCLUDED__
+
+#include <stdint.h>
+
+/**
+ * A function run by each worker thread in rs_thread_run().
+ *
+ * \param user the user data passed to rs_thread_run()
+ * \param thread the index of this worker, from 0 up to (but not
+ *        including) the number of threads
+ */
+typedef void (*RSThreadFunction)(void* user, unsigned int thread);
+
+/**
+ * Get a sensible default number of worker threads.
+ *
+ * This is the number of processors currently online, or 1 if that
+ * can't be determined or libredstone was built without thread
+ * support.
+ *
+ * \return the default number of threads
+ * \sa rs_thread_run
+ */
+unsigned int rs_thread_get_default_count(void);
+
+/**
+ * Run a function on several threads at once, and wait for them.
+ *
+ * This starts nthreads workers (the calling thread is used as worker
+ * 0), each running func, and returns once all of them have
+ * finished. Workers usually share their work by pulling indices with
+ * rs_thread_next().
+ *
+ * If nthreads is 0, rs_thread_get_default_count() is used. If
+ * libredstone was built without thread support, func is run once, on
+ * the calling thread, as worker 0.
+ *
+ * \param nthreads the number of threads to use, or 0
+ * \param func the function to run
+ * \param user data to pass to func
+ * \return the number of workers that actually ran
+ * \sa rs_thread_next, rs_thread_get_default_count
+ */
+unsigned int rs_thread_run(unsigned int nthreads, RSThreadFunction func, void* user);
+
+/**
+ * Atomically fetch and increment a counter.
+ *
+ * This is the usual way for workers started with rs_thread_run() to
+ * divide work among themselves: each one repeatedly takes the next
+ * index from a shared counter until it runs past the end.
+ *
+ * \param counter the shared counter
+ * \return the value of the counter before it was incremented
+ * \sa rs_thread_run
+ */
+uint32_t rs_thread_next(uint32_t* counter);
+
+/**
+ * Let other threads run.
+ *
+ * Workers that are waiting for other workers to produce more work
+ * can call this instead of spinning. Without thread support, this
+ * does nothing.
+ */
+void rs_thread_yield(void);
+
+struct _RSMutex;
+/**
+ * A mutual exclusion lock.
+ *
+ * If libredstone was built without thread support, these are still
+ * available, but do nothing.
+ */
+typedef struct _RSMutex RSMutex;
+
+/**
+ * Create a new mutex.
+ *
+ * \return the new, unlocked mutex
+ * \sa rs_mutex_free
+ */
+RSMutex* rs_mutex_new(void);
+
+/**
+ * Lock a mutex, waiting for it if needed.
+ *
+ * \param self the mutex to lock
+ * \sa rs_mutex_unlock
+ */
+void rs_mutex_lock(RSMutex* self);
+
+/**
+ * Unlock a mutex.
+ *
+ * \param self the mutex to unlock
+ * \sa rs_mutex_lock
+ */
+void rs_mutex_unlock(RSMutex* self);
+
+/**
+ * Free a mutex.
+ *
+ * The mutex must not be locked.
+ *
+ * \param self the mutex to free
+ * \sa rs_mutex_new
+ */
+void rs_mutex_free(RSMutex* self);
+
+#endif /* __RS_THREAD_H_INCLUDED__ */
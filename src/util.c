@@ -0,0 +1,133 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "util.h"
+
+#include "error.h"
+#include "memory.h"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+bool rs_write_all(int fd, const void* data, size_t len)
+{
+    size_t written = 0;
+    while (written < len)
+    {
+        ssize_t ret = write(fd, (const uint8_t*)data + written, len - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        written += ret;
+    }
+    
+    return true;
+}
+
+int rs_file_replace_begin(const char* path, char** tmp_path)
+{
+    rs_return_val_if_fail(path && tmp_path, -1);
+    
+    size_t len = strlen(path) + 5;
+    *tmp_path = rs_new(char, len);
+    snprintf(*tmp_path, len, "%s.tmp", path);
+    
+    int fd = open(*tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (fd < 0)
+    {
+        rs_free(*tmp_path);
+        *tmp_path = NULL;
+    }
+    
+    return fd;
+}
+
+bool rs_file_replace_commit(int fd, char* tmp_path, const char* path, bool sync)
+{
+    rs_return_val_if_fail(fd >= 0 && tmp_path && path, false);
+    
+    bool ok = !sync || fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    
+    if (ok)
+        ok = (rename(tmp_path, path) == 0);
+    if (!ok)
+        unlink(tmp_path);
+    if (ok && sync)
+        ok = rs_sync_parent_directory(path);
+    
+    rs_free(tmp_path);
+    return ok;
+}
+
+void rs_file_replace_abort(int fd, char* tmp_path)
+{
+    rs_return_if_fail(tmp_path);
+    
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp_path);
+    rs_free(tmp_path);
+}
+
+bool rs_file_replace(const char* path, const void* data, size_t len, bool sync)
+{
+    rs_return_val_if_fail(path && (data || len == 0), false);
+    
+    char* tmp_path = NULL;
+    int fd = rs_file_replace_begin(path, &tmp_path);
+    if (fd < 0)
+        return false;
+    
+    if (!rs_write_all(fd, data, len))
+    {
+        rs_file_replace_abort(fd, tmp_path);
+        return false;
+    }
+    
+    return rs_file_replace_commit(fd, tmp_path, path, sync);
+}
+
+bool rs_sync_parent_directory(const char* path)
+{
+    rs_return_val_if_fail(path, false);
+    
+#ifdef _WIN32
+    /* directories can't be opened (or synced) here */
+    return true;
+#else
+    const char* slash = strrchr(path, '/');
+    char* dir;
+    if (slash == NULL)
+    {
+        dir = rs_strdup(".");
+    } else {
+        /* keep the slash itself only when it is the root */
+        dir = rs_strdup(path);
+        dir[slash == path ? 1 : slash - path] = 0;
+    }
+    
+    bool ok = false;
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0)
+    {
+        ok = (fsync(fd) == 0);
+        close(fd);
+    }
+    
+    rs_free(dir);
+    return ok;
+#endif
+}
@@ -6,6 +6,9 @@
 #ifndef __RS_UTIL_H_INCLUDED__
 #define __RS_UTIL_H_INCLUDED__
 
+#include <stdbool.h>
+#include <stddef.h>
+
 /**
  * Begins multi-line preprocessor macros.
  *
@@ -31,4 +34,97 @@
 /** Maximum macro. */
 #define MAX(a, b) ((a) < (b) ? (b) : (a))
 
+#ifndef __PACKED__
+#ifdef __GNUC__
+/** Marks a struct as packed, for structs that mirror on-disk formats. */
+#define __PACKED__ __attribute__((gcc_struct, __packed__))
+#else
+#define __PACKED__ /**/
+#endif
+#endif
+
+/**
+ * Write a whole buffer to a file descriptor.
+ *
+ * Short and interrupted writes are retried until everything is
+ * written.
+ *
+ * \param fd the file descriptor to write to
+ * \param data the data to write
+ * \param len the length of data
+ * \return true on success, false if a write failed
+ */
+bool rs_write_all(int fd, const void* data, size_t len);
+
+/**
+ * Start replacing a file atomically.
+ *
+ * This opens a temporary file next to path (path with ".tmp" added)
+ * for writing. Write the new contents to the returned descriptor, then
+ * call rs_file_replace_commit() to move it into place, or
+ * rs_file_replace_abort() to throw it away.
+ *
+ * \param path the file to replace
+ * \param tmp_path where to store the temporary file's path
+ * \return a file descriptor, or -1 if the file could not be created
+ * \sa rs_file_replace_commit, rs_file_replace_abort, rs_file_replace
+ */
+int rs_file_replace_begin(const char* path, char** tmp_path);
+
+/**
+ * Finish replacing a file atomically.
+ *
+ * The temporary file is closed and renamed over path. If sync is
+ * true, the temporary file is synced before the rename, and the
+ * directory after it, so that once this returns the new contents
+ * survive a crash. On failure, the temporary file is removed and
+ * path is left as it was.
+ *
+ * Either way, fd is closed and tmp_path is freed.
+ *
+ * \param fd the descriptor from rs_file_replace_begin()
+ * \param tmp_path the path from rs_file_replace_begin()
+ * \param path the file to replace
+ * \param sync whether to make the replacement durable
+ * \return true on success
+ * \sa rs_file_replace_begin
+ */
+bool rs_file_replace_commit(int fd, char* tmp_path, const char* path, bool sync);
+
+/**
+ * Give up on replacing a file.
+ *
+ * fd is closed, and the temporary file is removed and tmp_path freed.
+ *
+ * \param fd the descriptor from rs_file_replace_begin()
+ * \param tmp_path the path from rs_file_replace_begin()
+ * \sa rs_file_replace_begin
+ */
+void rs_file_replace_abort(int fd, char* tmp_path);
+
+/**
+ * Replace a file's contents atomically, in one go.
+ *
+ * This is rs_file_replace_begin(), rs_write_all() and
+ * rs_file_replace_commit() together.
+ *
+ * \param path the file to replace
+ * \param data the new contents
+ * \param len the length of data
+ * \param sync whether to make the replacement durable
+ * \return true on success
+ */
+bool rs_file_replace(const char* path, const void* data, size_t len, bool sync);
+
+/**
+ * Sync the directory containing a file.
+ *
+ * After a file is created, renamed or removed, this makes the change
+ * to the directory itself survive a crash.
+ *
+ * \param path a path inside the directory to sync
+ * \return true on success, or where directories can't be synced
+ */
+bool rs_sync_parent_directory(const char* path);
+
 #endif /* __RS_UTIL_H_INCLUDED__ */
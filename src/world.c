@@ -0,0 +1,1525 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "world.h"
+
+#include "error.h"
+#include "memory.h"
+#include "list.h"
+#include "thread.h"
+#include "util.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if HAVE_MKDIR
+#  if MKDIR_TAKES_ONE_ARG
+#    define mkdir(a, b) mkdir(a)
+#  endif
+#else
+#  if HAVE__MKDIR
+#    define mkdir(a, b) _mkdir(a)
+#  else
+#    error "Don't know how to create a directory on this system."
+#  endif
+#endif
+
+/* an open region, as stored in the cache */
+struct WorldRegion
+{
+    int32_t rx, rz;
+    RSRegion* region;
+};
+
+/* the chunk index entries for one region, in header order */
+struct IndexRegion
+{
+    int32_t rx, rz;
+    RSWorldIndexEntry* entries;
+    uint16_t count;
+};
+
+/* overall world info */
+struct _RSWorld
+{
+    char* path;
+    char* region_dir;
+    bool write;
+    RSWorldFormat format;
+    
+    /* list of WorldRegion structs, most recently used first */
+    RSList* regions;
+    unsigned int open_count;
+    unsigned int max_open;
+    
+    /* set when regions were flushed without syncing, and closed */
+    bool pending_sync;
+    
+    /* the chunk index, kept up to date once it exists. Entries are
+     * grouped by region, and the regions sorted by coordinates, so
+     * updating one region doesn't touch the rest.
+     */
+    bool indexing;
+    bool index_dirty;
+    struct IndexRegion** index;
+    uint32_t index_regions;
+    uint32_t index_allocated;
+    uint32_t index_count;
+};
+
+/* helper to create a directory, if it's not there already */
+static bool _rs_world_make_dir(const char* path)
+{
+    return (mkdir(path, 0777) == 0 || errno == EEXIST);
+}
+
+/* helper to guess the format from the region files already there */
+static RSWorldFormat _rs_world_detect_format(const char* region_dir)
+{
+    bool anvil = false;
+    bool mcregion = false;
+    
+    DIR* dir = opendir(region_dir);
+    if (dir == NULL)
+        return RS_WORLD_ANVIL;
+    
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(ent->d_name);
+        if (len < 4 || strncmp(ent->d_name, "r.", 2) != 0)
+            continue;
+        
+        if (strcmp(ent->d_name + len - 4, ".mca") == 0)
+            anvil = true;
+        else if (strcmp(ent->d_name + len - 4, ".mcr") == 0)
+            mcregion = true;
+    }
+    closedir(dir);
+    
+    return (mcregion && !anvil) ? RS_WORLD_MCREGION : RS_WORLD_ANVIL;
+}
+
+/* helper to find the index entries for a region, optionally adding
+ * an empty set if there are none yet
+ */
+static struct IndexRegion* _rs_world_find_index_region(RSWorld* self, int32_t rx, int32_t rz, bool create)
+{
+    uint32_t low = 0;
+    uint32_t high = self->index_regions;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        struct IndexRegion* ir = self->index[mid];
+        if (ir->rx == rx && ir->rz == rz)
+            return ir;
+        
+        if (ir->rx < rx || (ir->rx == rx && ir->rz < rz))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    if (!create)
+        return NULL;
+    
+    if (self->index_regions == self->index_allocated)
+    {
+        self->index_allocated = self->index_allocated ? self->index_allocated * 2 : 64;
+        self->index = rs_renew(struct IndexRegion*, self->index, self->index_allocated);
+    }
+    
+    memmove(&(self->index[low + 1]), &(self->index[low]), (self->index_regions - low) * sizeof(struct IndexRegion*));
+    self->index_regions++;
+    
+    struct IndexRegion* ir = rs_new0(struct IndexRegion, 1);
+    ir->rx = rx;
+    ir->rz = rz;
+    self->index[low] = ir;
+    return ir;
+}
+
+/* helper to get where an index entry sits in its region's header */
+static inline uint16_t _rs_world_index_local(const RSWorldIndexEntry* entry)
+{
+    return rs_world_chunk_to_local(entry->z) * 32 + rs_world_chunk_to_local(entry->x);
+}
+
+/* qsort comparison for index entries, in header order */
+static int _rs_world_compare_index_local(const void* a, const void* b)
+{
+    uint16_t la = _rs_world_index_local(a);
+    uint16_t lb = _rs_world_index_local(b);
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    return 0;
+}
+
+/* helper to free every index entry */
+static void _rs_world_clear_index(RSWorld* self)
+{
+    for (uint32_t i = 0; i < self->index_regions; i++)
+    {
+        if (self->index[i]->entries)
+            rs_free(self->index[i]->entries);
+        rs_free(self->index[i]);
+    }
+    
+    self->index_regions = 0;
+    self->index_count = 0;
+}
+
+/* helper to read in an existing index file, grouping it by region */
+static void _rs_world_load_index(RSWorld* self, RSWorldIndex* index)
+{
+    uint32_t count = rs_world_index_get_count(index);
+    RSWorldIndexEntry* all = rs_new(RSWorldIndexEntry, count ? count : 1);
+    for (uint32_t i = 0; i < count; i++)
+        rs_world_index_get(index, i, &(all[i]));
+    
+    /* count the entries in each region first, so each set is allocated once */
+    uint16_t* region_of = rs_new(uint16_t, count ? count : 1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct IndexRegion* ir = _rs_world_find_index_region(self, rs_world_chunk_to_region(all[i].x), rs_world_chunk_to_region(all[i].z), true);
+        region_of[i] = ir->count < 32 * 32 ? ir->count++ : 32 * 32;
+    }
+    
+    for (uint32_t i = 0; i < self->index_regions; i++)
+    {
+        struct IndexRegion* ir = self->index[i];
+        ir->entries = rs_new(RSWorldIndexEntry, ir->count ? ir->count : 1);
+    }
+    
+    for (uint32_t i = 0; i < count; i++)
+    {
+        /* a corrupt file could list a chunk twice */
+        if (region_of[i] >= 32 * 32)
+            continue;
+        
+        struct IndexRegion* ir = _rs_world_find_index_region(self, rs_world_chunk_to_region(all[i].x), rs_world_chunk_to_region(all[i].z), false);
+        ir->entries[region_of[i]] = all[i];
+    }
+    
+    for (uint32_t i = 0; i < self->index_regions; i++)
+    {
+        struct IndexRegion* ir = self->index[i];
+        qsort(ir->entries, ir->count, sizeof(RSWorldIndexEntry), _rs_world_compare_index_local);
+        self->index_count += ir->count;
+    }
+    
+    rs_free(region_of);
+    rs_free(all);
+}
+
+/* helper to replace the index entries for a region with what is
+ * currently in its header, reusing hashes of chunks that haven't
+ * moved. The index is only marked dirty if something changed.
+ */
+static void _rs_world_index_region(RSWorld* self, int32_t rx, int32_t rz, RSRegion* region)
+{
+    struct IndexRegion* ir = _rs_world_find_index_region(self, rx, rz, true);
+    
+    RSWorldIndexEntry entries[32 * 32];
+    uint16_t count = 0;
+    uint16_t old = 0;
+    bool changed = false;
+    for (uint8_t z = 0; z < 32; z++)
+    {
+        for (uint8_t x = 0; x < 32; x++)
+        {
+            /* both lists are in header order, so walk them together */
+            uint16_t local = z * 32 + x;
+            while (old < ir->count && _rs_world_index_local(&(ir->entries[old])) < local)
+            {
+                old++;
+                changed = true;
+            }
+            
+            RSWorldIndexEntry* prev = NULL;
+            if (old < ir->count && _rs_world_index_local(&(ir->entries[old])) == local)
+                prev = &(ir->entries[old++]);
+            
+            if (!rs_region_contains_chunk(region, x, z))
+            {
+                changed = changed || prev != NULL;
+                continue;
+            }
+            
+            RSWorldIndexEntry* entry = &(entries[count++]);
+            entry->x = rx * 32 + x;
+            entry->z = rz * 32 + z;
+            entry->offset = rs_region_get_chunk_offset(region, x, z);
+            entry->length = rs_region_get_chunk_length(region, x, z);
+            entry->timestamp = rs_region_get_chunk_timestamp(region, x, z);
+            
+            if (prev && prev->offset == entry->offset && prev->length == entry->length && prev->timestamp == entry->timestamp)
+            {
+                entry->hash = prev->hash;
+            } else {
+                entry->hash = rs_region_get_chunk_hash(region, x, z);
+                changed = true;
+            }
+        }
+    }
+    
+    if (old < ir->count)
+        changed = true;
+    if (!changed)
+        return;
+    
+    self->index_count = self->index_count - ir->count + count;
+    ir->entries = rs_renew(RSWorldIndexEntry, ir->entries, count ? count : 1);
+    memcpy(ir->entries, entries, count * sizeof(RSWorldIndexEntry));
+    ir->count = count;
+    self->index_dirty = true;
+}
+
+/* helper to write out the index, if it has changed */
+static bool _rs_world_save_index(RSWorld* self)
+{
+    if (!(self->indexing) || !(self->index_dirty))
+        return true;
+    
+    /* the file is in coordinate order, which rs_world_index_write() sorts out */
+    RSWorldIndexEntry* all = rs_new(RSWorldIndexEntry, self->index_count ? self->index_count : 1);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < self->index_regions; i++)
+    {
+        struct IndexRegion* ir = self->index[i];
+        memcpy(&(all[count]), ir->entries, ir->count * sizeof(RSWorldIndexEntry));
+        count += ir->count;
+    }
+    
+    char* path = rs_world_get_index_path(self);
+    bool ok = rs_world_index_write(path, all, count);
+    rs_free(path);
+    rs_free(all);
+    
+    if (ok)
+        self->index_dirty = false;
+    return ok;
+}
+
+RSWorld* rs_world_open(const char* path, bool write)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    size_t len = strlen(path) + 8;
+    char* region_dir = rs_new(char, len);
+    snprintf(region_dir, len, "%s/region", path);
+    
+    if (write)
+    {
+        if (!_rs_world_make_dir(path) || !_rs_world_make_dir(region_dir))
+        {
+            rs_free(region_dir);
+            return NULL;
+        }
+    } else {
+        struct stat stat_buf;
+        if (stat(region_dir, &stat_buf) < 0 || !S_ISDIR(stat_buf.st_mode))
+        {
+            rs_free(region_dir);
+            return NULL;
+        }
+    }
+    
+    RSWorld* self = rs_new0(RSWorld, 1);
+    self->path = rs_strdup(path);
+    self->region_dir = region_dir;
+    self->write = write;
+    self->format = _rs_world_detect_format(region_dir);
+    self->regions = NULL;
+    self->open_count = 0;
+    self->max_open = RS_WORLD_DEFAULT_MAX_OPEN;
+    
+    /* pick up an existing index, so it stays up to date */
+    if (write)
+    {
+        char* index_path = rs_world_get_index_path(self);
+        RSWorldIndex* index = rs_world_index_open(index_path);
+        rs_free(index_path);
+        
+        if (index)
+        {
+            self->indexing = true;
+            _rs_world_load_index(self, index);
+            rs_world_index_close(index);
+        }
+    }
+    
+    return self;
+}
+
+/* helper to close a cached region, and free its cache entry */
+static void _rs_world_close_region(RSWorld* self, struct WorldRegion* entry)
+{
+    bool dirty = rs_region_is_dirty(entry->region);
+
+#ifdef HAVE_SYNCFS
+    /* the next commit syncs the whole filesystem anyway */
+    if (rs_region_is_dirty(entry->region))
+    {
+        rs_region_flush_nosync(entry->region);
+        self->pending_sync = true;
+    }
+#endif
+    
+    /* the index and bloom filters are built from what is on disk */
+    if (dirty)
+    {
+        if (rs_region_is_dirty(entry->region))
+            rs_region_flush(entry->region);
+        if (self->indexing)
+            _rs_world_index_region(self, entry->rx, entry->rz, entry->region);
+        rs_region_bloom_update(entry->region, false);
+    }
+    
+    rs_region_close(entry->region);
+    rs_free(entry);
+}
+
+/* helper to close regions until we're back under the limit */
+static void _rs_world_enforce_limit(RSWorld* self)
+{
+    while (self->open_count > self->max_open)
+    {
+        /* the last cell is the least recently used */
+        RSList* cell = self->regions;
+        while (cell->next)
+            cell = cell->next;
+        
+        _rs_world_close_region(self, cell->data);
+        self->regions = rs_list_remove(self->regions, cell);
+        self->open_count--;
+    }
+}
+
+void rs_world_close(RSWorld* self)
+{
+    rs_return_if_fail(self);
+    
+    rs_world_commit(self, 0);
+    
+    RSList* cell = self->regions;
+    for (; cell != NULL; cell = cell->next)
+        _rs_world_close_region(self, cell->data);
+    rs_list_free(self->regions);
+    
+    _rs_world_save_index(self);
+    _rs_world_clear_index(self);
+    if (self->index)
+        rs_free(self->index);
+    rs_free(self->path);
+    rs_free(self->region_dir);
+    rs_free(self);
+}
+
+void rs_world_set_format(RSWorld* self, RSWorldFormat format)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(format == RS_WORLD_ANVIL || format == RS_WORLD_MCREGION);
+    self->format = format;
+}
+
+RSWorldFormat rs_world_get_format(RSWorld* self)
+{
+    rs_return_val_if_fail(self, RS_WORLD_ANVIL);
+    return self->format;
+}
+
+void rs_world_set_max_open(RSWorld* self, unsigned int max_open)
+{
+    rs_return_if_fail(self);
+    rs_return_if_fail(max_open > 0);
+    
+    self->max_open = max_open;
+    _rs_world_enforce_limit(self);
+}
+
+unsigned int rs_world_get_max_open(RSWorld* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->max_open;
+}
+
+char* rs_world_get_region_path(RSWorld* self, int32_t rx, int32_t rz)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    const char* ext = (self->format == RS_WORLD_MCREGION) ? "mcr" : "mca";
+    size_t len = strlen(self->region_dir) + 64;
+    char* path = rs_new(char, len);
+    snprintf(path, len, "%s/r.%i.%i.%s", self->region_dir, rx, rz, ext);
+    return path;
+}
+
+RSRegion* rs_world_get_region(RSWorld* self, int32_t rx, int32_t rz, bool create)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    /* look for it in the cache, and move it to the front if it's there */
+    RSList* cell = self->regions;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct WorldRegion* entry = cell->data;
+        if (entry->rx != rx || entry->rz != rz)
+            continue;
+        
+        if (cell != self->regions)
+        {
+            self->regions = rs_list_remove(self->regions, cell);
+            self->regions = rs_list_push(self->regions, entry);
+        }
+        return entry->region;
+    }
+    
+    char* path = rs_world_get_region_path(self, rx, rz);
+    
+    /* rs_region_open creates files in write mode, so check first */
+    struct stat stat_buf;
+    bool exists = (stat(path, &stat_buf) == 0);
+    if (!exists && !(create && self->write))
+    {
+        rs_free(path);
+        return NULL;
+    }
+    
+    RSRegion* region = rs_region_open(path, self->write);
+    rs_free(path);
+    if (region == NULL)
+        return NULL;
+    
+    struct WorldRegion* entry = rs_new(struct WorldRegion, 1);
+    entry->rx = rx;
+    entry->rz = rz;
+    entry->region = region;
+    self->regions = rs_list_push(self->regions, entry);
+    self->open_count++;
+    
+    /* make room, if needed (the new region is safe at the front) */
+    _rs_world_enforce_limit(self);
+    
+    return region;
+}
+
+/* qsort comparison for RSWorldRegionCoords */
+static int _rs_world_compare_coords(const void* a, const void* b)
+{
+    const RSWorldRegionCoords* ca = a;
+    const RSWorldRegionCoords* cb = b;
+    if (ca->x != cb->x)
+        return ca->x < cb->x ? -1 : 1;
+    if (ca->z != cb->z)
+        return ca->z < cb->z ? -1 : 1;
+    return 0;
+}
+
+RSWorldRegionCoords* rs_world_list_regions(RSWorld* self, unsigned int* count)
+{
+    rs_return_val_if_fail(self && count, NULL);
+    *count = 0;
+    
+    DIR* dir = opendir(self->region_dir);
+    if (dir == NULL)
+        return NULL;
+    
+    const char* ext = self->format == RS_WORLD_MCREGION ? "mcr" : "mca";
+    unsigned int allocated = 0;
+    RSWorldRegionCoords* ret = NULL;
+    
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        int32_t rx, rz;
+        char file_ext[4];
+        int end = 0;
+        if (sscanf(ent->d_name, "r.%d.%d.%3s%n", &rx, &rz, file_ext, &end) != 3)
+            continue;
+        if (ent->d_name[end] != 0 || strcmp(file_ext, ext) != 0)
+            continue;
+        
+        if (*count == allocated)
+        {
+            allocated = allocated ? allocated * 2 : 16;
+            ret = rs_renew(RSWorldRegionCoords, ret, allocated);
+        }
+        
+        ret[*count].x = rx;
+        ret[*count].z = rz;
+        (*count)++;
+    }
+    closedir(dir);
+    
+    if (ret)
+        qsort(ret, *count, sizeof(RSWorldRegionCoords), _rs_world_compare_coords);
+    return ret;
+}
+
+bool rs_world_contains_chunk(RSWorld* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, false);
+    
+    RSRegion* region = rs_world_get_region(self, rs_world_chunk_to_region(x), rs_world_chunk_to_region(z), false);
+    if (region == NULL)
+        return false;
+    
+    return rs_region_contains_chunk(region, rs_world_chunk_to_local(x), rs_world_chunk_to_local(z));
+}
+
+RSNBT* rs_world_get_chunk(RSWorld* self, int32_t x, int32_t z)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    RSRegion* region = rs_world_get_region(self, rs_world_chunk_to_region(x), rs_world_chunk_to_region(z), false);
+    if (region == NULL)
+        return NULL;
+    
+    return rs_nbt_parse_from_region(region, rs_world_chunk_to_local(x), rs_world_chunk_to_local(z));
+}
+
+bool rs_world_set_chunk(RSWorld* self, int32_t x, int32_t z, RSNBT* nbt)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(nbt, false);
+    if (!(self->write))
+    {
+        rs_critical("world is not opened in write mode.");
+        return false;
+    }
+    
+    RSRegion* region = rs_world_get_region(self, rs_world_chunk_to_region(x), rs_world_chunk_to_region(z), true);
+    if (region == NULL)
+        return false;
+    
+    return rs_nbt_write_to_region(nbt, region, rs_world_chunk_to_local(x), rs_world_chunk_to_local(z));
+}
+
+void rs_world_clear_chunk(RSWorld* self, int32_t x, int32_t z)
+{
+    rs_return_if_fail(self);
+    if (!(self->write))
+    {
+        rs_critical("world is not opened in write mode.");
+        return;
+    }
+    
+    /* a chunk in a region that doesn't exist is already gone */
+    RSRegion* region = rs_world_get_region(self, rs_world_chunk_to_region(x), rs_world_chunk_to_region(z), false);
+    if (region == NULL)
+        return;
+    
+    rs_region_clear_chunk(region, rs_world_chunk_to_local(x), rs_world_chunk_to_local(z));
+}
+
+/* helper to point a box iterator at the start of its current region */
+static void _rs_world_box_iterator_enter(RSWorldBoxIterator* it)
+{
+    it->x = MAX(it->x1, it->rx * 32);
+    it->z = MAX(it->z1, it->rz * 32);
+}
+
+void rs_world_box_iterator_init(RSWorld* self, RSWorldBoxIterator* it, int32_t x1, int32_t z1, int32_t x2, int32_t z2)
+{
+    rs_return_if_fail(self && it);
+    
+    it->world = self;
+    it->x1 = MIN(x1, x2);
+    it->x2 = MAX(x1, x2);
+    it->z1 = MIN(z1, z2);
+    it->z2 = MAX(z1, z2);
+    it->rx = rs_world_chunk_to_region(it->x1);
+    it->rz = rs_world_chunk_to_region(it->z1);
+    _rs_world_box_iterator_enter(it);
+}
+
+bool rs_world_box_iterator_next(RSWorldBoxIterator* it, int32_t* x, int32_t* z, RSRegion** region)
+{
+    rs_return_val_if_fail(it && x && z, false);
+    
+    int32_t rx_end = rs_world_chunk_to_region(it->x2);
+    int32_t rz_end = rs_world_chunk_to_region(it->z2);
+    
+    while (it->rz <= rz_end)
+    {
+        RSRegion* current = rs_world_get_region(it->world, it->rx, it->rz, false);
+        if (current)
+        {
+            /* the part of the box inside this region */
+            int32_t x_start = MAX(it->x1, it->rx * 32);
+            int32_t x_end = MIN(it->x2, it->rx * 32 + 31);
+            int32_t z_end = MIN(it->z2, it->rz * 32 + 31);
+            
+            for (; it->z <= z_end; it->z++, it->x = x_start)
+            {
+                while (it->x <= x_end)
+                {
+                    int32_t cx = it->x++;
+                    if (rs_region_contains_chunk(current, rs_world_chunk_to_local(cx), rs_world_chunk_to_local(it->z)))
+                    {
+                        *x = cx;
+                        *z = it->z;
+                        if (region)
+                            *region = current;
+                        return true;
+                    }
+                }
+            }
+        }
+        
+        /* move on to the next region that overlaps the box */
+        it->rx++;
+        if (it->rx > rx_end)
+        {
+            it->rx = rs_world_chunk_to_region(it->x1);
+            it->rz++;
+        }
+        _rs_world_box_iterator_enter(it);
+    }
+    
+    return false;
+}
+
+/* a sliding window of parsed chunks, three rows high */
+struct _RSWorldNeighborhoodIterator
+{
+    RSWorld* world;
+    int32_t x1, z1, x2, z2;
+    
+    /* the next center chunk to look at */
+    int32_t x, z;
+    
+    /* rows[0] is row z - 1, rows[1] is row z, and rows[2] is row z + 1,
+     * each covering x1 - 1 to x2 + 1 */
+    uint32_t width;
+    RSNBT** rows[3];
+};
+
+/* helper to fill a window row with row z of the world */
+static void _rs_world_neighborhood_load(RSWorldNeighborhoodIterator* self, RSNBT** row, int32_t z)
+{
+    for (uint32_t i = 0; i < self->width; i++)
+        row[i] = rs_world_get_chunk(self->world, self->x1 - 1 + (int32_t)i, z);
+}
+
+/* helper to empty a window row */
+static void _rs_world_neighborhood_clear(RSWorldNeighborhoodIterator* self, RSNBT** row)
+{
+    for (uint32_t i = 0; i < self->width; i++)
+    {
+        if (row[i])
+            rs_nbt_free(row[i]);
+        row[i] = NULL;
+    }
+}
+
+RSWorldNeighborhoodIterator* rs_world_neighborhood_iterator_new(RSWorld* self, int32_t x1, int32_t z1, int32_t x2, int32_t z2)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    RSWorldNeighborhoodIterator* it = rs_new0(RSWorldNeighborhoodIterator, 1);
+    it->world = self;
+    it->x1 = MIN(x1, x2);
+    it->x2 = MAX(x1, x2);
+    it->z1 = MIN(z1, z2);
+    it->z2 = MAX(z1, z2);
+    it->x = it->x1;
+    it->z = it->z1;
+    it->width = (uint32_t)(it->x2 - it->x1) + 3;
+    
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        it->rows[i] = rs_new0(RSNBT*, it->width);
+        _rs_world_neighborhood_load(it, it->rows[i], it->z - 1 + (int32_t)i);
+    }
+    
+    return it;
+}
+
+bool rs_world_neighborhood_iterator_next(RSWorldNeighborhoodIterator* self, int32_t* x, int32_t* z, RSNBT* neighbors[9])
+{
+    rs_return_val_if_fail(self && x && z && neighbors, false);
+    
+    while (self->z <= self->z2)
+    {
+        while (self->x <= self->x2)
+        {
+            uint32_t i = (uint32_t)(self->x - self->x1) + 1;
+            if (self->rows[1][i] == NULL)
+            {
+                self->x++;
+                continue;
+            }
+            
+            for (unsigned int dz = 0; dz < 3; dz++)
+            {
+                for (unsigned int dx = 0; dx < 3; dx++)
+                    neighbors[dz * 3 + dx] = self->rows[dz][i - 1 + dx];
+            }
+            
+            *x = self->x++;
+            *z = self->z;
+            return true;
+        }
+        
+        /* slide the window down a row, reusing the oldest row's storage */
+        RSNBT** oldest = self->rows[0];
+        _rs_world_neighborhood_clear(self, oldest);
+        self->rows[0] = self->rows[1];
+        self->rows[1] = self->rows[2];
+        self->rows[2] = oldest;
+        
+        self->x = self->x1;
+        self->z++;
+        if (self->z <= self->z2)
+            _rs_world_neighborhood_load(self, self->rows[2], self->z + 1);
+    }
+    
+    return false;
+}
+
+void rs_world_neighborhood_iterator_free(RSWorldNeighborhoodIterator* self)
+{
+    rs_return_if_fail(self);
+    
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        _rs_world_neighborhood_clear(self, self->rows[i]);
+        rs_free(self->rows[i]);
+    }
+    rs_free(self);
+}
+
+void rs_world_flush(RSWorld* self)
+{
+    rs_return_if_fail(self);
+    
+    RSList* cell = self->regions;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct WorldRegion* entry = cell->data;
+        bool dirty = rs_region_is_dirty(entry->region);
+        rs_region_flush(entry->region);
+        if (dirty && self->indexing)
+            _rs_world_index_region(self, entry->rx, entry->rz, entry->region);
+        if (dirty)
+            rs_region_bloom_update(entry->region, false);
+    }
+    
+    _rs_world_save_index(self);
+}
+
+/* qsort comparison for WorldRegion pointers, by region coordinates */
+static int _rs_world_compare_regions(const void* a, const void* b)
+{
+    const struct WorldRegion* ra = *(struct WorldRegion* const*)a;
+    const struct WorldRegion* rb = *(struct WorldRegion* const*)b;
+    if (ra->rx != rb->rx)
+        return ra->rx < rb->rx ? -1 : 1;
+    if (ra->rz != rb->rz)
+        return ra->rz < rb->rz ? -1 : 1;
+    return 0;
+}
+
+/* shared state for rs_world_commit() workers */
+struct CommitJob
+{
+    struct WorldRegion** regions;
+    uint32_t count;
+    uint32_t next;
+    bool sync;
+    uint32_t failures;
+};
+
+static void _rs_world_commit_worker(void* user, unsigned int thread)
+{
+    struct CommitJob* job = user;
+    uint32_t i;
+    while ((i = rs_thread_next(&(job->next))) < job->count)
+    {
+        RSRegion* region = job->regions[i]->region;
+        if (!job->sync)
+            rs_region_flush_nosync(region);
+        else if (!rs_region_sync(region))
+            rs_thread_next(&(job->failures));
+    }
+}
+
+bool rs_world_commit(RSWorld* self, unsigned int nthreads)
+{
+    rs_return_val_if_fail(self, false);
+    
+    if (!(self->write))
+        return true;
+    if (self->open_count == 0)
+        return _rs_world_save_index(self);
+    
+    /* collect the dirty regions, in file name order */
+    struct CommitJob job;
+    job.regions = rs_new(struct WorldRegion*, self->open_count);
+    job.count = 0;
+    job.next = 0;
+    job.sync = false;
+    job.failures = 0;
+    
+    RSList* cell = self->regions;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct WorldRegion* entry = cell->data;
+        if (rs_region_is_dirty(entry->region))
+            job.regions[job.count++] = entry;
+    }
+    
+    if (job.count == 0 && !self->pending_sync)
+    {
+        rs_free(job.regions);
+        return _rs_world_save_index(self);
+    }
+    
+    qsort(job.regions, job.count, sizeof(struct WorldRegion*), _rs_world_compare_regions);
+    
+    /* write everything out in parallel, leaving it in the OS cache */
+    if (job.count > 0)
+        rs_thread_run(MIN(nthreads ? nthreads : rs_thread_get_default_count(), job.count), _rs_world_commit_worker, &job);
+    
+    for (uint32_t i = 0; i < job.count; i++)
+    {
+        if (self->indexing)
+            _rs_world_index_region(self, job.regions[i]->rx, job.regions[i]->rz, job.regions[i]->region);
+        rs_region_bloom_update(job.regions[i]->region, false);
+    }
+    
+    /* then wait for all of it to hit the disk at once */
+    bool ok = _rs_world_save_index(self);
+#ifdef HAVE_SYNCFS
+    int fd = open(self->region_dir, O_RDONLY);
+    ok = (fd >= 0 && syncfs(fd) == 0) && ok;
+    if (fd >= 0)
+        close(fd);
+#else
+    job.sync = true;
+    job.next = 0;
+    if (job.count > 0)
+        rs_thread_run(MIN(nthreads ? nthreads : rs_thread_get_default_count(), job.count), _rs_world_commit_worker, &job);
+    ok = (job.failures == 0) && ok;
+    
+    /* new region files need their directory entries synced, too */
+    int fd = open(self->region_dir, O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+    
+    rs_free(job.regions);
+    if (ok)
+        self->pending_sync = false;
+    return ok;
+}
+
+char* rs_world_get_index_path(RSWorld* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    size_t len = strlen(self->path) + strlen(RS_WORLD_INDEX_NAME) + 2;
+    char* path = rs_new(char, len);
+    snprintf(path, len, "%s/%s", self->path, RS_WORLD_INDEX_NAME);
+    return path;
+}
+
+bool rs_world_build_index(RSWorld* self)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(self->write, false);
+    
+    /* make sure the headers reflect every write so far */
+    rs_world_flush(self);
+    
+    self->indexing = true;
+    _rs_world_clear_index(self);
+    
+    unsigned int count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(self, &count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        RSRegion* region = rs_world_get_region(self, coords[i].x, coords[i].z, false);
+        if (region)
+            _rs_world_index_region(self, coords[i].x, coords[i].z, region);
+    }
+    if (coords)
+        rs_free(coords);
+    
+    self->index_dirty = true;
+    return _rs_world_save_index(self);
+}
+
+RSWorldIndex* rs_world_open_index(RSWorld* self)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    char* path = rs_world_get_index_path(self);
+    RSWorldIndex* index = rs_world_index_open(path);
+    rs_free(path);
+    return index;
+}
+
+bool rs_world_build_blooms(RSWorld* self)
+{
+    rs_return_val_if_fail(self, false);
+    
+    /* make sure the regions reflect every write so far */
+    if (self->write)
+        rs_world_flush(self);
+    
+    unsigned int count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(self, &count);
+    
+    bool ok = true;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        RSRegion* region = rs_world_get_region(self, coords[i].x, coords[i].z, false);
+        if (region)
+            ok = rs_region_bloom_update(region, true) && ok;
+    }
+    
+    if (coords)
+        rs_free(coords);
+    return ok;
+}
+
+RSRegionBloom* rs_world_open_bloom(RSWorld* self, int32_t rx, int32_t rz)
+{
+    rs_return_val_if_fail(self, NULL);
+    
+    char* path = rs_world_get_region_path(self, rx, rz);
+    RSRegionBloom* bloom = rs_region_bloom_open(path);
+    rs_free(path);
+    return bloom;
+}
+
+unsigned int rs_world_refresh(RSWorld* self)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    unsigned int changed = 0;
+    RSList* cell = self->regions;
+    for (; cell != NULL; cell = cell->next)
+    {
+        struct WorldRegion* entry = cell->data;
+        unsigned int region_changed = rs_region_refresh(entry->region, NULL);
+        if (region_changed > 0 && self->indexing)
+            _rs_world_index_region(self, entry->rx, entry->rz, entry->region);
+        if (region_changed > 0 && self->write)
+            rs_region_bloom_update(entry->region, false);
+        changed += region_changed;
+    }
+    
+    if (self->write)
+        _rs_world_save_index(self);
+    return changed;
+}
+
+bool rs_world_backup_incremental(RSWorld* self, uint32_t since, RSChunkStream* sink)
+{
+    rs_return_val_if_fail(self && sink, false);
+    
+    unsigned int count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(self, &count);
+    
+    bool ok = true;
+    for (unsigned int i = 0; ok && i < count; i++)
+    {
+        RSRegion* region = rs_world_get_region(self, coords[i].x, coords[i].z, false);
+        if (region == NULL)
+            continue;
+        
+        for (uint8_t z = 0; ok && z < 32; z++)
+        {
+            for (uint8_t x = 0; ok && x < 32; x++)
+            {
+                if (!rs_region_contains_chunk(region, x, z))
+                    continue;
+                
+                if (rs_region_get_chunk_timestamp(region, x, z) < since)
+                    continue;
+                
+                /* a stream can't carry it, and a backup missing it
+                 * would restore as if it had never existed
+                 */
+                RSCompressionType encoding = rs_region_get_chunk_compression(region, x, z);
+                if (rs_region_get_chunk_length(region, x, z) == 0 || (encoding != RS_GZIP && encoding != RS_ZLIB))
+                {
+                    rs_critical("chunk (%i, %i) can't be read, so it can't be backed up", coords[i].x * 32 + x, coords[i].z * 32 + z);
+                    ok = false;
+                    break;
+                }
+                
+                ok = rs_chunk_stream_write_from_region(sink, region, coords[i].x, coords[i].z, x, z);
+            }
+        }
+    }
+    
+    if (coords)
+        rs_free(coords);
+    return ok;
+}
+
+/* chunks read by rs_world_restore(), waiting to be written to one region */
+struct RestoreBatch
+{
+    int32_t rx, rz;
+    RSChunkWrite writes[32 * 32];
+    size_t offsets[32 * 32];
+    size_t count;
+    
+    /* all the chunk data, back to back */
+    uint8_t* data;
+    size_t data_size;
+    size_t data_used;
+};
+
+/* helper to hand a batch to its region */
+static bool _rs_world_restore_batch(RSWorld* self, struct RestoreBatch* batch)
+{
+    if (batch->count == 0)
+        return true;
+    
+    /* the data may have moved as it grew, so fill in pointers now */
+    for (size_t i = 0; i < batch->count; i++)
+        batch->writes[i].data = batch->data + batch->offsets[i];
+    
+    RSRegion* region = rs_world_get_region(self, batch->rx, batch->rz, true);
+    bool ok = region && rs_region_set_chunks(region, batch->writes, batch->count);
+    
+    batch->count = 0;
+    batch->data_used = 0;
+    return ok;
+}
+
+bool rs_world_restore(RSWorld* self, RSChunkStream* source)
+{
+    rs_return_val_if_fail(self && source, false);
+    rs_return_val_if_fail(self->write, false);
+    
+    struct RestoreBatch* batch = rs_new0(struct RestoreBatch, 1);
+    bool ok = true;
+    
+    RSStreamChunk chunk;
+    while (rs_chunk_stream_read(source, &chunk))
+    {
+        int32_t rx = rs_world_chunk_to_region(chunk.x);
+        int32_t rz = rs_world_chunk_to_region(chunk.z);
+        if (batch->count > 0 && (rx != batch->rx || rz != batch->rz || batch->count == 32 * 32))
+            ok = _rs_world_restore_batch(self, batch) && ok;
+        
+        if (batch->data_used + chunk.length > batch->data_size)
+        {
+            batch->data_size = MAX(batch->data_size * 2, batch->data_used + chunk.length);
+            batch->data = rs_renew(uint8_t, batch->data, batch->data_size);
+        }
+        
+        memcpy(batch->data + batch->data_used, chunk.data, chunk.length);
+        
+        RSChunkWrite* write = &(batch->writes[batch->count]);
+        write->x = rs_world_chunk_to_local(chunk.x);
+        write->z = rs_world_chunk_to_local(chunk.z);
+        write->length = chunk.length;
+        write->encoding = chunk.encoding;
+        write->timestamp = chunk.timestamp;
+        batch->offsets[batch->count] = batch->data_used;
+        batch->data_used += chunk.length;
+        batch->count++;
+        batch->rx = rx;
+        batch->rz = rz;
+    }
+    
+    ok = _rs_world_restore_batch(self, batch) && ok;
+    ok = rs_chunk_stream_is_complete(source) && ok;
+    
+    if (batch->data)
+        rs_free(batch->data);
+    rs_free(batch);
+    
+    return rs_world_commit(self, 0) && ok;
+}
+
+bool rs_world_export(RSWorld* self, int fd)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(fd >= 0, false);
+    
+    RSChunkStream* sink = rs_chunk_stream_new_writer(fd);
+    if (sink == NULL)
+        return false;
+    
+    if (!rs_world_backup_incremental(self, 0, sink))
+    {
+        rs_chunk_stream_free(sink);
+        return false;
+    }
+    
+    return rs_chunk_stream_finish(sink);
+}
+
+bool rs_world_import(RSWorld* self, int fd)
+{
+    rs_return_val_if_fail(self, false);
+    rs_return_val_if_fail(self->write, false);
+    rs_return_val_if_fail(fd >= 0, false);
+    
+    RSChunkStream* source = rs_chunk_stream_new_reader(fd);
+    if (source == NULL)
+        return false;
+    
+    bool ok = rs_world_restore(self, source);
+    rs_chunk_stream_free(source);
+    return ok;
+}
+
+/* the number of pieces each region is split into, once it is open */
+#define RS_WORLD_FOREACH_SPLIT 8
+
+/* a region being walked by rs_world_foreach_chunk_reduce() */
+struct ForeachRegion
+{
+    char* path;
+    int32_t rx, rz;
+    RSRegion* region;
+    
+    /* number of chunk ranges finished; the last one closes the region */
+    uint32_t finished;
+};
+
+/* one unit of work: either a whole region (end == 0), or a range
+ * of chunk indices in an open region */
+struct ForeachTask
+{
+    struct ForeachRegion* region;
+    uint16_t start, end;
+};
+
+/* a per-worker task queue. The owner pushes and pops at the tail,
+ * and other workers steal from the head, so thieves get the oldest
+ * (and usually largest) tasks. */
+struct TaskQueue
+{
+    RSMutex* lock;
+    struct ForeachTask* tasks;
+    unsigned int head, tail, allocated;
+};
+
+/* per-worker state */
+struct ForeachWorker
+{
+    struct TaskQueue queue;
+    
+    /* reusable decompression buffer */
+    uint8_t* buffer;
+    size_t buffer_size;
+    
+    void* local;
+    unsigned int visited;
+    bool ran;
+};
+
+/* shared state for rs_world_foreach_chunk_reduce() workers */
+struct ForeachJob
+{
+    RSWorldFilterFunction filter;
+    RSWorldChunkFunction func;
+    void* user;
+    
+    /* used instead of filter and func by rs_world_foreach_chunk_raw() */
+    RSWorldRawFilterFunction raw_filter;
+    RSWorldRawChunkFunction raw_func;
+    
+    struct ForeachWorker* workers;
+    unsigned int count;
+    
+    /* number of tasks queued or running, guarded by lock */
+    RSMutex* lock;
+    unsigned int pending;
+    
+    /* external chunks are loaded lazily, so access to them is serialized */
+    RSMutex* external_lock;
+};
+
+static void _rs_world_queue_push(struct TaskQueue* queue, struct ForeachTask* task)
+{
+    rs_mutex_lock(queue->lock);
+    if (queue->tail == queue->allocated)
+    {
+        queue->allocated = queue->allocated ? queue->allocated * 2 : 16;
+        queue->tasks = rs_renew(struct ForeachTask, queue->tasks, queue->allocated);
+    }
+    queue->tasks[queue->tail++] = *task;
+    rs_mutex_unlock(queue->lock);
+}
+
+/* takes from the tail if steal is false, or the head if it is true */
+static bool _rs_world_queue_pop(struct TaskQueue* queue, struct ForeachTask* task, bool steal)
+{
+    bool ret = false;
+    rs_mutex_lock(queue->lock);
+    if (queue->head < queue->tail)
+    {
+        if (steal)
+            *task = queue->tasks[queue->head++];
+        else
+            *task = queue->tasks[--(queue->tail)];
+        ret = true;
+        
+        if (queue->head == queue->tail)
+            queue->head = queue->tail = 0;
+    }
+    rs_mutex_unlock(queue->lock);
+    return ret;
+}
+
+/* helper to mark n tasks as added (or finished, if negative) */
+static unsigned int _rs_world_foreach_pending(struct ForeachJob* job, int n)
+{
+    rs_mutex_lock(job->lock);
+    job->pending += n;
+    unsigned int ret = job->pending;
+    rs_mutex_unlock(job->lock);
+    return ret;
+}
+
+/* helper to run func on each chunk in a range of an open region */
+static void _rs_world_foreach_range(struct ForeachJob* job, struct ForeachWorker* worker, struct ForeachTask* task)
+{
+    RSRegion* region = task->region->region;
+    for (unsigned int i = task->start; i < task->end; i++)
+    {
+        uint8_t x = i % 32;
+        uint8_t z = i / 32;
+        if (!rs_region_contains_chunk(region, x, z))
+            continue;
+        
+        /* external chunks are mapped the first time they're looked
+         * at, even just for their length, and other workers may be
+         * looking at the same region
+         */
+        bool external = rs_region_chunk_is_external(region, x, z);
+        
+        RSWorldChunkInfo info;
+        info.x = task->region->rx * 32 + x;
+        info.z = task->region->rz * 32 + z;
+        info.timestamp = rs_region_get_chunk_timestamp(region, x, z);
+        if (external)
+            rs_mutex_lock(job->external_lock);
+        info.length = rs_region_get_chunk_length(region, x, z);
+        if (external)
+            rs_mutex_unlock(job->external_lock);
+        info.encoding = rs_region_get_chunk_compression(region, x, z);
+        
+        bool ok = false;
+        if (job->filter)
+            ok = job->filter(info.x, info.z, info.timestamp, job->user);
+        else if (job->raw_filter)
+            ok = job->raw_filter(&info, job->user);
+        else
+            ok = true;
+        if (!ok)
+            continue;
+        
+        if (external)
+            rs_mutex_lock(job->external_lock);
+        
+        size_t len = 0;
+        ok = false;
+        void* data = rs_region_get_chunk_data(region, x, z);
+        if (data)
+            ok = rs_decompress_into(info.encoding, data, info.length, &(worker->buffer), &(worker->buffer_size), &len);
+        
+        if (external)
+            rs_mutex_unlock(job->external_lock);
+        
+        if (!ok)
+            continue;
+        
+        if (job->raw_func)
+        {
+            job->raw_func(&info, worker->buffer, len, worker->local, job->user);
+            worker->visited++;
+            continue;
+        }
+        
+        RSNBT* chunk = rs_nbt_parse_uncompressed(worker->buffer, len);
+        if (!chunk)
+            continue;
+        
+        job->func(info.x, info.z, chunk, worker->local, job->user);
+        rs_nbt_free(chunk);
+        worker->visited++;
+    }
+    
+    if (rs_thread_next(&(task->region->finished)) == RS_WORLD_FOREACH_SPLIT - 1)
+    {
+        rs_region_close(region);
+        task->region->region = NULL;
+    }
+}
+
+/* helper to run a single task, splitting it up if it is a whole region */
+static void _rs_world_foreach_task(struct ForeachJob* job, struct ForeachWorker* worker, struct ForeachTask* task)
+{
+    if (task->end == 0)
+    {
+        task->region->region = rs_region_open(task->region->path, false);
+        if (task->region->region == NULL)
+            return;
+        
+        /* keep one piece, and queue the rest where others can steal them */
+        unsigned int piece = (32 * 32) / RS_WORLD_FOREACH_SPLIT;
+        _rs_world_foreach_pending(job, RS_WORLD_FOREACH_SPLIT - 1);
+        for (unsigned int i = RS_WORLD_FOREACH_SPLIT - 1; i > 0; i--)
+        {
+            struct ForeachTask sub = {task->region, i * piece, (i + 1) * piece};
+            _rs_world_queue_push(&(worker->queue), &sub);
+        }
+        
+        task->start = 0;
+        task->end = piece;
+    }
+    
+    _rs_world_foreach_range(job, worker, task);
+}
+
+static void _rs_world_foreach_worker(void* user, unsigned int thread)
+{
+    struct ForeachJob* job = user;
+    struct ForeachWorker* worker = &(job->workers[thread]);
+    worker->ran = true;
+    
+    while (true)
+    {
+        struct ForeachTask task;
+        bool found = _rs_world_queue_pop(&(worker->queue), &task, false);
+        for (unsigned int i = 1; !found && i < job->count; i++)
+            found = _rs_world_queue_pop(&(job->workers[(thread + i) % job->count].queue), &task, true);
+        
+        if (found)
+        {
+            _rs_world_foreach_task(job, worker, &task);
+            _rs_world_foreach_pending(job, -1);
+        } else if (_rs_world_foreach_pending(job, 0) == 0) {
+            break;
+        } else {
+            /* everything left is running; wait for it to split or finish */
+            rs_thread_yield();
+        }
+    }
+}
+
+/* helper to run a prepared job over every region in the world */
+static unsigned int _rs_world_foreach_run(RSWorld* self, struct ForeachJob* job, size_t local_size, RSWorldReduceFunction reduce, void* user, unsigned int nthreads)
+{
+    unsigned int region_count = 0;
+    RSWorldRegionCoords* coords = rs_world_list_regions(self, &region_count);
+    if (coords == NULL)
+        return 0;
+    
+    if (nthreads == 0)
+        nthreads = rs_thread_get_default_count();
+    
+    job->user = user;
+    job->count = nthreads;
+    job->workers = rs_new0(struct ForeachWorker, nthreads);
+    job->lock = rs_mutex_new();
+    job->pending = region_count;
+    job->external_lock = rs_mutex_new();
+    
+    for (unsigned int i = 0; i < nthreads; i++)
+    {
+        job->workers[i].queue.lock = rs_mutex_new();
+        if (local_size > 0)
+            job->workers[i].local = rs_malloc0(local_size);
+    }
+    
+    /* deal the regions out round-robin, as whole-region tasks */
+    struct ForeachRegion* regions = rs_new0(struct ForeachRegion, region_count);
+    for (unsigned int i = 0; i < region_count; i++)
+    {
+        regions[i].path = rs_world_get_region_path(self, coords[i].x, coords[i].z);
+        regions[i].rx = coords[i].x;
+        regions[i].rz = coords[i].z;
+        
+        struct ForeachTask task = {&(regions[i]), 0, 0};
+        _rs_world_queue_push(&(job->workers[i % nthreads].queue), &task);
+    }
+    rs_free(coords);
+    
+    rs_thread_run(nthreads, _rs_world_foreach_worker, job);
+    
+    unsigned int visited = 0;
+    for (unsigned int i = 0; i < nthreads; i++)
+    {
+        struct ForeachWorker* worker = &(job->workers[i]);
+        if (worker->ran && reduce && worker->local)
+            reduce(worker->local, user);
+        visited += worker->visited;
+        
+        if (worker->local)
+            rs_free(worker->local);
+        if (worker->buffer)
+            rs_free(worker->buffer);
+        if (worker->queue.tasks)
+            rs_free(worker->queue.tasks);
+        rs_mutex_free(worker->queue.lock);
+    }
+    
+    for (unsigned int i = 0; i < region_count; i++)
+    {
+        if (regions[i].region)
+            rs_region_close(regions[i].region);
+        rs_free(regions[i].path);
+    }
+    
+    rs_free(regions);
+    rs_free(job->workers);
+    rs_mutex_free(job->lock);
+    rs_mutex_free(job->external_lock);
+    return visited;
+}
+
+unsigned int rs_world_foreach_chunk(RSWorld* self, RSWorldFilterFunction filter, RSWorldChunkFunction func, void* user, unsigned int nthreads)
+{
+    return rs_world_foreach_chunk_reduce(self, filter, func, 0, NULL, user, nthreads);
+}
+
+unsigned int rs_world_foreach_chunk_reduce(RSWorld* self, RSWorldFilterFunction filter, RSWorldChunkFunction func, size_t local_size, RSWorldReduceFunction reduce, void* user, unsigned int nthreads)
+{
+    rs_return_val_if_fail(self && func, 0);
+    
+    struct ForeachJob job;
+    memset(&job, 0, sizeof(job));
+    job.filter = filter;
+    job.func = func;
+    return _rs_world_foreach_run(self, &job, local_size, reduce, user, nthreads);
+}
+
+unsigned int rs_world_foreach_chunk_raw(RSWorld* self, RSWorldRawFilterFunction filter, RSWorldRawChunkFunction func, size_t local_size, RSWorldReduceFunction reduce, void* user, unsigned int nthreads)
+{
+    rs_return_val_if_fail(self && func, 0);
+    
+    struct ForeachJob job;
+    memset(&job, 0, sizeof(job));
+    job.raw_filter = filter;
+    job.raw_func = func;
+    return _rs_world_foreach_run(self, &job, local_size, reduce, user, nthreads);
+}
@@ -0,0 +1,749 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_WORLD_H_INCLUDED__
+#define __RS_WORLD_H_INCLUDED__
+
+#include "region.h"
+#include "nbt.h"
+#include "worldindex.h"
+#include "bloom.h"
+#include "stream.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSWorld;
+/**
+ * The world data type.
+ *
+ * This is an opaque structure that acts as a handle to a whole save
+ * directory, and is passed in to all world-related functions.
+ */
+typedef struct _RSWorld RSWorld;
+
+struct _RSWorldNeighborhoodIterator;
+/**
+ * An iterator over 3x3 neighborhoods of chunks.
+ *
+ * This is an opaque structure, created with
+ * rs_world_neighborhood_iterator_new().
+ */
+typedef struct _RSWorldNeighborhoodIterator RSWorldNeighborhoodIterator;
+
+/**
+ * Region file formats.
+ *
+ * These only decide which region files a world uses; the files
+ * themselves are handled the same way by the region API.
+ *
+ * \sa rs_world_set_format
+ */
+typedef enum
+{
+    /** the Anvil format, with region files named r.X.Z.mca */
+    RS_WORLD_ANVIL,
+    /** the older McRegion format, with region files named r.X.Z.mcr */
+    RS_WORLD_MCREGION,
+} RSWorldFormat;
+
+/**
+ * The coordinates of a region, as returned by rs_world_list_regions().
+ */
+typedef struct
+{
+    /** the x coordinate of the region */
+    int32_t x;
+    /** the z coordinate of the region */
+    int32_t z;
+} RSWorldRegionCoords;
+
+/**
+ * What the region headers say about a chunk, as passed to
+ * rs_world_foreach_chunk_raw().
+ */
+typedef struct
+{
+    /** the global x coordinate of the chunk */
+    int32_t x;
+    /** the global z coordinate of the chunk */
+    int32_t z;
+    /** the last modified time of the chunk */
+    uint32_t timestamp;
+    /** the length of the compressed chunk data */
+    uint32_t length;
+    /** the compression used on the chunk data */
+    RSCompressionType encoding;
+} RSWorldChunkInfo;
+
+/**
+ * A function deciding which chunks rs_world_foreach_chunk() reads.
+ *
+ * This is called with only the information in the region headers,
+ * before any chunk data is read, so it is a cheap way to skip
+ * chunks. It may be called from several threads at once.
+ *
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param timestamp the last modified time of the chunk
+ * \param user the user data passed to rs_world_foreach_chunk()
+ * \return true to read the chunk, false to skip it
+ * \sa rs_world_foreach_chunk
+ */
+typedef bool (*RSWorldFilterFunction)(int32_t x, int32_t z, uint32_t timestamp, void* user);
+
+/**
+ * A function called on each chunk by rs_world_foreach_chunk().
+ *
+ * This may be called from several threads at once. The chunk is
+ * freed after this returns, so take a reference to any tags you
+ * want to keep.
+ *
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param chunk the parsed chunk
+ * \param local this thread's local state, or NULL
+ * \param user the user data passed to rs_world_foreach_chunk()
+ * \sa rs_world_foreach_chunk, rs_world_foreach_chunk_reduce
+ */
+typedef void (*RSWorldChunkFunction)(int32_t x, int32_t z, RSNBT* chunk, void* local, void* user);
+
+/**
+ * A function that merges one thread's local state into the result.
+ *
+ * This is called once for each worker thread used by
+ * rs_world_foreach_chunk_reduce(), after all chunks are done, and
+ * never from two threads at once.
+ *
+ * \param local the thread's local state
+ * \param user the user data passed to rs_world_foreach_chunk_reduce()
+ * \sa rs_world_foreach_chunk_reduce
+ */
+typedef void (*RSWorldReduceFunction)(void* local, void* user);
+
+/**
+ * A function deciding which chunks rs_world_foreach_chunk_raw() reads.
+ *
+ * Like RSWorldFilterFunction, but with everything the region headers
+ * say about the chunk.
+ *
+ * \param info the chunk's header information
+ * \param user the user data passed to rs_world_foreach_chunk_raw()
+ * \return true to read the chunk, false to skip it
+ * \sa rs_world_foreach_chunk_raw
+ */
+typedef bool (*RSWorldRawFilterFunction)(const RSWorldChunkInfo* info, void* user);
+
+/**
+ * A function called on each chunk by rs_world_foreach_chunk_raw().
+ *
+ * This gets the chunk's uncompressed NBT, before it is parsed. The
+ * data belongs to the calling thread, and is only good until this
+ * returns; use rs_nbt_find_uncompressed() to pick out single tags, or
+ * rs_nbt_parse_uncompressed() to parse the whole chunk. This may be
+ * called from several threads at once.
+ *
+ * \param info the chunk's header information
+ * \param data the uncompressed NBT of the chunk
+ * \param len the length of data
+ * \param local this thread's local state, or NULL
+ * \param user the user data passed to rs_world_foreach_chunk_raw()
+ * \sa rs_world_foreach_chunk_raw
+ */
+typedef void (*RSWorldRawChunkFunction)(const RSWorldChunkInfo* info, void* data, size_t len, void* local, void* user);
+
+/**
+ * An iterator over the chunks in a rectangle of the world.
+ *
+ * Set this up with rs_world_box_iterator_init(), and step it with
+ * rs_world_box_iterator_next(). It lives on the stack, and needs no
+ * cleanup; the fields are only for internal use.
+ *
+ * \sa rs_world_box_iterator_init, rs_world_box_iterator_next
+ */
+typedef struct
+{
+    /** \private */
+    RSWorld* world;
+    /** \private the box, in global chunk coordinates */
+    int32_t x1, z1, x2, z2;
+    /** \private the current region */
+    int32_t rx, rz;
+    /** \private the next chunk to look at */
+    int32_t x, z;
+} RSWorldBoxIterator;
+
+/** The name of the chunk index file, inside the world directory. */
+#define RS_WORLD_INDEX_NAME "chunks.idx"
+
+/** The default limit on the number of regions a world keeps open. */
+#define RS_WORLD_DEFAULT_MAX_OPEN 64
+
+/**
+ * Open a save directory.
+ *
+ * This opens the world stored in the given directory, whose region
+ * files live in its region subdirectory. Region files are opened as
+ * they are needed, and kept open in a least-recently-used cache of
+ * at most RS_WORLD_DEFAULT_MAX_OPEN regions (see
+ * rs_world_set_max_open()), so that large worlds do not run out of
+ * file descriptors or address space.
+ *
+ * If the region directory already has McRegion files in it (and no
+ * Anvil files), the world uses the McRegion format; otherwise it
+ * uses Anvil. In write mode, the save directory and its region
+ * subdirectory are created if they do not exist yet.
+ *
+ * \param path the path to the save directory
+ * \param write whether to open the world with write mode or not
+ * \return the new world object, or NULL
+ * \sa rs_world_close
+ */
+RSWorld* rs_world_open(const char* path, bool write);
+
+/**
+ * Close the given world.
+ *
+ * This writes out any cached chunk writes with rs_world_commit(),
+ * closes every open region, and frees all memory associated with
+ * the world object.
+ *
+ * \param self the world to close
+ * \sa rs_world_open
+ */
+void rs_world_close(RSWorld* self);
+
+/**
+ * Set the region file format.
+ *
+ * Only regions opened after this call are affected, so this is best
+ * called right after rs_world_open().
+ *
+ * \param self the world
+ * \param format the region file format to use
+ * \sa RSWorldFormat, rs_world_get_format
+ */
+void rs_world_set_format(RSWorld* self, RSWorldFormat format);
+
+/**
+ * Get the region file format.
+ *
+ * \param self the world
+ * \return the region file format in use
+ * \sa rs_world_set_format
+ */
+RSWorldFormat rs_world_get_format(RSWorld* self);
+
+/**
+ * Set the maximum number of regions kept open at once.
+ *
+ * When opening a region would go over this limit, the least recently
+ * used region is closed first, which writes out any writes cached in
+ * it. If the limit is lowered below the number of regions already
+ * open, the extra regions are closed right away.
+ *
+ * \param self the world
+ * \param max_open the most regions to keep open, at least 1
+ * \sa rs_world_get_max_open
+ */
+void rs_world_set_max_open(RSWorld* self, unsigned int max_open);
+
+/**
+ * Get the maximum number of regions kept open at once.
+ *
+ * \param self the world
+ * \return the most regions kept open at once
+ * \sa rs_world_set_max_open
+ */
+unsigned int rs_world_get_max_open(RSWorld* self);
+
+/**
+ * Get the path to a region file.
+ *
+ * This builds the path of the region file with the given region
+ * coordinates, whether it exists or not. The result must be freed
+ * with rs_free().
+ *
+ * \param self the world
+ * \param rx the x coordinate of the region
+ * \param rz the z coordinate of the region
+ * \return the path to the region file
+ */
+char* rs_world_get_region_path(RSWorld* self, int32_t rx, int32_t rz);
+
+/**
+ * Get a region from the world.
+ *
+ * This returns the region with the given region coordinates, opening
+ * it if it is not open already. If the region file does not exist,
+ * this returns NULL, unless create is true and the world was opened
+ * in write mode, in which case a new region is created.
+ *
+ * The region belongs to the world, and must not be closed. It stays
+ * valid until the world is closed, or until it is pushed out of the
+ * cache by opening other regions, so don't hold on to it across
+ * other calls to the world API.
+ *
+ * \param self the world
+ * \param rx the x coordinate of the region
+ * \param rz the z coordinate of the region
+ * \param create whether to create the region if it does not exist
+ * \return the region, or NULL
+ * \sa rs_world_set_max_open
+ */
+RSRegion* rs_world_get_region(RSWorld* self, int32_t rx, int32_t rz, bool create);
+
+/**
+ * List the regions in the world.
+ *
+ * This lists every region file in the world's format, sorted by x
+ * and then z coordinate. The result must be freed with rs_free().
+ *
+ * \param self the world
+ * \param count where to store the number of regions
+ * \return the coordinates of each region, or NULL if there are none
+ */
+RSWorldRegionCoords* rs_world_list_regions(RSWorld* self, unsigned int* count);
+
+/**
+ * Get whether a chunk is present.
+ *
+ * \param self the world
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return true if the world contains the given chunk, false otherwise
+ */
+bool rs_world_contains_chunk(RSWorld* self, int32_t x, int32_t z);
+
+/**
+ * Read and parse a chunk.
+ *
+ * This finds the region containing the chunk at the given global
+ * chunk coordinates, and parses the chunk with
+ * rs_nbt_parse_from_region(). The result must be freed with
+ * rs_nbt_free().
+ *
+ * \param self the world
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \return the parsed chunk, or NULL if it does not exist
+ * \sa rs_world_set_chunk
+ */
+RSNBT* rs_world_get_chunk(RSWorld* self, int32_t x, int32_t z);
+
+/**
+ * Write a chunk.
+ *
+ * This writes the given NBT data as the chunk at the given global
+ * chunk coordinates, creating the region that holds it if needed, by
+ * way of rs_nbt_write_to_region(). As with the region API, the write
+ * is cached until rs_world_flush() or rs_world_close() is called, or
+ * until the region is pushed out of the cache of open regions.
+ *
+ * \param self the world
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param nbt the chunk data
+ * \return true on success, false otherwise
+ * \sa rs_world_get_chunk, rs_world_flush
+ */
+bool rs_world_set_chunk(RSWorld* self, int32_t x, int32_t z, RSNBT* nbt);
+
+/**
+ * Delete a chunk.
+ *
+ * Like other writes, this is cached until the region is flushed.
+ *
+ * \param self the world
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \sa rs_world_set_chunk, rs_world_flush
+ */
+void rs_world_clear_chunk(RSWorld* self, int32_t x, int32_t z);
+
+/**
+ * Flush every open region.
+ *
+ * This calls rs_region_flush() on every region the world has open.
+ * To flush many regions at once, rs_world_commit() is much faster.
+ *
+ * \param self the world
+ * \sa rs_region_flush, rs_world_commit
+ */
+void rs_world_flush(RSWorld* self);
+
+/**
+ * Write out every open region, and wait for it all to reach the disk.
+ *
+ * This is a faster rs_world_flush() for large edits. The regions
+ * with cached writes are flushed in order of their file names,
+ * spread across nthreads threads (or
+ * rs_thread_get_default_count() if 0), without syncing each file
+ * separately. Then a single syncfs() waits for all of them at once.
+ * On systems without syncfs(), the files are synced in parallel with
+ * fdatasync() instead.
+ *
+ * Regions pushed out of the cache of open regions are also flushed
+ * without syncing when syncfs() is available, and are made durable
+ * by the next commit. rs_world_close() commits automatically.
+ *
+ * \param self the world
+ * \param nthreads the number of threads to use, or 0
+ * \return true if everything was written and synced, false otherwise
+ * \sa rs_world_flush, rs_region_flush_nosync, rs_region_sync
+ */
+bool rs_world_commit(RSWorld* self, unsigned int nthreads);
+
+/**
+ * Start iterating over the chunks in a rectangle of the world.
+ *
+ * The box runs from (x1, z1) to (x2, z2) in global chunk
+ * coordinates, inclusive at both ends; the corners may be given in
+ * either order. Only the regions that overlap the box are opened,
+ * and only the header entries inside it are looked at, so a small
+ * box is cheap no matter how large the world is.
+ *
+ * Chunks are returned one region at a time, and in z-then-x order
+ * within each region. Regions come from the world's own cache, so
+ * changes made while iterating are seen.
+ *
+ * \param self the world
+ * \param it the iterator to set up
+ * \param x1 the x coordinate of one corner
+ * \param z1 the z coordinate of one corner
+ * \param x2 the x coordinate of the opposite corner
+ * \param z2 the z coordinate of the opposite corner
+ * \sa rs_world_box_iterator_next
+ */
+void rs_world_box_iterator_init(RSWorld* self, RSWorldBoxIterator* it, int32_t x1, int32_t z1, int32_t x2, int32_t z2);
+
+/**
+ * Get the next present chunk in a box.
+ *
+ * The region pointer returned, along with rs_world_chunk_to_local()
+ * on the coordinates, can be used to read the chunk's raw data
+ * without another lookup. It is only good until the next call into
+ * the world, since the world may close it to stay under its limit
+ * of open regions.
+ *
+ * \param it the iterator
+ * \param x where to store the chunk's global x coordinate
+ * \param z where to store the chunk's global z coordinate
+ * \param region where to store the chunk's region, or NULL
+ * \return true if a chunk was found, false when the box is done
+ * \sa rs_world_box_iterator_init
+ */
+bool rs_world_box_iterator_next(RSWorldBoxIterator* it, int32_t* x, int32_t* z, RSRegion** region);
+
+/**
+ * Start iterating over the 3x3 neighborhoods of chunks in a box.
+ *
+ * This visits every present chunk in the box from (x1, z1) to (x2,
+ * z2), inclusive, together with its eight neighbors, which may lie
+ * outside the box or in other regions. Chunks are visited in rows of
+ * increasing z, and increasing x within each row.
+ *
+ * The iterator keeps a sliding window of three rows of parsed
+ * chunks, so each chunk in and around the box is decompressed and
+ * parsed exactly once, instead of once for every neighborhood it
+ * appears in. The window holds 3 * (width + 2) chunks at most, so
+ * boxes that are narrow in x use the least memory.
+ *
+ * \param self the world
+ * \param x1 the x coordinate of one corner
+ * \param z1 the z coordinate of one corner
+ * \param x2 the x coordinate of the opposite corner
+ * \param z2 the z coordinate of the opposite corner
+ * \return the new iterator
+ * \sa rs_world_neighborhood_iterator_next,
+ *     rs_world_neighborhood_iterator_free
+ */
+RSWorldNeighborhoodIterator* rs_world_neighborhood_iterator_new(RSWorld* self, int32_t x1, int32_t z1, int32_t x2, int32_t z2);
+
+/**
+ * Get the next neighborhood.
+ *
+ * The neighbors array is filled in so that neighbors[(dz + 1) * 3 +
+ * (dx + 1)] is the chunk at (x + dx, z + dz), or NULL if that chunk
+ * is not present. The center, neighbors[4], is never NULL.
+ *
+ * The chunks belong to the iterator, and are only good until the
+ * next call. Changes made to them are seen by later neighborhoods,
+ * but are not saved unless you write them back, for example with
+ * rs_world_set_chunk().
+ *
+ * \param self the iterator
+ * \param x where to store the center chunk's global x coordinate
+ * \param z where to store the center chunk's global z coordinate
+ * \param neighbors where to store the nine chunks
+ * \return true if a neighborhood was found, false when the box is done
+ * \sa rs_world_neighborhood_iterator_new
+ */
+bool rs_world_neighborhood_iterator_next(RSWorldNeighborhoodIterator* self, int32_t* x, int32_t* z, RSNBT* neighbors[9]);
+
+/**
+ * Free a neighborhood iterator, along with any chunks it holds.
+ *
+ * \param self the iterator
+ * \sa rs_world_neighborhood_iterator_new
+ */
+void rs_world_neighborhood_iterator_free(RSWorldNeighborhoodIterator* self);
+
+/**
+ * Get the path of the world's chunk index file.
+ *
+ * The result must be freed with rs_free().
+ *
+ * \param self the world
+ * \return the path of the index file
+ * \sa rs_world_build_index, RS_WORLD_INDEX_NAME
+ */
+char* rs_world_get_index_path(RSWorld* self);
+
+/**
+ * Build a chunk index for the world.
+ *
+ * This writes an index file listing the offset, length, timestamp
+ * and hash of every chunk, built from the region headers. It can
+ * then be opened with rs_world_open_index() to answer questions like
+ * "which chunks changed since yesterday", or "where is this chunk
+ * stored", without opening any region files.
+ *
+ * Building the index reads every chunk once, to hash it. After that,
+ * whenever a world opened for writing has an index, it is kept up to
+ * date: rs_world_flush(), rs_world_commit() and rs_world_refresh()
+ * update the entries of only the regions that changed, and rewrite
+ * the file only if any entry actually did. Changes made to the regions outside of RSWorld are only
+ * picked up by rs_world_refresh(), or by building the index again.
+ *
+ * The world must be open for writing.
+ *
+ * \param self the world
+ * \return true on success, false on failure
+ * \sa rs_world_open_index, rs_world_get_index_path
+ */
+bool rs_world_build_index(RSWorld* self);
+
+/**
+ * Open the world's chunk index.
+ *
+ * This is rs_world_index_open() on rs_world_get_index_path().
+ *
+ * \param self the world
+ * \return the index, or NULL if there is none
+ * \sa rs_world_build_index, rs_world_index_open
+ */
+RSWorldIndex* rs_world_open_index(RSWorld* self);
+
+/**
+ * Build bloom filters for every region in the world.
+ *
+ * This calls rs_region_bloom_update() on every region, creating the
+ * sidecar files that let searches skip chunks without decompressing
+ * them. After that, whenever a world opened for writing writes a
+ * region (in rs_world_flush(), rs_world_commit(), or when a region is
+ * pushed out of the cache), or rs_world_refresh() sees it change,
+ * its filters are updated for the chunks that changed.
+ *
+ * \param self the world
+ * \return true on success, false if a sidecar could not be written
+ * \sa rs_world_open_bloom, rs_region_bloom_update
+ */
+bool rs_world_build_blooms(RSWorld* self);
+
+/**
+ * Open the bloom filters for one region of the world.
+ *
+ * This is rs_region_bloom_open() on rs_world_get_region_path().
+ *
+ * \param self the world
+ * \param rx the x coordinate of the region
+ * \param rz the z coordinate of the region
+ * \return the filters, or NULL if there are none
+ * \sa rs_world_build_blooms, rs_region_bloom_open
+ */
+RSRegionBloom* rs_world_open_bloom(RSWorld* self, int32_t rx, int32_t rz);
+
+/**
+ * Pick up changes made to open regions by other processes.
+ *
+ * This calls rs_region_refresh() on every region the world has open,
+ * and updates the chunk index (if there is one) for any that changed.
+ *
+ * \param self the world
+ * \return the number of chunks that changed
+ * \sa rs_region_refresh, rs_world_build_index
+ */
+unsigned int rs_world_refresh(RSWorld* self);
+
+/**
+ * Write the chunks changed since a given time to a chunk stream.
+ *
+ * This uses the region timestamp tables to find every chunk modified
+ * at or after since, and copies its compressed data, untouched, into
+ * sink. Every region is checked, since a file's modification time
+ * says nothing reliable about the timestamps inside it (copying or
+ * restoring a world can leave old file times on newer chunks). Passing
+ * 0 for since backs up every chunk.
+ *
+ * Only what is on disk is backed up, so call rs_world_commit() first
+ * if there are writes you want included. Chunk deletions are not
+ * recorded. The stream is not finished, so several worlds or calls
+ * can share one stream; call rs_chunk_stream_finish() when done.
+ *
+ * Every chunk that should be included must be, so this fails if any
+ * of them can't be read, or uses a compression type other than gzip
+ * or zlib.
+ *
+ * \param self the world
+ * \param since the oldest modification time to include
+ * \param sink the stream to write to
+ * \return true on success, false if a chunk couldn't be read or
+ *         writing to sink failed
+ * \sa rs_world_restore, rs_chunk_stream_new_writer
+ */
+bool rs_world_backup_incremental(RSWorld* self, uint32_t since, RSChunkStream* sink);
+
+/**
+ * Write every chunk in a chunk stream into the world.
+ *
+ * Chunks are written with their original timestamps, using
+ * rs_region_set_chunks() to cache all the chunks for a region at
+ * once, and the world is committed with rs_world_commit() at the end.
+ * Restoring a full backup and then each incremental backup in order
+ * brings the world up to date.
+ *
+ * The world must be open for writing. If the stream is cut short,
+ * the chunks read before the break are still written.
+ *
+ * \param self the world
+ * \param source the stream to read from
+ * \return true if the whole stream was restored, false otherwise
+ * \sa rs_world_backup_incremental, rs_chunk_stream_new_reader
+ */
+bool rs_world_restore(RSWorld* self, RSChunkStream* source);
+
+/**
+ * Write a whole world to a file descriptor, as a chunk stream.
+ *
+ * This is a complete chunk stream holding every chunk in the world,
+ * region by region, so that a matching rs_world_import() can write
+ * each region in one pass. Chunk data is copied as it is, and large
+ * chunks go straight from the region files to fd (see
+ * rs_chunk_stream_write_from_region()). fd can be a file, a pipe or
+ * a socket, and is not closed.
+ *
+ * Only what is on disk is exported, so call rs_world_commit() first
+ * if there are writes you want included. As with
+ * rs_world_backup_incremental(), this fails if any chunk can't be
+ * read.
+ *
+ * \param self the world
+ * \param fd the file descriptor to write to
+ * \return true on success, false if writing failed
+ * \sa rs_world_import, rs_world_backup_incremental
+ */
+bool rs_world_export(RSWorld* self, int fd);
+
+/**
+ * Read a whole world from a file descriptor, as written by
+ * rs_world_export().
+ *
+ * This is rs_world_restore() on a chunk stream read from fd, so the
+ * world must be open for writing, and is committed at the end. fd is
+ * not closed.
+ *
+ * \param self the world
+ * \param fd the file descriptor to read from
+ * \return true if a complete stream was imported, false otherwise
+ * \sa rs_world_export, rs_world_restore
+ */
+bool rs_world_import(RSWorld* self, int fd);
+
+/**
+ * Run a function on every chunk in the world, in parallel.
+ *
+ * This is rs_world_foreach_chunk_reduce(), without any thread-local
+ * state or reduce step.
+ *
+ * \param self the world
+ * \param filter the function deciding which chunks to read, or NULL
+ * \param func the function to call on each chunk
+ * \param user data to pass to filter and func
+ * \param nthreads the number of threads to use, or 0
+ * \return the number of chunks func was called on
+ * \sa rs_world_foreach_chunk_reduce
+ */
+unsigned int rs_world_foreach_chunk(RSWorld* self, RSWorldFilterFunction filter, RSWorldChunkFunction func, void* user, unsigned int nthreads);
+
+/**
+ * Run a function on every chunk in the world, and combine the results.
+ *
+ * This parses every chunk in the world (that filter accepts, if
+ * given) and passes it to func, using nthreads threads (or
+ * rs_thread_get_default_count() if 0). Each region is a task, which
+ * is split into smaller chunk-range tasks once the region is open.
+ * Idle threads steal these tasks from busy ones, so a few large
+ * regions don't leave most threads waiting. Each thread decompresses
+ * into its own reusable buffer.
+ *
+ * If local_size is not 0, each thread gets its own zero-filled block
+ * of that size, passed to func as local, so results can be gathered
+ * without locking. Once every chunk is done, reduce is called on each
+ * thread's block in turn to merge them into user.
+ *
+ * Regions are opened read-only, separately from the world's own
+ * cache, so this sees the world as it is on disk. Call
+ * rs_world_commit() first if there are writes you want included.
+ *
+ * \param self the world
+ * \param filter the function deciding which chunks to read, or NULL
+ * \param func the function to call on each chunk
+ * \param local_size the size of each thread's local state, or 0
+ * \param reduce the function merging local state into user, or NULL
+ * \param user data to pass to filter, func and reduce
+ * \param nthreads the number of threads to use, or 0
+ * \return the number of chunks func was called on
+ * \sa rs_world_foreach_chunk, RSWorldFilterFunction,
+ *     RSWorldChunkFunction, RSWorldReduceFunction
+ */
+unsigned int rs_world_foreach_chunk_reduce(RSWorld* self, RSWorldFilterFunction filter, RSWorldChunkFunction func, size_t local_size, RSWorldReduceFunction reduce, void* user, unsigned int nthreads);
+
+/**
+ * Run a function on the uncompressed data of every chunk in the world.
+ *
+ * This works exactly like rs_world_foreach_chunk_reduce(), except
+ * that filter sees the chunk's compressed length and encoding as
+ * well as its timestamp, and func gets the uncompressed NBT without
+ * it being parsed. Code that only needs a few tags from each chunk
+ * can then skip building the whole tag tree.
+ *
+ * \param self the world
+ * \param filter the function deciding which chunks to read, or NULL
+ * \param func the function to call on each chunk
+ * \param local_size the size of each thread's local state, or 0
+ * \param reduce the function merging local state into user, or NULL
+ * \param user data to pass to filter, func and reduce
+ * \param nthreads the number of threads to use, or 0
+ * \return the number of chunks func was called on
+ * \sa rs_world_foreach_chunk_reduce, RSWorldRawFilterFunction,
+ *     RSWorldRawChunkFunction
+ */
+unsigned int rs_world_foreach_chunk_raw(RSWorld* self, RSWorldRawFilterFunction filter, RSWorldRawChunkFunction func, size_t local_size, RSWorldReduceFunction reduce, void* user, unsigned int nthreads);
+
+/**
+ * Convert a global chunk coordinate into a region coordinate.
+ *
+ * This rounds towards negative infinity, so that chunk -1 is in
+ * region -1, and not region 0.
+ */
+#define rs_world_chunk_to_region(c) ((int32_t)((c) >= 0 ? (c) / 32 : ((c) - 31) / 32))
+
+/**
+ * Convert a global chunk coordinate into a coordinate within its region.
+ */
+#define rs_world_chunk_to_local(c) ((uint8_t)((c) & 31))
+
+#endif /* __RS_WORLD_H_INCLUDED__ */
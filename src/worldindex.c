@@ -0,0 +1,274 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#include "config.h"
+#include "worldindex.h"
+
+#include "error.h"
+#include "memory.h"
+#include "mmap.h"
+#include "rsendian.h"
+#include "util.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* An index file is a header, followed by every entry (sorted by
+ * coordinates), followed by the positions of those entries sorted by
+ * timestamp. Entries hold the chunk's first sector rather than its
+ * byte offset, which could overflow 32 bits. All numbers are
+ * big-endian, like region files.
+ */
+
+#define RS_WORLD_INDEX_MAGIC "RSWI"
+#define RS_WORLD_INDEX_VERSION 2
+
+struct IndexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} __PACKED__;
+
+struct IndexEntry
+{
+    int32_t x, z;
+    uint32_t sector;
+    uint32_t length;
+    uint32_t timestamp;
+    uint32_t hash;
+} __PACKED__;
+
+struct _RSWorldIndex
+{
+    void* map;
+    size_t size;
+    
+    uint32_t count;
+    struct IndexEntry* entries;
+    uint32_t* by_time;
+};
+
+RSWorldIndex* rs_world_index_open(const char* path)
+{
+    rs_return_val_if_fail(path, NULL);
+    
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) < 0 || stat_buf.st_size < (off_t)sizeof(struct IndexHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    void* map = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    
+    /* make sure the header makes sense before trusting the rest */
+    struct IndexHeader* header = map;
+    uint32_t count = rs_endian_uint32(header->count);
+    size_t expected = sizeof(struct IndexHeader) + (size_t)count * (sizeof(struct IndexEntry) + sizeof(uint32_t));
+    if (memcmp(header->magic, RS_WORLD_INDEX_MAGIC, 4) != 0 ||
+        rs_endian_uint32(header->version) != RS_WORLD_INDEX_VERSION ||
+        expected != (size_t)stat_buf.st_size)
+    {
+        munmap(map, stat_buf.st_size);
+        return NULL;
+    }
+    
+    RSWorldIndex* self = rs_new0(RSWorldIndex, 1);
+    self->map = map;
+    self->size = stat_buf.st_size;
+    self->count = count;
+    self->entries = (struct IndexEntry*)(map + sizeof(struct IndexHeader));
+    self->by_time = (uint32_t*)(self->entries + count);
+    return self;
+}
+
+void rs_world_index_close(RSWorldIndex* self)
+{
+    rs_return_if_fail(self);
+    
+    munmap(self->map, self->size);
+    rs_free(self);
+}
+
+uint32_t rs_world_index_get_count(RSWorldIndex* self)
+{
+    rs_return_val_if_fail(self, 0);
+    return self->count;
+}
+
+/* helper to decode a stored entry */
+static void _rs_world_index_decode(struct IndexEntry* stored, RSWorldIndexEntry* entry)
+{
+    entry->x = rs_endian_int32(stored->x);
+    entry->z = rs_endian_int32(stored->z);
+    entry->offset = (uint64_t)rs_endian_uint32(stored->sector) * 4096;
+    entry->length = rs_endian_uint32(stored->length);
+    entry->timestamp = rs_endian_uint32(stored->timestamp);
+    entry->hash = rs_endian_uint32(stored->hash);
+}
+
+bool rs_world_index_get(RSWorldIndex* self, uint32_t i, RSWorldIndexEntry* entry)
+{
+    rs_return_val_if_fail(self && entry, false);
+    
+    if (i >= self->count)
+        return false;
+    
+    _rs_world_index_decode(&(self->entries[i]), entry);
+    return true;
+}
+
+bool rs_world_index_get_by_time(RSWorldIndex* self, uint32_t i, RSWorldIndexEntry* entry)
+{
+    rs_return_val_if_fail(self && entry, false);
+    
+    if (i >= self->count)
+        return false;
+    
+    uint32_t pos = rs_endian_uint32(self->by_time[i]);
+    if (pos >= self->count)
+        return false;
+    
+    _rs_world_index_decode(&(self->entries[pos]), entry);
+    return true;
+}
+
+bool rs_world_index_lookup(RSWorldIndex* self, int32_t x, int32_t z, RSWorldIndexEntry* entry)
+{
+    rs_return_val_if_fail(self, false);
+    
+    uint32_t low = 0;
+    uint32_t high = self->count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int32_t mx = rs_endian_int32(self->entries[mid].x);
+        int32_t mz = rs_endian_int32(self->entries[mid].z);
+        
+        if (mx == x && mz == z)
+        {
+            if (entry)
+                _rs_world_index_decode(&(self->entries[mid]), entry);
+            return true;
+        }
+        
+        if (mx < x || (mx == x && mz < z))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    return false;
+}
+
+uint32_t rs_world_index_find_changed_since(RSWorldIndex* self, uint32_t timestamp)
+{
+    rs_return_val_if_fail(self, 0);
+    
+    uint32_t low = 0;
+    uint32_t high = self->count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        uint32_t pos = rs_endian_uint32(self->by_time[mid]);
+        if (pos < self->count && rs_endian_uint32(self->entries[pos].timestamp) < timestamp)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    return low;
+}
+
+/* qsort comparison for entries, by coordinates */
+static int _rs_world_index_compare_coords(const void* a, const void* b)
+{
+    const RSWorldIndexEntry* ea = a;
+    const RSWorldIndexEntry* eb = b;
+    if (ea->x != eb->x)
+        return ea->x < eb->x ? -1 : 1;
+    if (ea->z != eb->z)
+        return ea->z < eb->z ? -1 : 1;
+    return 0;
+}
+
+/* entries for qsort to order by timestamp, remembering their position */
+struct TimeOrder
+{
+    uint32_t timestamp;
+    uint32_t position;
+};
+
+static int _rs_world_index_compare_times(const void* a, const void* b)
+{
+    const struct TimeOrder* ta = a;
+    const struct TimeOrder* tb = b;
+    if (ta->timestamp != tb->timestamp)
+        return ta->timestamp < tb->timestamp ? -1 : 1;
+    if (ta->position != tb->position)
+        return ta->position < tb->position ? -1 : 1;
+    return 0;
+}
+
+bool rs_world_index_write(const char* path, RSWorldIndexEntry* entries, uint32_t count)
+{
+    rs_return_val_if_fail(path, false);
+    rs_return_val_if_fail(entries || count == 0, false);
+    
+    if (count > 0)
+        qsort(entries, count, sizeof(RSWorldIndexEntry), _rs_world_index_compare_coords);
+    
+    /* lay out the whole file in memory */
+    size_t size = sizeof(struct IndexHeader) + (size_t)count * (sizeof(struct IndexEntry) + sizeof(uint32_t));
+    uint8_t* buffer = rs_malloc0(size);
+    struct IndexHeader* header = (struct IndexHeader*)buffer;
+    struct IndexEntry* stored = (struct IndexEntry*)(buffer + sizeof(struct IndexHeader));
+    uint32_t* by_time = (uint32_t*)(stored + count);
+    
+    memcpy(header->magic, RS_WORLD_INDEX_MAGIC, 4);
+    header->version = rs_endian_uint32(RS_WORLD_INDEX_VERSION);
+    header->count = rs_endian_uint32(count);
+    
+    struct TimeOrder* order = rs_new(struct TimeOrder, count ? count : 1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        stored[i].x = rs_endian_int32(entries[i].x);
+        stored[i].z = rs_endian_int32(entries[i].z);
+        stored[i].sector = rs_endian_uint32(entries[i].offset / 4096);
+        stored[i].length = rs_endian_uint32(entries[i].length);
+        stored[i].timestamp = rs_endian_uint32(entries[i].timestamp);
+        stored[i].hash = rs_endian_uint32(entries[i].hash);
+        
+        order[i].timestamp = entries[i].timestamp;
+        order[i].position = i;
+    }
+    
+    if (count > 0)
+        qsort(order, count, sizeof(struct TimeOrder), _rs_world_index_compare_times);
+    for (uint32_t i = 0; i < count; i++)
+        by_time[i] = rs_endian_uint32(order[i].position);
+    rs_free(order);
+    
+    bool ok = rs_file_replace(path, buffer, size, true);
+    rs_free(buffer);
+    return ok;
+}
@@ -0,0 +1,143 @@
+/*
+ * This file is part of libredstone, and is distributed under the GNU LGPL.
+ * See redstone.h for details.
+ */
+
+#ifndef __RS_WORLDINDEX_H_INCLUDED__
+#define __RS_WORLDINDEX_H_INCLUDED__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct _RSWorldIndex;
+/**
+ * The world index data type.
+ *
+ * This is an opaque structure that acts as a handle to a mapped
+ * world index file. These are written by RSWorld (see
+ * rs_world_build_index()), and list where every chunk in a world is
+ * stored, so questions about chunk metadata can be answered without
+ * opening any region files.
+ */
+typedef struct _RSWorldIndex RSWorldIndex;
+
+/**
+ * The information kept about each chunk in a world index.
+ */
+typedef struct
+{
+    /** the global x coordinate of the chunk */
+    int32_t x;
+    /** the global z coordinate of the chunk */
+    int32_t z;
+    /** the byte offset of the chunk in its region file */
+    uint64_t offset;
+    /** the length of the compressed chunk data */
+    uint32_t length;
+    /** the last modified time of the chunk */
+    uint32_t timestamp;
+    /** the CRC-32 of the compressed chunk data */
+    uint32_t hash;
+} RSWorldIndexEntry;
+
+/**
+ * Open a world index file.
+ *
+ * The file is mapped into memory, and read lazily, so opening even a
+ * large index is cheap. It reflects the file as it was when opened;
+ * the index is always replaced as a whole when it is rewritten, so
+ * open it again to see later changes.
+ *
+ * \param path the index file to open
+ * \return the index, or NULL if it could not be opened or is invalid
+ * \sa rs_world_index_close, rs_world_open_index
+ */
+RSWorldIndex* rs_world_index_open(const char* path);
+
+/**
+ * Close a world index.
+ *
+ * \param self the index
+ * \sa rs_world_index_open
+ */
+void rs_world_index_close(RSWorldIndex* self);
+
+/**
+ * Get the number of chunks in an index.
+ *
+ * \param self the index
+ * \return the number of chunks
+ */
+uint32_t rs_world_index_get_count(RSWorldIndex* self);
+
+/**
+ * Get a chunk from an index, in coordinate order.
+ *
+ * Entries are sorted by x coordinate, and then z coordinate.
+ *
+ * \param self the index
+ * \param i the position of the chunk, less than rs_world_index_get_count()
+ * \param entry where to store the chunk's information
+ * \return true on success, false if i is out of range
+ * \sa rs_world_index_get_by_time
+ */
+bool rs_world_index_get(RSWorldIndex* self, uint32_t i, RSWorldIndexEntry* entry);
+
+/**
+ * Get a chunk from an index, in timestamp order.
+ *
+ * Entries are sorted by timestamp, oldest first.
+ *
+ * \param self the index
+ * \param i the position of the chunk, less than rs_world_index_get_count()
+ * \param entry where to store the chunk's information
+ * \return true on success, false if i is out of range
+ * \sa rs_world_index_find_changed_since, rs_world_index_get
+ */
+bool rs_world_index_get_by_time(RSWorldIndex* self, uint32_t i, RSWorldIndexEntry* entry);
+
+/**
+ * Look up a single chunk in an index.
+ *
+ * This is a binary search over the mapped file.
+ *
+ * \param self the index
+ * \param x the global x coordinate of the chunk
+ * \param z the global z coordinate of the chunk
+ * \param entry where to store the chunk's information, or NULL
+ * \return true if the chunk is in the index, false otherwise
+ */
+bool rs_world_index_lookup(RSWorldIndex* self, int32_t x, int32_t z, RSWorldIndexEntry* entry);
+
+/**
+ * Find the chunks changed since a given time.
+ *
+ * This returns the position, in timestamp order, of the first chunk
+ * modified at or after timestamp. Every chunk from there up to
+ * rs_world_index_get_count() can then be read with
+ * rs_world_index_get_by_time().
+ *
+ * \param self the index
+ * \param timestamp the time to search for
+ * \return the position of the first changed chunk in timestamp order
+ * \sa rs_world_index_get_by_time
+ */
+uint32_t rs_world_index_find_changed_since(RSWorldIndex* self, uint32_t timestamp);
+
+/**
+ * Write a world index file.
+ *
+ * This sorts entries in place, and then replaces the file at path
+ * with a new index holding them. The new file is written next to the
+ * old one and renamed over it, so readers never see a partial index.
+ * Usually, RSWorld does this for you.
+ *
+ * \param path the index file to write
+ * \param entries the chunks to put in the index
+ * \param count the number of entries
+ * \return true on success, false on failure
+ * \sa rs_world_build_index
+ */
+bool rs_world_index_write(const char* path, RSWorldIndexEntry* entries, uint32_t count);
+
+#endif /* __RS_WORLDINDEX_H_INCLUDED__ */
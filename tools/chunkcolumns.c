@@ -0,0 +1,91 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "redstone.h"
+#include <stdio.h>
+#include <string.h>
+
+/* the type names accepted after a path */
+static const struct
+{
+    const char* name;
+    RSTagType type;
+} types[] = {
+    {"byte", RS_TAG_BYTE},
+    {"short", RS_TAG_SHORT},
+    {"int", RS_TAG_INT},
+    {"long", RS_TAG_LONG},
+    {"float", RS_TAG_FLOAT},
+    {"double", RS_TAG_DOUBLE},
+    {"bytes", RS_TAG_BYTE_ARRAY},
+    {"ints", RS_TAG_INT_ARRAY},
+    {"string", RS_TAG_STRING},
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        if (argc != 1)
+            fprintf(stderr, "invalid arguments\n");
+        fprintf(stderr, "Usage: %s <world> <output> <path>:<type> ...\n", argv[0]);
+        fprintf(stderr, "types: byte short int long float double bytes ints string\n");
+        return 1;
+    }
+    
+    RSChunkColumns* columns = rs_chunk_columns_new();
+    for (int i = 3; i < argc; i++)
+    {
+        char* sep = strrchr(argv[i], ':');
+        RSTagType type = RS_TAG_END;
+        for (unsigned int t = 0; sep && t < sizeof(types) / sizeof(types[0]); t++)
+        {
+            if (strcmp(sep + 1, types[t].name) == 0)
+                type = types[t].type;
+        }
+        
+        if (type == RS_TAG_END)
+        {
+            fprintf(stderr, "invalid column: `%s'\n", argv[i]);
+            rs_chunk_columns_free(columns);
+            return 1;
+        }
+        
+        *sep = 0;
+        rs_chunk_columns_add_column(columns, argv[i], type);
+    }
+    
+    RSWorld* world = rs_world_open(argv[1], false);
+    if (!world)
+    {
+        fprintf(stderr, "could not open world: `%s'\n", argv[1]);
+        rs_chunk_columns_free(columns);
+        return 1;
+    }
+    
+    rs_chunk_columns_add_world(columns, world, 0);
+    rs_world_close(world);
+    
+    bool ok = rs_chunk_columns_write(columns, argv[2]);
+    if (ok)
+        printf("wrote %u chunks to `%s'\n", rs_chunk_columns_get_row_count(columns), argv[2]);
+    else
+        fprintf(stderr, "could not write columns: `%s'\n", argv[2]);
+    
+    rs_chunk_columns_free(columns);
+    return ok ? 0 : 1;
+}
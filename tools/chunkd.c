@@ -0,0 +1,79 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "redstone.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+static RSChunkServer* server = NULL;
+
+static void stop_server(int sig)
+{
+    rs_chunk_server_stop(server);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3 && argc != 4)
+    {
+        if (argc != 1)
+            fprintf(stderr, "invalid number of arguments\n");
+        fprintf(stderr, "Usage: %s <world> <socket> [max open regions]\n", argv[0]);
+        return 1;
+    }
+    
+    RSWorld* world = rs_world_open(argv[1], false);
+    if (!world)
+    {
+        fprintf(stderr, "could not open world: `%s'\n", argv[1]);
+        return 1;
+    }
+    
+    if (argc == 4)
+    {
+        char* endptr;
+        long max_open = strtol(argv[3], &endptr, 10);
+        if (*endptr != 0 || max_open <= 0)
+        {
+            fprintf(stderr, "max open regions not a positive integer: `%s'\n", argv[3]);
+            rs_world_close(world);
+            return 1;
+        }
+        
+        rs_world_set_max_open(world, max_open);
+    }
+    
+    server = rs_chunk_server_new(world, argv[2]);
+    if (!server)
+    {
+        fprintf(stderr, "could not listen on socket: `%s'\n", argv[2]);
+        rs_world_close(world);
+        return 1;
+    }
+    
+    /* clients that hang up shouldn't take the server with them */
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    
+    bool ok = rs_chunk_server_run(server);
+    
+    rs_chunk_server_free(server);
+    rs_world_close(world);
+    return ok ? 0 : 1;
+}
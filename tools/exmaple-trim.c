@@ -18,41 +18,45 @@
 #include "redstone.h"
 #include <stdio.h>
 
-#define INSIDE_EXMAPLE(x, z) ((x) >= 11 && (x) <= 22 && (z) >= 1 && (z) <= 10)
+/* the area to keep, in global chunk coordinates */
+#define EXMAPLE_X1 11
+#define EXMAPLE_Z1 1
+#define EXMAPLE_X2 22
+#define EXMAPLE_Z2 10
 
 int main(int argc, char** argv)
 {
     if (argc != 3)
     {
-        fprintf(stderr, "usage: %s [input] [output]\n", argv[0]);
+        fprintf(stderr, "usage: %s [input world] [output world]\n", argv[0]);
         return 1;
     }
     
-    RSRegion* reg = rs_region_open(argv[1], false);
-    RSRegion* out = rs_region_open(argv[2], true);
-    rs_assert(reg);
+    RSWorld* world = rs_world_open(argv[1], false);
+    RSWorld* out = rs_world_open(argv[2], true);
+    rs_assert(world);
     rs_assert(out);
-
-    int x = 0, z = 0;
-    for (z = 0; z < 32; z++)
+    rs_world_set_format(out, rs_world_get_format(world));
+    
+    RSWorldBoxIterator it;
+    int32_t x, z;
+    RSRegion* reg;
+    rs_world_box_iterator_init(world, &it, EXMAPLE_X1, EXMAPLE_Z1, EXMAPLE_X2, EXMAPLE_Z2);
+    while (rs_world_box_iterator_next(&it, &x, &z, &reg))
     {
-        for (x = 0; x < 32; x++)
-        {
-            if (INSIDE_EXMAPLE(x, z) && rs_region_contains_chunk(reg, x, z))
-            {
-                void* data = rs_region_get_chunk_data(reg, x, z);
-                uint32_t len = rs_region_get_chunk_length(reg, x, z);
-                RSCompressionType comp = rs_region_get_chunk_compression(reg, x, z);
-                uint32_t timestamp = rs_region_get_chunk_timestamp(reg, x, z);
-                
-                rs_region_set_chunk_data_full(out, x, z, data, len, comp, timestamp);
-            }
-        }
+        uint8_t lx = rs_world_chunk_to_local(x);
+        uint8_t lz = rs_world_chunk_to_local(z);
+        void* data = rs_region_get_chunk_data(reg, lx, lz);
+        uint32_t len = rs_region_get_chunk_length(reg, lx, lz);
+        RSCompressionType comp = rs_region_get_chunk_compression(reg, lx, lz);
+        uint32_t timestamp = rs_region_get_chunk_timestamp(reg, lx, lz);
+        
+        RSRegion* dest = rs_world_get_region(out, rs_world_chunk_to_region(x), rs_world_chunk_to_region(z), true);
+        rs_region_set_chunk_data_full(dest, lx, lz, data, len, comp, timestamp);
     }
     
-    rs_region_flush(out);
-    rs_region_close(out);
-    rs_region_close(reg);
-
-	return 0;
+    rs_world_close(out);
+    rs_world_close(world);
+    
+    return 0;
 }
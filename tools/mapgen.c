@@ -17,23 +17,9 @@
 
 #include "redstone.h"
 #include "config.h"
-#include <sys/stat.h>
-#include <errno.h>
 #include <string.h>
 #include <stdio.h>
 
-#if HAVE_MKDIR
-#  if MKDIR_TAKES_ONE_ARG
-#    define mkdir(a, b) mkdir(a)
-#  endif
-#else
-#  if HAVE__MKDIR
-#    define mkdir(a, b) _mkdir(a)
-#  else
-#    error "Don't know how to create a directory on this system."
-#  endif
-#endif
-
 #define index_block(blocks, x, y, z) ((blocks)[y + (z) * 128 + (x) * 128 * 16])
 #define set_half_byte(dest, x, y, z, val)                               \
     do                                                                  \
@@ -242,23 +228,14 @@ int main(int argc, char* argv[])
         return 1;
     }
     
-    /* create dest */
-    if (mkdir(argv[1], 0777) == -1 && errno != EEXIST)
+    /* create dest, and dest/region */
+    RSWorld* world = rs_world_open(argv[1], true);
+    if (!world)
     {
         fprintf(stderr, "could not create %s\n", argv[1]);
         return 1;
     }
-    
-    char* tmps = rs_malloc(strlen(argv[1]) + 128);
-    
-    /* create dest/region */
-    sprintf(tmps, "%s/region", argv[1]);
-    if (mkdir(tmps, 0777) == -1 && errno != EEXIST)
-    {
-        fprintf(stderr, "could not create %s\n", tmps);
-        rs_free(tmps);
-        return 1;
-    }
+    rs_world_set_format(world, RS_WORLD_MCREGION);
     
     /* iterate through all regions / chunks */
     int radius = 2;
@@ -270,15 +247,6 @@ int main(int argc, char* argv[])
     {
         for (rz = -radius; rz < radius; rz++)
         {
-            sprintf(tmps, "%s/region/r.%i.%i.mcr", argv[1], rx, rz);
-            RSRegion* region = rs_region_open(tmps, true);
-            if (!region)
-            {
-                success = false;
-                fprintf(stderr, "could not create %s\n", tmps);
-                break;
-            }
-            
             i++;
             printf("writing region %i of %i ...\n", i, 4 * radius * radius);
             for (cx = 0; cx < 32; cx++)
@@ -294,7 +262,7 @@ int main(int argc, char* argv[])
                     }
                     RSNBT* nbt = rs_nbt_new();
                     rs_nbt_set_root(nbt, chunk);
-                    success = rs_nbt_write_to_region(nbt, region, cx, cz);
+                    success = rs_world_set_chunk(world, rx * 32 + cx, rz * 32 + cz, nbt);
                     rs_nbt_free(nbt);
                     
                     if (!success)
@@ -308,8 +276,6 @@ int main(int argc, char* argv[])
                     break;
             }
             
-            rs_region_close(region);
-            
             if (!success)
                 break;
         }
@@ -318,12 +284,14 @@ int main(int argc, char* argv[])
             break;
     }
     
+    /* writes everything out */
+    rs_world_close(world);
+    
     if (!success)
-    {
-        rs_free(tmps);
         return 1;
-    }
-
+    
+    char* tmps = rs_malloc(strlen(argv[1]) + 128);
+    
     /* create level.dat file */
     sprintf(tmps, "%s/level.dat", argv[1]);
     RSTag* level_dat = create_level_dat(spawn_height);
@@ -0,0 +1,85 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "redstone.h"
+#include <stdio.h>
+#include <string.h>
+
+void print_chunks(const char* path, const char* problem, RSRegionBitmap* chunks)
+{
+    int x = 0, z = 0;
+    for (z = 0; z < 32; z++)
+    {
+        for (x = 0; x < 32; x++)
+        {
+            if (rs_region_bitmap_get(chunks, x, z))
+                printf("%s: (%i, %i) %s\n", path, x, z, problem);
+        }
+    }
+}
+
+void report(const char* path, RSRegionVerifyResult* result, void* user)
+{
+    bool verbose = *(bool*)user;
+    
+    if (result == NULL)
+    {
+        printf("%s: could not open region\n", path);
+        return;
+    }
+    
+    print_chunks(path, "overlaps another chunk", &(result->overlapping));
+    print_chunks(path, "is out of bounds", &(result->out_of_bounds));
+    print_chunks(path, "has a bad length", &(result->bad_length));
+    print_chunks(path, "has bad data", &(result->bad_data));
+    
+    if (result->error_count > 0 || verbose)
+        printf("%s: %i chunks, %i bad\n", path, result->chunk_count, result->error_count);
+}
+
+int main(int argc, char** argv)
+{
+    RSRegionVerifyFlags flags = RS_REGION_VERIFY_HEADERS;
+    unsigned int threads = 0;
+    bool verbose = false;
+    
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0)
+        {
+            flags |= RS_REGION_VERIFY_DECOMPRESS;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            break;
+        }
+    }
+    
+    if (i >= argc)
+    {
+        fprintf(stderr, "usage: %s [-d] [-v] [-j threads] [region] ...\n", argv[0]);
+        fprintf(stderr, "  -d  also decompress every chunk\n");
+        fprintf(stderr, "  -v  report on good regions, too\n");
+        return 1;
+    }
+    
+    unsigned int failures = rs_region_verify_files((const char**)&(argv[i]), argc - i, flags, threads, report, &verbose);
+    return failures > 0 ? 2 : 0;
+}
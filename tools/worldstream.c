@@ -0,0 +1,59 @@
+/*
+ * This program is part of libredstone.
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "redstone.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char** argv)
+{
+    if (argc != 3 || (strcmp(argv[1], "export") != 0 && strcmp(argv[1], "import") != 0))
+    {
+        if (argc != 1)
+            fprintf(stderr, "invalid arguments\n");
+        fprintf(stderr, "Usage: %s export <world> > stream\n", argv[0]);
+        fprintf(stderr, "       %s import <world> < stream\n", argv[0]);
+        return 1;
+    }
+    
+    bool export = (strcmp(argv[1], "export") == 0);
+    if (export && isatty(STDOUT_FILENO))
+    {
+        fprintf(stderr, "refusing to write a stream to a terminal\n");
+        return 1;
+    }
+    
+    RSWorld* world = rs_world_open(argv[2], !export);
+    if (!world)
+    {
+        fprintf(stderr, "could not open world: `%s'\n", argv[2]);
+        return 1;
+    }
+    
+    bool ok;
+    if (export)
+        ok = rs_world_export(world, STDOUT_FILENO);
+    else
+        ok = rs_world_import(world, STDIN_FILENO);
+    
+    if (!ok)
+        fprintf(stderr, "could not %s world: `%s'\n", argv[1], argv[2]);
+    
+    rs_world_close(world);
+    return ok ? 0 : 1;
+}